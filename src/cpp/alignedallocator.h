@@ -0,0 +1,95 @@
+#ifndef RESTRAINT_ALIGNEDALLOCATOR_H
+#define RESTRAINT_ALIGNEDALLOCATOR_H
+
+/*! \file
+ * \brief Aligned, padded storage for data used by SIMD restraint kernels.
+ */
+
+#include <stdlib.h>
+
+#include <cstddef>
+
+#include <limits>
+#include <new>
+#include <vector>
+
+namespace plugin
+{
+
+/*!
+ * \brief Alignment in bytes of kernel data. One cache line, which is also enough for AVX-512 loads.
+ */
+constexpr std::size_t kernelAlignment = 64;
+
+/*!
+ * \brief Minimal allocator providing memory aligned to kernelAlignment.
+ *
+ * \tparam T value type
+ */
+template<typename T>
+class AlignedAllocator
+{
+    public:
+        using value_type = T;
+
+        AlignedAllocator() noexcept = default;
+
+        template<typename U>
+        explicit AlignedAllocator(const AlignedAllocator<U>&) noexcept
+        {}
+
+        T* allocate(std::size_t n)
+        {
+            if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+            {
+                throw std::bad_alloc();
+            }
+            void* p{nullptr};
+            if (posix_memalign(&p, kernelAlignment, n * sizeof(T)) != 0)
+            {
+                throw std::bad_alloc();
+            }
+            return static_cast<T*>(p);
+        }
+
+        void deallocate(T* p, std::size_t) noexcept
+        {
+            free(p);
+        }
+
+        template<typename U>
+        struct rebind
+        {
+            using other = AlignedAllocator<U>;
+        };
+};
+
+template<typename T, typename U>
+bool operator==(const AlignedAllocator<T>&, const AlignedAllocator<U>&) noexcept
+{ return true; }
+
+template<typename T, typename U>
+bool operator!=(const AlignedAllocator<T>&, const AlignedAllocator<U>&) noexcept
+{ return false; }
+
+/*!
+ * \brief Container for kernel data with aligned storage.
+ */
+template<typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+/*!
+ * \brief Round a number of elements up to a whole number of cache lines.
+ *
+ * Kernels may read (but not write) elements beyond the logical size up to the padded size, so
+ * padding elements must be kept at zero.
+ */
+template<typename T>
+constexpr std::size_t paddedSize(std::size_t n)
+{
+    return ((n * sizeof(T) + kernelAlignment - 1) / kernelAlignment) * kernelAlignment / sizeof(T);
+}
+
+} // end namespace plugin
+
+#endif //RESTRAINT_ALIGNEDALLOCATOR_H
@@ -0,0 +1,149 @@
+/*! \file
+ * \brief Code to implement the arena declared in arena.h
+ */
+
+#include "arena.h"
+
+#include <stdlib.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <sstream>
+
+namespace plugin
+{
+
+namespace
+{
+
+/// Size and alignment of transparent huge pages on x86-64 Linux.
+constexpr std::size_t hugePageSize = std::size_t(2) << 20;
+
+/// Round bytes up to a multiple of alignment, which is a power of two.
+std::size_t roundUp(std::size_t bytes,
+                    std::size_t alignment)
+{
+    return (bytes + alignment - 1) & ~(alignment - 1);
+}
+
+} // end anonymous namespace
+
+Arena::Arena() :
+    Arena(Options())
+{
+}
+
+Arena::Arena(const Options& options) :
+    options_{options}
+{
+}
+
+Arena::~Arena()
+{
+    for (const auto& block : blocks_)
+    {
+        free(block.data);
+    }
+}
+
+void Arena::addBlock(std::size_t bytes)
+{
+    const std::size_t alignment = options_.hugePages ? hugePageSize : kernelAlignment;
+    const std::size_t size = roundUp(std::max(bytes, options_.blockSize),
+                                     alignment);
+    void* data{nullptr};
+    if (posix_memalign(&data, alignment, size) != 0)
+    {
+        throw std::bad_alloc();
+    }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (options_.hugePages)
+    {
+        // Only advice: without transparent huge page support, the block uses normal pages.
+        madvise(data,
+                size,
+                MADV_HUGEPAGE);
+    }
+#endif
+    if (options_.firstTouch)
+    {
+        std::memset(data,
+                    0,
+                    size);
+    }
+
+    blocks_.push_back({static_cast<char*>(data), size});
+    next_ = static_cast<char*>(data);
+    end_ = next_ + size;
+    ++footprint_.blocks;
+    footprint_.reservedBytes += size;
+}
+
+void* Arena::allocate(std::size_t bytes)
+{
+    // Every allocation starts and ends on a cache line, so buffers of different restraints never share one.
+    const std::size_t size = roundUp(std::max<std::size_t>(bytes, 1),
+                                     kernelAlignment);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (static_cast<std::size_t>(end_ - next_) < size)
+    {
+        // The rest of the current block is abandoned.
+        addBlock(size);
+    }
+    void* p = next_;
+    next_ += size;
+    footprint_.usedBytes += size;
+    ++footprint_.allocations;
+    assert(reinterpret_cast<std::uintptr_t>(p) % kernelAlignment == 0);
+    return p;
+}
+
+void Arena::deallocate(void* p,
+                       std::size_t bytes) noexcept
+{
+    if (p == nullptr)
+    {
+        return;
+    }
+    const std::size_t size = roundUp(std::max<std::size_t>(bytes, 1),
+                                     kernelAlignment);
+    std::lock_guard<std::mutex> lock(mutex_);
+    assert(footprint_.usedBytes >= size && footprint_.allocations > 0);
+    footprint_.usedBytes -= size;
+    footprint_.releasedBytes += size;
+    --footprint_.allocations;
+}
+
+Arena::Footprint Arena::footprint() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return footprint_;
+}
+
+std::string Arena::report() const
+{
+    const auto current = footprint();
+    const auto mebibytes = [](std::size_t bytes) { return bytes / double(std::size_t(1) << 20); };
+    std::ostringstream stream;
+    stream << "Restraint arena: " << current.allocations << " buffers using "
+           << mebibytes(current.usedBytes) << " MiB of " << mebibytes(current.reservedBytes) << " MiB reserved in "
+           << current.blocks << " blocks";
+    if (options_.hugePages)
+    {
+        stream << " (huge pages requested)";
+    }
+    if (current.releasedBytes > 0)
+    {
+        stream << ", " << mebibytes(current.releasedBytes) << " MiB released but not reused";
+    }
+    stream << ".";
+    return stream.str();
+}
+
+} // end namespace plugin
@@ -0,0 +1,202 @@
+#ifndef RESTRAINT_ARENA_H
+#define RESTRAINT_ARENA_H
+
+/*! \file
+ * \brief Pooled storage for the state of many restraints.
+ *
+ * A simulation with thousands of restraints would otherwise hold thousands of small heap
+ * allocations per kind of buffer, scattered over the heap and, on NUMA machines, over memory
+ * nodes. An Arena hands out cache-line aligned pieces of a few large blocks instead, so the state
+ * of restraints created together is packed together.
+ */
+
+#include <cstddef>
+
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "alignedallocator.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief Bump allocator for restraint buffers that live as long as the restraints.
+ *
+ * Memory returned to the arena is only counted, not reused. It is released when the arena is
+ * destroyed, which happens when the last ArenaAllocator referring to it goes away. This suits
+ * restraint state, which is sized once on construction.
+ *
+ * Blocks are optionally backed by transparent huge pages (on Linux), and by default are written
+ * once by the thread that allocates them. Under the first-touch policy of Linux, that places their
+ * pages on the memory node of the thread constructing the restraints, which is the thread that
+ * updates them unless an UpdateCoordinator spreads updates over other threads.
+ *
+ * Thread safe.
+ */
+class Arena
+{
+    public:
+        struct Options
+        {
+            /// Size of each block. Larger requests get a block of their own.
+            std::size_t blockSize{std::size_t(2) << 20};
+            /// Align blocks to 2 MiB and advise the kernel to back them with huge pages.
+            bool hugePages{false};
+            /// Zero blocks on the allocating thread to place their pages near it.
+            bool firstTouch{true};
+        };
+
+        /*!
+         * \brief Memory use of an arena, for sizing jobs.
+         */
+        struct Footprint
+        {
+            /// Number of blocks obtained from the system.
+            std::size_t blocks{0};
+            /// Bytes obtained from the system.
+            std::size_t reservedBytes{0};
+            /// Bytes handed out, including alignment padding, and not yet returned.
+            std::size_t usedBytes{0};
+            /// Bytes handed out and since returned. They are not reused.
+            std::size_t releasedBytes{0};
+            /// Number of live allocations.
+            std::size_t allocations{0};
+        };
+
+        Arena();
+
+        explicit Arena(const Options& options);
+
+        ~Arena();
+
+        Arena(const Arena&) = delete;
+
+        Arena& operator=(const Arena&) = delete;
+
+        /*!
+         * \brief Get storage aligned to kernelAlignment.
+         *
+         * \throws std::bad_alloc if a new block cannot be obtained.
+         */
+        void* allocate(std::size_t bytes);
+
+        /*!
+         * \brief Return storage obtained with allocate().
+         */
+        void deallocate(void* p,
+                        std::size_t bytes) noexcept;
+
+        /*!
+         * \brief Current memory use.
+         */
+        Footprint footprint() const;
+
+        /*!
+         * \brief Human-readable summary of footprint().
+         */
+        std::string report() const;
+
+    private:
+        /// Get a new block with at least bytes of space and make it current.
+        void addBlock(std::size_t bytes);
+
+        Options options_;
+
+        mutable std::mutex mutex_;
+        struct Block
+        {
+            char* data;
+            std::size_t size;
+        };
+        std::vector<Block> blocks_;
+        /// Next free byte and end of the current block.
+        char* next_{nullptr};
+        char* end_{nullptr};
+        Footprint footprint_;
+};
+
+/*!
+ * \brief Standard allocator drawing from a shared Arena.
+ *
+ * A default-constructed allocator has no arena and uses aligned heap storage, as AlignedAllocator
+ * does, so containers using it behave as before when no arena is configured. Either way, storage is
+ * aligned to kernelAlignment.
+ *
+ * \tparam T value type
+ */
+template<typename T>
+class ArenaAllocator
+{
+    public:
+        using value_type = T;
+
+        ArenaAllocator() noexcept = default;
+
+        explicit ArenaAllocator(std::shared_ptr<Arena> arena) noexcept :
+            arena_{std::move(arena)}
+        {}
+
+        template<typename U>
+        ArenaAllocator(const ArenaAllocator<U>& other) noexcept :
+            arena_{other.arena()}
+        {}
+
+        T* allocate(std::size_t n)
+        {
+            if (!arena_)
+            {
+                return AlignedAllocator<T>().allocate(n);
+            }
+            if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+            {
+                throw std::bad_alloc();
+            }
+            return static_cast<T*>(arena_->allocate(n * sizeof(T)));
+        }
+
+        void deallocate(T* p,
+                        std::size_t n) noexcept
+        {
+            if (arena_)
+            {
+                arena_->deallocate(p,
+                                   n * sizeof(T));
+            }
+            else
+            {
+                AlignedAllocator<T>().deallocate(p,
+                                                 n);
+            }
+        }
+
+        /// The arena, or nullptr for heap storage.
+        const std::shared_ptr<Arena>& arena() const noexcept
+        { return arena_; }
+
+    private:
+        std::shared_ptr<Arena> arena_;
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) noexcept
+{ return a.arena() == b.arena(); }
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) noexcept
+{ return !(a == b); }
+
+/*!
+ * \brief Container for restraint state, stored in an Arena if one is provided.
+ */
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+} // end namespace plugin
+
+#endif //RESTRAINT_ARENA_H
@@ -0,0 +1,78 @@
+/*! \file
+ * \brief Code to implement the bias kernel declared in biaskernel.h
+ */
+
+#include "biaskernel.h"
+
+#include <cassert>
+#include <cmath>
+
+#include <algorithm>
+
+#include "alignedallocator.h"
+#include "simd.h"
+
+namespace plugin
+{
+
+template<typename T>
+BiasKernel<T>::BiasKernel(double binWidth,
+                          double sigma,
+                          double k,
+                          double cutoffSigmas) :
+    binWidth_{static_cast<T>(binWidth)},
+    exponentScale_{static_cast<T>(-0.5 / (sigma * sigma))},
+    forceScale_{k / (sqrt(2 * M_PI) * sigma * sigma * sigma)},
+    energyScale_{k / (sqrt(2 * M_PI) * sigma)},
+    cutoff_{cutoffSigmas > 0 ? cutoffSigmas * sigma : 0.}
+{
+}
+
+template<typename T>
+BiasPoint BiasKernel<T>::operator()(double R,
+                                    const T* histogram,
+                                    std::size_t nBins) const
+{
+    using S = SimdTraits<T>;
+    constexpr auto width = S::width;
+    static_assert(paddedSize<T>(1) % width == 0, "Histogram padding must hold whole SIMD vectors.");
+
+    // Visit the range of bins within the cutoff, expanded to whole (aligned) SIMD vectors.
+    std::size_t begin{0};
+    std::size_t end{nBins};
+    if (cutoff_ > 0)
+    {
+        const double low = std::ceil((R - cutoff_) / binWidth_);
+        const double high = std::floor((R + cutoff_) / binWidth_) + 1;
+        begin = low > 0 ? std::min(static_cast<std::size_t>(low), nBins) : 0;
+        end = high > 0 ? std::min(static_cast<std::size_t>(high), nBins) : 0;
+    }
+    begin -= begin % width;
+    end = std::min(((end + width - 1) / width) * width, paddedSize<T>(nBins));
+
+    const auto offsets = S::mul(S::iota(), S::set1(binWidth_));
+    const auto scale = S::set1(exponentScale_);
+    auto force = S::set1(0);
+    auto energy = S::set1(0);
+    for (std::size_t n = begin;n < end;n += width)
+    {
+        // x = n * binWidth - R for each lane.
+        const auto x = S::add(offsets, S::set1(static_cast<T>(n * static_cast<double>(binWidth_) - R)));
+        const auto gaussian = S::mul(S::load(histogram + n), simdExp<T>(S::mul(S::mul(x, x), scale)));
+        force = S::fma(gaussian, x, force);
+        energy = S::add(energy, gaussian);
+    }
+
+    BiasPoint point;
+    point.force = -forceScale_ * S::sum(force);
+    point.energy = energyScale_ * S::sum(energy);
+    return point;
+}
+
+template
+class BiasKernel<float>;
+
+template
+class BiasKernel<double>;
+
+} // end namespace plugin
@@ -0,0 +1,84 @@
+#ifndef RESTRAINT_BIASKERNEL_H
+#define RESTRAINT_BIASKERNEL_H
+
+/*! \file
+ * \brief SIMD evaluation of the smoothed-histogram bias used by EnsemblePotential.
+ *
+ * This is the default force kernel when the bias is not tabulated (see forcetable.h).
+ */
+
+#include <cstddef>
+
+#include "forcetable.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief Cutoff-truncated, vectorized Gaussian sum over histogram bins.
+ *
+ * Only bins within cutoffSigmas * sigma of R are visited, rounded outward to whole SIMD vectors.
+ * Each Gaussian is evaluated with the fast exponential in simd.h.
+ *
+ * Tolerance: compared to the direct sum in evaluateBias(), the truncation neglects Gaussians with
+ * relative weight below exp(-cutoffSigmas^2 / 2) (1.5e-8 for the default cutoff of 6 sigma), and
+ * the fast exponential contributes a relative error below 1e-15 per term. With a cutoff of zero
+ * (no truncation) results agree with evaluateBias() to within rounding.
+ *
+ * For T = float, distances and Gaussians are computed in single precision, which limits the
+ * relative accuracy to about 1e-5.
+ *
+ * \tparam T scalar type of the histogram and of the arithmetic.
+ */
+template<typename T>
+class BiasKernel
+{
+    public:
+        /*!
+         * \brief Precompute kernel constants.
+         *
+         * \param binWidth histogram bin width.
+         * \param sigma width of the Gaussian smoothing.
+         * \param k force constant.
+         * \param cutoffSigmas truncation distance in units of sigma. Zero or less sums every bin.
+         */
+        BiasKernel(double binWidth,
+                   double sigma,
+                   double k,
+                   double cutoffSigmas);
+
+        /*!
+         * \brief Evaluate force and energy at R.
+         *
+         * \param R pair distance.
+         * \param histogram bias histogram in aligned storage padded to paddedSize<T>(nBins)
+         *        elements, with zero padding.
+         * \param nBins number of bins in the histogram.
+         * \return force and energy at R. slope is not computed.
+         */
+        BiasPoint operator()(double R,
+                             const T* histogram,
+                             std::size_t nBins) const;
+
+    private:
+        T binWidth_;
+        /// -1 / (2 sigma^2)
+        T exponentScale_;
+        /// k / (sqrt(2 pi) sigma^3)
+        double forceScale_;
+        /// k / (sqrt(2 pi) sigma)
+        double energyScale_;
+        /// Truncation distance, or zero to visit every bin.
+        double cutoff_;
+};
+
+// Explicitly instantiated in biaskernel.cpp
+extern template
+class BiasKernel<float>;
+
+extern template
+class BiasKernel<double>;
+
+} // end namespace plugin
+
+#endif //RESTRAINT_BIASKERNEL_H
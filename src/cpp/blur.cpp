@@ -0,0 +1,349 @@
+/*! \file
+ * \brief Code to implement the blurring functor declared in blur.h
+ */
+
+#include "blur.h"
+
+#include <cassert>
+#include <cmath>
+
+#include <algorithm>
+#include <complex>
+#include <string>
+
+#include "gmxapi/exceptions.h"
+
+#include "alignedallocator.h"
+#include "simd.h"
+
+namespace plugin
+{
+
+namespace
+{
+
+/*!
+ * \brief In-place iterative radix-2 FFT.
+ *
+ * \param data sequence with a power of two length.
+ * \param inverse compute the unnormalized inverse transform instead.
+ */
+void fft(std::vector<std::complex<double>>* data,
+         bool inverse)
+{
+    auto& a = *data;
+    const auto n = a.size();
+    assert((n & (n - 1)) == 0);
+
+    // Bit-reversal permutation.
+    for (std::size_t i = 1, j = 0;i < n;++i)
+    {
+        auto bit = n >> 1;
+        for (;j & bit;bit >>= 1)
+        {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j)
+        {
+            std::swap(a[i], a[j]);
+        }
+    }
+
+    for (std::size_t length = 2;length <= n;length <<= 1)
+    {
+        const double angle = (inverse ? 2 : -2) * M_PI / length;
+        const std::complex<double> root{cos(angle), sin(angle)};
+        for (std::size_t start = 0;start < n;start += length)
+        {
+            std::complex<double> twiddle{1., 0.};
+            for (std::size_t k = 0;k < length / 2;++k)
+            {
+                const auto even = a[start + k];
+                const auto odd = a[start + k + length / 2] * twiddle;
+                a[start + k] = even + odd;
+                a[start + k + length / 2] = even - odd;
+                twiddle *= root;
+            }
+        }
+    }
+}
+
+} // end anonymous namespace
+
+BlurMode blurModeFromString(const std::string& name)
+{
+    if (name == "direct")
+    {
+        return BlurMode::Direct;
+    }
+    else if (name == "binned")
+    {
+        return BlurMode::Binned;
+    }
+    throw gmxapi::UsageError("Unknown blur mode '" + name + "'. Expected 'direct' or 'binned'.");
+}
+
+template<typename T>
+BlurToGrid<T>::BlurToGrid(double low,
+                          double gridSpacing,
+                          double sigma,
+                          double cutoffSigmas) :
+    low_{low},
+    binWidth_{gridSpacing},
+    sigma_{sigma},
+    exponentScale_{static_cast<T>(-0.5 / (sigma * sigma))},
+    cutoff_{cutoffSigmas > 0 ? cutoffSigmas * sigma : 0.},
+    scratch_{}
+{
+}
+
+template<typename T>
+void BlurToGrid<T>::operator()(const T* samples,
+                               std::size_t nSamples,
+                               std::size_t nBins,
+                               T* grid) const
+{
+    using S = SimdTraits<T>;
+    constexpr auto width = S::width;
+    const auto paddedBins = paddedSize<T>(nBins);
+    std::fill(grid,
+              grid + paddedBins,
+              T(0));
+    if (nSamples == 0)
+    {
+        return;
+    }
+
+    const auto offsets = S::mul(S::iota(), S::set1(static_cast<T>(binWidth_)));
+    const auto scale = S::set1(exponentScale_);
+    for (std::size_t s = 0;s < nSamples;++s)
+    {
+        const T sample = samples[s];
+        // Scatter onto the grid points within the cutoff, expanded to whole (aligned) SIMD vectors.
+        std::size_t begin{0};
+        std::size_t end{nBins};
+        if (cutoff_ > 0)
+        {
+            const double first = std::ceil((sample - cutoff_ - low_) / binWidth_);
+            const double last = std::floor((sample + cutoff_ - low_) / binWidth_) + 1;
+            begin = first > 0 ? std::min(static_cast<std::size_t>(first), nBins) : 0;
+            end = last > 0 ? std::min(static_cast<std::size_t>(last), nBins) : 0;
+        }
+        begin -= begin % width;
+        end = std::min(((end + width - 1) / width) * width, paddedBins);
+
+        for (std::size_t n = begin;n < end;n += width)
+        {
+            // x = (low + n * binWidth) - sample for each lane.
+            const auto x = S::add(offsets, S::set1(static_cast<T>(low_ + n * binWidth_ - sample)));
+            const auto gaussian = simdExp<T>(S::mul(S::mul(x, x), scale));
+            S::store(grid + n, S::add(S::load(grid + n), gaussian));
+        }
+    }
+
+    const T normalization = static_cast<T>(1.0 / (nSamples * std::sqrt(2.0 * M_PI * sigma_ * sigma_)));
+    for (std::size_t i = 0;i < nBins;++i)
+    {
+        grid[i] *= normalization;
+    }
+    // Samples near the end of the grid also reach into the padding, which kernels require to be zero.
+    std::fill(grid + nBins,
+              grid + paddedBins,
+              T(0));
+}
+
+template<typename T>
+BinnedBlur<T>::BinnedBlur(double low,
+                          double gridSpacing,
+                          double sigma,
+                          double cutoffSigmas,
+                          Convolution convolution) :
+    low_{low},
+    binWidth_{gridSpacing},
+    sigma_{sigma},
+    cutoffSigmas_{cutoffSigmas},
+    convolution_{convolution},
+    // Fine spacing of at most sigma / 16 bounds the linear binning error (see blur.h).
+    subdivisions_{std::max<std::size_t>(1, static_cast<std::size_t>(std::ceil(16 * gridSpacing / sigma)))},
+    fineSpacing_{gridSpacing / subdivisions_}
+{
+}
+
+template<typename T>
+void BinnedBlur<T>::prepare(std::size_t nBins)
+{
+    preparedBins_ = nBins;
+    const std::size_t span = (nBins > 0 ? nBins - 1 : 0) * subdivisions_;
+    halfWidth_ = cutoffSigmas_ > 0 ? static_cast<std::size_t>(std::ceil(cutoffSigmas_ * sigma_ / fineSpacing_)) : span;
+
+    const std::size_t stencilSize = 2 * halfWidth_ + 1;
+    stencil_.assign(paddedSize<T>(stencilSize),
+                    T(0));
+    for (std::size_t k = 0;k < stencilSize;++k)
+    {
+        const double x = (static_cast<double>(k) - halfWidth_) * fineSpacing_;
+        stencil_[k] = static_cast<T>(exp(-0.5 * x * x / (sigma_ * sigma_)));
+    }
+    // The direct convolution reads a whole padded stencil beyond the last output point.
+    fine_.assign(span + stencil_.size(),
+                 T(0));
+
+    // The linear convolution of the fine grid with the stencil must not wrap around.
+    const std::size_t fineSize = span + stencilSize;
+    std::size_t transformSize{1};
+    while (transformSize < fineSize + stencilSize - 1)
+    {
+        transformSize <<= 1;
+    }
+    switch (convolution_)
+    {
+        case Convolution::Direct:
+            useFft_ = false;
+            break;
+        case Convolution::Fft:
+            useFft_ = true;
+            break;
+        case Convolution::Automatic:
+            // Multiply-adds of the direct stencil against the butterflies of two transforms.
+            useFft_ = nBins * stencil_.size() > 8 * transformSize * std::log2(transformSize);
+            break;
+    }
+
+    stencilTransform_.clear();
+    transform_.clear();
+    if (useFft_)
+    {
+        stencilTransform_.assign(transformSize,
+                                 0.);
+        for (std::size_t k = 0;k < stencilSize;++k)
+        {
+            stencilTransform_[k] = stencil_[k];
+        }
+        fft(&stencilTransform_,
+            false);
+        transform_.resize(transformSize);
+    }
+}
+
+template<typename T>
+void BinnedBlur<T>::operator()(const T* samples,
+                               std::size_t nSamples,
+                               std::size_t nBins,
+                               T* grid)
+{
+    const auto paddedBins = paddedSize<T>(nBins);
+    std::fill(grid,
+              grid + paddedBins,
+              T(0));
+    if (nSamples == 0 || nBins == 0)
+    {
+        return;
+    }
+    if (nBins != preparedBins_)
+    {
+        prepare(nBins);
+    }
+
+    // Linear binning onto the fine grid. Samples beyond the reach of the stencil are dropped.
+    std::fill(fine_.begin(),
+              fine_.end(),
+              T(0));
+    const std::size_t fineSize = (nBins - 1) * subdivisions_ + 2 * halfWidth_ + 1;
+    const double fineLow = low_ - halfWidth_ * fineSpacing_;
+    for (std::size_t s = 0;s < nSamples;++s)
+    {
+        const double u = (samples[s] - fineLow) / fineSpacing_;
+        if (u < 0 || u > fineSize - 1)
+        {
+            continue;
+        }
+        const auto j = std::min(static_cast<std::size_t>(u), fineSize - 1);
+        const double fraction = u - j;
+        fine_[j] += static_cast<T>(1 - fraction);
+        if (j + 1 < fineSize)
+        {
+            fine_[j + 1] += static_cast<T>(fraction);
+        }
+    }
+
+    if (useFft_)
+    {
+        convolveFft(nBins,
+                    grid);
+    }
+    else
+    {
+        convolveDirect(nBins,
+                       grid);
+    }
+
+    const T normalization = static_cast<T>(1.0 / (nSamples * std::sqrt(2.0 * M_PI * sigma_ * sigma_)));
+    for (std::size_t i = 0;i < nBins;++i)
+    {
+        grid[i] *= normalization;
+    }
+}
+
+template<typename T>
+void BinnedBlur<T>::convolveDirect(std::size_t nBins,
+                                   T* grid) const
+{
+    using S = SimdTraits<T>;
+    constexpr auto width = S::width;
+    for (std::size_t i = 0;i < nBins;++i)
+    {
+        // Fine grid points i * subdivisions_ + k are centered on output point i at k == halfWidth_.
+        const T* window = fine_.data() + i * subdivisions_;
+        auto sum = S::set1(0);
+        for (std::size_t k = 0;k < stencil_.size();k += width)
+        {
+            sum = S::fma(S::loadu(window + k), S::load(stencil_.data() + k), sum);
+        }
+        grid[i] = S::sum(sum);
+    }
+}
+
+template<typename T>
+void BinnedBlur<T>::convolveFft(std::size_t nBins,
+                                T* grid)
+{
+    std::fill(transform_.begin(),
+              transform_.end(),
+              0.);
+    const std::size_t fineSize = (nBins - 1) * subdivisions_ + 2 * halfWidth_ + 1;
+    for (std::size_t j = 0;j < fineSize;++j)
+    {
+        transform_[j] = fine_[j];
+    }
+    fft(&transform_,
+        false);
+    for (std::size_t j = 0;j < transform_.size();++j)
+    {
+        transform_[j] *= stencilTransform_[j];
+    }
+    fft(&transform_,
+        true);
+
+    // The stencil is symmetric, so output point i is element i * subdivisions_ + 2 * halfWidth_
+    // of the linear convolution.
+    const double inverseSize = 1. / transform_.size();
+    for (std::size_t i = 0;i < nBins;++i)
+    {
+        grid[i] = static_cast<T>(transform_[i * subdivisions_ + 2 * halfWidth_].real() * inverseSize);
+    }
+}
+
+template
+class BlurToGrid<float>;
+
+template
+class BlurToGrid<double>;
+
+template
+class BinnedBlur<float>;
+
+template
+class BinnedBlur<double>;
+
+} // end namespace plugin
@@ -0,0 +1,316 @@
+#ifndef RESTRAINT_BLUR_H
+#define RESTRAINT_BLUR_H
+
+/*! \file
+ * \brief Gaussian smoothing of distance samples onto the histogram grid of EnsemblePotential.
+ */
+
+#include <cstddef>
+
+#include <algorithm>
+#include <complex>
+#include <string>
+#include <vector>
+
+#include "alignedallocator.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief Run-time selector for the engine that smooths window samples.
+ */
+enum class BlurMode
+{
+    /// Scatter each sample onto nearby bins (BlurToGrid).
+    Direct,
+    /// Bin samples onto a fine grid, then convolve with a Gaussian stencil (BinnedBlur).
+    Binned
+};
+
+/*!
+ * \brief Get the blur mode named by a user-provided string.
+ *
+ * \param name one of "direct" or "binned".
+ * \return the named mode.
+ * \throws gmxapi::UsageError if the name is not recognized.
+ */
+BlurMode blurModeFromString(const std::string& name);
+
+/*!
+ * \brief Discretize a density field on a grid.
+ *
+ * Apply a Gaussian blur when building a density grid for a list of values.
+ * Normalize such that the area under each sample is 1.0/num_samples.
+ *
+ * Each sample is scattered onto the grid points within cutoffSigmas * sigma of it, a whole SIMD
+ * vector of grid points at a time, with the fast exponential in simd.h. The cost is proportional to
+ * nSamples * cutoffSigmas * sigma / gridSpacing instead of nSamples * nBins.
+ *
+ * Tolerance: compared to the untruncated sum, each grid value loses Gaussian terms with relative
+ * weight below exp(-cutoffSigmas^2 / 2) (1.5e-8 for a cutoff of 6 sigma).
+ *
+ * \tparam T scalar type of the samples and of the arithmetic.
+ */
+template<typename T>
+class BlurToGrid
+{
+    public:
+        /*!
+         * \brief Construct the blurring functor.
+         *
+         * \param low The coordinate value of the first grid point.
+         * \param gridSpacing Distance between grid points.
+         * \param sigma Gaussian parameter for blurring inputs onto the grid.
+         * \param cutoffSigmas truncation distance in units of sigma. Zero or less blurs every sample
+         *        onto every grid point.
+         */
+        BlurToGrid(double low,
+                   double gridSpacing,
+                   double sigma,
+                   double cutoffSigmas);
+
+        /*!
+         * \brief Blur samples onto a grid in kernel storage.
+         *
+         * \param samples values to be blurred onto the grid.
+         * \param nSamples number of samples.
+         * \param nBins number of grid points.
+         * \param grid aligned storage for paddedSize<T>(nBins) elements. Previous contents are
+         *        overwritten, and padding elements are set to zero.
+         */
+        void operator()(const T* samples,
+                        std::size_t nSamples,
+                        std::size_t nBins,
+                        T* grid) const;
+
+        /*!
+         * \brief Blur a list of samples onto a grid in kernel storage.
+         */
+        template<typename Allocator>
+        void operator()(const std::vector<T, Allocator>& samples,
+                        std::size_t nBins,
+                        T* grid) const
+        {
+            (*this)(samples.data(),
+                    samples.size(),
+                    nBins,
+                    grid);
+        };
+
+        /*!
+         * \brief Callable for the functor.
+         *
+         * \param samples A list of values to be blurred onto the grid.
+         * \param grid Pointer to the container into which to accumulate a blurred histogram of samples.
+         *        Its elements may have a different type than T.
+         *
+         * Example:
+         *
+         *     # Acquire 3 samples to be discretized with blurring.
+         *     std::vector<double> someData = {3.7, 8.1, 4.2};
+         *
+         *     # Create an empty grid to store magnitudes for points 0.5, 1.0, ..., 10.0.
+         *     std::vector<double> histogram(20, 0.);
+         *
+         *     # Specify the above grid and a Gaussian parameter of 0.8, truncated at 6 sigma.
+         *     auto blur = BlurToGrid<double>(0.5, 0.5, 0.8, 6.);
+         *
+         *     # Collect the density grid for the samples.
+         *     blur(someData, &histogram);
+         *
+         */
+        template<typename Allocator, typename Grid>
+        void operator()(const std::vector<T, Allocator>& samples,
+                        Grid* grid)
+        {
+            const auto nbins = grid->size();
+            scratch_.resize(paddedSize<T>(nbins));
+            (*this)(samples,
+                    nbins,
+                    scratch_.data());
+            std::copy_n(scratch_.begin(),
+                        nbins,
+                        grid->begin());
+        };
+
+    private:
+        /// Minimum value of bin zero
+        double low_;
+
+        /// Size of each bin
+        double binWidth_;
+
+        /// Smoothing factor
+        double sigma_;
+
+        /// -1 / (2 sigma^2)
+        T exponentScale_;
+
+        /// Truncation distance, or zero to visit every grid point.
+        double cutoff_;
+
+        /// Aligned grid for the kernel, reused between calls.
+        AlignedVector<T> scratch_;
+};
+
+/*!
+ * \brief Discretize a density field on a grid by binning, then convolving.
+ *
+ * Produces the same normalized grid as BlurToGrid in two steps:
+ *
+ * 1. Samples are distributed onto a fine grid, with spacing at most sigma / 16 and commensurate
+ *    with the output grid, by linear binning. The cost is proportional to nSamples.
+ * 2. The fine grid is convolved with a precomputed Gaussian stencil that extends cutoffSigmas * sigma
+ *    to either side, and the result is read at the output grid points. Narrow stencils are applied
+ *    directly with SIMD dot products, at a cost proportional to nBins * stencil size. Wide stencils
+ *    are applied with a radix-2 FFT, at a cost proportional to n log n in the fine grid size n.
+ *
+ * The cost is independent of the product nSamples * nBins, so this engine is preferable when
+ * windows hold many samples.
+ *
+ * Tolerance: linear binning moves each sample's weight to its two neighboring fine grid points,
+ * which smooths the result by a relative error of at most (h / sigma)^2 / 8 < 5e-4 of the peak value
+ * for fine spacing h. Truncation of the stencil behaves as for BlurToGrid.
+ *
+ * \tparam T scalar type of the samples and of the arithmetic. The FFT uses double precision.
+ */
+template<typename T>
+class BinnedBlur
+{
+    public:
+        /*!
+         * \brief How to apply the Gaussian stencil.
+         */
+        enum class Convolution
+        {
+            /// Choose by estimated cost.
+            Automatic,
+            /// SIMD dot product for each output grid point.
+            Direct,
+            /// Radix-2 FFT.
+            Fft
+        };
+
+        /*!
+         * \brief Construct the blurring functor.
+         *
+         * \param low The coordinate value of the first grid point.
+         * \param gridSpacing Distance between grid points.
+         * \param sigma Gaussian parameter for blurring inputs onto the grid.
+         * \param cutoffSigmas truncation distance in units of sigma. Zero or less extends the stencil
+         *        over the whole grid.
+         * \param convolution how to apply the stencil.
+         */
+        BinnedBlur(double low,
+                   double gridSpacing,
+                   double sigma,
+                   double cutoffSigmas,
+                   Convolution convolution = Convolution::Automatic);
+
+        /*!
+         * \brief Blur samples onto a grid in kernel storage.
+         *
+         * \param samples values to be blurred onto the grid.
+         * \param nSamples number of samples.
+         * \param nBins number of grid points.
+         * \param grid aligned storage for paddedSize<T>(nBins) elements. Previous contents are
+         *        overwritten, and padding elements are set to zero.
+         */
+        void operator()(const T* samples,
+                        std::size_t nSamples,
+                        std::size_t nBins,
+                        T* grid);
+
+        /*!
+         * \brief Blur a list of samples onto a grid in kernel storage.
+         */
+        template<typename Allocator>
+        void operator()(const std::vector<T, Allocator>& samples,
+                        std::size_t nBins,
+                        T* grid)
+        {
+            (*this)(samples.data(),
+                    samples.size(),
+                    nBins,
+                    grid);
+        };
+
+        /*!
+         * \brief Blur samples onto a container, as for BlurToGrid.
+         *
+         * \param samples A list of values to be blurred onto the grid.
+         * \param grid Pointer to the container into which to write the blurred histogram of samples.
+         */
+        template<typename Allocator, typename Grid>
+        void operator()(const std::vector<T, Allocator>& samples,
+                        Grid* grid)
+        {
+            const auto nbins = grid->size();
+            output_.resize(paddedSize<T>(nbins));
+            (*this)(samples,
+                    nbins,
+                    output_.data());
+            std::copy_n(output_.begin(),
+                        nbins,
+                        grid->begin());
+        };
+
+    private:
+        /// (Re)build the stencil and FFT buffers for a grid of nBins points.
+        void prepare(std::size_t nBins);
+
+        /// Convolve fine_ with stencil_ and write every subdivisions_-th point to grid.
+        void convolveDirect(std::size_t nBins,
+                            T* grid) const;
+
+        /// As for convolveDirect(), using the FFT.
+        void convolveFft(std::size_t nBins,
+                         T* grid);
+
+        double low_;
+        double binWidth_;
+        double sigma_;
+        double cutoffSigmas_;
+        Convolution convolution_;
+
+        /// Fine grid points per output grid spacing.
+        std::size_t subdivisions_;
+        /// Fine grid spacing.
+        double fineSpacing_;
+
+        /// Number of output grid points the buffers are prepared for.
+        std::size_t preparedBins_{0};
+        /// Stencil half-width in fine grid points.
+        std::size_t halfWidth_{0};
+        /// Whether to use the FFT for the prepared size.
+        bool useFft_{false};
+
+        /// Gaussian weights at fine grid offsets -halfWidth_ ... halfWidth_, zero-padded.
+        AlignedVector<T> stencil_;
+        /// Binned sample weights. Point j is at low - halfWidth_ * fineSpacing_ + j * fineSpacing_.
+        AlignedVector<T> fine_;
+        /// FFT of the zero-padded stencil.
+        std::vector<std::complex<double>> stencilTransform_;
+        /// FFT work space.
+        std::vector<std::complex<double>> transform_;
+        /// Aligned output grid for the container interface.
+        AlignedVector<T> output_;
+};
+
+// Explicitly instantiated in blur.cpp
+extern template
+class BlurToGrid<float>;
+
+extern template
+class BlurToGrid<double>;
+
+extern template
+class BinnedBlur<float>;
+
+extern template
+class BinnedBlur<double>;
+
+} // end namespace plugin
+
+#endif //RESTRAINT_BLUR_H
@@ -0,0 +1,155 @@
+/*! \file
+ * \brief Code to implement the checkpoint files declared in checkpoint.h
+ */
+
+#include "checkpoint.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "gmxapi/exceptions.h"
+
+#include "sessionresources.h"
+
+namespace plugin
+{
+
+namespace {
+
+/// Magic number at the start of every checkpoint file.
+constexpr std::uint32_t checkpointMagic{0x4b435245}; // "ERCK"
+
+/*!
+ * \brief Flush the directory entries of the directory holding filename to disk.
+ *
+ * \return whether the directory was synced.
+ */
+bool syncDirectory(const std::string& filename)
+{
+    const auto slash = filename.rfind('/');
+    std::string directory{"."};
+    if (slash != std::string::npos)
+    {
+        // A file in the root directory keeps the slash.
+        directory = filename.substr(0,
+                                    slash > 0 ? slash : 1);
+    }
+    const int fd = ::open(directory.c_str(),
+                          O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    const bool synced = fsync(fd) == 0;
+    return ::close(fd) == 0 && synced;
+}
+
+} // end anonymous namespace
+
+void CheckpointWriter::begin(std::uint32_t format)
+{
+    buffer_.clear();
+    write(checkpointMagic);
+    write(format);
+}
+
+void CheckpointWriter::commit(const std::string& filename) const
+{
+    const auto temporary = filename + ".tmp";
+    {
+        RAIIFile file{temporary.c_str(),
+                      "wb"};
+        if (!file.fh())
+        {
+            throw gmxapi::ProtocolError("Could not open checkpoint file " + temporary + " for writing.");
+        }
+        // The data must be on disk before the rename makes it the checkpoint.
+        if (std::fwrite(buffer_.data(),
+                        1,
+                        buffer_.size(),
+                        file.fh()) != buffer_.size()
+            || std::fflush(file.fh()) != 0
+            || fsync(fileno(file.fh())) != 0)
+        {
+            throw gmxapi::ProtocolError("Could not write checkpoint file " + temporary + ".");
+        }
+        if (file.close() != 0)
+        {
+            throw gmxapi::ProtocolError("Could not close checkpoint file " + temporary + ".");
+        }
+    }
+    if (std::rename(temporary.c_str(),
+                    filename.c_str()) != 0)
+    {
+        throw gmxapi::ProtocolError("Could not replace checkpoint file " + filename + ".");
+    }
+    // The rename is only durable once the directory entry is on disk.
+    if (!syncDirectory(filename))
+    {
+        throw gmxapi::ProtocolError("Could not sync the directory of checkpoint file " + filename + ".");
+    }
+}
+
+std::unique_ptr<CheckpointReader> CheckpointReader::open(const std::string& filename,
+                                                         std::uint32_t format)
+{
+    RAIIFile file{filename.c_str(),
+                  "rb"};
+    if (!file.fh())
+    {
+        if (errno == ENOENT)
+        {
+            return nullptr;
+        }
+        throw gmxapi::ProtocolError("Could not open checkpoint file " + filename + ".");
+    }
+    std::vector<char> buffer;
+    char block[4096];
+    std::size_t count{0};
+    while ((count = std::fread(block,
+                               1,
+                               sizeof(block),
+                               file.fh())) > 0)
+    {
+        buffer.insert(buffer.end(),
+                      block,
+                      block + count);
+    }
+    if (std::ferror(file.fh()))
+    {
+        throw gmxapi::ProtocolError("Could not read checkpoint file " + filename + ".");
+    }
+
+    std::unique_ptr<CheckpointReader> reader{new CheckpointReader(filename,
+                                                                  std::move(buffer))};
+    if (reader->buffer_.size() < 2 * sizeof(std::uint32_t) || reader->read<std::uint32_t>() != checkpointMagic
+        || reader->read<std::uint32_t>() != format)
+    {
+        throw gmxapi::UsageError(filename + " is not a checkpoint of this kind of restraint.");
+    }
+    return reader;
+}
+
+CheckpointReader::CheckpointReader(std::string filename,
+                                   std::vector<char> buffer) :
+    filename_{std::move(filename)},
+    buffer_{std::move(buffer)}
+{
+}
+
+const char* CheckpointReader::take(std::size_t size)
+{
+    if (size > buffer_.size() - position_)
+    {
+        throw gmxapi::ProtocolError("Checkpoint file " + filename_ + " is truncated.");
+    }
+    const char* data = buffer_.data() + position_;
+    position_ += size;
+    return data;
+}
+
+} // end namespace plugin
@@ -0,0 +1,147 @@
+#ifndef RESTRAINT_CHECKPOINT_H
+#define RESTRAINT_CHECKPOINT_H
+
+/*! \file
+ * \brief Binary checkpoints of restraint state.
+ *
+ * A restraint serializes its state into a CheckpointWriter, which replaces the checkpoint file
+ * atomically: the data is written and synced to a temporary file next to it, which is then renamed
+ * over the checkpoint. A preempted simulation leaves either the previous or the new checkpoint,
+ * never a partial one. A CheckpointReader reads the values back in the order they were written.
+ *
+ * Values are stored in the byte order and representation of the host, so checkpoints are meant to
+ * restart a simulation on the same kind of machine.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace plugin
+{
+
+/*!
+ * \brief Accumulate a checkpoint in memory and commit it to a file.
+ *
+ * The buffer is kept between checkpoints, so that writing a checkpoint of the same size again
+ * does not allocate.
+ */
+class CheckpointWriter
+{
+    public:
+        /*!
+         * \brief Start a new checkpoint.
+         *
+         * \param format identifies the kind and version of the state that follows.
+         */
+        void begin(std::uint32_t format);
+
+        /// Append a value.
+        template<typename T>
+        void write(const T& value)
+        {
+            write(&value,
+                  1);
+        }
+
+        /// Append count values.
+        template<typename T>
+        void write(const T* values,
+                   std::size_t count)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "Checkpoints hold raw bytes of values.");
+            const auto offset = buffer_.size();
+            buffer_.resize(offset + count * sizeof(T));
+            if (count > 0)
+            {
+                std::memcpy(buffer_.data() + offset,
+                            values,
+                            count * sizeof(T));
+            }
+        }
+
+        /*!
+         * \brief Replace the file with the checkpoint.
+         *
+         * \param filename checkpoint file. The data is first written to filename + ".tmp".
+         * \throws gmxapi::ProtocolError if the file cannot be written or renamed.
+         */
+        void commit(const std::string& filename) const;
+
+        /// Size of the checkpoint (bytes).
+        std::size_t size() const
+        { return buffer_.size(); }
+
+    private:
+        std::vector<char> buffer_;
+};
+
+/*!
+ * \brief Read back the values of a checkpoint file.
+ */
+class CheckpointReader
+{
+    public:
+        /*!
+         * \brief Read a checkpoint file.
+         *
+         * \param filename checkpoint file.
+         * \param format expected kind and version of the state.
+         * \return reader positioned after the format, or nullptr if there is no such file.
+         * \throws gmxapi::UsageError if the file holds a different format.
+         */
+        static std::unique_ptr<CheckpointReader> open(const std::string& filename,
+                                                      std::uint32_t format);
+
+        /// Read a value.
+        template<typename T>
+        T read()
+        {
+            T value;
+            read(&value,
+                 1);
+            return value;
+        }
+
+        /*!
+         * \brief Read count values.
+         *
+         * \throws gmxapi::ProtocolError if the checkpoint ends first.
+         */
+        template<typename T>
+        void read(T* values,
+                  std::size_t count)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "Checkpoints hold raw bytes of values.");
+            const char* source = take(count * sizeof(T));
+            if (count > 0)
+            {
+                std::memcpy(values,
+                            source,
+                            count * sizeof(T));
+            }
+        }
+
+        /// Name of the file being read, for error messages.
+        const std::string& filename() const
+        { return filename_; }
+
+    private:
+        CheckpointReader(std::string filename,
+                         std::vector<char> buffer);
+
+        /// Advance past size bytes and return their location.
+        const char* take(std::size_t size);
+
+        std::string filename_;
+        std::vector<char> buffer_;
+        std::size_t position_{0};
+};
+
+} // end namespace plugin
+
+#endif //RESTRAINT_CHECKPOINT_H
@@ -0,0 +1,342 @@
+/*! \file
+ * \brief Code to implement the restraint bank declared in ensemblebank.h
+ */
+
+#include "ensemblebank.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "gmxapi/exceptions.h"
+
+#include "stepscheduler.h"
+
+namespace plugin
+{
+
+namespace
+{
+
+/// Arena of the resources, if any.
+std::shared_ptr<Arena> arenaOf(const std::shared_ptr<Resources>& resources)
+{
+    return resources ? resources->arena() : nullptr;
+}
+
+} // end anonymous namespace
+
+EnsembleBank::EnsembleBank(const input_param_type& params,
+                           std::shared_ptr<Resources> resources) :
+    nPairs_{params.shared.nBins > 0 ? params.experimental.size() / params.shared.nBins : 0},
+    nBins_{params.shared.nBins},
+    paddedBins_{paddedSize<double>(params.shared.nBins)},
+    minDist_{params.shared.minDist},
+    maxDist_{params.shared.maxDist},
+    k_{params.shared.k},
+    resources_{std::move(resources)},
+    histograms_(nPairs_ * paddedBins_,
+                0.,
+                ArenaAllocator<double>(arenaOf(resources_))),
+    experimental_(params.experimental.begin(),
+                  params.experimental.end(),
+                  ArenaAllocator<double>(arenaOf(resources_))),
+    nSamples_{params.shared.nSamples},
+    currentSample_{0},
+    samplePeriod_{params.shared.samplePeriod},
+    samples_(nPairs_ * params.shared.nSamples,
+             0.,
+             ArenaAllocator<double>(arenaOf(resources_))),
+    reported_(nPairs_,
+              0),
+    numReported_{0},
+    nextSampleTime_{params.shared.samplePeriod},
+    windowStartTime_{0},
+    scheduler_{resources_ ? resources_->stepScheduler().get() : nullptr},
+    sampleSteps_{0},
+    windowStartStep_{0},
+    windows_{nPairs_ * nBins_,
+             params.shared.nWindows,
+             0,
+             ArenaAllocator<double>(arenaOf(resources_))},
+    blurred_(nPairs_ * paddedBins_,
+             0.,
+             ArenaAllocator<double>(arenaOf(resources_))),
+    reduceSend_{1,
+                nPairs_ * nBins_},
+    reduceReceive_{1,
+                   nPairs_ * nBins_},
+    reduceEncoding_{params.shared.reduceEncoding},
+    fixedPointScale_{params.shared.fixedPointScale},
+    reduceHistory_{},
+    kernel_{params.shared.binWidth,
+            params.shared.sigma,
+            params.shared.k,
+            params.shared.cutoffSigmas},
+    blurMode_{params.shared.blurMode},
+    blur_{0.0,
+          params.shared.binWidth,
+          params.shared.sigma,
+          params.shared.blurCutoffSigmas},
+    binnedBlur_{0.0,
+                params.shared.binWidth,
+                params.shared.sigma,
+                params.shared.blurCutoffSigmas}
+{
+    if (nPairs_ == 0 || !resources_)
+    {
+        throw gmxapi::UsageError("EnsembleBank requires at least one pair and ensemble resources.");
+    }
+    if (experimental_.size() != nPairs_ * nBins_)
+    {
+        throw gmxapi::UsageError("Each pair of an EnsembleBank needs an experimental distribution of nbins values.");
+    }
+    if (scheduler_)
+    {
+        sampleSteps_ = scheduler_->steps(samplePeriod_);
+    }
+    scheduleSample();
+}
+
+void EnsembleBank::callback(std::size_t pair,
+                            gmx::Vector v,
+                            gmx::Vector v0,
+                            double t)
+{
+    // Most steps fall between samples.
+    if (t < nextSampleTime_ || reported_[pair])
+    {
+        return;
+    }
+    const auto rdiff = v - v0;
+    samples_[pair * nSamples_ + currentSample_] = std::sqrt(dot(rdiff,
+                                                                rdiff));
+    reported_[pair] = 1;
+    if (++numReported_ == nPairs_)
+    {
+        completeSample(t);
+    }
+}
+
+void EnsembleBank::callback(const PairBatch& pairs,
+                            double t)
+{
+    if (t < nextSampleTime_)
+    {
+        return;
+    }
+    if (pairs.size != nPairs_)
+    {
+        throw gmxapi::UsageError("EnsembleBank::callback() requires coordinates of every pair of the bank.");
+    }
+    const auto numPairs = static_cast<std::ptrdiff_t>(nPairs_);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if(nPairs_ >= minThreadedBatchSize)
+#endif
+    for (std::ptrdiff_t i = 0;i < numPairs;++i)
+    {
+        const double dx = pairs.x[i] - pairs.x0[i];
+        const double dy = pairs.y[i] - pairs.y0[i];
+        const double dz = pairs.z[i] - pairs.z0[i];
+        samples_[i * nSamples_ + currentSample_] = std::sqrt(dx * dx + dy * dy + dz * dz);
+    }
+    completeSample(t);
+}
+
+void EnsembleBank::completeSample(double t)
+{
+    std::fill(reported_.begin(),
+              reported_.end(),
+              0);
+    numReported_ = 0;
+    if (++currentSample_ == nSamples_)
+    {
+        closeWindow();
+        currentSample_ = 0;
+        windowStartTime_ = t;
+        if (scheduler_)
+        {
+            windowStartStep_ = scheduler_->step(t);
+        }
+    }
+    scheduleSample();
+}
+
+void EnsembleBank::scheduleSample()
+{
+    if (scheduler_)
+    {
+        // Halfway between steps, so that rounding of t does not move samples.
+        nextSampleTime_ = (static_cast<double>(windowStartStep_ + (currentSample_ + 1) * sampleSteps_) - 0.5)
+            * scheduler_->dt();
+    }
+    else
+    {
+        nextSampleTime_ = windowStartTime_ + (currentSample_ + 1) * samplePeriod_;
+    }
+}
+
+void EnsembleBank::closeWindow()
+{
+    // Blur the samples of all pairs. The direct engine keeps no state, so pairs can be spread over threads.
+    const auto numPairs = static_cast<std::ptrdiff_t>(nPairs_);
+    if (blurMode_ == BlurMode::Binned)
+    {
+        for (std::ptrdiff_t pair = 0;pair < numPairs;++pair)
+        {
+            binnedBlur_(samples_.data() + pair * nSamples_,
+                        nSamples_,
+                        nBins_,
+                        blurred_.data() + pair * paddedBins_);
+        }
+    }
+    else
+    {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if(nPairs_ * nSamples_ >= minThreadedBatchSize)
+#endif
+        for (std::ptrdiff_t pair = 0;pair < numPairs;++pair)
+        {
+            blur_(samples_.data() + pair * nSamples_,
+                  nSamples_,
+                  nBins_,
+                  blurred_.data() + pair * paddedBins_);
+        }
+    }
+    for (std::size_t pair = 0;pair < nPairs_;++pair)
+    {
+        std::copy_n(blurred_.data() + pair * paddedBins_,
+                    nBins_,
+                    reduceSend_.data() + pair * nBins_);
+    }
+
+    // One ensemble mean for the whole bank.
+    ReduceOptions options;
+    options.operation = ReduceOperation::Mean;
+    options.encoding = reduceEncoding_;
+    options.fixedPointScale = fixedPointScale_;
+    options.history = &reduceHistory_;
+    resources_->getHandle().reduce(reduceSend_,
+                                   &reduceReceive_,
+                                   options);
+    windows_.push(reduceReceive_.data());
+
+    const auto sum = windows_.sum();
+    const auto nWindows = static_cast<double>(windows_.size());
+    for (std::size_t pair = 0;pair < nPairs_;++pair)
+    {
+        for (std::size_t i = 0;i < nBins_;++i)
+        {
+            histograms_[pair * paddedBins_ + i] = sum[pair * nBins_ + i] / nWindows - experimental_[pair * nBins_ + i];
+        }
+    }
+}
+
+BiasPoint EnsembleBank::evaluateDistance(std::size_t pair,
+                                         double R) const
+{
+    BiasPoint bias;
+    if (R > maxDist_)
+    {
+        // apply a force to reduce R
+        bias.force = k_ * (maxDist_ - R);
+        bias.energy = 0.5 * k_ * (R - maxDist_) * (R - maxDist_);
+    }
+    else if (R < minDist_)
+    {
+        // apply a force to increase R
+        bias.force = k_ * (minDist_ - R);
+        bias.energy = 0.5 * k_ * (minDist_ - R) * (minDist_ - R);
+    }
+    else
+    {
+        bias = kernel_(R,
+                       histograms_.data() + pair * paddedBins_,
+                       nBins_);
+    }
+    return bias;
+}
+
+gmx::PotentialPointData EnsembleBank::calculate(std::size_t pair,
+                                                gmx::Vector v,
+                                                gmx::Vector v0,
+                                                double /* t */) const
+{
+    const auto rdiff = v - v0;
+    const auto R = std::sqrt(dot(rdiff,
+                                 rdiff));
+
+    gmx::PotentialPointData output;
+    if (R != 0) // Direction of force is ill-defined when v == v0
+    {
+        const auto bias = evaluateDistance(pair,
+                                           R);
+        const auto magnitude = bias.force / R;
+        output.force = rdiff * static_cast<decltype(rdiff[0])>(magnitude);
+        output.energy = static_cast<real>(bias.energy);
+    }
+    return output;
+}
+
+void EnsembleBank::calculate(const PairBatch& pairs,
+                             double /* t */,
+                             const PairBatchForces& forces) const
+{
+    assert(forces.x && forces.y && forces.z);
+    if (pairs.size != nPairs_)
+    {
+        throw gmxapi::UsageError("EnsembleBank::calculate() requires coordinates of every pair of the bank.");
+    }
+    const auto numPairs = static_cast<std::ptrdiff_t>(nPairs_);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if(nPairs_ >= minThreadedBatchSize)
+#endif
+    for (std::ptrdiff_t i = 0;i < numPairs;++i)
+    {
+        const double dx = pairs.x[i] - pairs.x0[i];
+        const double dy = pairs.y[i] - pairs.y0[i];
+        const double dz = pairs.z[i] - pairs.z0[i];
+        const double R = std::sqrt(dx * dx + dy * dy + dz * dz);
+
+        double magnitude{0};
+        double energy{0};
+        if (R != 0) // Direction of force is ill-defined when v == v0
+        {
+            const auto bias = evaluateDistance(static_cast<std::size_t>(i),
+                                               R);
+            magnitude = bias.force / R;
+            energy = bias.energy;
+        }
+        forces.x[i] = static_cast<real>(magnitude * dx);
+        forces.y[i] = static_cast<real>(magnitude * dy);
+        forces.z[i] = static_cast<real>(magnitude * dz);
+        if (forces.energy)
+        {
+            forces.energy[i] = static_cast<real>(energy);
+        }
+    }
+}
+
+EnsembleBankPair::EnsembleBankPair(std::vector<int> sites,
+                                   const input_param_type& params,
+                                   std::shared_ptr<Resources> /* resources */) :
+    sites_{std::move(sites)},
+    bank_{params.bank},
+    pair_{params.pair}
+{
+    if (!bank_ || pair_ >= bank_->size())
+    {
+        throw gmxapi::UsageError("EnsembleBankPair requires a bank and the index of one of its pairs.");
+    }
+}
+
+// Explicitly instantiate a definition.
+template
+class ::plugin::RestraintModule<EnsembleBankPair>;
+
+} // end namespace plugin
@@ -0,0 +1,269 @@
+#ifndef RESTRAINT_ENSEMBLEBANK_H
+#define RESTRAINT_ENSEMBLEBANK_H
+
+/*! \file
+ * \brief Restrained-ensemble bias for many site pairs held in one object.
+ *
+ * An EnsembleRestraint restrains one pair, with its own schedule, window history, blur, and
+ * ensemble reduction. To restrain hundreds of label pairs, an EnsembleBank holds the state of all
+ * pairs in structure-of-arrays layout: distances of all pairs are sampled in one pass, the window
+ * history is one nPairs x nBins block per window, all pairs are blurred together, and each window
+ * of the bank is averaged over the ensemble in one reduction.
+ *
+ * GROMACS evaluates restraints one pair at a time, so each pair is presented to GROMACS by an
+ * EnsembleBankPair, which holds no more than a reference to the bank, its index, and its sites.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "gromacs/restraint/restraintpotential.h"
+#include "gromacs/utility/real.h"
+
+#include "arena.h"
+#include "biaskernel.h"
+#include "blur.h"
+#include "ensemblepotential.h"
+#include "pairbatch.h"
+#include "sessionresources.h"
+#include "windowhistory.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief Parameters of an EnsembleBank.
+ */
+struct ensemble_bank_param_type
+{
+    /// Parameters shared by all pairs. Its experimental distribution is not used.
+    ensemble_input_param_type shared{};
+
+    /// Experimental distributions of the pairs, row-major with shared.nBins values per pair.
+    std::vector<double> experimental{};
+};
+
+/*!
+ * \brief Restrained-ensemble bias of many site pairs with a shared schedule.
+ *
+ * Applies the bias of BasicEnsemblePotential to each pair, with the parameters of the bank and the
+ * experimental distribution of the pair. All pairs are sampled at the same times, and their windows
+ * are closed, averaged over the ensemble, and added to the history together.
+ *
+ * The bank computes in double precision and evaluates the bias with the direct-sum kernel
+ * (tableResolution and precision are not used). Window reductions are blocking and use the
+ * reduce encoding of the parameters (asyncReduceSteps is not used, and the UpdateCoordinator and
+ * ReduceCoordinator of the Resources are not used). The bank is called back on every MD step
+ * (callbackPeriod is not used), and has no checkpoints (checkpointFile and checkpointInterval are
+ * not used) or log (the HistogramLog of the Resources is not used). If the Resources provide a
+ * StepScheduler, samples are taken on exact MD steps.
+ */
+class EnsembleBank
+{
+    public:
+        using input_param_type = ensemble_bank_param_type;
+
+        /*!
+         * \brief Create a bank.
+         *
+         * \param params parameters, with one experimental distribution per pair.
+         * \param resources ensemble resources used by all pairs. The buffers of the bank are drawn
+         *        from its arena, if any.
+         * \throws gmxapi::UsageError if there are no pairs, or the experimental distributions are not
+         *         nBins values per pair.
+         */
+        EnsembleBank(const input_param_type& params,
+                     std::shared_ptr<Resources> resources);
+
+        /// Number of pairs.
+        std::size_t size() const
+        { return nPairs_; }
+
+        /// Number of bins per pair.
+        std::size_t nBins() const
+        { return nBins_; }
+
+        /// Resources of the bank.
+        const std::shared_ptr<Resources>& resources() const
+        { return resources_; }
+
+        /*!
+         * \brief Evaluate the bias of every pair of the bank.
+         *
+         * \param pairs coordinates of the (v, v0) pairs, in the order of the bank.
+         * \param t simulation time.
+         * \param forces caller-provided buffers to receive the force on each v (and energies).
+         */
+        void calculate(const PairBatch& pairs,
+                       double t,
+                       const PairBatchForces& forces) const;
+
+        /*!
+         * \brief Evaluate the bias of one pair.
+         */
+        gmx::PotentialPointData calculate(std::size_t pair,
+                                          gmx::Vector v,
+                                          gmx::Vector v0,
+                                          double t) const;
+
+        /*!
+         * \brief Update the state of all pairs at time t.
+         *
+         * \param pairs coordinates of the (v, v0) pairs, in the order of the bank.
+         * \param t simulation time.
+         */
+        void callback(const PairBatch& pairs,
+                      double t);
+
+        /*!
+         * \brief Update the state of one pair at time t.
+         *
+         * At a sample time, the sample is recorded when every pair of the bank has reported, and
+         * the last pair to report closes the window, if due.
+         */
+        void callback(std::size_t pair,
+                      gmx::Vector v,
+                      gmx::Vector v0,
+                      double t);
+
+    private:
+        /// Record that all pairs were sampled at time t, and close the window if it is full.
+        void completeSample(double t);
+
+        /// Blur the samples of all pairs, average them over the ensemble, and rebuild the histograms.
+        void closeWindow();
+
+        /// Set the time of the next sample.
+        void scheduleSample();
+
+        /// Force magnitude and energy for a pair at distance R > 0.
+        BiasPoint evaluateDistance(std::size_t pair,
+                                   double R) const;
+
+        std::size_t nPairs_;
+        std::size_t nBins_;
+        /// Stride of the padded per-pair rows of histograms_ and blurred_.
+        std::size_t paddedBins_;
+
+        /// Flat-bottom potential boundaries.
+        double minDist_;
+        double maxDist_;
+        /// Harmonic force coefficient
+        double k_;
+
+        std::shared_ptr<Resources> resources_;
+
+        /// Smoothed historic distribution minus experimental distribution, one padded row per pair.
+        ArenaVector<double> histograms_;
+        /// Experimental distributions, nBins per pair.
+        ArenaVector<double> experimental_;
+
+        unsigned int nSamples_;
+        unsigned int currentSample_;
+        double samplePeriod_;
+        /// Samples of the open window, nSamples per pair.
+        ArenaVector<double> samples_;
+        /// Pairs that have reported at the current sample time, and their count.
+        std::vector<char> reported_;
+        std::size_t numReported_;
+
+        /// Until this time, callback() has nothing to do.
+        double nextSampleTime_;
+        double windowStartTime_;
+        /// Schedule in MD steps, used instead of times with a StepScheduler.
+        StepScheduler* scheduler_;
+        std::int64_t sampleSteps_;
+        std::int64_t windowStartStep_;
+
+        /// Window history of all pairs, nPairs x nBins per window.
+        WindowHistory<double> windows_;
+        /// Blurred window of each pair, one padded row per pair.
+        ArenaVector<double> blurred_;
+        /// Buffers for the ensemble reduction of the windows of all pairs.
+        Matrix<double> reduceSend_;
+        Matrix<double> reduceReceive_;
+        ReduceEncoding reduceEncoding_;
+        double fixedPointScale_;
+        ReduceHistory reduceHistory_;
+
+        BiasKernel<double> kernel_;
+        BlurMode blurMode_;
+        BlurToGrid<double> blur_;
+        BinnedBlur<double> binnedBlur_;
+};
+
+/*!
+ * \brief Parameters of an EnsembleBankPair.
+ */
+struct ensemble_bank_pair_param_type
+{
+    /// Bank holding the state of the pair.
+    std::shared_ptr<EnsembleBank> bank;
+    /// Index of the pair in the bank.
+    std::size_t pair{0};
+};
+
+/*!
+ * \brief Present one pair of an EnsembleBank to GROMACS as a restraint.
+ *
+ * Use with RestraintModule<EnsembleBankPair> to create one module per pair.
+ */
+class EnsembleBankPair : public ::gmx::IRestraintPotential
+{
+    public:
+        using input_param_type = ensemble_bank_pair_param_type;
+
+        /*!
+         * \param sites sites of the pair.
+         * \param params bank and index of the pair.
+         * \param resources ignored: the pair uses the resources of the bank.
+         */
+        EnsembleBankPair(std::vector<int> sites,
+                         const input_param_type& params,
+                         std::shared_ptr<Resources> resources);
+
+        std::vector<int> sites() const override
+        {
+            return sites_;
+        }
+
+        gmx::PotentialPointData evaluate(gmx::Vector r1,
+                                         gmx::Vector r2,
+                                         double t) override
+        {
+            return bank_->calculate(pair_,
+                                    r1,
+                                    r2,
+                                    t);
+        }
+
+        void update(gmx::Vector v,
+                    gmx::Vector v0,
+                    double t) override
+        {
+            bank_->callback(pair_,
+                            v,
+                            v0,
+                            t);
+        }
+
+        void bindSession(gmxapi::SessionResources* session) override
+        {
+            bank_->resources()->setSession(session);
+        }
+
+    private:
+        std::vector<int> sites_;
+        std::shared_ptr<EnsembleBank> bank_;
+        std::size_t pair_;
+};
+
+// Explicitly instantiated in ensemblebank.cpp
+extern template
+class RestraintModule<EnsembleBankPair>;
+
+} // end namespace plugin
+
+#endif //RESTRAINT_ENSEMBLEBANK_H
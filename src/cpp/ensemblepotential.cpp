@@ -14,145 +14,343 @@
 
 #include <cassert>
 #include <cmath>
+#include <cstddef>
 
+#include <algorithm>
+#include <limits>
 #include <memory>
 #include <vector>
 
 #include "gmxapi/context.h"
+#include "gmxapi/exceptions.h"
 #include "gmxapi/session.h"
 #include "gmxapi/md/mdsignals.h"
 
+#include "blur.h"
+#include "checkpoint.h"
+#include "forcetable.h"
 #include "sessionresources.h"
+#include "stepscheduler.h"
+#include "updatecoordinator.h"
 
 namespace plugin
 {
 
-/*!
- * \brief Discretize a density field on a grid.
- *
- * Apply a Gaussian blur when building a density grid for a list of values.
- * Normalize such that the area under each sample is 1.0/num_samples.
- */
-class BlurToGrid
+template<class Precision>
+BasicEnsemblePotential<Precision>::BasicEnsemblePotential(const input_param_type& params,
+                                                          std::shared_ptr<Arena> arena) :
+    nBins_{params.nBins},
+    binWidth_{params.binWidth},
+    minDist_{params.minDist},
+    maxDist_{params.maxDist},
+    histogram_(paddedSize<compute_type>(params.nBins),
+               compute_type(0),
+               ArenaAllocator<compute_type>(arena)),
+    experimental_(params.experimental.begin(),
+                  params.experimental.end(),
+                  ArenaAllocator<double>(arena)),
+    nSamples_{params.nSamples},
+    currentSample_{0},
+    samplePeriod_{params.samplePeriod},
+    // In actuality, we have nsamples at (samplePeriod - dt), but we don't have access to dt.
+    nextSampleTime_{params.samplePeriod},
+    distanceSamples_(params.nSamples,
+                     compute_type(0),
+                     ArenaAllocator<compute_type>(arena)),
+    nWindows_{params.nWindows},
+    currentWindow_{0},
+    windowStartTime_{0},
+    nextWindowUpdateTime_{params.nSamples * params.samplePeriod},
+    nextCallbackTime_{std::min(params.samplePeriod,
+                               params.nSamples * params.samplePeriod)},
+    sampleSteps_{0},
+    nextSampleStep_{0},
+    windowStartStep_{0},
+    nextWindowStep_{0},
+    windows_{params.nBins,
+             params.nWindows,
+             0,
+             ArenaAllocator<accumulate_type>(arena)},
+    newWindow_(params.nBins,
+               accumulate_type(0),
+               ArenaAllocator<accumulate_type>(arena)),
+    tempWindow_(params.nBins,
+                accumulate_type(0),
+                ArenaAllocator<accumulate_type>(arena)),
+    reduceSend_{1,
+                params.nBins},
+    reduceReceive_{1,
+                   params.nBins},
+    reduceEncoding_{params.reduceEncoding},
+    fixedPointScale_{params.fixedPointScale},
+    reduceHistory_{},
+    updateTime_{0},
+    reduceRequest_{},
+    reducePending_{false},
+    asyncReduceSteps_{params.asyncReduceSteps},
+    reduceSteps_{0},
+    reduceStartStep_{0},
+    coordinator_{nullptr},
+    reduceCoordinator_{nullptr},
+    scheduler_{nullptr},
+    checkpointFile_{params.checkpointFile},
+    checkpointInterval_{params.checkpointInterval > 0 ? params.checkpointInterval : params.nSamples * params.samplePeriod},
+    nextCheckpointTime_{checkpointInterval_},
+    checkpoint_{},
+    checkpointTime_{0},
+    resumePending_{false},
+    k_{params.k},
+    sigma_{params.sigma},
+    tableResolution_{params.tableResolution},
+    table_{},
+    kernel_{params.binWidth,
+            params.sigma,
+            params.k,
+            params.cutoffSigmas},
+    blurMode_{params.blurMode},
+    blur_{0.0,
+          params.binWidth,
+          params.sigma,
+          params.blurCutoffSigmas},
+    binnedBlur_{0.0,
+                params.binWidth,
+                params.sigma,
+                params.blurCutoffSigmas}
 {
-    public:
-        /*!
-         * \brief Construct the blurring functor.
-         *
-         * \param low The coordinate value of the first grid point.
-         * \param gridSpacing Distance between grid points.
-         * \param sigma Gaussian parameter for blurring inputs onto the grid.
-         */
-        BlurToGrid(double low,
-                   double gridSpacing,
-                   double sigma) :
-            low_{low},
-            binWidth_{gridSpacing},
-            sigma_{sigma}
-        {
-        };
-
-        /*!
-         * \brief Callable for the functor.
-         *
-         * \param samples A list of values to be blurred onto the grid.
-         * \param grid Pointer to the container into which to accumulate a blurred histogram of samples.
-         *
-         * Example:
-         *
-         *     # Acquire 3 samples to be discretized with blurring.
-         *     std::vector<double> someData = {3.7, 8.1, 4.2};
-         *
-         *     # Create an empty grid to store magnitudes for points 0.5, 1.0, ..., 10.0.
-         *     std::vector<double> histogram(20, 0.);
-         *
-         *     # Specify the above grid and a Gaussian parameter of 0.8.
-         *     auto blur = BlurToGrid(0.5, 0.5, 0.8);
-         *
-         *     # Collect the density grid for the samples.
-         *     blur(someData, &histogram);
-         *
-         */
-        void operator()(const std::vector<double>& samples,
-                        std::vector<double>* grid)
-        {
-            const auto nbins = grid->size();
-            const double& dx{binWidth_};
-            const auto num_samples = samples.size();
-
-            const double denominator = 1.0 / (2 * sigma_ * sigma_);
-            const double normalization = 1.0 / (num_samples * sqrt(2.0 * M_PI * sigma_ * sigma_));
-            // We aren't doing any filtering of values too far away to contribute meaningfully, which
-            // is admittedly wasteful for large sigma...
-            for (size_t i = 0;i < nbins;++i)
-            {
-                double bin_value{0};
-                const double bin_x{low_ + i * dx};
-                for (const auto distance : samples)
-                {
-                    const double relative_distance{bin_x - distance};
-                    const auto numerator = -relative_distance * relative_distance;
-                    bin_value += normalization * exp(numerator * denominator);
-                }
-                grid->at(i) = bin_value;
-            }
-        };
+    updateTable();
+}
 
-    private:
-        /// Minimum value of bin zero
-        const double low_;
+template<class Precision>
+BasicEnsemblePotential<Precision>::~BasicEnsemblePotential()
+{
+    if (coordinator_)
+    {
+        coordinator_->withdraw(this);
+    }
+    if (reduceCoordinator_)
+    {
+        reduceCoordinator_->withdraw(this);
+    }
+    if (scheduler_)
+    {
+        scheduler_->withdraw(this);
+    }
+}
 
-        /// Size of each bin
-        const double binWidth_;
+template<class Precision>
+BasicEnsemblePotential<Precision>::BasicEnsemblePotential(size_t nbins,
+                                                          double binWidth,
+                                                          double minDist,
+                                                          double maxDist,
+                                                          PairHist experimental,
+                                                          unsigned int nSamples,
+                                                          double samplePeriod,
+                                                          unsigned int nWindows,
+                                                          double k,
+                                                          double sigma) :
+    BasicEnsemblePotential(*makeEnsembleParams(nbins,
+                                          binWidth,
+                                          minDist,
+                                          maxDist,
+                                          experimental,
+                                          nSamples,
+                                          samplePeriod,
+                                          nWindows,
+                                          k,
+                                          sigma))
+{
+}
 
-        /// Smoothing factor
-        const double sigma_;
-};
+template<class Precision>
+void BasicEnsemblePotential<Precision>::updateTable()
+{
+    if (tableResolution_ > 0)
+    {
+        table_.build(histogram_.data(),
+                     nBins_,
+                     binWidth_,
+                     sigma_,
+                     k_,
+                     minDist_,
+                     maxDist_,
+                     tableResolution_);
+    }
+}
 
-EnsemblePotential::EnsemblePotential(size_t nbins,
-                                   double binWidth,
-                                   double minDist,
-                                   double maxDist,
-                                   PairHist experimental,
-                                   unsigned int nSamples,
-                                   double samplePeriod,
-                                   unsigned int nWindows,
-                                   double k,
-                                   double sigma) :
-    nBins_{nbins},
-    binWidth_{binWidth},
-    minDist_{minDist},
-    maxDist_{maxDist},
-    histogram_(nbins,
-               0),
-    experimental_{std::move(experimental)},
-    nSamples_{nSamples},
-    currentSample_{0},
-    samplePeriod_{samplePeriod},
-    // In actuality, we have nsamples at (samplePeriod - dt), but we don't have access to dt.
-    nextSampleTime_{samplePeriod},
-    distanceSamples_(nSamples),
-    nWindows_{nWindows},
-    currentWindow_{0},
-    windowStartTime_{0},
-    nextWindowUpdateTime_{nSamples * samplePeriod},
-    windows_{},
-    k_{k},
-    sigma_{sigma}
-{}
-
-EnsemblePotential::EnsemblePotential(const input_param_type& params) :
-    EnsemblePotential(params.nBins,
-                     params.binWidth,
-                     params.minDist,
-                     params.maxDist,
-                     params.experimental,
-                     params.nSamples,
-                     params.samplePeriod,
-                     params.nWindows,
-                     params.k,
-                     params.sigma)
+template<class Precision>
+void BasicEnsemblePotential<Precision>::blurWindow()
+{
+    // Reduce sampled data for this restraint in this simulation, applying a Gaussian blur to fill a grid.
+    assert(distanceSamples_.size() == nSamples_);
+    if (blurMode_ == BlurMode::Binned)
+    {
+        binnedBlur_(distanceSamples_,
+                    &newWindow_);
+    }
+    else
+    {
+        blur_(distanceSamples_,
+              &newWindow_);
+    }
+}
+
+template<class Precision>
+void BasicEnsemblePotential<Precision>::reduceWindow(const Resources& resources)
+{
+    // Reductions always exchange double precision Matrix data, so the window is copied on the way.
+    std::copy(newWindow_.begin(),
+              newWindow_.end(),
+              reduceSend_.data());
+
+    const auto reduceCoordinator = resources.reduceCoordinator().get();
+    if (reduceCoordinator)
+    {
+        // Combined with the reductions of other restraints. Unless an UpdateCoordinator will
+        // rebuild the histogram after flushing the reductions, rebuild it on completion.
+        reduceCoordinator_ = reduceCoordinator;
+        const bool rebuild = coordinator_ == nullptr;
+        reduceCoordinator->enqueue(this,
+                                   &reduceSend_,
+                                   &reduceReceive_,
+                                   updateTime_,
+                                   [this, rebuild]() {
+                                       collectReduction();
+                                       if (rebuild)
+                                       {
+                                           rebuildHistogram();
+                                       }
+                                   },
+                                   ReduceOperation::Mean);
+        return;
+    }
+
+    // We request a handle each time before using resources to make error handling easier if there is a failure in
+    // one of the ensemble member processes and to give more freedom to how resources are managed from step to step.
+    auto ensemble = resources.getHandle();
+    // Get global reduction (mean) and checkpoint.
+    ensemble.reduce(reduceSend_,
+                    &reduceReceive_,
+                    reduceOptions());
+    collectReduction();
+}
+
+template<class Precision>
+ReduceOptions BasicEnsemblePotential<Precision>::reduceOptions()
+{
+    ReduceOptions options;
+    options.operation = ReduceOperation::Mean;
+    options.encoding = reduceEncoding_;
+    options.fixedPointScale = fixedPointScale_;
+    options.history = &reduceHistory_;
+    return options;
+}
+
+template<class Precision>
+void BasicEnsemblePotential<Precision>::collectReduction()
+{
+    std::copy_n(reduceReceive_.data(),
+                tempWindow_.size(),
+                tempWindow_.begin());
+    reduceCoordinator_ = nullptr;
+}
+
+template<class Precision>
+void BasicEnsemblePotential<Precision>::startReduction(const Resources& resources)
 {
+    std::copy(newWindow_.begin(),
+              newWindow_.end(),
+              reduceSend_.data());
+    reduceRequest_ = resources.getHandle().startReduce(reduceSend_,
+                                                       &reduceReceive_,
+                                                       reduceOptions());
+    reducePending_ = true;
+    reduceSteps_ = 0;
+}
+
+template<class Precision>
+void BasicEnsemblePotential<Precision>::pollReduction(bool wait)
+{
+    if (wait)
+    {
+        reduceRequest_.wait();
+    }
+    else if (!reduceRequest_.test())
+    {
+        return;
+    }
+    reducePending_ = false;
+    collectReduction();
+    rebuildHistogram();
+}
+
+template<class Precision>
+void BasicEnsemblePotential<Precision>::rebuildHistogram()
+{
+    // Update window list with the ensemble mean of the smoothed data, replacing the oldest window once nWindows are stored.
+    historyVersion_.begin();
+    windows_.push(tempWindow_.data());
+
+    // Get new histogram difference. Subtract the experimental distribution to get the values to use in our potential.
+    // The mean over windows comes from the running sum in accumulate_type. Bins beyond nBins_ are padding and stay zero.
+    const auto sum = windows_.sum();
+    const auto nWindows = static_cast<accumulate_type>(windows_.size());
+    for (size_t i = 0;i < nBins_;++i)
+    {
+        histogram_[i] = static_cast<compute_type>(sum[i] / nWindows - experimental_[i]);
+    }
+    historyVersion_.end();
+    if (log_)
+    {
+        // Records are dropped, rather than waited for, if the writer falls behind.
+        const std::int64_t step = scheduler_ ? scheduler_->step(updateTime_) : -1;
+        log_->push(LogRecordKind::Window,
+                   step,
+                   updateTime_,
+                   tempWindow_.data(),
+                   nBins_);
+        log_->push(LogRecordKind::Histogram,
+                   step,
+                   updateTime_,
+                   histogram_.data(),
+                   nBins_);
+    }
+    updateTable();
+    coordinator_ = nullptr;
+}
+
+template<class Precision>
+void BasicEnsemblePotential<Precision>::abandonUpdate() noexcept
+{
+    // The reduction may still be queued if the coordinator failed before flushing it.
+    if (reduceCoordinator_)
+    {
+        reduceCoordinator_->withdraw(this);
+        reduceCoordinator_ = nullptr;
+    }
+    // The ensemble may not have added up the last change, so the next window starts a new Delta sequence.
+    reduceHistory_ = ReduceHistory{};
+    coordinator_ = nullptr;
+}
+
+template<class Precision>
+EnsembleStateView BasicEnsemblePotential<Precision>::stateView() const
+{
+    EnsembleStateView view;
+    view.histogram = {histogram_.data(),
+                      sizeof(compute_type),
+                      {nBins_}};
+    view.windows = {windows_.data(),
+                    sizeof(accumulate_type),
+                    {windows_.capacity(), nBins_}};
+    view.samples = {distanceSamples_.data(),
+                    sizeof(compute_type),
+                    {distanceSamples_.size()}};
+    view.oldestWindow = windows_.oldest();
+    view.windowCount = windows_.size();
+    view.currentSample = currentSample_;
+    view.historyVersion = &historyVersion_;
+    view.samplesVersion = &samplesVersion_;
+    return view;
 }
 
 //
@@ -162,21 +360,74 @@ EnsemblePotential::EnsemblePotential(const input_param_type& params) :
 // a parallelized simulation).
 //
 //
-void EnsemblePotential::callback(gmx::Vector v,
-                                 gmx::Vector v0,
-                                 double t,
-                                 const Resources& resources)
+template<class Precision>
+void BasicEnsemblePotential<Precision>::callback(gmx::Vector v,
+                                                gmx::Vector v0,
+                                                double t,
+                                                const Resources& resources)
 {
-    const auto rdiff = v - v0;
-    const auto Rsquared = dot(rdiff,
-                              rdiff);
-    const auto R = sqrt(Rsquared);
+    // Most steps fall between events.
+    const auto scheduler = resources.stepScheduler().get();
+    if (scheduler)
+    {
+        if (!scheduler->due(this,
+                            t))
+        {
+            return;
+        }
+    }
+    else if (t < nextCallbackTime_)
+    {
+        return;
+    }
+    if (resumePending_)
+    {
+        resume(t,
+               scheduler);
+    }
+    if (scheduler && scheduler_ == nullptr)
+    {
+        startSchedule(scheduler);
+    }
+    const std::int64_t step = scheduler ? scheduler->step(t) : 0;
+    const bool sampleDue = scheduler ? step >= nextSampleStep_ : t >= nextSampleTime_;
+    const bool windowDue = scheduler ? step >= nextWindowStep_ : t >= nextWindowUpdateTime_;
+
+    // Complete the window updates and reductions queued by all restraints at an earlier step.
+    if (resources.updateCoordinator())
+    {
+        resources.updateCoordinator()->beginUpdate(t);
+    }
+    if (resources.reduceCoordinator())
+    {
+        resources.reduceCoordinator()->beginUpdate(t);
+    }
+
+    // Apply the histogram of a non-blocking reduction once it arrives, or when it is due. Without a
+    // StepScheduler, callbacks are made on every step, so counting them counts MD steps.
+    if (reducePending_)
+    {
+        const bool deadline = scheduler ? step - reduceStartStep_ >= asyncReduceSteps_ : ++reduceSteps_ >= asyncReduceSteps_;
+        pollReduction(deadline || windowDue);
+    }
 
     // Store historical data every sample_period steps
-    if (t >= nextSampleTime_)
+    if (sampleDue)
     {
-        distanceSamples_[currentSample_++] = R;
-        nextSampleTime_ = (currentSample_ + 1) * samplePeriod_ + windowStartTime_;
+        const auto rdiff = v - v0;
+        const auto Rsquared = dot(rdiff,
+                                  rdiff);
+        const auto R = sqrt(Rsquared);
+        samplesVersion_.begin();
+        // After a restart from an older checkpoint, this sample also stands in for those missed since.
+        do
+        {
+            distanceSamples_[currentSample_++] = R;
+            nextSampleTime_ = (currentSample_ + 1) * samplePeriod_ + windowStartTime_;
+            nextSampleStep_ = (currentSample_ + 1) * sampleSteps_ + windowStartStep_;
+        }
+        while (currentSample_ < nSamples_ && (scheduler ? step >= nextSampleStep_ : t >= nextSampleTime_));
+        samplesVersion_.end();
     };
 
     // Every nsteps:
@@ -186,91 +437,262 @@ void EnsemblePotential::callback(gmx::Vector v,
     //   3. On update, checkpoint the historical data source.
     //   4. Update historic windows.
     //   5. Use handles retained from previous windows to reconstruct the smoothed working histogram
-    if (t >= nextWindowUpdateTime_)
+    if (windowDue)
     {
-        // Get next histogram array, recycling old one if available.
-        std::unique_ptr<Matrix<double>> new_window = std::make_unique<Matrix<double>>(1,
-                                                                                              nBins_);
-        std::unique_ptr<Matrix<double>> temp_window;
-        if (windows_.size() == nWindows_)
+        assert(currentSample_ == nSamples_);
+        updateTime_ = t;
+        const auto coordinator = resources.updateCoordinator().get();
+        if (coordinator)
         {
-            // Recycle the oldest window.
-            // \todo wrap this in a helper class that manages a buffer we can shuffle through.
-            windows_[0].swap(temp_window);
-            windows_.erase(windows_.begin());
+            // The coordinator completes the update at the next callback of a restraint sharing it,
+            // which is the next MD step unless callbackPeriod is above one. Until then, the
+            // restraint applies the previous histogram, and the blur reads distanceSamples_ on
+            // another thread.
+            assert(coordinator_ == nullptr);
+            coordinator_ = coordinator;
+            coordinator->enqueue(this,
+                                 &resources,
+                                 t);
         }
-        else
+        else if (asyncReduceSteps_ > 0 && !resources.reduceCoordinator())
         {
-            auto new_temp_window = std::make_unique<Matrix<double>>(1,
-                                                                            nBins_);
-            assert(new_temp_window);
-            temp_window.swap(new_temp_window);
+            blurWindow();
+            startReduction(resources);
+            reduceStartStep_ = step;
         }
-
-        // Reduce sampled data for this restraint in this simulation, applying a Gaussian blur to fill a grid.
-        auto blur = BlurToGrid(0.0,
-                               binWidth_,
-                               sigma_);
-        assert(new_window != nullptr);
-        assert(distanceSamples_.size() == nSamples_);
-        assert(currentSample_ == nSamples_);
-        blur(distanceSamples_,
-             new_window->vector());
-        // We can just do the blur locally since there aren't many bins. Bundling these operations for
-        // all restraints could give us a chance at some parallelism. We should at least use some
-        // threading if we can.
-
-        // We request a handle each time before using resources to make error handling easier if there is a failure in
-        // one of the ensemble member processes and to give more freedom to how resources are managed from step to step.
-        auto ensemble = resources.getHandle();
-        // Get global reduction (sum) and checkpoint.
-        assert(temp_window != nullptr);
-        // Todo: in reduce function, give us a mean instead of a sum.
-        ensemble.reduce(*new_window,
-                        temp_window.get());
-
-        // Update window list with smoothed data.
-        windows_.emplace_back(std::move(new_window));
-
-        // Get new histogram difference. Subtract the experimental distribution to get the values to use in our potential.
-        for (auto& bin : histogram_)
-        {
-            bin = 0;
-        }
-        for (const auto& window : windows_)
+        else
         {
-            for (size_t i = 0;i < window->cols();++i)
+            blurWindow();
+            reduceWindow(resources);
+            // A ReduceCoordinator rebuilds the histogram once the combined reduction completes.
+            if (!reduceCoordinator_)
             {
-                histogram_.at(i) += (window->vector()->at(i) - experimental_.at(i)) / windows_.size();
+                rebuildHistogram();
             }
         }
 
-
-        // Note we do not have the integer timestep available here. Therefore, we can't guarantee that updates occur
-        // with the same number of MD steps in each interval, and the interval will effectively lose digits as the
-        // simulation progresses, so _update_period should be cleanly representable in binary. When we extract this
-        // to a facility, we can look for a part of the code with access to the current timestep.
+        // Without a StepScheduler, we do not have the integer timestep available here. Therefore, we can't guarantee
+        // that updates occur with the same number of MD steps in each interval, and the interval will effectively lose
+        // digits as the simulation progresses, so _update_period should be cleanly representable in binary.
         windowStartTime_ = t;
         nextWindowUpdateTime_ = nSamples_ * samplePeriod_ + windowStartTime_;
+        windowStartStep_ = step;
+        nextWindowStep_ = nSamples_ * sampleSteps_ + windowStartStep_;
         ++currentWindow_; // This is currently never used. I'm not sure it will be, either...
 
         // Reset sample bufering.
+        samplesVersion_.begin();
         currentSample_ = 0;
+        samplesVersion_.end();
         // Reset sample times.
         nextSampleTime_ = t + samplePeriod_;
+        nextSampleStep_ = step + sampleSteps_;
     };
 
+    // Checkpoints are deferred while a window update is in flight.
+    if (!checkpointFile_.empty() && t >= nextCheckpointTime_ && !updatePending())
+    {
+        writeCheckpoint(checkpointFile_,
+                        t);
+        nextCheckpointTime_ = t + checkpointInterval_;
+    }
+
+    scheduleCallback(t,
+                     step);
+}
+
+namespace {
+
+/// Format of the checkpoints of BasicEnsemblePotential.
+constexpr std::uint32_t ensembleCheckpointFormat{1};
+
+} // end anonymous namespace
+
+template<class Precision>
+void BasicEnsemblePotential<Precision>::writeCheckpoint(const std::string& filename,
+                                                        double t)
+{
+    assert(!updatePending());
+    checkpoint_.begin(ensembleCheckpointFormat);
+    checkpoint_.write(std::uint32_t(sizeof(compute_type)));
+    checkpoint_.write(std::uint32_t(sizeof(accumulate_type)));
+    checkpoint_.write(std::uint64_t(nBins_));
+    checkpoint_.write(std::uint32_t(nSamples_));
+    checkpoint_.write(std::uint64_t(nWindows_));
+
+    checkpoint_.write(t);
+    checkpoint_.write(std::uint64_t(currentWindow_));
+    checkpoint_.write(windowStartTime_);
+    checkpoint_.write(std::uint32_t(currentSample_));
+    checkpoint_.write(distanceSamples_.data(),
+                      distanceSamples_.size());
+    checkpoint_.write(histogram_.data(),
+                      nBins_);
+    windows_.save(&checkpoint_);
+
+    checkpoint_.commit(filename);
 }
 
+template<class Precision>
+bool BasicEnsemblePotential<Precision>::restoreCheckpoint(const std::string& filename)
+{
+    const auto checkpoint = CheckpointReader::open(filename,
+                                                   ensembleCheckpointFormat);
+    if (!checkpoint)
+    {
+        return false;
+    }
+    const auto computeSize = checkpoint->read<std::uint32_t>();
+    const auto accumulateSize = checkpoint->read<std::uint32_t>();
+    const auto nBins = checkpoint->read<std::uint64_t>();
+    const auto nSamples = checkpoint->read<std::uint32_t>();
+    const auto nWindows = checkpoint->read<std::uint64_t>();
+    if (computeSize != sizeof(compute_type) || accumulateSize != sizeof(accumulate_type) || nBins != nBins_
+        || nSamples != nSamples_ || nWindows != nWindows_)
+    {
+        throw gmxapi::UsageError(filename + " is a checkpoint of a restraint with a different precision, "
+                                 "number of bins, samples, or windows.");
+    }
+
+    checkpointTime_ = checkpoint->read<double>();
+    currentWindow_ = checkpoint->read<std::uint64_t>();
+    windowStartTime_ = checkpoint->read<double>();
+    const auto currentSample = checkpoint->read<std::uint32_t>();
+    if (currentSample >= nSamples_)
+    {
+        throw gmxapi::ProtocolError("Checkpoint file " + filename + " is corrupt.");
+    }
+    samplesVersion_.begin();
+    currentSample_ = currentSample;
+    checkpoint->read(distanceSamples_.data(),
+                     distanceSamples_.size());
+    samplesVersion_.end();
+    historyVersion_.begin();
+    checkpoint->read(histogram_.data(),
+                     nBins_);
+    windows_.restore(checkpoint.get());
+    historyVersion_.end();
+    updateTable();
+
+    nextSampleTime_ = (currentSample_ + 1) * samplePeriod_ + windowStartTime_;
+    nextWindowUpdateTime_ = nSamples_ * samplePeriod_ + windowStartTime_;
+    nextCheckpointTime_ = checkpointTime_ + checkpointInterval_;
+    // The first callback() resumes the schedule.
+    nextCallbackTime_ = std::numeric_limits<double>::lowest();
+    resumePending_ = true;
+    return true;
+}
+
+template<class Precision>
+void BasicEnsemblePotential<Precision>::resume(double t,
+                                               const StepScheduler* scheduler)
+{
+    // Ensemble members restart from MD checkpoints written at different times, so the schedule stays
+    // where the checkpoint left it and window updates remain on the same steps on every member.
+    const auto before = [scheduler](double first,
+                                    double second) {
+        return scheduler ? scheduler->step(first) < scheduler->step(second) : first < second;
+    };
+    if (before(t,
+               windowStartTime_))
+    {
+        throw gmxapi::UsageError("The restraint checkpoint holds a window that closed after the time the "
+                                 "simulation restarted from. Restart from a later MD checkpoint.");
+    }
+    if (before(nSamples_ * samplePeriod_ + windowStartTime_,
+               t))
+    {
+        throw gmxapi::UsageError("The restraint checkpoint is missing a window that closed before the time the "
+                                 "simulation restarted from. Write restraint checkpoints more often.");
+    }
+    if (before(t,
+               checkpointTime_))
+    {
+        // The restarted simulation takes the samples from t on again.
+        samplesVersion_.begin();
+        while (currentSample_ > 0 && !before(currentSample_ * samplePeriod_ + windowStartTime_,
+                                             t))
+        {
+            --currentSample_;
+        }
+        samplesVersion_.end();
+        nextSampleTime_ = (currentSample_ + 1) * samplePeriod_ + windowStartTime_;
+    }
+    // Samples missed after an older checkpoint are taken at the first callback.
+    resumePending_ = false;
+}
+
+template<class Precision>
+void BasicEnsemblePotential<Precision>::startSchedule(StepScheduler* scheduler)
+{
+    scheduler_ = scheduler;
+    sampleSteps_ = scheduler->steps(samplePeriod_);
+    // The open window starts at time zero, or where a restored one resumed.
+    windowStartStep_ = scheduler->step(windowStartTime_);
+    nextSampleStep_ = (currentSample_ + 1) * sampleSteps_ + windowStartStep_;
+    nextWindowStep_ = nSamples_ * sampleSteps_ + windowStartStep_;
+}
+
+template<class Precision>
+void BasicEnsemblePotential<Precision>::scheduleCallback(double t,
+                                                         std::int64_t step)
+{
+    // Updates in flight are polled or completed at the next step.
+    const bool busy = updatePending();
+    if (scheduler_)
+    {
+        scheduler_->schedule(this,
+                             busy ? step + 1 : std::max(std::min(nextSampleStep_,
+                                                                 nextWindowStep_),
+                                                        step + 1));
+    }
+    else if (busy)
+    {
+        nextCallbackTime_ = t;
+    }
+    else
+    {
+        nextCallbackTime_ = std::min(nextSampleTime_,
+                                     nextWindowUpdateTime_);
+    }
+}
+
+
+template<class Precision>
+BiasPoint BasicEnsemblePotential<Precision>::evaluateDistance(double R) const
+{
+    BiasPoint bias;
+    if (R > maxDist_)
+    {
+        // apply a force to reduce R
+        bias.force = k_ * (maxDist_ - R);
+        bias.energy = 0.5 * k_ * (R - maxDist_) * (R - maxDist_);
+    }
+    else if (R < minDist_)
+    {
+        // apply a force to increase R
+        bias.force = k_ * (minDist_ - R);
+        bias.energy = 0.5 * k_ * (minDist_ - R) * (minDist_ - R);
+    }
+    else
+    {
+        // Between window updates the histogram is constant, so prefer the precomputed table if we have one.
+        bias = table_.empty() ? kernel_(R,
+                                        histogram_.data(),
+                                        nBins_) : table_.evaluate(R);
+    }
+    return bias;
+}
 
 //
 //
 // HERE is the function that does the calculation of the restraint force.
 //
 //
-gmx::PotentialPointData EnsemblePotential::calculate(gmx::Vector v,
-                                                    gmx::Vector v0,
-                                                    double /* t */)
+template<class Precision>
+gmx::PotentialPointData BasicEnsemblePotential<Precision>::calculate(gmx::Vector v,
+                                                                     gmx::Vector v0,
+                                                                     double /* t */)
 {
     // This is not the vector from v to v0. It is the position of a site
     // at v, relative to the origin v0. This is a potentially confusing convention...
@@ -279,47 +701,53 @@ gmx::PotentialPointData EnsemblePotential::calculate(gmx::Vector v,
                               rdiff);
     const auto R = sqrt(Rsquared);
 
-
     // Compute output
     gmx::PotentialPointData output;
-    // Energy not needed right now.
-//    output.energy = 0;
 
     if (R != 0) // Direction of force is ill-defined when v == v0
     {
+        const auto bias = evaluateDistance(R);
+        const auto magnitude = bias.force / R;
+        output.force = rdiff * static_cast<decltype(rdiff[0])>(magnitude);
+        output.energy = static_cast<real>(bias.energy);
+    }
+    return output;
+}
 
-        double f{0};
+template<class Precision>
+void BasicEnsemblePotential<Precision>::calculate(const PairBatch& pairs,
+                                                  double /* t */,
+                                                  const PairBatchForces& forces) const
+{
+    assert(forces.x && forces.y && forces.z);
+    const auto numPairs = static_cast<std::ptrdiff_t>(pairs.size);
 
-        if (R > maxDist_)
-        {
-            // apply a force to reduce R
-            f = k_ * (maxDist_ - R);
-        }
-        else if (R < minDist_)
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if(pairs.size >= minThreadedBatchSize)
+#endif
+    for (std::ptrdiff_t i = 0;i < numPairs;++i)
+    {
+        const compute_type dx = pairs.x[i] - pairs.x0[i];
+        const compute_type dy = pairs.y[i] - pairs.y0[i];
+        const compute_type dz = pairs.z[i] - pairs.z0[i];
+        const compute_type R = std::sqrt(dx * dx + dy * dy + dz * dz);
+
+        compute_type magnitude{0};
+        compute_type energy{0};
+        if (R != 0) // Direction of force is ill-defined when v == v0
         {
-            // apply a force to increase R
-            f = k_ * (minDist_ - R);
+            const auto bias = evaluateDistance(R);
+            magnitude = bias.force / R;
+            energy = bias.energy;
         }
-        else
+        forces.x[i] = static_cast<real>(magnitude * dx);
+        forces.y[i] = static_cast<real>(magnitude * dy);
+        forces.z[i] = static_cast<real>(magnitude * dz);
+        if (forces.energy)
         {
-            double f_scal{0};
-
-            const size_t numBins = histogram_.size();
-            double normConst = sqrt(2 * M_PI) * sigma_ * sigma_ * sigma_;
-
-            for (size_t n = 0;n < numBins;n++)
-            {
-                const double x{n * binWidth_ - R};
-                const double argExp{-0.5 * x * x / (sigma_ * sigma_)};
-                f_scal += histogram_.at(n) * exp(argExp) * x / normConst;
-            }
-            f = -k_ * f_scal;
+            forces.energy[i] = static_cast<real>(energy);
         }
-
-        const auto magnitude = f / norm(rdiff);
-        output.force = rdiff * static_cast<decltype(rdiff[0])>(magnitude);
     }
-    return output;
 }
 
 std::unique_ptr<ensemble_input_param_type>
@@ -350,6 +778,87 @@ makeEnsembleParams(size_t nbins,
     return params;
 };
 
+unsigned int checkCallbackPeriod(const ensemble_input_param_type& params,
+                                 const Resources* resources)
+{
+    if (params.callbackPeriod <= 1)
+    {
+        return 1;
+    }
+    // Without MD steps, a sample could fall between callbacks and be missed, leaving the window short.
+    const auto scheduler = resources ? resources->stepScheduler().get() : nullptr;
+    if (!scheduler)
+    {
+        throw gmxapi::UsageError("A callback period above one requires the MD time step (time_step).");
+    }
+    // A period that does not divide the sample period would take samples late and stretch every window.
+    if (scheduler->steps(params.samplePeriod) % params.callbackPeriod != 0)
+    {
+        throw gmxapi::UsageError("The callback period must divide the sample period in MD steps.");
+    }
+    return params.callbackPeriod;
+}
+
+/*!
+ * \brief Create an EnsembleRestraint implementation with the given precision.
+ */
+template<class Precision>
+std::shared_ptr<EnsembleRestraint> makeEnsembleRestraint(std::vector<int> sites,
+                                                         const ensemble_input_param_type& params,
+                                                         std::shared_ptr<Resources> resources)
+{
+    using restraint_type = BasicEnsembleRestraint<Precision>;
+    // Restraints are over-aligned, which std::make_shared does not honor before C++17. The allocator
+    // takes the object from the arena of the resources, if any, next to its buffers.
+    static_assert(alignof(restraint_type) <= kernelAlignment, "ArenaAllocator does not provide enough alignment.");
+    ArenaAllocator<restraint_type> allocator{resources ? resources->arena() : nullptr};
+    return std::allocate_shared<restraint_type>(allocator,
+                                                std::move(sites),
+                                                params,
+                                                std::move(resources));
+}
+
+std::shared_ptr<EnsembleRestraint>
+RestraintFactory<EnsembleRestraint>::create(std::vector<int> sites,
+                                            const ensemble_input_param_type& params,
+                                            std::shared_ptr<Resources> resources)
+{
+    std::shared_ptr<EnsembleRestraint> restraint;
+    switch (params.precision)
+    {
+        case PrecisionMode::Single:
+            restraint = makeEnsembleRestraint<SinglePrecision>(std::move(sites),
+                                                               params,
+                                                               std::move(resources));
+            break;
+        case PrecisionMode::Mixed:
+            restraint = makeEnsembleRestraint<MixedPrecision>(std::move(sites),
+                                                              params,
+                                                              std::move(resources));
+            break;
+        case PrecisionMode::Double:
+            restraint = makeEnsembleRestraint<DoublePrecision>(std::move(sites),
+                                                               params,
+                                                               std::move(resources));
+            break;
+    }
+    if (!params.checkpointFile.empty())
+    {
+        restraint->restoreCheckpoint(params.checkpointFile);
+    }
+    return restraint;
+}
+
+// Explicitly instantiate the potential for each precision policy.
+template
+class BasicEnsemblePotential<DoublePrecision>;
+
+template
+class BasicEnsemblePotential<SinglePrecision>;
+
+template
+class BasicEnsemblePotential<MixedPrecision>;
+
 // Important: Explicitly instantiate a definition for the templated class declared in ensemblepotential.h.
 // Failing to do this will cause a linker error.
 template
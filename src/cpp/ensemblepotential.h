@@ -17,9 +17,12 @@
  * \author M. Eric Irrgang <ericirrgang@gmail.com>
  */
 
+#include <algorithm>
 #include <array>
+#include <cstdint>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <vector>
 
 #include "gmxapi/gromacsfwd.h"
@@ -29,7 +32,20 @@
 #include "gromacs/restraint/restraintpotential.h"
 #include "gromacs/utility/real.h"
 
+#include "alignedallocator.h"
+#include "arena.h"
+#include "biaskernel.h"
+#include "blur.h"
+#include "checkpoint.h"
+#include "forcetable.h"
+#include "histogramlog.h"
+#include "pairbatch.h"
+#include "precision.h"
 #include "sessionresources.h"
+#include "stateview.h"
+#include "stepscheduler.h"
+#include "updatecoordinator.h"
+#include "windowhistory.h"
 
 namespace plugin
 {
@@ -39,6 +55,9 @@ using PairHist = std::vector<double>;
 
 struct ensemble_input_param_type
 {
+    /// Name of the restraint in logs.
+    std::string name{};
+
     /// distance histogram parameters
     size_t nBins{0};
     double binWidth{0.};
@@ -62,6 +81,43 @@ struct ensemble_input_param_type
     /// Smoothing factor: width of Gaussian interpolation for histogram
     double sigma{0};
 
+    /// Number of force table intervals per histogram bin. If zero, the bias is summed directly on every call.
+    unsigned int tableResolution{0};
+
+    /// Bins farther than this many sigma from the pair distance are skipped by the direct sum (zero: no cutoff).
+    double cutoffSigmas{6.};
+
+    /// Samples are only blurred onto bins within this many sigma (zero: no cutoff).
+    double blurCutoffSigmas{6.};
+
+    /// Engine for smoothing window samples. Binned is faster for windows with many samples.
+    BlurMode blurMode{BlurMode::Direct};
+
+    /// Floating point precision of force evaluation and of histogram accumulation (see precision.h).
+    PrecisionMode precision{PrecisionMode::Double};
+
+    /// If nonzero, window reductions do not block: the new histogram is applied once the reduction
+    /// completes, but at most this many MD steps after the window boundary (rounded up to the next
+    /// call of callback()).
+    unsigned int asyncReduceSteps{0};
+
+    /// Representation of windows in the ensemble reduction (see sessionresources.h).
+    ReduceEncoding reduceEncoding{ReduceEncoding::Float64};
+    /// Resolution of the Fixed32 and Delta reduce encodings. The sum of a bin over the ensemble must
+    /// fit in a 32-bit integer, so with N members, window values (Delta: changes) must stay below
+    /// 2^31 / (N * fixedPointScale). The default allows 2048 / N.
+    double fixedPointScale{1048576.};
+
+    /// MD steps between calls of callback() by the restraint. Periods above one require a
+    /// StepScheduler and must divide the sample period in steps, so that every sample and window
+    /// update falls on a callback.
+    unsigned int callbackPeriod{1};
+
+    /// File to which the state of the restraint is checkpointed, and from which it is restored
+    /// when the restraint is created. Empty: no checkpoints.
+    std::string checkpointFile{};
+    /// Simulation time (ps) between checkpoints. Zero: once per window.
+    double checkpointInterval{0};
 };
 
 // \todo We should be able to automate a lot of the parameter setting stuff
@@ -90,18 +146,52 @@ makeEnsembleParams(size_t nbins,
  * ensemble members. Each window contains a histogram populated with `nsamples` distances recorded at
  * `sample_period` step intervals.
  *
+ * \tparam Precision a precision policy from precision.h. The smoothed histogram, the force kernels,
+ * and the blurring of samples use Precision::compute_type. Stored windows and the sums over windows
+ * use Precision::accumulate_type.
+ *
+ * If the Resources passed to callback() provide an UpdateCoordinator, window updates are queued with
+ * it and completed in parallel with those of other restraints (see updatecoordinator.h). Objects are
+ * aligned to whole cache lines so that restraints updated on different threads do not share any.
+ *
+ * Per-bin and per-sample buffers are drawn from an Arena, if one is provided, so that the state of
+ * many restraints is packed into a few large blocks. Scratch space of the blurring and tabulation
+ * engines stays on the heap.
+ *
+ * With asyncReduceSteps set, a restraint using neither coordinator starts its window reduction with
+ * ResourcesHandle::startReduce() and keeps applying the previous histogram while the ensemble
+ * catches up. Each callback() checks for completion until the deadline, then waits.
+ *
+ * Windows are averaged over the ensemble with the reduceEncoding of the parameters, except when
+ * combined by a ReduceCoordinator, which exchanges doubles.
+ *
+ * If the Resources provide a HistogramLog, each window added to the history and each rebuilt
+ * histogram is queued for the log, without waiting for the file.
+ *
+ * If the parameters name a checkpoint file, callback() checkpoints the state of the restraint at
+ * the configured interval, at the first event with no update in flight (see writeCheckpoint()).
+ *
+ * Between sample and window events, and with no update in flight, callback() returns after a
+ * single comparison of the time. If the Resources provide a StepScheduler, events are scheduled on
+ * integer MD steps with it instead, so that intervals are exact and identical on all ensemble members.
+ *
  * \internal
  * During a the window_update_period steps of a window, the potential applied is a harmonic function of
  * the difference between the sampled and experimental histograms. At the beginning of the window, this
  * difference is found and a Gaussian blur is applied.
  */
-class EnsemblePotential
+template<class Precision>
+class alignas(kernelAlignment) BasicEnsemblePotential : private UpdateCoordinator::Participant, private StepScheduler::Client
 {
     public:
         using input_param_type = ensemble_input_param_type;
+        using compute_type = typename Precision::compute_type;
+        using accumulate_type = typename Precision::accumulate_type;
+        /// Storage for one window of blurred samples.
+        using window_type = ArenaVector<accumulate_type>;
 
         /* No default constructor. Parameters must be provided. */
-        EnsemblePotential() = delete;
+        BasicEnsemblePotential() = delete;
 
         /*!
          * \brief Constructor called by the wrapper code to produce a new instance.
@@ -110,8 +200,15 @@ class EnsemblePotential
          * gmxapi 0.0.8 there is only one instance per simulation in a thread-MPI simulation.
          *
          * \param params
+         * \param arena storage for the restraint state, or nullptr to use the heap.
          */
-        explicit EnsemblePotential(const input_param_type& params);
+        explicit BasicEnsemblePotential(const input_param_type& params,
+                                        std::shared_ptr<Arena> arena = nullptr);
+
+        /*!
+         * \brief Withdraw a pending window update from its coordinator.
+         */
+        ~BasicEnsemblePotential() override;
 
         /*!
          * \brief Deprecated constructor taking a parameter list.
@@ -127,16 +224,16 @@ class EnsemblePotential
          * \param k
          * \param sigma
          */
-        EnsemblePotential(size_t nbins,
-                          double binWidth,
-                          double minDist,
-                          double maxDist,
-                          PairHist experimental,
-                          unsigned int nSamples,
-                          double samplePeriod,
-                          unsigned int nWindows,
-                          double k,
-                          double sigma);
+        BasicEnsemblePotential(size_t nbins,
+                               double binWidth,
+                               double minDist,
+                               double maxDist,
+                               PairHist experimental,
+                               unsigned int nSamples,
+                               double samplePeriod,
+                               unsigned int nWindows,
+                               double k,
+                               double sigma);
 
         /*!
          * \brief Evaluates the pair restraint potential.
@@ -158,6 +255,21 @@ class EnsemblePotential
                                           gmx::Vector v0,
                                           double t);
 
+        /*!
+         * \brief Evaluates the pair restraint potential for a batch of site pairs.
+         *
+         * Every pair in the batch is subject to the bias of this potential. Large batches are
+         * evaluated with OpenMP threads (see minThreadedBatchSize). Like calculate(), this does not
+         * modify the object and may be called concurrently.
+         *
+         * \param pairs coordinates of the (v, v0) pairs.
+         * \param t current simulation time (ps).
+         * \param forces caller-provided buffers to receive the force on each v (and energies).
+         */
+        void calculate(const PairBatch& pairs,
+                       double t,
+                       const PairBatchForces& forces) const;
+
         /*!
          * \brief An update function to be called on the simulation master rank/thread periodically by the Restraint framework.
          *
@@ -174,7 +286,101 @@ class EnsemblePotential
                       double t,
                       const Resources& resources);
 
+        /*!
+         * \brief Record the windows and histograms of the restraint.
+         *
+         * \param channel channel of a HistogramLog for records of nBins_ values, or nullptr not to log.
+         */
+        void logHistograms(std::shared_ptr<LogChannel> channel)
+        { log_ = std::move(channel); }
+
+        /*!
+         * \brief Describe the live state for read-only monitoring.
+         *
+         * The buffers are not copied. Readers validate their copies with the versions of the view.
+         */
+        EnsembleStateView stateView() const;
+
+        /*!
+         * \brief Checkpoint the window history, the histogram, the samples of the open window, and the schedule.
+         *
+         * The file is replaced atomically. Must not be called while a window update is in flight.
+         * The history of the Delta reduce encoding is not saved, so all ensemble members should
+         * restart together.
+         *
+         * \param filename checkpoint file.
+         * \param t current simulation time (ps).
+         * \throws gmxapi::ProtocolError if the file cannot be written.
+         */
+        void writeCheckpoint(const std::string& filename,
+                             double t);
+
+        /*!
+         * \brief Restore the state saved by writeCheckpoint(), if the file exists.
+         *
+         * The schedule is not shifted, so window updates stay on the same steps on all ensemble
+         * members, whenever their MD checkpoints were written. At the first callback(), samples
+         * from the time of the restarted simulation on are dropped, to be taken again, and samples
+         * missed since an older checkpoint repeat the first one taken. A checkpoint holding a
+         * window closed after that time, or missing one closed before it, is refused there with a
+         * gmxapi::UsageError.
+         *
+         * \param filename checkpoint file.
+         * \return whether a checkpoint was restored.
+         * \throws gmxapi::UsageError if the checkpoint is of a restraint with different parameters.
+         */
+        bool restoreCheckpoint(const std::string& filename);
+
     private:
+        /// Smooth the samples of the closed window into newWindow_.
+        void blurWindow() override;
+
+        /// Combine newWindow_ across the ensemble, or queue it with the ReduceCoordinator of the resources.
+        void reduceWindow(const Resources& resources) override;
+
+        /// Take the result of the ensemble reduction.
+        void collectReduction();
+
+        /// Mean over the ensemble with the configured encoding.
+        ReduceOptions reduceOptions();
+
+        /// Start a non-blocking reduction of newWindow_.
+        void startReduction(const Resources& resources);
+
+        /// Rebuild the histogram if the reduction started by startReduction() has completed, or if wait is set.
+        void pollReduction(bool wait);
+
+        /// Add newWindow_ to the window history and rebuild the histogram and bias table from it.
+        void rebuildHistogram() override;
+
+        /// Drop the closed window after a failed coordinated update, keeping the current histogram.
+        void abandonUpdate() noexcept override;
+
+        /// Rebuild the bias table from the current histogram, if tabulation is enabled.
+        void updateTable();
+
+        /// Convert the schedule to MD steps of the scheduler, at the first callback with a StepScheduler.
+        void startSchedule(StepScheduler* scheduler);
+
+        /// Find the time or step of the next call of callback() with work to do.
+        void scheduleCallback(double t,
+                              std::int64_t step);
+
+        /// Whether a window update is in flight.
+        bool updatePending() const
+        { return reducePending_ || coordinator_ || reduceCoordinator_; }
+
+        /// Fit the restored open window to the restart time t (see restoreCheckpoint()).
+        void resume(double t,
+                    const StepScheduler* scheduler);
+
+        /*!
+         * \brief Force magnitude and energy for a pair at distance R > 0.
+         *
+         * A positive force acts to increase R.
+         */
+        BiasPoint evaluateDistance(double R) const;
+
         /// Width of bins (distance) in histogram
         size_t nBins_;
         double binWidth_;
@@ -183,9 +389,9 @@ class EnsemblePotential
         double minDist_;
         double maxDist_;
         /// Smoothed historic distribution for this restraint. An element of the array of restraints in this simulation.
-        // Was `hij` in earlier code.
-        PairHist histogram_;
-        PairHist experimental_;
+        // Was `hij` in earlier code. Padded with zeros for the SIMD kernel.
+        ArenaVector<compute_type> histogram_;
+        ArenaVector<double> experimental_;
 
         /// Number of samples to store during each window.
         unsigned int nSamples_;
@@ -193,37 +399,102 @@ class EnsemblePotential
         double samplePeriod_;
         double nextSampleTime_;
         /// Accumulated list of samples during a new window.
-        std::vector<double> distanceSamples_;
+        ArenaVector<compute_type> distanceSamples_;
 
         /// Number of windows to use for smoothing histogram updates.
         size_t nWindows_;
         size_t currentWindow_;
         double windowStartTime_;
         double nextWindowUpdateTime_;
-        /// The history of nwindows histograms for this restraint.
-        std::vector<std::unique_ptr<plugin::Matrix<double>>> windows_;
+        /// Until this time, callback() has nothing to do.
+        double nextCallbackTime_;
+        /// Schedule in MD steps, used instead of times with a StepScheduler.
+        std::int64_t sampleSteps_;
+        std::int64_t nextSampleStep_;
+        std::int64_t windowStartStep_;
+        std::int64_t nextWindowStep_;
+        /// The history of nwindows histograms for this restraint, and their sum.
+        WindowHistory<accumulate_type> windows_;
+        /// Window being updated, and its mean over the ensemble. Reused for every window.
+        window_type newWindow_;
+        window_type tempWindow_;
+        /// Buffers for the ensemble reduction of newWindow_.
+        Matrix<double> reduceSend_;
+        Matrix<double> reduceReceive_;
+        ReduceEncoding reduceEncoding_;
+        double fixedPointScale_;
+        ReduceHistory reduceHistory_;
+        /// Time of the pending window update.
+        double updateTime_;
+        /// Non-blocking reduction in progress, if reducePending_. Destroyed before the buffers it uses.
+        ReduceRequest reduceRequest_;
+        bool reducePending_;
+        /// Steps the reduction may take before callback() waits for it (zero: reduce synchronously).
+        unsigned int asyncReduceSteps_;
+        /// Callbacks since the reduction started, which are MD steps without a StepScheduler, and
+        /// the MD step at which it started, with one.
+        unsigned int reduceSteps_;
+        std::int64_t reduceStartStep_;
+        /// Coordinator holding a pending update of this restraint, if any. Owned by the Resources.
+        UpdateCoordinator* coordinator_;
+        /// Coordinator holding a pending reduction of this restraint, if any. Owned by the Resources.
+        ReduceCoordinator* reduceCoordinator_;
+        /// Scheduler of the events of this restraint, if any. Owned by the Resources.
+        StepScheduler* scheduler_;
+        /// Channel of the log receiving windows and histograms, if any.
+        std::shared_ptr<LogChannel> log_;
+        /// Versions of histogram_ and windows_, and of distanceSamples_, for readers of stateView().
+        StateVersion historyVersion_;
+        StateVersion samplesVersion_;
+        /// Checkpoint file, if any, interval (ps), and time of the next checkpoint.
+        std::string checkpointFile_;
+        double checkpointInterval_;
+        double nextCheckpointTime_;
+        /// Buffer of the checkpoints, reused for each.
+        CheckpointWriter checkpoint_;
+        /// Time of the restored checkpoint, until the schedule is resumed at the first callback().
+        double checkpointTime_;
+        bool resumePending_;
 
         /// Harmonic force coefficient
         double k_;
         /// Smoothing factor: width of Gaussian interpolation for histogram
         double sigma_;
+
+        /// Table intervals per bin, or zero to evaluate the bias directly.
+        unsigned int tableResolution_;
+        /// Tabulated bias over [minDist_, maxDist_], rebuilt whenever histogram_ changes.
+        ForceTable<compute_type> table_;
+        /// Direct-sum kernel used when the bias is not tabulated.
+        BiasKernel<compute_type> kernel_;
+        /// Engine that smooths the samples of each window onto the histogram grid.
+        BlurMode blurMode_;
+        BlurToGrid<compute_type> blur_;
+        BinnedBlur<compute_type> binnedBlur_;
 };
 
 /*!
- * \brief Use EnsemblePotential to implement a RestraintPotential
+ * \brief The default instance: double precision everywhere.
+ */
+using EnsemblePotential = BasicEnsemblePotential<DoublePrecision>;
+
+/*!
+ * \brief Use an ensemble potential to implement a RestraintPotential
+ *
+ * The precision of the underlying potential is chosen at run time (see
+ * ensemble_input_param_type::precision), so this interface is implemented by BasicEnsembleRestraint
+ * and instances are created by RestraintFactory<EnsembleRestraint>.
  *
  * This is boiler plate that will be templated and moved.
  */
-class EnsembleRestraint : public ::gmx::IRestraintPotential, private EnsemblePotential
+class EnsembleRestraint : public ::gmx::IRestraintPotential
 {
     public:
-        using EnsemblePotential::input_param_type;
+        using input_param_type = ensemble_input_param_type;
 
         EnsembleRestraint(std::vector<int> sites,
-                          const input_param_type& params,
                           std::shared_ptr<Resources> resources
         ) :
-            EnsemblePotential(params),
             sites_{std::move(sites)},
             resources_{std::move(resources)}
         {}
@@ -243,6 +514,98 @@ class EnsembleRestraint : public ::gmx::IRestraintPotential, private EnsemblePot
             return sites_;
         }
 
+        /*!
+         * \brief Evaluate a batch of site pairs in one call, avoiding a virtual call per pair.
+         *
+         * \param pairs coordinates of the (v, v0) pairs
+         * \param t simulation time
+         * \param forces caller-provided output buffers
+         */
+        virtual void evaluate(const PairBatch& pairs,
+                              double t,
+                              const PairBatchForces& forces) const = 0;
+
+        /*!
+         * \brief Describe the live state of the restraint for read-only monitoring.
+         */
+        virtual EnsembleStateView stateView() const = 0;
+
+        /*!
+         * \brief Restore the state of the restraint from a checkpoint file, if it exists.
+         *
+         * \return whether a checkpoint was restored.
+         */
+        virtual bool restoreCheckpoint(const std::string& filename) = 0;
+
+        // Don't hide the single-pair overload from gmx::IRestraintPotential.
+        using ::gmx::IRestraintPotential::evaluate;
+
+        /*!
+         * \brief Implement the binding protocol that allows access to Session resources.
+         *
+         * The client receives a non-owning pointer to the session and cannot extent the life of the session. In
+         * the future we can use a more formal handle mechanism.
+         *
+         * \param session pointer to the current session
+         */
+        void bindSession(gmxapi::SessionResources* session) override
+        {
+            resources_->setSession(session);
+        }
+
+        void setResources(std::unique_ptr<Resources>&& resources)
+        {
+            resources_ = std::move(resources);
+        }
+
+    protected:
+        std::vector<int> sites_;
+        std::shared_ptr<Resources> resources_;
+};
+
+/*!
+ * \brief Check the callback period of the parameters against the schedule of the resources.
+ *
+ * \return the period, at least one.
+ * \throws gmxapi::UsageError if the period is above one without a StepScheduler, or does not
+ *         divide the sample period in MD steps.
+ */
+unsigned int checkCallbackPeriod(const ensemble_input_param_type& params,
+                                 const Resources* resources);
+
+/*!
+ * \brief Implement EnsembleRestraint with a BasicEnsemblePotential of the chosen precision.
+ *
+ * \tparam Precision a precision policy from precision.h
+ */
+template<class Precision>
+class BasicEnsembleRestraint : public EnsembleRestraint, private BasicEnsemblePotential<Precision>
+{
+    public:
+        using input_param_type = ensemble_input_param_type;
+
+        BasicEnsembleRestraint(std::vector<int> sites,
+                               const input_param_type& params,
+                               std::shared_ptr<Resources> resources
+        ) :
+            EnsembleRestraint(std::move(sites),
+                              std::move(resources)),
+            // The EnsembleRestraint base, which now holds the resources, is constructed first.
+            BasicEnsemblePotential<Precision>(params,
+                                              resources_ ? resources_->arena() : nullptr),
+            callbackPeriod_{checkCallbackPeriod(params,
+                                                resources_.get())},
+            stepsToCallback_{0}
+        {
+            if (resources_ && resources_->histogramLog())
+            {
+                this->logHistograms(resources_->histogramLog()->channel(params.name,
+                                                                         params.nBins));
+            }
+        }
+
+        ~BasicEnsembleRestraint() override = default;
+
         /*!
          * \brief Implement the interface gmx::IRestraintPotential
          *
@@ -259,54 +622,85 @@ class EnsembleRestraint : public ::gmx::IRestraintPotential, private EnsemblePot
                                          gmx::Vector r2,
                                          double t) override
         {
-            return calculate(r1,
-                             r2,
-                             t);
+            return this->calculate(r1,
+                                   r2,
+                                   t);
         };
 
+        void evaluate(const PairBatch& pairs,
+                      double t,
+                      const PairBatchForces& forces) const override
+        {
+            this->calculate(pairs,
+                            t,
+                            forces);
+        }
+
+        EnsembleStateView stateView() const override
+        {
+            return BasicEnsemblePotential<Precision>::stateView();
+        }
+
+        bool restoreCheckpoint(const std::string& filename) override
+        {
+            return BasicEnsemblePotential<Precision>::restoreCheckpoint(filename);
+        }
+
         /*!
          * \brief An update function to be called on the simulation master rank/thread periodically by the Restraint framework.
          *
          * Implements optional override of gmx::IRestraintPotential::update
          *
          * This boilerplate will disappear into the Restraint template in an upcoming gmxapi release.
+         *
+         * Called every MD step, but calls callback() only every callbackPeriod steps. Updates in
+         * flight are then completed or polled at the next callback rather than the next step.
          */
         void update(gmx::Vector v,
                     gmx::Vector v0,
                     double t) override
         {
-            // Todo: use a callback period to mostly bypass this and avoid excessive mutex locking.
-            callback(v,
-                     v0,
-                     t,
-                     *resources_);
+            if (stepsToCallback_ > 1)
+            {
+                --stepsToCallback_;
+                return;
+            }
+            stepsToCallback_ = callbackPeriod_;
+            this->callback(v,
+                           v0,
+                           t,
+                           *resources_);
         };
 
-        /*!
-         * \brief Implement the binding protocol that allows access to Session resources.
-         *
-         * The client receives a non-owning pointer to the session and cannot extent the life of the session. In
-         * the future we can use a more formal handle mechanism.
-         *
-         * \param session pointer to the current session
-         */
-        void bindSession(gmxapi::SessionResources* session) override
-        {
-            resources_->setSession(session);
-        }
-
-        void setResources(std::unique_ptr<Resources>&& resources)
-        {
-            resources_ = std::move(resources);
-        }
-
     private:
-        std::vector<int> sites_;
-//        double callbackPeriod_;
-//        double nextCallback_;
-        std::shared_ptr<Resources> resources_;
+        /// MD steps between calls of callback(), and steps left until the next one.
+        unsigned int callbackPeriod_;
+        unsigned int stepsToCallback_;
+};
+
+/*!
+ * \brief Create the EnsembleRestraint implementation for the precision requested in the parameters.
+ *
+ * If the parameters name a checkpoint file that exists, the new restraint continues from it, so that
+ * RestraintModule::getRestraint() resumes a restarted simulation.
+ */
+template<>
+struct RestraintFactory<EnsembleRestraint>
+{
+    static std::shared_ptr<EnsembleRestraint> create(std::vector<int> sites,
+                                                     const ensemble_input_param_type& params,
+                                                     std::shared_ptr<Resources> resources);
 };
 
+// Explicitly instantiated in ensemblepotential.cpp
+extern template
+class BasicEnsemblePotential<DoublePrecision>;
+
+extern template
+class BasicEnsemblePotential<SinglePrecision>;
+
+extern template
+class BasicEnsemblePotential<MixedPrecision>;
 
 // Important: Just declare the template instantiation here for client code.
 // We will explicitly instantiate a definition in the .cpp file where the input_param_type is defined.
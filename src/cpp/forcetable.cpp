@@ -0,0 +1,123 @@
+/*! \file
+ * \brief Code to implement the bias table declared in forcetable.h
+ */
+
+#include "forcetable.h"
+
+#include <cassert>
+#include <cmath>
+
+#include <algorithm>
+
+namespace plugin
+{
+
+template<typename T>
+BiasPoint evaluateBias(double R,
+                       const T* histogram,
+                       std::size_t nBins,
+                       double binWidth,
+                       double sigma,
+                       double k)
+{
+    const double normConst = sqrt(2 * M_PI) * sigma * sigma * sigma;
+    const double inverseSigmaSquared = 1. / (sigma * sigma);
+
+    double f_scal{0};
+    double e_scal{0};
+    double s_scal{0};
+    for (size_t n = 0;n < nBins;n++)
+    {
+        const double x{n * binWidth - R};
+        const double gaussian{histogram[n] * exp(-0.5 * x * x * inverseSigmaSquared)};
+        f_scal += gaussian * x;
+        e_scal += gaussian;
+        s_scal += gaussian * (x * x * inverseSigmaSquared - 1.);
+    }
+
+    BiasPoint point;
+    point.force = -k * f_scal / normConst;
+    // U = k * sum_n h_n N(R; n * binWidth, sigma), so that force == -dU/dR.
+    point.energy = k * e_scal * sigma * sigma / normConst;
+    point.slope = -k * s_scal / normConst;
+    return point;
+}
+
+template<typename T>
+void ForceTable<T>::build(const T* histogram,
+                          std::size_t nBins,
+                          double binWidth,
+                          double sigma,
+                          double k,
+                          double low,
+                          double high,
+                          unsigned int resolution)
+{
+    knots_.clear();
+    if (!(high > low) || resolution == 0 || !(binWidth > 0))
+    {
+        return;
+    }
+
+    const auto numIntervals = static_cast<size_t>(std::ceil((high - low) / binWidth * resolution));
+    assert(numIntervals > 0);
+    const double spacing = (high - low) / numIntervals;
+    low_ = static_cast<T>(low);
+    high_ = static_cast<T>(high);
+    spacing_ = static_cast<T>(spacing);
+    inverseSpacing_ = static_cast<T>(1. / spacing);
+
+    knots_.resize(numIntervals + 1);
+    for (size_t i = 0;i < knots_.size();++i)
+    {
+        const auto point = evaluateBias(low + i * spacing,
+                                        histogram,
+                                        nBins,
+                                        binWidth,
+                                        sigma,
+                                        k);
+        knots_[i] = {{static_cast<T>(point.energy), static_cast<T>(point.force), static_cast<T>(point.slope), T(0)}};
+    }
+}
+
+template<typename T>
+BiasPoint ForceTable<T>::evaluate(double R) const
+{
+    assert(!empty());
+    const auto numIntervals = knots_.size() - 1;
+
+    const T x = std::min(std::max(static_cast<T>(R) - low_, T(0)) * inverseSpacing_, static_cast<T>(numIntervals));
+    const auto i = std::min(static_cast<size_t>(x), numIntervals - 1);
+    const T t = x - i;
+
+    const auto& k0 = knots_[i];
+    const auto& k1 = knots_[i + 1];
+
+    // Cubic Hermite basis functions.
+    const T t2 = t * t;
+    const T t3 = t2 * t;
+    const T h00 = 2 * t3 - 3 * t2 + 1;
+    const T h10 = t3 - 2 * t2 + t;
+    const T h01 = -2 * t3 + 3 * t2;
+    const T h11 = t3 - t2;
+
+    BiasPoint point;
+    // dU/dR == -force
+    point.energy = h00 * k0[0] - h10 * spacing_ * k0[1] + h01 * k1[0] - h11 * spacing_ * k1[1];
+    point.force = h00 * k0[1] + h10 * spacing_ * k0[2] + h01 * k1[1] + h11 * spacing_ * k1[2];
+    return point;
+}
+
+template
+BiasPoint evaluateBias<float>(double, const float*, std::size_t, double, double, double);
+
+template
+BiasPoint evaluateBias<double>(double, const double*, std::size_t, double, double, double);
+
+template
+class ForceTable<float>;
+
+template
+class ForceTable<double>;
+
+} // end namespace plugin
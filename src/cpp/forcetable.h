@@ -0,0 +1,135 @@
+#ifndef RESTRAINT_FORCETABLE_H
+#define RESTRAINT_FORCETABLE_H
+
+/*! \file
+ * \brief Tabulated evaluation of the smoothed-histogram bias used by EnsemblePotential.
+ *
+ * The restrained-ensemble bias is a sum of Gaussians centered on the histogram bins. The histogram
+ * only changes at window boundaries, so the sum can be tabulated once per window and interpolated
+ * on every MD step instead of re-evaluating nBins exponentials.
+ */
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+namespace plugin
+{
+
+/*!
+ * \brief Force, energy, and force derivative of the bias at a pair distance.
+ *
+ * Sign convention follows EnsemblePotential::calculate(): a positive force acts to increase R.
+ */
+struct BiasPoint
+{
+    double force{0};
+    double energy{0};
+    /// Derivative of force with respect to R. Used to build a C1 interpolation of the force.
+    double slope{0};
+};
+
+/*!
+ * \brief Evaluate the Gaussian-smoothed histogram bias by direct summation over bins.
+ *
+ * Reference implementation for the table and for the direct-sum path of EnsemblePotential.
+ * Bin n is centered at n * binWidth.
+ *
+ * The sum is always accumulated in double precision.
+ *
+ * \tparam T scalar type of the histogram.
+ * \param R pair distance at which to evaluate the bias.
+ * \param histogram difference between sampled and experimental distributions.
+ * \param nBins number of bins in histogram.
+ * \param binWidth histogram bin width.
+ * \param sigma width of the Gaussian smoothing.
+ * \param k force constant.
+ * \return force, energy, and slope at R.
+ */
+template<typename T>
+BiasPoint evaluateBias(double R,
+                       const T* histogram,
+                       std::size_t nBins,
+                       double binWidth,
+                       double sigma,
+                       double k);
+
+/*!
+ * \brief Piecewise cubic Hermite table of the histogram bias on a fixed interval.
+ *
+ * Energy is interpolated from tabulated energy and force (its exact negative derivative), and
+ * force is interpolated from tabulated force and slope, so both are C1 continuous and the
+ * interpolation error is fourth order in the table spacing.
+ *
+ * A default-constructed (or empty) table must not be evaluated.
+ *
+ * \tparam T scalar type for table storage and interpolation.
+ */
+template<typename T>
+class ForceTable
+{
+    public:
+        /*!
+         * \brief (Re)build the table.
+         *
+         * \param histogram bias histogram (see evaluateBias()).
+         * \param nBins number of bins in histogram.
+         * \param binWidth histogram bin width.
+         * \param sigma width of the Gaussian smoothing.
+         * \param k force constant.
+         * \param low lower bound of the tabulated interval.
+         * \param high upper bound of the tabulated interval.
+         * \param resolution number of table intervals per histogram bin width.
+         *
+         * If the interval is empty or resolution is zero, the table is cleared.
+         */
+        void build(const T* histogram,
+                   std::size_t nBins,
+                   double binWidth,
+                   double sigma,
+                   double k,
+                   double low,
+                   double high,
+                   unsigned int resolution);
+
+        /*!
+         * \brief Whether the table holds data that can be evaluated.
+         */
+        bool empty() const
+        { return knots_.empty(); }
+
+        /*!
+         * \brief Interpolate the bias.
+         *
+         * \param R pair distance. Values outside of the tabulated interval are clamped.
+         * \return interpolated force and energy. slope is not interpolated.
+         */
+        BiasPoint evaluate(double R) const;
+
+    private:
+        /// Tabulated energy, force, and slope for one knot, padded to a power of two.
+        using Knot = std::array<T, 4>;
+
+        T low_{0};
+        T high_{0};
+        T spacing_{0};
+        T inverseSpacing_{0};
+        std::vector<Knot> knots_;
+};
+
+// Explicitly instantiated in forcetable.cpp
+extern template
+BiasPoint evaluateBias<float>(double, const float*, std::size_t, double, double, double);
+
+extern template
+BiasPoint evaluateBias<double>(double, const double*, std::size_t, double, double, double);
+
+extern template
+class ForceTable<float>;
+
+extern template
+class ForceTable<double>;
+
+} // end namespace plugin
+
+#endif //RESTRAINT_FORCETABLE_H
@@ -0,0 +1,151 @@
+/*! \file
+ * \brief Code to implement the harmonic restraint bank declared in harmonicbank.h
+ */
+
+#include "harmonicbank.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+
+#include "gmxapi/exceptions.h"
+
+#include "simd.h"
+
+namespace plugin
+{
+
+HarmonicBank::HarmonicBank(const input_param_type& params) :
+    R0_(params.R0.begin(),
+        params.R0.end()),
+    k_(params.k.begin(),
+       params.k.end())
+{
+    if (R0_.empty() || R0_.size() != k_.size())
+    {
+        throw gmxapi::UsageError("HarmonicBank requires an equilibrium distance and a spring constant for each of at least one pair.");
+    }
+}
+
+gmx::PotentialPointData HarmonicBank::calculate(std::size_t pair,
+                                                gmx::Vector v,
+                                                gmx::Vector v0,
+                                                double /* t */) const
+{
+    // As for Harmonic, v is the position of a site relative to the reference site at v0.
+    const auto rdiff = v - v0;
+    const real R = std::sqrt(dot(rdiff,
+                                 rdiff));
+    const real stretch = R - R0_[pair];
+
+    gmx::PotentialPointData output;
+    output.energy = real(0.5) * k_[pair] * stretch * stretch;
+    // Direction of force is ill-defined when v == v0
+    if (R != 0)
+    {
+        output.force = rdiff * (k_[pair] * (R0_[pair] / R - real(1)));
+    }
+    return output;
+}
+
+void HarmonicBank::calculate(const PairBatch& pairs,
+                             double /* t */,
+                             const PairBatchForces& forces) const
+{
+    assert(forces.x && forces.y && forces.z);
+    if (pairs.size != size())
+    {
+        throw gmxapi::UsageError("HarmonicBank::calculate() requires coordinates of every pair of the bank.");
+    }
+    using S = SimdTraits<real>;
+    const auto numBlocks = static_cast<std::ptrdiff_t>(pairs.size / S::width);
+
+    // Coordinates and forces belong to the caller and may be unaligned. The parameters are aligned.
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) if(pairs.size >= minThreadedBatchSize)
+#endif
+    for (std::ptrdiff_t block = 0;block < numBlocks;++block)
+    {
+        const auto i = static_cast<std::size_t>(block) * S::width;
+        const auto dx = S::sub(S::loadu(pairs.x + i),
+                               S::loadu(pairs.x0 + i));
+        const auto dy = S::sub(S::loadu(pairs.y + i),
+                               S::loadu(pairs.y0 + i));
+        const auto dz = S::sub(S::loadu(pairs.z + i),
+                               S::loadu(pairs.z0 + i));
+        const auto R = S::sqrt(S::fma(dx,
+                                      dx,
+                                      S::fma(dy,
+                                             dy,
+                                             S::mul(dz,
+                                                    dz))));
+        const auto R0 = S::load(R0_.data() + i);
+        const auto k = S::load(k_.data() + i);
+        // Lanes with R == 0 divide by one instead, so that no floating-point exception is raised,
+        // and their force is masked to zero.
+        const auto one = S::set1(1);
+        const auto divisor = S::add(R,
+                                    S::sub(one,
+                                           S::whereNonzero(one,
+                                                           R)));
+        const auto magnitude = S::whereNonzero(S::mul(k,
+                                                      S::sub(S::div(R0,
+                                                                    divisor),
+                                                             one)),
+                                               R);
+        S::storeu(forces.x + i,
+                  S::mul(magnitude,
+                         dx));
+        S::storeu(forces.y + i,
+                  S::mul(magnitude,
+                         dy));
+        S::storeu(forces.z + i,
+                  S::mul(magnitude,
+                         dz));
+        if (forces.energy)
+        {
+            const auto stretch = S::sub(R,
+                                        R0);
+            S::storeu(forces.energy + i,
+                      S::mul(S::mul(S::set1(0.5),
+                                    k),
+                             S::mul(stretch,
+                                    stretch)));
+        }
+    }
+
+    // Pairs after the last full SIMD block.
+    for (std::size_t i = static_cast<std::size_t>(numBlocks) * S::width;i < pairs.size;++i)
+    {
+        const auto point = calculate(i,
+                                     {pairs.x[i], pairs.y[i], pairs.z[i]},
+                                     {pairs.x0[i], pairs.y0[i], pairs.z0[i]},
+                                     0);
+        forces.x[i] = point.force[0];
+        forces.y[i] = point.force[1];
+        forces.z[i] = point.force[2];
+        if (forces.energy)
+        {
+            forces.energy[i] = point.energy;
+        }
+    }
+}
+
+HarmonicBankPair::HarmonicBankPair(std::vector<int> sites,
+                                   const input_param_type& params,
+                                   std::shared_ptr<Resources> /* resources */) :
+    sites_{std::move(sites)},
+    bank_{params.bank},
+    pair_{params.pair}
+{
+    if (!bank_ || pair_ >= bank_->size())
+    {
+        throw gmxapi::UsageError("HarmonicBankPair requires a bank and the index of one of its pairs.");
+    }
+}
+
+// Explicitly instantiate a definition.
+template
+class ::plugin::RestraintModule<HarmonicBankPair>;
+
+} // end namespace plugin
@@ -0,0 +1,145 @@
+#ifndef RESTRAINT_HARMONICBANK_H
+#define RESTRAINT_HARMONICBANK_H
+
+/*! \file
+ * \brief Harmonic distance restraints for many site pairs held in one object.
+ *
+ * A HarmonicRestraint restrains one pair with scalar parameters. Steering protocols use thousands
+ * of such restraints, so a HarmonicBank holds the equilibrium distance and spring constant of
+ * every pair in structure-of-arrays layout and evaluates a batch of all pairs in one SIMD pass.
+ *
+ * GROMACS evaluates restraints one pair at a time, so each pair is presented to GROMACS by a
+ * HarmonicBankPair, which holds no more than a reference to the bank, its index, and its sites.
+ */
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "gromacs/restraint/restraintpotential.h"
+#include "gromacs/utility/real.h"
+
+#include "alignedallocator.h"
+#include "pairbatch.h"
+#include "sessionresources.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief Parameters of a HarmonicBank.
+ */
+struct harmonic_bank_param_type
+{
+    /// Equilibrium distance of each pair.
+    std::vector<real> R0{};
+    /// Spring constant of each pair.
+    std::vector<real> k{};
+};
+
+/*!
+ * \brief Harmonic distance restraints of many site pairs.
+ *
+ * Pair i has the potential energy 0.5 * k[i] * (R - R0[i])^2, as for the Harmonic potential.
+ */
+class HarmonicBank
+{
+    public:
+        using input_param_type = harmonic_bank_param_type;
+
+        /*!
+         * \brief Create a bank.
+         *
+         * \param params equilibrium distance and spring constant of each pair.
+         * \throws gmxapi::UsageError if there are no pairs, or R0 and k differ in size.
+         */
+        explicit HarmonicBank(const input_param_type& params);
+
+        /// Number of pairs.
+        std::size_t size() const
+        { return R0_.size(); }
+
+        /*!
+         * \brief Evaluate the restraint of one pair.
+         */
+        gmx::PotentialPointData calculate(std::size_t pair,
+                                          gmx::Vector v,
+                                          gmx::Vector v0,
+                                          double t) const;
+
+        /*!
+         * \brief Evaluate the restraints of every pair of the bank in one pass.
+         *
+         * \param pairs coordinates of the (v, v0) pairs, in the order of the bank.
+         * \param t simulation time.
+         * \param forces caller-provided buffers to receive the force on each v (and energies).
+         * \throws gmxapi::UsageError if pairs does not hold every pair of the bank.
+         */
+        void calculate(const PairBatch& pairs,
+                       double t,
+                       const PairBatchForces& forces) const;
+
+    private:
+        std::vector<real, AlignedAllocator<real>> R0_;
+        std::vector<real, AlignedAllocator<real>> k_;
+};
+
+/*!
+ * \brief Parameters of a HarmonicBankPair.
+ */
+struct harmonic_bank_pair_param_type
+{
+    /// Bank holding the parameters of the pair.
+    std::shared_ptr<HarmonicBank> bank;
+    /// Index of the pair in the bank.
+    std::size_t pair{0};
+};
+
+/*!
+ * \brief Present one pair of a HarmonicBank to GROMACS as a restraint.
+ *
+ * Use with RestraintModule<HarmonicBankPair>, which creates the restraint once and returns the
+ * same instance from every call of getRestraint().
+ */
+class HarmonicBankPair : public ::gmx::IRestraintPotential
+{
+    public:
+        using input_param_type = harmonic_bank_pair_param_type;
+
+        /*!
+         * \param sites sites of the pair.
+         * \param params bank and index of the pair.
+         * \param resources ignored: harmonic restraints use no Session resources.
+         */
+        HarmonicBankPair(std::vector<int> sites,
+                         const input_param_type& params,
+                         std::shared_ptr<Resources> resources);
+
+        std::vector<int> sites() const override
+        {
+            return sites_;
+        }
+
+        gmx::PotentialPointData evaluate(gmx::Vector r1,
+                                         gmx::Vector r2,
+                                         double t) override
+        {
+            return bank_->calculate(pair_,
+                                    r1,
+                                    r2,
+                                    t);
+        }
+
+    private:
+        std::vector<int> sites_;
+        std::shared_ptr<HarmonicBank> bank_;
+        std::size_t pair_;
+};
+
+// Explicitly instantiated in harmonicbank.cpp
+extern template
+class RestraintModule<HarmonicBankPair>;
+
+} // end namespace plugin
+
+#endif //RESTRAINT_HARMONICBANK_H
@@ -56,7 +56,7 @@ gmx::PotentialPointData HarmonicRestraint::evaluate(gmx::Vector r1,
 
 std::vector<int> HarmonicRestraint::sites() const
 {
-    return {site1_, site2_};
+    return sites_;
 }
 
 } // end namespace plugin
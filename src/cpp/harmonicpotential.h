@@ -6,6 +6,9 @@
 #define GROMACS_HARMONICPOTENTIAL_H
 
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include "gmxapi/gromacsfwd.h"
 #include "gmxapi/md/mdmodule.h"
@@ -108,8 +111,7 @@ class HarmonicRestraint : public ::gmx::IRestraintPotential, private Harmonic
                           real R0,
                           real k) :
             Harmonic{R0, k},
-            site1_{site1},
-            site2_{site2}
+            sites_{site1, site2}
         {};
 
         ~HarmonicRestraint() override = default;
@@ -141,8 +143,8 @@ class HarmonicRestraint : public ::gmx::IRestraintPotential, private Harmonic
                                          double t) override;
 
     private:
-        int site1_{0};
-        int site2_{0};
+        /// Site indices, built once rather than at each call of sites().
+        std::vector<int> sites_;
 };
 
 /*!
@@ -176,14 +178,21 @@ class HarmonicModule : public gmxapi::MDModule
          * \brief implement gmxapi::MDModule::getRestraint()
          *
          * \return Handle to configured library object.
+         *
+         * Creates the restraint at the first call, and returns the same instance until the
+         * parameters change.
          */
         std::shared_ptr<gmx::IRestraintPotential> getRestraint() override
         {
-            auto restraint = std::make_shared<HarmonicRestraint>(site1_,
+            std::lock_guard<std::mutex> lock(restraintInstantiation_);
+            if (!restraint_)
+            {
+                restraint_ = std::make_shared<HarmonicRestraint>(site1_,
                                                                  site2_,
                                                                  R0_,
                                                                  k_);
-            return restraint;
+            }
+            return restraint_;
         }
 
         /*!
@@ -200,10 +209,12 @@ class HarmonicModule : public gmxapi::MDModule
                        real R0,
                        real k)
         {
+            std::lock_guard<std::mutex> lock(restraintInstantiation_);
             site1_ = site1;
             site2_ = site2;
             R0_ = R0;
             k_ = k;
+            restraint_.reset();
         }
 
     private:
@@ -211,6 +222,9 @@ class HarmonicModule : public gmxapi::MDModule
         int site2_;
         real R0_;
         real k_;
+
+        std::shared_ptr<HarmonicRestraint> restraint_{nullptr};
+        std::mutex restraintInstantiation_;
 };
 
 } // end namespace plugin
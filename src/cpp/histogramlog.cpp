@@ -0,0 +1,236 @@
+/*! \file
+ * \brief Code to implement the histogram log declared in histogramlog.h
+ */
+
+#include "histogramlog.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <utility>
+
+#include <unistd.h>
+
+#include "gmxapi/exceptions.h"
+
+namespace plugin
+{
+
+namespace {
+
+/// Magic number and version at the start of a log file.
+constexpr std::uint32_t histogramLogMagic{0x474c4845}; // "EHLG"
+constexpr std::uint32_t histogramLogVersion{1};
+
+/// Append the bytes of a value to buffer.
+template<typename T>
+void append(std::vector<char>* buffer,
+            const T& value)
+{
+    const auto bytes = reinterpret_cast<const char*>(&value);
+    buffer->insert(buffer->end(),
+                   bytes,
+                   bytes + sizeof(T));
+}
+
+} // end anonymous namespace
+
+LogChannel::LogChannel(std::string name,
+                       std::size_t maxValues,
+                       std::size_t capacity) :
+    name_{std::move(name)},
+    slotBytes_{maxValues * sizeof(double)},
+    capacity_{std::max<std::size_t>(capacity, 1)},
+    slots_(capacity_),
+    payload_(capacity_ * slotBytes_)
+{
+}
+
+bool LogChannel::push(LogRecordKind kind,
+                      std::int64_t step,
+                      double t,
+                      const void* values,
+                      std::size_t itemSize,
+                      std::size_t count)
+{
+    assert(itemSize * count <= slotBytes_);
+    const auto head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == capacity_)
+    {
+        dropped_.fetch_add(1,
+                           std::memory_order_relaxed);
+        return false;
+    }
+    const auto slot = head % capacity_;
+    slots_[slot] = {kind, static_cast<std::uint32_t>(itemSize), static_cast<std::uint32_t>(count), step, t};
+    std::memcpy(payload_.data() + slot * slotBytes_,
+                values,
+                itemSize * count);
+    // Publish the slot to the consumer.
+    head_.store(head + 1,
+                std::memory_order_release);
+    return true;
+}
+
+std::size_t LogChannel::drain(std::vector<char>* buffer)
+{
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    const auto head = head_.load(std::memory_order_acquire);
+    for (auto record = tail;record < head;++record)
+    {
+        const auto slot = record % capacity_;
+        const auto& header = slots_[slot];
+        append(buffer,
+               static_cast<std::uint32_t>(header.kind));
+        append(buffer,
+               static_cast<std::uint32_t>(name_.size()));
+        append(buffer,
+               header.step);
+        append(buffer,
+               header.time);
+        append(buffer,
+               header.itemSize);
+        append(buffer,
+               header.count);
+        buffer->insert(buffer->end(),
+                       name_.begin(),
+                       name_.end());
+        const char* values = payload_.data() + slot * slotBytes_;
+        buffer->insert(buffer->end(),
+                       values,
+                       values + header.itemSize * header.count);
+    }
+    // Return the slots to the producer.
+    tail_.store(head,
+                std::memory_order_release);
+    return head - tail;
+}
+
+HistogramLog::HistogramLog(const std::string& filename) :
+    HistogramLog(filename,
+                 Options())
+{
+}
+
+HistogramLog::HistogramLog(const std::string& filename,
+                           const Options& options) :
+    file_{filename.c_str(),
+          "ab"},
+    options_{options}
+{
+    if (!file_.fh())
+    {
+        throw gmxapi::UsageError("Could not open histogram log " + filename + " for appending.");
+    }
+    // A new log starts with the file header. The position of a stream in append mode is the end of the file.
+    std::fseek(file_.fh(),
+               0,
+               SEEK_END);
+    if (std::ftell(file_.fh()) == 0)
+    {
+        append(&batch_,
+               histogramLogMagic);
+        append(&batch_,
+               histogramLogVersion);
+        write(false);
+    }
+    writer_ = std::thread([this]() { run(); });
+}
+
+HistogramLog::~HistogramLog()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_one();
+    writer_.join();
+    file_.close();
+}
+
+std::shared_ptr<LogChannel> HistogramLog::channel(std::string name,
+                                                  std::size_t maxValues)
+{
+    // The ring indices are on separate cache lines, which std::make_shared does not honor before C++17.
+    auto channel = std::allocate_shared<LogChannel>(AlignedAllocator<LogChannel>(),
+                                                    std::move(name),
+                                                    maxValues,
+                                                    options_.channelCapacity);
+    std::lock_guard<std::mutex> lock(mutex_);
+    channels_.push_back(channel);
+    return channel;
+}
+
+std::uint64_t HistogramLog::dropped() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::uint64_t dropped{0};
+    for (const auto& channel : channels_)
+    {
+        dropped += channel->dropped();
+    }
+    return dropped;
+}
+
+void HistogramLog::run()
+{
+    auto lastSync = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+        wake_.wait_for(lock,
+                       options_.flushInterval,
+                       [this]() { return stop_; });
+        const bool stopping = stop_;
+        std::size_t records{0};
+        for (const auto& channel : channels_)
+        {
+            records += channel->drain(&batch_);
+        }
+        lock.unlock();
+
+        const auto now = std::chrono::steady_clock::now();
+        const bool sync = stopping || now - lastSync >= options_.syncInterval;
+        if (records > 0 || sync)
+        {
+            write(sync);
+            written_.fetch_add(records,
+                               std::memory_order_relaxed);
+        }
+        if (sync)
+        {
+            lastSync = now;
+        }
+
+        lock.lock();
+        if (stopping)
+        {
+            break;
+        }
+    }
+}
+
+void HistogramLog::write(bool sync)
+{
+    if (good() && !batch_.empty())
+    {
+        if (std::fwrite(batch_.data(),
+                        1,
+                        batch_.size(),
+                        file_.fh()) != batch_.size() || std::fflush(file_.fh()) != 0)
+        {
+            good_.store(false,
+                        std::memory_order_relaxed);
+        }
+    }
+    batch_.clear();
+    if (good() && sync && fsync(fileno(file_.fh())) != 0)
+    {
+        good_.store(false,
+                    std::memory_order_relaxed);
+    }
+}
+
+} // end namespace plugin
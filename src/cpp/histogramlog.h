@@ -0,0 +1,225 @@
+#ifndef RESTRAINT_HISTOGRAMLOG_H
+#define RESTRAINT_HISTOGRAMLOG_H
+
+/*! \file
+ * \brief Append-only binary log of window histograms, written by a background thread.
+ *
+ * For post-analysis, restraints record every reduced window and every rebuilt histogram. Writing
+ * files on the thread that updates the restraint would stall MD, so each restraint copies its
+ * records into a LogChannel, a lock-free single-producer single-consumer ring with preallocated
+ * slots. A HistogramLog owns the file and a writer thread, which periodically drains all channels
+ * into one batch, appends it to the file, and syncs the file at a configurable cadence. A full
+ * channel drops the record and counts it, so the restraint never waits for the disk.
+ *
+ * The file starts with the magic number and version of the format (two uint32). Each record is
+ *
+ *     uint32 kind          LogRecordKind
+ *     uint32 nameLength    bytes of the restraint name
+ *     int64  step          MD step, or -1 if the restraint has no StepScheduler
+ *     double time          simulation time (ps)
+ *     uint32 itemSize      bytes per value: 4 (float) or 8 (double)
+ *     uint32 count         number of values
+ *     char   name[nameLength]
+ *     values[count]
+ *
+ * in the byte order of the host. Runs appending to an existing log do not repeat the file header.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "alignedallocator.h"
+#include "sessionresources.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief Content of a log record.
+ */
+enum class LogRecordKind : std::uint32_t
+{
+    /// Window averaged over the ensemble, as added to the window history.
+    Window = 1,
+    /// Histogram rebuilt from the window history, minus the experimental distribution.
+    Histogram = 2
+};
+
+/*!
+ * \brief Records of one restraint on their way to the log file.
+ *
+ * Ring of preallocated slots with one producer, the thread updating the restraint, and one
+ * consumer, the writer thread. Neither side locks or allocates.
+ */
+class LogChannel
+{
+    public:
+        /*!
+         * \brief Allocate the ring.
+         *
+         * \param name name of the restraint in the records.
+         * \param maxValues largest number of values in a record.
+         * \param capacity number of slots. A full ring drops new records.
+         */
+        LogChannel(std::string name,
+                   std::size_t maxValues,
+                   std::size_t capacity);
+
+        /*!
+         * \brief Copy a record into the ring.
+         *
+         * \return false if the ring was full and the record was dropped.
+         */
+        template<typename T>
+        bool push(LogRecordKind kind,
+                  std::int64_t step,
+                  double t,
+                  const T* values,
+                  std::size_t count)
+        {
+            static_assert(sizeof(T) == sizeof(float) || sizeof(T) == sizeof(double), "Log values are float or double.");
+            return push(kind,
+                        step,
+                        t,
+                        values,
+                        sizeof(T),
+                        count);
+        }
+
+        /*!
+         * \brief Append the records in the ring to buffer, in the file format, and free their slots.
+         *
+         * Called by the consumer only.
+         *
+         * \return number of records appended.
+         */
+        std::size_t drain(std::vector<char>* buffer);
+
+        /// Name of the restraint.
+        const std::string& name() const
+        { return name_; }
+
+        /// Number of records dropped because the ring was full.
+        std::uint64_t dropped() const
+        { return dropped_.load(std::memory_order_relaxed); }
+
+    private:
+        bool push(LogRecordKind kind,
+                  std::int64_t step,
+                  double t,
+                  const void* values,
+                  std::size_t itemSize,
+                  std::size_t count);
+
+        /// Header of the record in a slot. Its values are in payload_.
+        struct Slot
+        {
+            LogRecordKind kind;
+            std::uint32_t itemSize;
+            std::uint32_t count;
+            std::int64_t step;
+            double time;
+        };
+
+        const std::string name_;
+        const std::size_t slotBytes_;
+        const std::size_t capacity_;
+        std::vector<Slot> slots_;
+        std::vector<char> payload_;
+        std::atomic<std::uint64_t> dropped_{0};
+
+        /// Records pushed and drained. Each is written by one side only, on its own cache line.
+        alignas(kernelAlignment) std::atomic<std::size_t> head_{0};
+        alignas(kernelAlignment) std::atomic<std::size_t> tail_{0};
+};
+
+/*!
+ * \brief Append-only log file fed by the LogChannels of many restraints.
+ *
+ * Share one instance between the restraints of a simulation (see Resources::setHistogramLog()).
+ * The destructor writes the remaining records, syncs the file, and joins the writer thread.
+ */
+class HistogramLog
+{
+    public:
+        struct Options
+        {
+            /// Time between passes of the writer over the channels.
+            std::chrono::milliseconds flushInterval{100};
+            /// Time between syncs of the file to disk. Zero syncs after every batch.
+            std::chrono::milliseconds syncInterval{std::chrono::seconds(10)};
+            /// Slots of the ring of each channel.
+            std::size_t channelCapacity{64};
+        };
+
+        explicit HistogramLog(const std::string& filename);
+
+        /*!
+         * \brief Open the file for appending and start the writer thread.
+         *
+         * \throws gmxapi::UsageError if the file cannot be opened.
+         */
+        HistogramLog(const std::string& filename,
+                     const Options& options);
+
+        ~HistogramLog();
+
+        HistogramLog(const HistogramLog&) = delete;
+
+        HistogramLog& operator=(const HistogramLog&) = delete;
+
+        /*!
+         * \brief Create the channel of a restraint. Thread safe.
+         *
+         * \param name name of the restraint in the records.
+         * \param maxValues largest number of values in a record.
+         */
+        std::shared_ptr<LogChannel> channel(std::string name,
+                                            std::size_t maxValues);
+
+        /// Number of records written to the file.
+        std::uint64_t written() const
+        { return written_.load(std::memory_order_relaxed); }
+
+        /// Number of records dropped by full channels.
+        std::uint64_t dropped() const;
+
+        /// Whether every write and sync of the file has succeeded.
+        bool good() const
+        { return good_.load(std::memory_order_relaxed); }
+
+    private:
+        /// Body of the writer thread.
+        void run();
+
+        /// Append the batch to the file, and sync it if requested.
+        void write(bool sync);
+
+        RAIIFile file_;
+        const Options options_;
+
+        /// Protects channels_ and stop_.
+        mutable std::mutex mutex_;
+        std::condition_variable wake_;
+        std::vector<std::shared_ptr<LogChannel>> channels_;
+        bool stop_{false};
+
+        /// Records drained by the writer thread and not yet written.
+        std::vector<char> batch_;
+        std::atomic<std::uint64_t> written_{0};
+        std::atomic<bool> good_{true};
+
+        std::thread writer_;
+};
+
+} // end namespace plugin
+
+#endif //RESTRAINT_HISTOGRAMLOG_H
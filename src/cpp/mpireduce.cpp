@@ -0,0 +1,281 @@
+/*! \file
+ * \brief Code to implement the MPI reduction declared in mpireduce.h
+ */
+
+#include "mpireduce.h"
+
+#include <unistd.h>
+
+#include <climits>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "gmxapi/exceptions.h"
+
+namespace plugin
+{
+
+namespace
+{
+
+/// Throw if an MPI call failed.
+void checkMpi(int status,
+              const char* operation)
+{
+    if (status != MPI_SUCCESS)
+    {
+        throw gmxapi::ProtocolError(std::string("Ensemble reduction failed in ") + operation + ".");
+    }
+}
+
+/// Throw if MPI cannot be used.
+void requireInitialized()
+{
+    int initialized{0};
+    MPI_Initialized(&initialized);
+    int finalized{0};
+    MPI_Finalized(&finalized);
+    if (!initialized || finalized)
+    {
+        throw gmxapi::UsageError("MPI must be initialized to create an MPI ensemble reduction.");
+    }
+}
+
+/// Throw if count elements cannot be reduced by MPI.
+int checkedCount(size_t count)
+{
+    if (count > static_cast<size_t>(INT_MAX))
+    {
+        throw gmxapi::ProtocolError("Ensemble reduction buffer is too large for MPI.");
+    }
+    return static_cast<int>(count);
+}
+
+/// Throw unless send and receive can be reduced by MPI.
+int checkedCount(const Matrix<double>& send,
+                 const Matrix<double>* receive)
+{
+    if (receive == nullptr || receive->rows() != send.rows() || receive->cols() != send.cols())
+    {
+        throw gmxapi::ProtocolError("Ensemble reduction requires send and receive buffers of the same shape.");
+    }
+    return checkedCount(send.rows() * send.cols());
+}
+
+MPI_Datatype mpiType(WireType type)
+{
+    switch (type)
+    {
+        case WireType::Float32:
+            return MPI_FLOAT;
+        case WireType::Int32:
+            return MPI_INT32_T;
+        default:
+            return MPI_DOUBLE;
+    }
+}
+
+#if MPI_VERSION >= 3
+/*!
+ * \brief Non-blocking reduction, holding the communicator until complete.
+ */
+class MpiReduceOperation : public ReduceRequest::Operation
+{
+    public:
+        explicit MpiReduceOperation(std::shared_ptr<MPI_Comm> comm) :
+            comm_{std::move(comm)}
+        {}
+
+        ~MpiReduceOperation() override
+        {
+            int finalized{0};
+            MPI_Finalized(&finalized);
+            if (request_ != MPI_REQUEST_NULL && !finalized)
+            {
+                // Collectives cannot be cancelled, and MPI may still write to the receive buffer.
+                MPI_Wait(&request_,
+                         MPI_STATUS_IGNORE);
+            }
+        }
+
+        bool test() override
+        {
+            int complete{0};
+            checkMpi(MPI_Test(&request_,
+                              &complete,
+                              MPI_STATUS_IGNORE),
+                     "MPI_Test");
+            return complete != 0;
+        }
+
+        void wait() override
+        {
+            checkMpi(MPI_Wait(&request_,
+                              MPI_STATUS_IGNORE),
+                     "MPI_Wait");
+        }
+
+        MPI_Request* request()
+        { return &request_; }
+
+    private:
+        std::shared_ptr<MPI_Comm> comm_;
+        MPI_Request request_{MPI_REQUEST_NULL};
+};
+#endif
+
+} // end anonymous namespace
+
+MpiReduce::MpiReduce(MPI_Comm comm)
+{
+    requireInitialized();
+    auto duplicate = new MPI_Comm(MPI_COMM_NULL);
+    if (MPI_Comm_dup(comm,
+                     duplicate) != MPI_SUCCESS)
+    {
+        delete duplicate;
+        throw gmxapi::ProtocolError("Could not duplicate the ensemble communicator.");
+    }
+    comm_ = std::shared_ptr<MPI_Comm>(duplicate,
+                                      [](MPI_Comm* comm) {
+                                          int finalized{0};
+                                          MPI_Finalized(&finalized);
+                                          if (!finalized)
+                                          {
+                                              MPI_Comm_free(comm);
+                                          }
+                                          delete comm;
+                                      });
+}
+
+void MpiReduce::operator()(const Matrix<double>& send,
+                           Matrix<double>* receive) const
+{
+    checkMpi(MPI_Allreduce(send.data(),
+                           receive->data(),
+                           checkedCount(send,
+                                        receive),
+                           MPI_DOUBLE,
+                           MPI_SUM,
+                           *comm_),
+             "MPI_Allreduce");
+}
+
+ReduceRequest MpiReduce::start(const Matrix<double>& send,
+                               Matrix<double>* receive) const
+{
+    const auto count = checkedCount(send,
+                                    receive);
+    return start(WireType::Float64,
+                 send.data(),
+                 receive->data(),
+                 count);
+}
+
+ReduceRequest MpiReduce::start(WireType type,
+                               const void* send,
+                               void* receive,
+                               size_t count) const
+{
+#if MPI_VERSION >= 3
+    auto operation = std::make_unique<MpiReduceOperation>(comm_);
+    checkMpi(MPI_Iallreduce(send,
+                            receive,
+                            checkedCount(count),
+                            mpiType(type),
+                            MPI_SUM,
+                            *comm_,
+                            operation->request()),
+             "MPI_Iallreduce");
+    return ReduceRequest(std::move(operation));
+#else
+    checkMpi(MPI_Allreduce(send,
+                           receive,
+                           checkedCount(count),
+                           mpiType(type),
+                           MPI_SUM,
+                           *comm_),
+             "MPI_Allreduce");
+    return {};
+#endif
+}
+
+int MpiReduce::size() const
+{
+    int size{0};
+    checkMpi(MPI_Comm_size(*comm_,
+                           &size),
+             "MPI_Comm_size");
+    return size;
+}
+
+MpiReduce mpiReduceFromFortran(MPI_Fint comm)
+{
+    requireInitialized();
+    return MpiReduce(MPI_Comm_f2c(comm));
+}
+
+#if GMXAPI_EXTENSION_HAVE_SHM
+SharedMemoryReduce hierarchicalReduceFromFortran(MPI_Fint comm,
+                                                 std::size_t capacity)
+{
+    requireInitialized();
+    const MPI_Comm ensemble = MPI_Comm_f2c(comm);
+    int rank{0};
+    checkMpi(MPI_Comm_rank(ensemble,
+                           &rank),
+             "MPI_Comm_rank");
+
+    MPI_Comm node{MPI_COMM_NULL};
+    checkMpi(MPI_Comm_split_type(ensemble,
+                                 MPI_COMM_TYPE_SHARED,
+                                 rank,
+                                 MPI_INFO_NULL,
+                                 &node),
+             "MPI_Comm_split_type");
+    int localRank{0};
+    int localSize{0};
+    MPI_Comm_rank(node,
+                  &localRank);
+    MPI_Comm_size(node,
+                  &localSize);
+    // Name the segment after the leader's process, which is unique on the node.
+    long leader[2] = {static_cast<long>(getpid()), static_cast<long>(rank)};
+    checkMpi(MPI_Bcast(leader,
+                       2,
+                       MPI_LONG,
+                       0,
+                       node),
+             "MPI_Bcast");
+    MPI_Comm_free(&node);
+
+    MPI_Comm leaders{MPI_COMM_NULL};
+    checkMpi(MPI_Comm_split(ensemble,
+                            localRank == 0 ? 0 : MPI_UNDEFINED,
+                            rank,
+                            &leaders),
+             "MPI_Comm_split");
+    SharedMemoryReduce::reduce_type interNodeReduce;
+    if (leaders != MPI_COMM_NULL)
+    {
+        int nodes{0};
+        MPI_Comm_size(leaders,
+                      &nodes);
+        if (nodes > 1)
+        {
+            interNodeReduce = MpiReduce(leaders);
+        }
+        MPI_Comm_free(&leaders);
+    }
+
+    const std::string name = "/gmxapi_reduce_" + std::to_string(leader[0]) + "_" + std::to_string(leader[1]);
+    return SharedMemoryReduce(name,
+                              localRank,
+                              localSize,
+                              capacity,
+                              std::move(interNodeReduce));
+}
+#endif
+
+} // end namespace plugin
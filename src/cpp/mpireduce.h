@@ -0,0 +1,103 @@
+#ifndef RESTRAINT_MPIREDUCE_H
+#define RESTRAINT_MPIREDUCE_H
+
+/*! \file
+ * \brief Ensemble reduction with MPI, for use as the reduce function of Resources.
+ *
+ * The Python bindings otherwise reduce through the ensemble_update() method of the Python Context,
+ * which takes the GIL and wraps the Matrix buffers for mpi4py on every call. This file is only
+ * compiled if CMake finds MPI (GMXAPI_EXTENSION_HAVE_MPI is then defined), and must be built with
+ * the same MPI library as mpi4py.
+ */
+
+#include <memory>
+
+#include <mpi.h>
+
+#include "sessionresources.h"
+#if GMXAPI_EXTENSION_HAVE_SHM
+#include "shmreduce.h"
+#endif
+
+namespace plugin
+{
+
+/*!
+ * \brief Reduce function object summing a Matrix over an MPI communicator.
+ *
+ * Copies share a duplicate of the communicator, which is freed with the last copy (unless MPI has
+ * already been finalized), so the reduction does not interfere with other traffic on the original
+ * communicator and does not depend on the lifetime of the object that provided it.
+ */
+class MpiReduce
+{
+    public:
+        /*!
+         * \brief Duplicate a communicator for ensemble reductions.
+         *
+         * Collective over comm.
+         *
+         * \throws gmxapi::UsageError if MPI is not initialized.
+         */
+        explicit MpiReduce(MPI_Comm comm);
+
+        /*!
+         * \brief Sum send over all ranks of the communicator into receive.
+         *
+         * Collective: every rank must call with matrices of the same size.
+         *
+         * \throws gmxapi::ProtocolError if the matrices differ in size or MPI reports an error.
+         */
+        void operator()(const Matrix<double>& send,
+                        Matrix<double>* receive) const;
+
+        /*!
+         * \brief Start summing send over all ranks of the communicator into receive.
+         *
+         * Uses MPI_Iallreduce with MPI 3, and otherwise completes the reduction before returning.
+         * Collective, like operator().
+         *
+         * \throws gmxapi::ProtocolError if the matrices differ in size or MPI reports an error.
+         */
+        ReduceRequest start(const Matrix<double>& send,
+                            Matrix<double>* receive) const;
+
+        /*!
+         * \brief Start summing count elements of the given type, for use as a Resources wire reduce.
+         *
+         * \throws gmxapi::ProtocolError if the count is too large or MPI reports an error.
+         */
+        ReduceRequest start(WireType type,
+                            const void* send,
+                            void* receive,
+                            size_t count) const;
+
+        /// Number of ranks in the communicator.
+        int size() const;
+
+    private:
+        std::shared_ptr<MPI_Comm> comm_;
+};
+
+/*!
+ * \brief Convert a Fortran communicator handle, as from mpi4py's Comm.py2f(), to a reduce function.
+ */
+MpiReduce mpiReduceFromFortran(MPI_Fint comm);
+
+#if GMXAPI_EXTENSION_HAVE_SHM
+/*!
+ * \brief Create a hierarchical reduce function for the ensemble members of a Fortran communicator.
+ *
+ * Members that share a node, according to MPI_Comm_split_type(), sum through shared memory, and the
+ * lowest rank of each node reduces over MPI with the other node leaders. Collective over comm.
+ *
+ * \param comm Fortran handle of the ensemble communicator, as from mpi4py's Comm.py2f().
+ * \param capacity number of elements reduced at a time through shared memory.
+ */
+SharedMemoryReduce hierarchicalReduceFromFortran(MPI_Fint comm,
+                                                 std::size_t capacity = 65536);
+#endif
+
+} // end namespace plugin
+
+#endif //RESTRAINT_MPIREDUCE_H
@@ -0,0 +1,63 @@
+#ifndef RESTRAINT_PAIRBATCH_H
+#define RESTRAINT_PAIRBATCH_H
+
+/*! \file
+ * \brief Structure-of-arrays views for evaluating many restrained pairs in one call.
+ *
+ * The views do not own their data. Callers keep the coordinate and force arrays alive for the
+ * duration of the call.
+ */
+
+#include <cstddef>
+
+#include "gromacs/utility/real.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief Coordinates of a batch of (v, v0) site pairs.
+ *
+ * Element i of each array describes pair i, following the (v, v0) convention of
+ * gmx::IRestraintPotential::evaluate().
+ */
+struct PairBatch
+{
+    /// Number of pairs in the batch.
+    std::size_t size{0};
+
+    /// Coordinates of the site at which force is evaluated.
+    const real* x{nullptr};
+    const real* y{nullptr};
+    const real* z{nullptr};
+
+    /// Coordinates of the reference site.
+    const real* x0{nullptr};
+    const real* y0{nullptr};
+    const real* z0{nullptr};
+};
+
+/*!
+ * \brief Caller-provided output buffers for a PairBatch.
+ *
+ * Each array must hold at least PairBatch::size elements. Elements are overwritten, not
+ * accumulated. energy may be null if energies are not needed.
+ */
+struct PairBatchForces
+{
+    real* x{nullptr};
+    real* y{nullptr};
+    real* z{nullptr};
+    real* energy{nullptr};
+};
+
+/*!
+ * \brief Batches at least this large are split across OpenMP threads, if available.
+ *
+ * Smaller batches are not worth the cost of waking the thread team.
+ */
+constexpr std::size_t minThreadedBatchSize = 256;
+
+} // end namespace plugin
+
+#endif //RESTRAINT_PAIRBATCH_H
@@ -0,0 +1,31 @@
+/*! \file
+ * \brief Code to support the precision policies declared in precision.h
+ */
+
+#include "precision.h"
+
+#include <string>
+
+#include "gmxapi/exceptions.h"
+
+namespace plugin
+{
+
+PrecisionMode precisionModeFromString(const std::string& name)
+{
+    if (name == "double")
+    {
+        return PrecisionMode::Double;
+    }
+    else if (name == "single")
+    {
+        return PrecisionMode::Single;
+    }
+    else if (name == "mixed")
+    {
+        return PrecisionMode::Mixed;
+    }
+    throw gmxapi::UsageError("Unknown precision '" + name + "'. Expected 'double', 'single', or 'mixed'.");
+}
+
+} // end namespace plugin
@@ -0,0 +1,72 @@
+#ifndef RESTRAINT_PRECISION_H
+#define RESTRAINT_PRECISION_H
+
+/*! \file
+ * \brief Precision policies for the restraint kernels and their state.
+ *
+ * A policy names two scalar types. compute_type is used for per-step force evaluation, the
+ * smoothed histogram that the force kernels read, and Gaussian blurring of samples. accumulate_type
+ * is used for stored windows and for sums over windows. Ensemble reductions always exchange double
+ * precision data (see ResourcesHandle::reduce()).
+ *
+ * In mixed-precision GROMACS builds, `real` is float, so the single and mixed policies avoid
+ * conversions at the restraint interface and double the SIMD width of the kernels.
+ */
+
+#include <string>
+
+namespace plugin
+{
+
+/*!
+ * \brief Run-time selector for a precision policy.
+ */
+enum class PrecisionMode
+{
+    Double,
+    Single,
+    Mixed
+};
+
+/*!
+ * \brief Double precision everywhere. This is the default.
+ */
+struct DoublePrecision
+{
+    using compute_type = double;
+    using accumulate_type = double;
+    static constexpr PrecisionMode mode = PrecisionMode::Double;
+};
+
+/*!
+ * \brief Single precision everywhere.
+ */
+struct SinglePrecision
+{
+    using compute_type = float;
+    using accumulate_type = float;
+    static constexpr PrecisionMode mode = PrecisionMode::Single;
+};
+
+/*!
+ * \brief Single precision force evaluation and blurring, double precision accumulation.
+ */
+struct MixedPrecision
+{
+    using compute_type = float;
+    using accumulate_type = double;
+    static constexpr PrecisionMode mode = PrecisionMode::Mixed;
+};
+
+/*!
+ * \brief Get the precision mode named by a user-provided string.
+ *
+ * \param name one of "double", "single", or "mixed".
+ * \return the named mode.
+ * \throws gmxapi::UsageError if the name is not recognized.
+ */
+PrecisionMode precisionModeFromString(const std::string& name);
+
+} // end namespace plugin
+
+#endif //RESTRAINT_PRECISION_H
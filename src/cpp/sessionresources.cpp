@@ -9,8 +9,14 @@
 #include "sessionresources.h"
 
 #include <cassert>
+#include <cmath>
+#include <cstdint>
 
+#include <algorithm>
+#include <limits>
 #include <memory>
+#include <string>
+#include <utility>
 
 #include "gmxapi/exceptions.h"
 #include "gmxapi/md/mdsignals.h"
@@ -22,6 +28,296 @@ namespace plugin
 template
 class ::plugin::Matrix<double>;
 
+template
+class ::plugin::Matrix<float>;
+
+namespace
+{
+
+WireType wireTypeOf(ReduceEncoding encoding)
+{
+    switch (encoding)
+    {
+        case ReduceEncoding::Float32:
+            return WireType::Float32;
+        case ReduceEncoding::Fixed32:
+        case ReduceEncoding::Delta:
+            return WireType::Int32;
+        default:
+            return WireType::Float64;
+    }
+}
+
+/*!
+ * \brief Reduction of encoded data, decoded into the receive buffer on completion.
+ *
+ * Owns the wire buffers, so that the caller's buffers need not match the encoding.
+ */
+class EncodedReduction : public ReduceRequest::Operation
+{
+    public:
+        EncodedReduction(const Matrix<double>& send,
+                         Matrix<double>* receive,
+                         const ReduceOptions& options) :
+            receive_{receive},
+            options_{options},
+            size_{send.rows() * send.cols()},
+            count_{size_ + (options.operation == ReduceOperation::Mean ? 1 : 0)},
+            keyFrame_{options.encoding == ReduceEncoding::Delta && options.history->sent.empty()},
+            type_{keyFrame_ ? WireType::Float64 : wireTypeOf(options.encoding)},
+            doubleSend_{1,
+                        count_},
+            doubleReceive_{1,
+                           count_}
+        {
+            encode(send.data());
+        }
+
+        /*!
+         * \brief Start the exchange with the wire reduction if available, and otherwise as doubles.
+         */
+        void start(const ResourcesHandle& handle)
+        {
+            native_ = handle.wireReduce_ && *handle.wireReduce_;
+            if (native_)
+            {
+                request_ = (*handle.wireReduce_)(type_,
+                                                 sendBuffer(),
+                                                 receiveBuffer(),
+                                                 count_);
+                return;
+            }
+            if (type_ == WireType::Float32)
+            {
+                std::copy(floatSend_.begin(),
+                          floatSend_.end(),
+                          doubleSend_.data());
+            }
+            else if (type_ == WireType::Int32)
+            {
+                std::copy(intSend_.begin(),
+                          intSend_.end(),
+                          doubleSend_.data());
+            }
+            request_ = handle.startReduce(doubleSend_,
+                                          &doubleReceive_);
+        }
+
+        bool test() override
+        {
+            if (!request_.test())
+            {
+                return false;
+            }
+            finish();
+            return true;
+        }
+
+        void wait() override
+        {
+            request_.wait();
+            finish();
+        }
+
+    private:
+        void encode(const double* data)
+        {
+            std::vector<double> values(data,
+                                       data + size_);
+            // The history is only updated once the exchange completes, so a failed reduction does not
+            // leave it out of step with what the ensemble has added up.
+            if (keyFrame_)
+            {
+                sent_ = values;
+            }
+            else if (options_.encoding == ReduceEncoding::Delta)
+            {
+                sent_ = options_.history->sent;
+                if (sent_.size() != size_)
+                {
+                    throw gmxapi::ProtocolError("ReduceHistory was used for data of a different size.");
+                }
+                for (size_t i = 0;i < size_;++i)
+                {
+                    // Send the rounded change, and remember what the ensemble will add up.
+                    values[i] = std::round((values[i] - sent_[i]) * options_.fixedPointScale) / options_.fixedPointScale;
+                    sent_[i] += values[i];
+                }
+            }
+            if (type_ == WireType::Float64)
+            {
+                std::copy(values.begin(),
+                          values.end(),
+                          doubleSend_.data());
+                // Each member counts itself for a Mean.
+                std::fill(doubleSend_.data() + size_,
+                          doubleSend_.data() + count_,
+                          1.);
+            }
+            else if (type_ == WireType::Float32)
+            {
+                floatSend_.assign(values.begin(),
+                                  values.end());
+                floatSend_.resize(count_,
+                                  1.f);
+                floatReceive_.resize(count_);
+            }
+            else
+            {
+                intSend_.resize(count_,
+                                1);
+                // If every member's values are within range/members, the sums cannot overflow.
+                const double members = std::max<double>(options_.ensembleSize,
+                                                        1.);
+                for (size_t i = 0;i < size_;++i)
+                {
+                    const double scaled = std::round(values[i] * options_.fixedPointScale);
+                    if (!(std::abs(scaled) * members <= std::numeric_limits<std::int32_t>::max()))
+                    {
+                        throw gmxapi::ProtocolError("Value out of range for the fixed32 or delta reduce encoding. "
+                                                    "Use a smaller fixed point scale.");
+                    }
+                    intSend_[i] = static_cast<std::int32_t>(scaled);
+                }
+                intReceive_.resize(count_);
+            }
+        }
+
+        void finish()
+        {
+            // Get the result in the units of the caller's data.
+            std::vector<double> result(count_);
+            if (type_ == WireType::Float32)
+            {
+                for (size_t i = 0;i < count_;++i)
+                {
+                    // Exchanged as doubles, sums are rounded as by a single precision reduction.
+                    result[i] = native_ ? floatReceive_[i] : static_cast<float>(doubleReceive_.data()[i]);
+                }
+            }
+            else if (type_ == WireType::Int32)
+            {
+                for (size_t i = 0;i < count_;++i)
+                {
+                    result[i] = native_ ? intReceive_[i] : doubleReceive_.data()[i];
+                }
+                for (size_t i = 0;i < size_;++i)
+                {
+                    result[i] /= options_.fixedPointScale;
+                }
+            }
+            else
+            {
+                std::copy_n(doubleReceive_.data(),
+                            count_,
+                            result.begin());
+            }
+
+            if (keyFrame_)
+            {
+                options_.history->sent = std::move(sent_);
+                options_.history->reduced.assign(result.begin(),
+                                                 result.begin() + size_);
+            }
+            else if (options_.encoding == ReduceEncoding::Delta)
+            {
+                options_.history->sent = std::move(sent_);
+                auto& reduced = options_.history->reduced;
+                for (size_t i = 0;i < size_;++i)
+                {
+                    reduced[i] += result[i];
+                    result[i] = reduced[i];
+                }
+            }
+
+            double divisor{1.};
+            if (options_.operation == ReduceOperation::Mean)
+            {
+                divisor = result[size_];
+                if (!(divisor > 0))
+                {
+                    throw gmxapi::ProtocolError("Ensemble reduction did not count any ensemble members.");
+                }
+            }
+            for (size_t i = 0;i < size_;++i)
+            {
+                receive_->data()[i] = result[i] / divisor;
+            }
+        }
+
+        const void* sendBuffer() const
+        {
+            switch (type_)
+            {
+                case WireType::Float32:
+                    return floatSend_.data();
+                case WireType::Int32:
+                    return intSend_.data();
+                default:
+                    return doubleSend_.data();
+            }
+        }
+
+        void* receiveBuffer()
+        {
+            switch (type_)
+            {
+                case WireType::Float32:
+                    return floatReceive_.data();
+                case WireType::Int32:
+                    return intReceive_.data();
+                default:
+                    return doubleReceive_.data();
+            }
+        }
+
+        Matrix<double>* receive_;
+        ReduceOptions options_;
+        size_t size_;
+        size_t count_;
+        /// Whether this starts a Delta sequence, exchanging the values themselves.
+        bool keyFrame_;
+        WireType type_;
+        /// Whether the exchange uses the wire type instead of doubles.
+        bool native_{false};
+        /// Delta history sent by this member once the exchange completes.
+        std::vector<double> sent_;
+
+        Matrix<double> doubleSend_;
+        Matrix<double> doubleReceive_;
+        std::vector<float> floatSend_;
+        std::vector<float> floatReceive_;
+        std::vector<std::int32_t> intSend_;
+        std::vector<std::int32_t> intReceive_;
+
+        /// Exchange in progress. Destroyed before the buffers it uses.
+        ReduceRequest request_;
+};
+
+} // end anonymous namespace
+
+ReduceEncoding reduceEncodingFromString(const std::string& name)
+{
+    if (name == "float64")
+    {
+        return ReduceEncoding::Float64;
+    }
+    else if (name == "float32")
+    {
+        return ReduceEncoding::Float32;
+    }
+    else if (name == "fixed32")
+    {
+        return ReduceEncoding::Fixed32;
+    }
+    else if (name == "delta")
+    {
+        return ReduceEncoding::Delta;
+    }
+    throw gmxapi::UsageError("Unknown reduce encoding '" + name
+                             + "'. Expected 'float64', 'float32', 'fixed32', or 'delta'.");
+}
+
 void ResourcesHandle::reduce(const Matrix<double>& send,
                              Matrix<double>* receive) const
 {
@@ -37,9 +333,63 @@ void ResourcesHandle::reduce(const Matrix<double>& send,
     }
 }
 
+ReduceRequest ResourcesHandle::startReduce(const Matrix<double>& send,
+                                           Matrix<double>* receive) const
+{
+    if (startReduce_ && *startReduce_)
+    {
+        return (*startReduce_)(send,
+                               receive);
+    }
+    reduce(send,
+           receive);
+    return {};
+}
+
+void ResourcesHandle::reduce(const Matrix<double>& send,
+                             Matrix<double>* receive,
+                             const ReduceOptions& options) const
+{
+    startReduce(send,
+                receive,
+                options).wait();
+}
+
+ReduceRequest ResourcesHandle::startReduce(const Matrix<double>& send,
+                                           Matrix<double>* receive,
+                                           const ReduceOptions& options) const
+{
+    if (options.operation == ReduceOperation::Sum && options.encoding == ReduceEncoding::Float64)
+    {
+        return startReduce(send,
+                           receive);
+    }
+    if (receive == nullptr || receive->rows() * receive->cols() != send.rows() * send.cols())
+    {
+        throw gmxapi::ProtocolError("Ensemble reduction requires send and receive buffers of the same size.");
+    }
+    if (options.encoding == ReduceEncoding::Delta && options.history == nullptr)
+    {
+        throw gmxapi::UsageError("The delta reduce encoding requires a ReduceHistory.");
+    }
+    auto sized = options;
+    if (sized.ensembleSize == 0)
+    {
+        sized.ensembleSize = ensembleSize_;
+    }
+    auto operation = std::make_unique<EncodedReduction>(send,
+                                                        receive,
+                                                        sized);
+    operation->start(*this);
+    return ReduceRequest(std::move(operation));
+}
+
 void ResourcesHandle::stop()
 {
-    assert(session_);
+    if (!session_)
+    {
+        throw gmxapi::ProtocolError("Resources::setSession() must be called before a stop signal can be issued.");
+    }
     auto signaller = gmxapi::getMdrunnerSignal(session_,
                                                gmxapi::md::signals::STOP);
 
@@ -47,6 +397,168 @@ void ResourcesHandle::stop()
     signaller();
 }
 
+bool ReduceRequest::test()
+{
+    if (!operation_)
+    {
+        return true;
+    }
+    bool complete{false};
+    try
+    {
+        complete = operation_->test();
+    }
+    catch (...)
+    {
+        operation_.reset();
+        throw;
+    }
+    if (complete)
+    {
+        operation_.reset();
+    }
+    return complete;
+}
+
+void ReduceRequest::wait()
+{
+    if (operation_)
+    {
+        // Complete, whether or not the reduction succeeds.
+        const auto operation = std::move(operation_);
+        operation->wait();
+    }
+}
+
+ReduceCoordinator::ReduceCoordinator(reduce_type reduce) :
+    reduce_{std::move(reduce)}
+{
+    if (!reduce_)
+    {
+        throw gmxapi::ProtocolError("ReduceCoordinator requires a reduce function.");
+    }
+}
+
+void ReduceCoordinator::beginUpdate(double t)
+{
+    bool stale{false};
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stale = !queue_.empty() && t > queueTime_;
+    }
+    if (stale)
+    {
+        flush();
+    }
+}
+
+void ReduceCoordinator::enqueue(const void* owner,
+                                const Matrix<double>* send,
+                                Matrix<double>* receive,
+                                double t,
+                                completion_type onComplete,
+                                ReduceOperation operation)
+{
+    assert(send && receive);
+    if (receive->rows() * receive->cols() != send->rows() * send->cols())
+    {
+        throw gmxapi::ProtocolError("Ensemble reduction requires send and receive buffers of the same size.");
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back({owner, send, receive, std::move(onComplete), operation});
+    queueTime_ = t;
+}
+
+void ReduceCoordinator::flush()
+{
+    std::vector<Request> requests;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        requests.swap(queue_);
+    }
+    if (requests.empty())
+    {
+        return;
+    }
+
+    size_t total{0};
+    bool mean{false};
+    for (const auto& request : requests)
+    {
+        total += request.send->rows() * request.send->cols();
+        mean = mean || request.operation == ReduceOperation::Mean;
+    }
+    std::vector<double> packed;
+    packed.reserve(total + 1);
+    for (const auto& request : requests)
+    {
+        const auto data = request.send->data();
+        packed.insert(packed.end(),
+                      data,
+                      data + request.send->rows() * request.send->cols());
+    }
+    if (mean)
+    {
+        // Each member counts itself.
+        packed.push_back(1.);
+    }
+    const auto packedSize = packed.size();
+    Matrix<double> send{std::move(packed)};
+    Matrix<double> receive{1,
+                           packedSize};
+    reduce_(send,
+            &receive);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++collectives_;
+    }
+
+    const double members = mean ? receive.data()[total] : 1.;
+    if (!(members > 0))
+    {
+        throw gmxapi::ProtocolError("Ensemble reduction did not count any ensemble members.");
+    }
+    const double* result = receive.data();
+    for (const auto& request : requests)
+    {
+        const auto size = request.receive->rows() * request.receive->cols();
+        const double divisor = request.operation == ReduceOperation::Mean ? members : 1.;
+        std::transform(result,
+                       result + size,
+                       request.receive->data(),
+                       [divisor](double value) { return value / divisor; });
+        result += size;
+    }
+    for (const auto& request : requests)
+    {
+        if (request.onComplete)
+        {
+            request.onComplete();
+        }
+    }
+}
+
+void ReduceCoordinator::withdraw(const void* owner)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.erase(std::remove_if(queue_.begin(),
+                                queue_.end(),
+                                [owner](const Request& request) { return request.owner == owner; }),
+                 queue_.end());
+}
+
+size_t ReduceCoordinator::pending() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+}
+
+size_t ReduceCoordinator::collectives() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return collectives_;
+}
+
 ResourcesHandle Resources::getHandle() const
 {
     auto handle = ResourcesHandle();
@@ -56,11 +568,11 @@ ResourcesHandle Resources::getHandle() const
         throw gmxapi::ProtocolError("reduce operation functor is not set, which should not happen...");
     }
     handle.reduce_ = &reduce_;
+    handle.startReduce_ = &startReduce_;
+    handle.wireReduce_ = &wireReduce_;
+    handle.ensembleSize_ = ensembleSize_;
 
-    if (!session_)
-    {
-        throw gmxapi::ProtocolError("Resources::getHandle() must not be called before setSession() has been called.");
-    }
+    // Reductions do not need the Session, so ensembles can be served without one. Only stop() checks for it.
     handle.session_ = session_;
 
     return handle;
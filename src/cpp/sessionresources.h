@@ -12,6 +12,7 @@
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <vector>
 
 #include "gmxapi/gromacsfwd.h"
@@ -25,6 +26,11 @@
 namespace plugin
 {
 
+class Arena;
+class HistogramLog;
+class StepScheduler;
+class UpdateCoordinator;
+
 // Stop-gap for cross-language data exchange pending SharedData implementation and inclusion of Eigen.
 // Adapted from pybind docs.
 template<class T>
@@ -53,6 +59,9 @@ class Matrix
         T* data()
         { return data_.data(); };
 
+        const T* data() const
+        { return data_.data(); };
+
         size_t rows() const
         { return rows_; }
 
@@ -65,10 +74,158 @@ class Matrix
         std::vector<T> data_;
 };
 
-// Defer implicit instantiation to ensemblepotential.cpp
+// Defer implicit instantiation to sessionresources.cpp
 extern template
 class Matrix<double>;
 
+extern template
+class Matrix<float>;
+
+/*!
+ * \brief Arithmetic applied across the ensemble by a reduction.
+ */
+enum class ReduceOperation
+{
+    /// Sum over ensemble members.
+    Sum,
+    /// Sum divided by the number of ensemble members.
+    Mean
+};
+
+/*!
+ * \brief Representation of reduced data while it is exchanged between ensemble members.
+ *
+ * Encodings other than Float64 halve the size of the exchange if the Context provides a reduction
+ * for the wire type (see Resources::setWireReduce()). Otherwise the encoded values are exchanged as
+ * doubles, with the same result.
+ */
+enum class ReduceEncoding
+{
+    /// Exact double precision values.
+    Float64,
+    /// Single precision values and sums, with a relative error around 1e-7.
+    Float32,
+    /// 32-bit integer multiples of 1/fixedPointScale. The sum is exact, so it does not depend on the
+    /// order in which ensemble members are added, but it must not overflow.
+    Fixed32,
+    /// Change from the previous reduction of the same data, as a 32-bit integer multiple of
+    /// 1/fixedPointScale. Like Fixed32, but only the scaled changes must fit in an integer, so data
+    /// that varies slowly can use a much finer resolution. Each member carries its rounding error
+    /// into the next change, so errors do not accumulate. The first reduction of a ReduceHistory
+    /// exchanges the values as doubles.
+    Delta
+};
+
+/*!
+ * \brief Get the reduce encoding named by a user-provided string.
+ *
+ * \param name one of "float64", "float32", "fixed32", or "delta".
+ * \return the named encoding.
+ * \throws gmxapi::UsageError if the name is not recognized.
+ */
+ReduceEncoding reduceEncodingFromString(const std::string& name);
+
+/*!
+ * \brief Element type exchanged by a wire reduction.
+ */
+enum class WireType
+{
+    Float64,
+    Float32,
+    Int32
+};
+
+/*!
+ * \brief State of a sequence of reductions of the same data with the Delta encoding.
+ *
+ * Every ensemble member must start from an empty history and use it for one sequence only. Clear
+ * it on all members if a reduction fails.
+ */
+struct ReduceHistory
+{
+    /// Sum of the rounded changes sent by this member.
+    std::vector<double> sent;
+    /// Sum of the reduced changes.
+    std::vector<double> reduced;
+};
+
+/*!
+ * \brief Options for ResourcesHandle::reduce() and ResourcesHandle::startReduce().
+ */
+struct ReduceOptions
+{
+    ReduceOperation operation{ReduceOperation::Sum};
+    ReduceEncoding encoding{ReduceEncoding::Float64};
+    /// Fixed32 and Delta resolution. Scaled sums over the ensemble must stay within the range of a 32-bit integer.
+    double fixedPointScale{1048576.};
+    /// Number of ensemble members, or zero if unknown. If known, Fixed32 and Delta check that no sum
+    /// over the ensemble can overflow, rather than only the values of this member.
+    size_t ensembleSize{0};
+    /// Required by the Delta encoding.
+    ReduceHistory* history{nullptr};
+};
+
+/*!
+ * \brief Handle to an ensemble reduction that may still be in progress.
+ *
+ * Returned by ResourcesHandle::startReduce(). The receive buffer may be written until test() has
+ * returned true or wait() has returned, and neither buffer may be modified or destroyed before then.
+ * A default constructed request is complete. Destroying a request that is not complete waits for it.
+ */
+class ReduceRequest
+{
+    public:
+        /*!
+         * \brief Backend implementation of an ensemble reduction in progress.
+         *
+         * Destroying an Operation that has not completed must wait for it to complete.
+         */
+        class Operation
+        {
+            public:
+                virtual ~Operation() = default;
+
+                /// Check for completion without blocking.
+                virtual bool test() = 0;
+
+                /// Block until complete.
+                virtual void wait() = 0;
+        };
+
+        ReduceRequest() = default;
+
+        /*!
+         * \brief Take ownership of a reduction started by a backend.
+         */
+        explicit ReduceRequest(std::unique_ptr<Operation> operation) :
+            operation_{std::move(operation)}
+        {}
+
+        /*!
+         * \brief Check whether the reduction has completed, without blocking.
+         *
+         * \return true once the receive buffer holds the result.
+         * \throws gmxapi::ProtocolError if the reduction failed. The request is then complete.
+         */
+        bool test();
+
+        /*!
+         * \brief Block until the reduction has completed.
+         *
+         * \throws gmxapi::ProtocolError if the reduction failed. The request is then complete.
+         */
+        void wait();
+
+        /*!
+         * \brief Whether the request is known to be complete, without checking on the backend.
+         */
+        bool done() const
+        { return operation_ == nullptr; }
+
+    private:
+        std::unique_ptr<Operation> operation_;
+};
+
 /*!
  * \brief An active handle to ensemble resources provided by the Context.
  *
@@ -117,11 +274,50 @@ class ResourcesHandle
         void reduce(const Matrix<double>& send,
                     Matrix<double>* receive) const;
 
+        /*!
+         * \brief Start an ensemble reduce without waiting for the other ensemble members.
+         *
+         * Every ensemble member must start the same reductions in the same order. If the Context
+         * provides no non-blocking reduction, the reduction is performed before returning and the
+         * request is already complete.
+         *
+         * \param send Matrix to be summed across the ensemble. Must not be modified until the request completes.
+         * \param receive destination of the sum. Must stay valid until the request completes.
+         * \return request with which to check for or wait for completion.
+         */
+        ReduceRequest startReduce(const Matrix<double>& send,
+                                  Matrix<double>* receive) const;
+
+        /*!
+         * \brief Ensemble reduce with a choice of operation and wire encoding.
+         *
+         * \param send Matrix to be reduced across the ensemble.
+         * \param receive destination of the result, of the same size as send.
+         * \param options operation, encoding, and, for the Delta encoding, the history of send.
+         * \throws gmxapi::UsageError if the Delta encoding is requested without a history.
+         * \throws gmxapi::ProtocolError if the matrices differ in size or a fixed-point value is out of range.
+         */
+        void reduce(const Matrix<double>& send,
+                    Matrix<double>* receive,
+                    const ReduceOptions& options) const;
+
+        /*!
+         * \brief Start an ensemble reduce with a choice of operation and wire encoding.
+         *
+         * Combines startReduce() with the options of reduce(). receive is written, and the history
+         * updated, when the request completes.
+         */
+        ReduceRequest startReduce(const Matrix<double>& send,
+                                  Matrix<double>* receive,
+                                  const ReduceOptions& options) const;
+
         /*!
          * \brief Issue a stop condition event.
          *
          * Can be called on any or all ranks. Sets a condition that will cause the current simulation to shut down
          * after the current step.
+         *
+         * \throws gmxapi::ProtocolError if the Resources have no Session.
          */
         void stop();
 
@@ -129,9 +325,112 @@ class ResourcesHandle
         const std::function<void(const Matrix<double>&,
                                  Matrix<double>*)>* reduce_;
 
+        const std::function<ReduceRequest(const Matrix<double>&,
+                                          Matrix<double>*)>* startReduce_;
+
+        const std::function<ReduceRequest(WireType,
+                                          const void*,
+                                          void*,
+                                          size_t)>* wireReduce_;
+
+        /// Number of ensemble members, or zero if unknown.
+        size_t ensembleSize_;
+
         gmxapi::SessionResources* session_;
 };
 
+/*!
+ * \brief Combine the ensemble reductions of many restraints into one collective.
+ *
+ * Collectives across nodes are latency bound, so reducing each restraint's window separately costs
+ * about as many collectives as there are restraints. Restraints that share a ReduceCoordinator
+ * instead enqueue their buffers. flush() packs the queued buffers into one Matrix, performs one
+ * reduction, and scatters the result back into the receive buffers in queue order. Restraints
+ * reach their window boundaries in the same order on every ensemble member, so the packed layout
+ * matches across the ensemble. If any request asks for a Mean, one more element counts the members.
+ * Combined reductions always use the Float64 encoding.
+ *
+ * The first beginUpdate() call of a later time step flushes the queue, so when restraints are
+ * updated one after another (without an UpdateCoordinator), their reductions complete, and their
+ * completion callbacks run, one MD step after the window boundary. An UpdateCoordinator flushes
+ * the queue after the reduce phase of its updates instead.
+ *
+ * Thread safe, but flush() must be called on the thread allowed to perform the reduction.
+ */
+class ReduceCoordinator
+{
+    public:
+        using reduce_type = std::function<void(const Matrix<double>&,
+                                               Matrix<double>*)>;
+        using completion_type = std::function<void()>;
+
+        /*!
+         * \brief Create a coordinator.
+         *
+         * \param reduce ensemble reduction (sum) for the packed buffer.
+         */
+        explicit ReduceCoordinator(reduce_type reduce);
+
+        /*!
+         * \brief Flush reductions queued at an earlier time.
+         */
+        void beginUpdate(double t);
+
+        /*!
+         * \brief Queue a reduction.
+         *
+         * \param owner key with which the request can be withdrawn.
+         * \param send data to reduce. Must stay valid until flushed or withdrawn.
+         * \param receive buffer of the same shape to receive the sum. Must stay valid until flushed or withdrawn.
+         * \param t simulation time.
+         * \param onComplete called after receive has been written, if provided.
+         * \param operation Sum, or Mean to divide by the number of ensemble members.
+         */
+        void enqueue(const void* owner,
+                     const Matrix<double>* send,
+                     Matrix<double>* receive,
+                     double t,
+                     completion_type onComplete = {},
+                     ReduceOperation operation = ReduceOperation::Sum);
+
+        /*!
+         * \brief Perform all queued reductions with a single call of the reduce function.
+         */
+        void flush();
+
+        /*!
+         * \brief Drop queued reductions of an owner that is about to be destroyed.
+         */
+        void withdraw(const void* owner);
+
+        /*!
+         * \brief Number of queued reductions.
+         */
+        size_t pending() const;
+
+        /*!
+         * \brief Number of reduce calls made so far.
+         */
+        size_t collectives() const;
+
+    private:
+        struct Request
+        {
+            const void* owner;
+            const Matrix<double>* send;
+            Matrix<double>* receive;
+            completion_type onComplete;
+            ReduceOperation operation;
+        };
+
+        reduce_type reduce_;
+
+        mutable std::mutex mutex_;
+        std::vector<Request> queue_;
+        double queueTime_{0};
+        size_t collectives_{0};
+};
+
 /*!
  * \brief Reference to workflow-level resources managed by the Context.
  *
@@ -144,13 +443,20 @@ class ResourcesHandle
 class Resources
 {
     public:
+        using async_reduce_type = std::function<ReduceRequest(const Matrix<double>&,
+                                                              Matrix<double>*)>;
+        using wire_reduce_type = std::function<ReduceRequest(WireType,
+                                                             const void*,
+                                                             void*,
+                                                             size_t)>;
+
         /*!
          * \brief Create a new resources object.
          *
          * This constructor is called by the framework during Session launch to provide the plugin
          * potential with external resources.
          *
-         * \note If getHandle() is going to be used, setSession() must be called first.
+         * \note If ResourcesHandle::stop() is going to be used, setSession() must be called first.
          *
          * \param reduce ownership of a function object providing ensemble averaging of a 2D matrix.
          */
@@ -167,7 +473,7 @@ class Resources
          * calculate() and callback() functions get a handle to the resources for the current time step
          * by calling getHandle().
          *
-         * \note setSession() must be called before this function can be used.
+         * \note setSession() must be called before ResourcesHandle::stop() can be used.
          * This clumsy protocol requires other infrastructure before it can be
          * cleaned up for gmxapi 0.1
          *
@@ -185,13 +491,160 @@ class Resources
          */
         void setSession(gmxapi::SessionResources* session);
 
+        /*!
+         * \brief Provide a non-blocking version of the ensemble reduce.
+         *
+         * \param startReduce function starting the same reduction as the reduce function of the
+         *        constructor and returning a request for its completion, or an empty function to
+         *        complete reductions started with ResourcesHandle::startReduce() immediately (the default).
+         */
+        void setAsyncReduce(async_reduce_type startReduce)
+        { startReduce_ = std::move(startReduce); }
+
+        /*!
+         * \brief Provide a non-blocking ensemble sum for each WireType.
+         *
+         * \param wireReduce function starting the sum of count elements of the given type from
+         *        send into receive, or an empty function to exchange encoded values as doubles
+         *        through the reduce functions (the default).
+         */
+        void setWireReduce(wire_reduce_type wireReduce)
+        { wireReduce_ = std::move(wireReduce); }
+
+        /*!
+         * \brief Share a coordinator for the window updates of restraints using these resources.
+         *
+         * \param coordinator coordinator shared by the restraints of a simulation, or nullptr to
+         *        update each restraint synchronously (the default).
+         */
+        void setUpdateCoordinator(std::shared_ptr<UpdateCoordinator> coordinator)
+        { updateCoordinator_ = std::move(coordinator); }
+
+        /*!
+         * \brief Get the update coordinator, if any.
+         */
+        const std::shared_ptr<UpdateCoordinator>& updateCoordinator() const
+        { return updateCoordinator_; }
+
+        /*!
+         * \brief Share a coordinator to combine the ensemble reductions of restraints using these resources.
+         *
+         * \param coordinator coordinator shared by the restraints of a simulation, or nullptr to
+         *        reduce each restraint's window separately (the default).
+         */
+        void setReduceCoordinator(std::shared_ptr<ReduceCoordinator> coordinator)
+        { reduceCoordinator_ = std::move(coordinator); }
+
+        /*!
+         * \brief Get the reduce coordinator, if any.
+         */
+        const std::shared_ptr<ReduceCoordinator>& reduceCoordinator() const
+        { return reduceCoordinator_; }
+
+        /*!
+         * \brief Share an arena for the state of restraints created with these resources.
+         *
+         * \param arena arena shared by the restraints of a simulation, or nullptr to use the heap (the default).
+         */
+        void setArena(std::shared_ptr<Arena> arena)
+        { arena_ = std::move(arena); }
+
+        /*!
+         * \brief Get the arena, if any.
+         */
+        const std::shared_ptr<Arena>& arena() const
+        { return arena_; }
+
+        /*!
+         * \brief Share a schedule of restraint events on integer MD steps.
+         *
+         * \param scheduler scheduler shared by the restraints of a simulation, or nullptr to
+         *        schedule events by simulation time (the default).
+         */
+        void setStepScheduler(std::shared_ptr<StepScheduler> scheduler)
+        { stepScheduler_ = std::move(scheduler); }
+
+        /*!
+         * \brief Get the step scheduler, if any.
+         */
+        const std::shared_ptr<StepScheduler>& stepScheduler() const
+        { return stepScheduler_; }
+
+        /*!
+         * \brief Share a log of the windows and histograms of restraints using these resources.
+         *
+         * \param log log shared by the restraints of a simulation, or nullptr not to log (the default).
+         */
+        void setHistogramLog(std::shared_ptr<HistogramLog> log)
+        { histogramLog_ = std::move(log); }
+
+        /*!
+         * \brief Get the histogram log, if any.
+         */
+        const std::shared_ptr<HistogramLog>& histogramLog() const
+        { return histogramLog_; }
+
+        /*!
+         * \brief Declare the number of ensemble members.
+         *
+         * \param size number of members, or zero if unknown (the default). If known, reductions with
+         *        the Fixed32 and Delta encodings check that sums over the ensemble cannot overflow.
+         */
+        void setEnsembleSize(size_t size)
+        { ensembleSize_ = size; }
+
     private:
         //! bound function object to provide ensemble reduce facility.
         std::function<void(const Matrix<double>&,
                            Matrix<double>*)> reduce_;
 
+        //! Optional non-blocking ensemble reduce.
+        async_reduce_type startReduce_;
+
+        //! Optional reduce for encoded data.
+        wire_reduce_type wireReduce_;
+
+        //! Number of ensemble members, or zero if unknown.
+        size_t ensembleSize_{0};
+
         // Raw pointer to the session in which these resources live.
         gmxapi::SessionResources* session_;
+
+        //! Optional coordinator for window updates.
+        std::shared_ptr<UpdateCoordinator> updateCoordinator_;
+
+        //! Optional coordinator for ensemble reductions.
+        std::shared_ptr<ReduceCoordinator> reduceCoordinator_;
+
+        //! Optional arena for restraint state.
+        std::shared_ptr<Arena> arena_;
+
+        //! Optional schedule of restraint events.
+        std::shared_ptr<StepScheduler> stepScheduler_;
+
+        //! Optional log of windows and histograms.
+        std::shared_ptr<HistogramLog> histogramLog_;
+};
+
+/*!
+ * \brief Create restraint instances for RestraintModule.
+ *
+ * The default constructs an R directly. Specialize for restraint interfaces whose implementation
+ * is chosen at run time from the parameters.
+ *
+ * \tparam R a class implementing the gmx::IRestraintPotential interface.
+ */
+template<class R>
+struct RestraintFactory
+{
+    static std::shared_ptr<R> create(std::vector<int> sites,
+                                     const typename R::input_param_type& params,
+                                     std::shared_ptr<Resources> resources)
+    {
+        return std::make_shared<R>(std::move(sites),
+                                   params,
+                                   std::move(resources));
+    }
 };
 
 /*!
@@ -267,13 +720,24 @@ class RestraintModule : public gmxapi::MDModule // consider names
             std::lock_guard<std::mutex> lock(restraintInstantiation_);
             if (!restraint_)
             {
-                restraint_ = std::make_shared<R>(sites_,
-                                                 params_,
-                                                 resources_);
+                restraint_ = RestraintFactory<R>::create(sites_,
+                                                         params_,
+                                                         resources_);
             }
             return restraint_;
         }
 
+        /*!
+         * \brief Get the restraint instance without creating it.
+         *
+         * \return the instance created by getRestraint(), or nullptr before the simulation is launched.
+         */
+        std::shared_ptr<R> instance()
+        {
+            std::lock_guard<std::mutex> lock(restraintInstantiation_);
+            return restraint_;
+        }
+
     private:
         std::vector<int> sites_;
         param_t params_;
@@ -340,14 +804,19 @@ class RAIIFile
          * object destructor is called exactly once if it needs to be shared.
          *
          * Refer to documentation on fclose() on checking for and interpreting `errno`.
+         *
+         * \return zero on success or if the file was not open, or EOF if fclose() failed, in which
+         *         case buffered data may not have been written.
          */
-        void close()
+        int close()
         {
+            int result{0};
             if (fh_ != nullptr)
             {
-                fclose(fh_);
+                result = fclose(fh_);
             }
             fh_ = nullptr;
+            return result;
         }
 
         /*!
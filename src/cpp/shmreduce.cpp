@@ -0,0 +1,328 @@
+/*! \file
+ * \brief Code to implement the shared memory reduction declared in shmreduce.h
+ */
+
+#include "shmreduce.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+
+#include "gmxapi/exceptions.h"
+
+namespace plugin
+{
+
+namespace
+{
+
+// Atomics in the segment are shared between processes, which requires them to be lock-free.
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+              "SharedMemoryReduce requires lock-free atomic integers.");
+
+/// Separate the counters written by different members.
+constexpr std::size_t cacheLine = 64;
+
+/*!
+ * \brief Control block at the start of the segment.
+ *
+ * A new segment is filled with zeros, which is the initial state of the counters.
+ */
+struct Header
+{
+    /// Written by the leader before it attaches, and checked by the other members once all have attached.
+    std::uint64_t localSize;
+    std::uint64_t capacity;
+    std::uint32_t hierarchical;
+    std::atomic<std::uint32_t> attached;
+    /// Set by the leader if the reduction between nodes failed, and cleared at the next piece.
+    alignas(cacheLine) std::atomic<std::uint32_t> failed;
+    alignas(cacheLine) std::atomic<std::uint32_t> arrived;
+    alignas(cacheLine) std::atomic<std::uint32_t> generation;
+};
+
+/// Round bytes up to whole cache lines.
+std::size_t roundUp(std::size_t bytes)
+{
+    return (bytes + cacheLine - 1) / cacheLine * cacheLine;
+}
+
+/// Spin briefly, then yield, until ready() returns true.
+template<typename F>
+void waitUntil(F ready)
+{
+    for (int spin = 0;!ready();++spin)
+    {
+        if (spin > 1000)
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+} // end anonymous namespace
+
+/*!
+ * \brief Mapping of the segment shared by the members of a node.
+ *
+ * The segment holds, for each of two generations of reductions, one slot per member and a slot for
+ * the result. Alternating generations lets a member begin the next reduction while others still
+ * read the result of the previous one.
+ */
+class SharedMemoryReduce::Segment
+{
+    public:
+        Segment(const std::string& name,
+                int localRank,
+                int localSize,
+                std::size_t capacity,
+                bool hierarchical) :
+            localRank_{localRank},
+            localSize_{localSize},
+            capacity_{capacity},
+            slotSize_{roundUp(capacity * sizeof(double))},
+            bytes_{roundUp(sizeof(Header)) + 2 * (localSize + 1) * slotSize_}
+        {
+            const int fd = shm_open(name.c_str(),
+                                    O_CREAT | O_RDWR,
+                                    S_IRUSR | S_IWUSR);
+            if (fd < 0)
+            {
+                throw gmxapi::ProtocolError("Could not open shared memory segment " + name + ": "
+                                            + std::strerror(errno));
+            }
+            if (ftruncate(fd,
+                          static_cast<off_t>(bytes_)) != 0)
+            {
+                const int error = errno;
+                close(fd);
+                throw gmxapi::ProtocolError("Could not size shared memory segment " + name + ": "
+                                            + std::strerror(error));
+            }
+            void* data = mmap(nullptr,
+                              bytes_,
+                              PROT_READ | PROT_WRITE,
+                              MAP_SHARED,
+                              fd,
+                              0);
+            close(fd);
+            if (data == MAP_FAILED)
+            {
+                throw gmxapi::ProtocolError("Could not map shared memory segment " + name + ": "
+                                            + std::strerror(errno));
+            }
+            data_ = static_cast<char*>(data);
+            header_ = reinterpret_cast<Header*>(data_);
+
+            if (localRank_ == 0)
+            {
+                header_->localSize = static_cast<std::uint64_t>(localSize);
+                header_->capacity = capacity;
+                header_->hierarchical = hierarchical ? 1 : 0;
+            }
+            header_->attached.fetch_add(1,
+                                        std::memory_order_acq_rel);
+            waitUntil([this]() {
+                return header_->attached.load(std::memory_order_acquire)
+                       >= static_cast<std::uint32_t>(localSize_);
+            });
+            if (localRank_ == 0)
+            {
+                shm_unlink(name.c_str());
+            }
+            if (header_->attached.load(std::memory_order_acquire) != static_cast<std::uint32_t>(localSize_)
+                || header_->localSize != static_cast<std::uint64_t>(localSize_)
+                || header_->capacity != capacity_)
+            {
+                munmap(data_,
+                       bytes_);
+                throw gmxapi::ProtocolError("Shared memory segment " + name
+                                            + " is in use or was created with different parameters.");
+            }
+            hierarchical_ = header_->hierarchical != 0;
+        }
+
+        ~Segment()
+        {
+            munmap(data_,
+                   bytes_);
+        }
+
+        Segment(const Segment&) = delete;
+
+        Segment& operator=(const Segment&) = delete;
+
+        /// Wait for all members of the node (centralized barrier with a generation count).
+        void barrier()
+        {
+            const auto generation = header_->generation.load(std::memory_order_acquire);
+            if (header_->arrived.fetch_add(1,
+                                           std::memory_order_acq_rel) + 1 == static_cast<std::uint32_t>(localSize_))
+            {
+                header_->arrived.store(0,
+                                       std::memory_order_relaxed);
+                header_->generation.fetch_add(1,
+                                              std::memory_order_acq_rel);
+            }
+            else
+            {
+                waitUntil([this, generation]() {
+                    return header_->generation.load(std::memory_order_acquire) != generation;
+                });
+            }
+        }
+
+        /// Slot of a member in a generation. The result is in slot localSize.
+        double* slot(unsigned int parity,
+                     int member)
+        {
+            return reinterpret_cast<double*>(data_ + roundUp(sizeof(Header))
+                                             + (parity * (localSize_ + 1) + member) * slotSize_);
+        }
+
+        Header* header()
+        { return header_; }
+
+        int localRank_;
+        int localSize_;
+        std::size_t capacity_;
+        bool hierarchical_{false};
+        /// Number of pieces reduced so far, identical on all members.
+        unsigned long pieces_{0};
+
+    private:
+        std::size_t slotSize_;
+        std::size_t bytes_;
+        char* data_{nullptr};
+        Header* header_{nullptr};
+};
+
+SharedMemoryReduce::SharedMemoryReduce(const std::string& name,
+                                       int localRank,
+                                       int localSize,
+                                       std::size_t capacity,
+                                       reduce_type interNodeReduce) :
+    interNodeReduce_{std::move(interNodeReduce)}
+{
+    if (localSize < 1 || localRank < 0 || localRank >= localSize || capacity == 0)
+    {
+        throw gmxapi::UsageError("SharedMemoryReduce requires 0 <= localRank < localSize and a nonzero capacity.");
+    }
+    if (localRank != 0 && interNodeReduce_)
+    {
+        throw gmxapi::UsageError("Only the node leader (local rank 0) reduces between nodes.");
+    }
+    segment_ = std::make_shared<Segment>(name,
+                                         localRank,
+                                         localSize,
+                                         capacity,
+                                         bool(interNodeReduce_));
+}
+
+void SharedMemoryReduce::operator()(const Matrix<double>& send,
+                                    Matrix<double>* receive) const
+{
+    if (receive == nullptr || receive->rows() * receive->cols() != send.rows() * send.cols())
+    {
+        throw gmxapi::ProtocolError("Ensemble reduction requires send and receive buffers of the same size.");
+    }
+    auto& segment = *segment_;
+    const auto size = send.rows() * send.cols();
+    const int members = segment.localSize_;
+
+    for (std::size_t offset = 0;offset < size;offset += segment.capacity_)
+    {
+        const auto count = std::min(segment.capacity_,
+                                    size - offset);
+        const auto parity = static_cast<unsigned int>(segment.pieces_++ & 1);
+        std::copy_n(send.data() + offset,
+                    count,
+                    segment.slot(parity,
+                                 segment.localRank_));
+        segment.barrier();
+        // Every member has read the flag of the previous piece before arriving here.
+        if (segment.localRank_ == 0)
+        {
+            segment.header()->failed.store(0,
+                                           std::memory_order_relaxed);
+        }
+
+        // Each member sums a stripe of the elements over all members.
+        double* result = segment.slot(parity,
+                                      members);
+        const auto begin = count * segment.localRank_ / members;
+        const auto end = count * (segment.localRank_ + 1) / members;
+        for (std::size_t i = begin;i < end;++i)
+        {
+            double sum{0};
+            for (int member = 0;member < members;++member)
+            {
+                sum += segment.slot(parity,
+                                    member)[i];
+            }
+            result[i] = sum;
+        }
+        segment.barrier();
+
+        if (segment.hierarchical_)
+        {
+            std::exception_ptr error;
+            if (segment.localRank_ == 0)
+            {
+                try
+                {
+                    Matrix<double> nodeSum{std::vector<double>(result,
+                                                               result + count)};
+                    Matrix<double> ensembleSum{1,
+                                               count};
+                    interNodeReduce_(nodeSum,
+                                     &ensembleSum);
+                    std::copy_n(ensembleSum.data(),
+                                count,
+                                result);
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                    segment.header()->failed.store(1,
+                                                   std::memory_order_release);
+                }
+            }
+            segment.barrier();
+            // The leader reports the actual error. The other members only know that it failed.
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+            if (segment.header()->failed.load(std::memory_order_acquire))
+            {
+                throw gmxapi::ProtocolError("Ensemble reduction between nodes failed.");
+            }
+        }
+        std::copy_n(result,
+                    count,
+                    receive->data() + offset);
+    }
+}
+
+int SharedMemoryReduce::localRank() const
+{
+    return segment_->localRank_;
+}
+
+int SharedMemoryReduce::localSize() const
+{
+    return segment_->localSize_;
+}
+
+} // end namespace plugin
@@ -0,0 +1,93 @@
+#ifndef RESTRAINT_SHMREDUCE_H
+#define RESTRAINT_SHMREDUCE_H
+
+/*! \file
+ * \brief Hierarchical ensemble reduction through POSIX shared memory, for use as the reduce function of Resources.
+ *
+ * When several ensemble members run on one node, each of them joining the global reduction costs
+ * as many inter-node messages as there are members. SharedMemoryReduce first sums the members of a
+ * node in a shared memory segment. Only the node leader takes part in the reduction between nodes,
+ * and the result is published back to the other members through the segment.
+ *
+ * This file is only compiled on POSIX systems (GMXAPI_EXTENSION_HAVE_SHM is then defined). With MPI,
+ * hierarchicalReduceFromFortran() in mpireduce.h sets up the members and leaders of each node.
+ */
+
+#include <cstddef>
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "sessionresources.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief Reduce function object summing a Matrix over the ensemble members of a node, then over nodes.
+ *
+ * Every member of the node must construct a SharedMemoryReduce with the same name, size, and
+ * capacity, and call it with matrices of the same size in the same order. Sums over the members of a
+ * node are formed in rank order, so they do not depend on timing. Copies share the mapping of the
+ * segment, which is unmapped with the last copy.
+ *
+ * Members wait for each other by spinning and then yielding, which suits members that each have
+ * their own cores, as MD simulations do.
+ */
+class SharedMemoryReduce
+{
+    public:
+        using reduce_type = std::function<void(const Matrix<double>&,
+                                               Matrix<double>*)>;
+
+        /*!
+         * \brief Attach to the shared memory segment of a node.
+         *
+         * Blocks until all localSize members have attached. The segment name is then removed, so it
+         * does not outlive the members, and a new set of members can reuse it.
+         *
+         * \param name POSIX shared memory name, such as "/restraints_job1234_node0". It must not
+         *        be in use by another set of members.
+         * \param localRank rank of this member on the node. Rank 0 is the node leader.
+         * \param localSize number of members on the node.
+         * \param capacity number of elements reduced at a time. Larger reductions are done in pieces.
+         * \param interNodeReduce sum over the node leaders, called on the leader only. Empty if the
+         *        whole ensemble shares the node.
+         * \throws gmxapi::UsageError if the arguments are inconsistent.
+         * \throws gmxapi::ProtocolError if the segment cannot be created or does not match.
+         */
+        SharedMemoryReduce(const std::string& name,
+                           int localRank,
+                           int localSize,
+                           std::size_t capacity = 65536,
+                           reduce_type interNodeReduce = {});
+
+        /*!
+         * \brief Sum send over the ensemble into receive.
+         *
+         * Collective over all members of all nodes.
+         *
+         * \throws gmxapi::ProtocolError if the matrices differ in size or the reduction between
+         *         nodes failed. In the latter case, the node leader rethrows the exception of
+         *         interNodeReduce instead, and all members can go on to the next reduction.
+         */
+        void operator()(const Matrix<double>& send,
+                        Matrix<double>* receive) const;
+
+        /// Rank of this member on the node.
+        int localRank() const;
+
+        /// Number of members on the node.
+        int localSize() const;
+
+    private:
+        class Segment;
+
+        std::shared_ptr<Segment> segment_;
+        reduce_type interNodeReduce_;
+};
+
+} // end namespace plugin
+
+#endif //RESTRAINT_SHMREDUCE_H
@@ -0,0 +1,575 @@
+#ifndef RESTRAINT_SIMD_H
+#define RESTRAINT_SIMD_H
+
+/*! \file
+ * \brief Thin SIMD wrappers for the restraint kernels.
+ *
+ * Only the handful of operations needed by the kernels in this directory are provided. The
+ * instruction set is chosen at compile time: AVX-512F, AVX2 with FMA, or portable scalar code.
+ *
+ * This header should only be included by translation units of the restraint library, which are
+ * all compiled with the same instruction set flags (see src/cpp/CMakeLists.txt).
+ */
+
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+#include <immintrin.h>
+#endif
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace plugin
+{
+
+/*!
+ * \brief SIMD operations for a scalar type.
+ *
+ * Specializations provide the vector type, its width, and element-wise operations. load() and
+ * store() require memory aligned to kernelAlignment (see alignedallocator.h).
+ *
+ * \tparam T scalar type
+ */
+template<typename T>
+struct SimdTraits;
+
+#if defined(__AVX512F__)
+
+template<>
+struct SimdTraits<double>
+{
+    using type = __m512d;
+    static constexpr std::size_t width = 8;
+
+    static type set1(double x)
+    { return _mm512_set1_pd(x); }
+
+    static type load(const double* p)
+    { return _mm512_load_pd(p); }
+
+    /// Load from memory with no alignment requirement.
+    static type loadu(const double* p)
+    { return _mm512_loadu_pd(p); }
+
+    static void store(double* p, type a)
+    { _mm512_store_pd(p, a); }
+
+    /// Store to memory with no alignment requirement.
+    static void storeu(double* p, type a)
+    { _mm512_storeu_pd(p, a); }
+
+    static type iota()
+    { return _mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0); }
+
+    static type add(type a, type b)
+    { return _mm512_add_pd(a, b); }
+
+    static type mul(type a, type b)
+    { return _mm512_mul_pd(a, b); }
+
+    /// a * b + c
+    static type fma(type a, type b, type c)
+    { return _mm512_fmadd_pd(a, b, c); }
+
+    static type sub(type a, type b)
+    { return _mm512_sub_pd(a, b); }
+
+    static type div(type a, type b)
+    { return _mm512_div_pd(a, b); }
+
+    static type sqrt(type a)
+    { return _mm512_sqrt_pd(a); }
+
+    /// a where b is not zero, and zero elsewhere.
+    static type whereNonzero(type a, type b)
+    { return _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(b, _mm512_setzero_pd(), _CMP_NEQ_UQ), a); }
+
+    /// a where b >= c, and zero elsewhere, including where b is NaN.
+    static type whereNotLess(type a, type b, type c)
+    { return _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(b, c, _CMP_GE_OQ), a); }
+
+    static type min(type a, type b)
+    { return _mm512_min_pd(a, b); }
+
+    static type max(type a, type b)
+    { return _mm512_max_pd(a, b); }
+
+    static type round(type a)
+    { return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+
+    static double sum(type a)
+    { return _mm512_reduce_add_pd(a); }
+
+    /// 2^n for integral-valued n in the normal range.
+    static type exp2i(type n)
+    {
+        // Adding 1.5 * 2^52 places the integer n in the low mantissa bits.
+        const type shifter = set1(6755399441055744.0);
+        const __m512i bits = _mm512_castpd_si512(_mm512_add_pd(n, shifter));
+        const __m512i biased = _mm512_sub_epi64(bits, _mm512_set1_epi64(0x4338000000000000LL - 1023));
+        return _mm512_castsi512_pd(_mm512_slli_epi64(biased, 52));
+    }
+};
+
+template<>
+struct SimdTraits<float>
+{
+    using type = __m512;
+    static constexpr std::size_t width = 16;
+
+    static type set1(float x)
+    { return _mm512_set1_ps(x); }
+
+    static type load(const float* p)
+    { return _mm512_load_ps(p); }
+
+    /// Load from memory with no alignment requirement.
+    static type loadu(const float* p)
+    { return _mm512_loadu_ps(p); }
+
+    static void store(float* p, type a)
+    { _mm512_store_ps(p, a); }
+
+    /// Store to memory with no alignment requirement.
+    static void storeu(float* p, type a)
+    { _mm512_storeu_ps(p, a); }
+
+    static type iota()
+    { return _mm512_set_ps(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0); }
+
+    static type add(type a, type b)
+    { return _mm512_add_ps(a, b); }
+
+    static type mul(type a, type b)
+    { return _mm512_mul_ps(a, b); }
+
+    /// a * b + c
+    static type fma(type a, type b, type c)
+    { return _mm512_fmadd_ps(a, b, c); }
+
+    static type sub(type a, type b)
+    { return _mm512_sub_ps(a, b); }
+
+    static type div(type a, type b)
+    { return _mm512_div_ps(a, b); }
+
+    static type sqrt(type a)
+    { return _mm512_sqrt_ps(a); }
+
+    /// a where b is not zero, and zero elsewhere.
+    static type whereNonzero(type a, type b)
+    { return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(b, _mm512_setzero_ps(), _CMP_NEQ_UQ), a); }
+
+    /// a where b >= c, and zero elsewhere, including where b is NaN.
+    static type whereNotLess(type a, type b, type c)
+    { return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(b, c, _CMP_GE_OQ), a); }
+
+    static type min(type a, type b)
+    { return _mm512_min_ps(a, b); }
+
+    static type max(type a, type b)
+    { return _mm512_max_ps(a, b); }
+
+    static type round(type a)
+    { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+
+    static float sum(type a)
+    { return _mm512_reduce_add_ps(a); }
+
+    /// 2^n for integral-valued n in the normal range.
+    static type exp2i(type n)
+    {
+        // Adding 1.5 * 2^23 places the integer n in the low mantissa bits.
+        const type shifter = set1(12582912.0f);
+        const __m512i bits = _mm512_castps_si512(_mm512_add_ps(n, shifter));
+        const __m512i biased = _mm512_sub_epi32(bits, _mm512_set1_epi32(0x4B400000 - 127));
+        return _mm512_castsi512_ps(_mm512_slli_epi32(biased, 23));
+    }
+};
+
+#elif defined(__AVX2__) && defined(__FMA__)
+
+template<>
+struct SimdTraits<double>
+{
+    using type = __m256d;
+    static constexpr std::size_t width = 4;
+
+    static type set1(double x)
+    { return _mm256_set1_pd(x); }
+
+    static type load(const double* p)
+    { return _mm256_load_pd(p); }
+
+    /// Load from memory with no alignment requirement.
+    static type loadu(const double* p)
+    { return _mm256_loadu_pd(p); }
+
+    static void store(double* p, type a)
+    { _mm256_store_pd(p, a); }
+
+    /// Store to memory with no alignment requirement.
+    static void storeu(double* p, type a)
+    { _mm256_storeu_pd(p, a); }
+
+    static type iota()
+    { return _mm256_set_pd(3, 2, 1, 0); }
+
+    static type add(type a, type b)
+    { return _mm256_add_pd(a, b); }
+
+    static type mul(type a, type b)
+    { return _mm256_mul_pd(a, b); }
+
+    /// a * b + c
+    static type fma(type a, type b, type c)
+    { return _mm256_fmadd_pd(a, b, c); }
+
+    static type sub(type a, type b)
+    { return _mm256_sub_pd(a, b); }
+
+    static type div(type a, type b)
+    { return _mm256_div_pd(a, b); }
+
+    static type sqrt(type a)
+    { return _mm256_sqrt_pd(a); }
+
+    /// a where b is not zero, and zero elsewhere.
+    static type whereNonzero(type a, type b)
+    { return _mm256_and_pd(a, _mm256_cmp_pd(b, _mm256_setzero_pd(), _CMP_NEQ_UQ)); }
+
+    /// a where b >= c, and zero elsewhere, including where b is NaN.
+    static type whereNotLess(type a, type b, type c)
+    { return _mm256_and_pd(a, _mm256_cmp_pd(b, c, _CMP_GE_OQ)); }
+
+    static type min(type a, type b)
+    { return _mm256_min_pd(a, b); }
+
+    static type max(type a, type b)
+    { return _mm256_max_pd(a, b); }
+
+    static type round(type a)
+    { return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+
+    static double sum(type a)
+    {
+        const __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+    }
+
+    /// 2^n for integral-valued n in the normal range.
+    static type exp2i(type n)
+    {
+        // Adding 1.5 * 2^52 places the integer n in the low mantissa bits.
+        const type shifter = set1(6755399441055744.0);
+        const __m256i bits = _mm256_castpd_si256(_mm256_add_pd(n, shifter));
+        const __m256i biased = _mm256_sub_epi64(bits, _mm256_set1_epi64x(0x4338000000000000LL - 1023));
+        return _mm256_castsi256_pd(_mm256_slli_epi64(biased, 52));
+    }
+};
+
+template<>
+struct SimdTraits<float>
+{
+    using type = __m256;
+    static constexpr std::size_t width = 8;
+
+    static type set1(float x)
+    { return _mm256_set1_ps(x); }
+
+    static type load(const float* p)
+    { return _mm256_load_ps(p); }
+
+    /// Load from memory with no alignment requirement.
+    static type loadu(const float* p)
+    { return _mm256_loadu_ps(p); }
+
+    static void store(float* p, type a)
+    { _mm256_store_ps(p, a); }
+
+    /// Store to memory with no alignment requirement.
+    static void storeu(float* p, type a)
+    { _mm256_storeu_ps(p, a); }
+
+    static type iota()
+    { return _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0); }
+
+    static type add(type a, type b)
+    { return _mm256_add_ps(a, b); }
+
+    static type mul(type a, type b)
+    { return _mm256_mul_ps(a, b); }
+
+    /// a * b + c
+    static type fma(type a, type b, type c)
+    { return _mm256_fmadd_ps(a, b, c); }
+
+    static type sub(type a, type b)
+    { return _mm256_sub_ps(a, b); }
+
+    static type div(type a, type b)
+    { return _mm256_div_ps(a, b); }
+
+    static type sqrt(type a)
+    { return _mm256_sqrt_ps(a); }
+
+    /// a where b is not zero, and zero elsewhere.
+    static type whereNonzero(type a, type b)
+    { return _mm256_and_ps(a, _mm256_cmp_ps(b, _mm256_setzero_ps(), _CMP_NEQ_UQ)); }
+
+    /// a where b >= c, and zero elsewhere, including where b is NaN.
+    static type whereNotLess(type a, type b, type c)
+    { return _mm256_and_ps(a, _mm256_cmp_ps(b, c, _CMP_GE_OQ)); }
+
+    static type min(type a, type b)
+    { return _mm256_min_ps(a, b); }
+
+    static type max(type a, type b)
+    { return _mm256_max_ps(a, b); }
+
+    static type round(type a)
+    { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+
+    static float sum(type a)
+    {
+        __m128 quad = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+        quad = _mm_add_ps(quad, _mm_movehl_ps(quad, quad));
+        return _mm_cvtss_f32(_mm_add_ss(quad, _mm_movehdup_ps(quad)));
+    }
+
+    /// 2^n for integral-valued n in the normal range.
+    static type exp2i(type n)
+    {
+        // Adding 1.5 * 2^23 places the integer n in the low mantissa bits.
+        const type shifter = set1(12582912.0f);
+        const __m256i bits = _mm256_castps_si256(_mm256_add_ps(n, shifter));
+        const __m256i biased = _mm256_sub_epi32(bits, _mm256_set1_epi32(0x4B400000 - 127));
+        return _mm256_castsi256_ps(_mm256_slli_epi32(biased, 23));
+    }
+};
+
+#else
+
+template<>
+struct SimdTraits<double>
+{
+    using type = double;
+    static constexpr std::size_t width = 1;
+
+    static type set1(double x)
+    { return x; }
+
+    static type load(const double* p)
+    { return *p; }
+
+    /// Load from memory with no alignment requirement.
+    static type loadu(const double* p)
+    { return *p; }
+
+    static void store(double* p, type a)
+    { *p = a; }
+
+    /// Store to memory with no alignment requirement.
+    static void storeu(double* p, type a)
+    { *p = a; }
+
+    static type iota()
+    { return 0; }
+
+    static type add(type a, type b)
+    { return a + b; }
+
+    static type mul(type a, type b)
+    { return a * b; }
+
+    /// a * b + c
+    static type fma(type a, type b, type c)
+    { return a * b + c; }
+
+    static type sub(type a, type b)
+    { return a - b; }
+
+    static type div(type a, type b)
+    { return a / b; }
+
+    static type sqrt(type a)
+    { return std::sqrt(a); }
+
+    /// a where b is not zero, and zero elsewhere.
+    static type whereNonzero(type a, type b)
+    { return b != 0 ? a : 0; }
+
+    /// a where b >= c, and zero elsewhere, including where b is NaN.
+    static type whereNotLess(type a, type b, type c)
+    { return b >= c ? a : 0; }
+
+    static type min(type a, type b)
+    { return a < b ? a : b; }
+
+    static type max(type a, type b)
+    { return a > b ? a : b; }
+
+    static type round(type a)
+    { return std::nearbyint(a); }
+
+    static double sum(type a)
+    { return a; }
+
+    /// 2^n for integral-valued n in the normal range.
+    static type exp2i(type n)
+    {
+        const auto biased = static_cast<std::uint64_t>(static_cast<std::int64_t>(n) + 1023) << 52;
+        double result;
+        std::memcpy(&result, &biased, sizeof(result));
+        return result;
+    }
+};
+
+template<>
+struct SimdTraits<float>
+{
+    using type = float;
+    static constexpr std::size_t width = 1;
+
+    static type set1(float x)
+    { return x; }
+
+    static type load(const float* p)
+    { return *p; }
+
+    /// Load from memory with no alignment requirement.
+    static type loadu(const float* p)
+    { return *p; }
+
+    static void store(float* p, type a)
+    { *p = a; }
+
+    /// Store to memory with no alignment requirement.
+    static void storeu(float* p, type a)
+    { *p = a; }
+
+    static type iota()
+    { return 0; }
+
+    static type add(type a, type b)
+    { return a + b; }
+
+    static type mul(type a, type b)
+    { return a * b; }
+
+    /// a * b + c
+    static type fma(type a, type b, type c)
+    { return a * b + c; }
+
+    static type sub(type a, type b)
+    { return a - b; }
+
+    static type div(type a, type b)
+    { return a / b; }
+
+    static type sqrt(type a)
+    { return std::sqrt(a); }
+
+    /// a where b is not zero, and zero elsewhere.
+    static type whereNonzero(type a, type b)
+    { return b != 0 ? a : 0; }
+
+    /// a where b >= c, and zero elsewhere, including where b is NaN.
+    static type whereNotLess(type a, type b, type c)
+    { return b >= c ? a : 0; }
+
+    static type min(type a, type b)
+    { return a < b ? a : b; }
+
+    static type max(type a, type b)
+    { return a > b ? a : b; }
+
+    static type round(type a)
+    { return std::nearbyint(a); }
+
+    static float sum(type a)
+    { return a; }
+
+    /// 2^n for integral-valued n in the normal range.
+    static type exp2i(type n)
+    {
+        const auto biased = static_cast<std::uint32_t>(static_cast<std::int32_t>(n) + 127) << 23;
+        float result;
+        std::memcpy(&result, &biased, sizeof(result));
+        return result;
+    }
+};
+
+#endif
+
+/*!
+ * \brief Fast element-wise exponential.
+ *
+ * Cody-Waite range reduction to |r| <= ln(2)/2 followed by a polynomial approximation of exp(r).
+ * For double, a degree 12 Taylor polynomial gives a relative error below 1e-15 for arguments in
+ * [-708, 709]. For float, the degree 7 polynomial from Cephes expf gives a relative error below
+ * 2e-7 for arguments in [-87, 88]. Below these ranges, where exp(x) would be denormal, the result is
+ * exactly zero, so that the tails of Gaussians vanish. Above them, arguments are clamped, so the
+ * result never overflows to infinity.
+ *
+ * \tparam T scalar type
+ * \param x SIMD vector of arguments
+ * \return SIMD vector of exp(x)
+ */
+template<typename T>
+inline typename SimdTraits<T>::type simdExp(typename SimdTraits<T>::type x);
+
+template<>
+inline SimdTraits<double>::type simdExp<double>(SimdTraits<double>::type x)
+{
+    using S = SimdTraits<double>;
+    const auto lowest = S::set1(-708.);
+    const auto xin = x;
+    x = S::min(S::max(x, lowest), S::set1(709.));
+    const auto n = S::round(S::mul(x, S::set1(1.4426950408889634)));
+    // ln(2) split into a part exactly representable with few bits and a correction.
+    auto r = S::fma(n, S::set1(-6.93145751953125e-1), x);
+    r = S::fma(n, S::set1(-1.42860682030941723212e-6), r);
+
+    auto p = S::set1(1. / 479001600.);
+    p = S::fma(p, r, S::set1(1. / 39916800.));
+    p = S::fma(p, r, S::set1(1. / 3628800.));
+    p = S::fma(p, r, S::set1(1. / 362880.));
+    p = S::fma(p, r, S::set1(1. / 40320.));
+    p = S::fma(p, r, S::set1(1. / 5040.));
+    p = S::fma(p, r, S::set1(1. / 720.));
+    p = S::fma(p, r, S::set1(1. / 120.));
+    p = S::fma(p, r, S::set1(1. / 24.));
+    p = S::fma(p, r, S::set1(1. / 6.));
+    p = S::fma(p, r, S::set1(0.5));
+    p = S::fma(p, r, S::set1(1.));
+    p = S::fma(p, r, S::set1(1.));
+    return S::whereNotLess(S::mul(p, S::exp2i(n)), xin, lowest);
+}
+
+template<>
+inline SimdTraits<float>::type simdExp<float>(SimdTraits<float>::type x)
+{
+    using S = SimdTraits<float>;
+    const auto lowest = S::set1(-87.f);
+    const auto xin = x;
+    x = S::min(S::max(x, lowest), S::set1(88.f));
+    const auto n = S::round(S::mul(x, S::set1(1.44269504088896341f)));
+    auto r = S::fma(n, S::set1(-0.693359375f), x);
+    r = S::fma(n, S::set1(2.12194440e-4f), r);
+
+    auto p = S::set1(1.9875691500e-4f);
+    p = S::fma(p, r, S::set1(1.3981999507e-3f));
+    p = S::fma(p, r, S::set1(8.3334519073e-3f));
+    p = S::fma(p, r, S::set1(4.1665795894e-2f));
+    p = S::fma(p, r, S::set1(1.6666665459e-1f));
+    p = S::fma(p, r, S::set1(5.0000001201e-1f));
+    p = S::fma(p, r, S::set1(1.f));
+    p = S::fma(p, r, S::set1(1.f));
+    return S::whereNotLess(S::mul(p, S::exp2i(n)), xin, lowest);
+}
+
+} // end namespace plugin
+
+#endif //RESTRAINT_SIMD_H
@@ -0,0 +1,98 @@
+#ifndef RESTRAINT_STATEVIEW_H
+#define RESTRAINT_STATEVIEW_H
+
+/*! \file
+ * \brief Read-only views of live restraint state for monitoring.
+ *
+ * Monitoring code reads the buffers of a restraint in place while the simulation runs. The
+ * restraint does not lock or copy anything for its readers: each group of buffers has a
+ * StateVersion, a sequence counter that is odd while the buffers are written. A reader copies
+ * the buffers between two reads of the version, and retries if the version was odd or changed.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace plugin
+{
+
+/*!
+ * \brief Sequence counter of a group of buffers with one writer at a time.
+ */
+class StateVersion
+{
+    public:
+        /// Mark the start of a write. The version is odd until end().
+        void begin() noexcept
+        {
+            const auto version = version_.load(std::memory_order_relaxed);
+            version_.store(version + 1,
+                           std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        /// Mark the end of a write.
+        void end() noexcept
+        {
+            version_.store(version_.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_release);
+        }
+
+        /*!
+         * \brief Current version, odd while a write is in progress.
+         *
+         * Orders the reads of the buffers made before the call, so a reader can load the version
+         * again after its copy to validate it.
+         */
+        std::uint64_t load() const noexcept
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return version_.load(std::memory_order_acquire);
+        }
+
+    private:
+        std::atomic<std::uint64_t> version_{0};
+};
+
+/*!
+ * \brief Location and layout of a C-contiguous buffer of live state.
+ */
+struct StateView
+{
+    const void* data{nullptr};
+    /// Size of an element: sizeof(float) or sizeof(double).
+    std::size_t itemSize{0};
+    std::vector<std::size_t> shape{};
+};
+
+/*!
+ * \brief Live state of an ensemble restraint.
+ *
+ * The buffers stay valid for the lifetime of the restraint, and can be read again without taking
+ * a new view. The counts are copied when the view is taken. historyVersion covers histogram,
+ * windows, oldestWindow and windowCount. samplesVersion covers samples and currentSample.
+ */
+struct EnsembleStateView
+{
+    /// Smoothed histogram minus the experimental distribution (nBins).
+    StateView histogram;
+    /// Window history (nWindows x nBins), in storage order starting at slot 0.
+    StateView windows;
+    /// Distance samples of the open window (nSamples).
+    StateView samples;
+
+    /// Slot of the oldest window and number of stored windows, when the view was taken.
+    std::size_t oldestWindow{0};
+    std::size_t windowCount{0};
+    /// Number of samples of the open window, when the view was taken.
+    std::size_t currentSample{0};
+
+    const StateVersion* historyVersion{nullptr};
+    const StateVersion* samplesVersion{nullptr};
+};
+
+} // end namespace plugin
+
+#endif //RESTRAINT_STATEVIEW_H
@@ -0,0 +1,106 @@
+/*! \file
+ * \brief Code to implement the step scheduler declared in stepscheduler.h
+ */
+
+#include "stepscheduler.h"
+
+#include <cassert>
+#include <cmath>
+
+#include <algorithm>
+#include <limits>
+
+#include "gmxapi/exceptions.h"
+
+namespace plugin
+{
+
+namespace
+{
+
+/// Order events for a min-heap.
+struct Later
+{
+    template<typename E>
+    bool operator()(const E& a,
+                    const E& b) const
+    {
+        return a.step > b.step;
+    }
+};
+
+} // end anonymous namespace
+
+StepScheduler::StepScheduler(double dt) :
+    dt_{dt},
+    time_{std::numeric_limits<double>::quiet_NaN()}
+{
+    if (!(dt > 0))
+    {
+        throw gmxapi::UsageError("StepScheduler requires a positive time step.");
+    }
+}
+
+double StepScheduler::dt() const
+{
+    return dt_;
+}
+
+std::int64_t StepScheduler::step(double t) const
+{
+    return std::llround(t / dt_);
+}
+
+std::int64_t StepScheduler::steps(double interval) const
+{
+    return std::max(step(interval),
+                    std::int64_t(1));
+}
+
+void StepScheduler::schedule(Client* client,
+                             std::int64_t step)
+{
+    assert(!client->scheduled_);
+    assert(step > step_);
+    client->scheduled_ = true;
+    client->due_ = false;
+    heap_.push_back({step, client});
+    std::push_heap(heap_.begin(),
+                   heap_.end(),
+                   Later());
+}
+
+void StepScheduler::withdraw(Client* client) noexcept
+{
+    heap_.erase(std::remove_if(heap_.begin(),
+                               heap_.end(),
+                               [client](const Event& event) { return event.client == client; }),
+                heap_.end());
+    std::make_heap(heap_.begin(),
+                   heap_.end(),
+                   Later());
+    client->scheduled_ = false;
+    client->due_ = false;
+}
+
+std::size_t StepScheduler::pending() const
+{
+    return heap_.size();
+}
+
+void StepScheduler::advance(double t)
+{
+    time_ = t;
+    step_ = step(t);
+    // On most steps, this is the only comparison.
+    while (!heap_.empty() && heap_.front().step <= step_)
+    {
+        std::pop_heap(heap_.begin(),
+                      heap_.end(),
+                      Later());
+        heap_.back().client->due_ = true;
+        heap_.pop_back();
+    }
+}
+
+} // end namespace plugin
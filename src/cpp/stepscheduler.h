@@ -0,0 +1,122 @@
+#ifndef RESTRAINT_STEPSCHEDULER_H
+#define RESTRAINT_STEPSCHEDULER_H
+
+/*! \file
+ * \brief Schedule the sampling and window events of all restraints on integer MD steps.
+ *
+ * Restraints receive the simulation time, and scheduling events at floating point times loses
+ * digits as the simulation progresses, so that intervals may vary by a step over a long run and
+ * between ensemble members. A StepScheduler converts times to MD steps with the time step of the
+ * simulation, and keeps the next event step of each restraint in a min-heap. On a step without
+ * events, only the first restraint updated compares the step with the top of the heap, and the
+ * other restraints find that the step was already checked.
+ */
+
+#include <cstdint>
+#include <vector>
+
+namespace plugin
+{
+
+/*!
+ * \brief Plugin-wide schedule of restraint events on integer MD steps.
+ *
+ * Share one instance between all restraints of a simulation (see Resources::setStepScheduler()).
+ * Restraints are updated in turn on the master rank, so the scheduler is not thread-safe.
+ */
+class StepScheduler
+{
+    public:
+        /*!
+         * \brief A restraint with events on the schedule.
+         *
+         * Each client has at most one scheduled event at a time.
+         */
+        class Client
+        {
+            private:
+                friend class StepScheduler;
+
+                /// Whether the client has been scheduled since it was last due.
+                bool scheduled_{false};
+                /// Whether the event of the client is due at the current step.
+                bool due_{false};
+        };
+
+        /*!
+         * \brief Create a scheduler.
+         *
+         * \param dt MD time step (ps).
+         * \throws gmxapi::UsageError if dt is not positive.
+         */
+        explicit StepScheduler(double dt);
+
+        /// MD time step (ps).
+        double dt() const;
+
+        /// MD step at simulation time t.
+        std::int64_t step(double t) const;
+
+        /// Number of MD steps in an interval (ps), at least one.
+        std::int64_t steps(double interval) const;
+
+        /*!
+         * \brief Check whether client has an event at time t.
+         *
+         * A client that has not been scheduled is always due. A due event is removed from the
+         * schedule, and the client must schedule its next one.
+         */
+        bool due(Client* client,
+                 double t)
+        {
+            if (t != time_)
+            {
+                advance(t);
+            }
+            if (client->scheduled_ && !client->due_)
+            {
+                return false;
+            }
+            client->scheduled_ = false;
+            client->due_ = false;
+            return true;
+        }
+
+        /*!
+         * \brief Schedule the next event of client.
+         *
+         * \param client restraint to be due at step. Must stay alive until due or withdrawn.
+         * \param step MD step after the current one.
+         */
+        void schedule(Client* client,
+                      std::int64_t step);
+
+        /*!
+         * \brief Drop the event of a client that is about to be destroyed.
+         */
+        void withdraw(Client* client) noexcept;
+
+        /// Number of scheduled events.
+        std::size_t pending() const;
+
+    private:
+        struct Event
+        {
+            std::int64_t step;
+            Client* client;
+        };
+
+        /// Mark the clients with events up to the step at time t as due.
+        void advance(double t);
+
+        double dt_;
+        /// Time and step most recently checked.
+        double time_;
+        std::int64_t step_{0};
+        /// Scheduled events, with the earliest at the front.
+        std::vector<Event> heap_;
+};
+
+} // end namespace plugin
+
+#endif //RESTRAINT_STEPSCHEDULER_H
@@ -0,0 +1,118 @@
+/*! \file
+ * \brief Code to implement the threaded ensemble declared in threadensemble.h
+ */
+
+#include "threadensemble.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "gmxapi/exceptions.h"
+
+namespace plugin
+{
+
+ThreadEnsemble::ThreadEnsemble(int size) :
+    size_{size}
+{
+    if (size < 1)
+    {
+        throw gmxapi::UsageError("A ThreadEnsemble needs at least one member.");
+    }
+    sends_.resize(size);
+    sizes_.resize(size);
+}
+
+ThreadEnsemble::reduce_type ThreadEnsemble::member(int rank)
+{
+    if (rank < 0 || rank >= size_)
+    {
+        throw gmxapi::UsageError("ThreadEnsemble member rank out of range.");
+    }
+    auto ensemble = shared_from_this();
+    return [ensemble, rank](const Matrix<double>& send,
+                            Matrix<double>* receive) {
+        ensemble->reduce(rank,
+                         send,
+                         receive);
+    };
+}
+
+template<typename F>
+void ThreadEnsemble::barrier(F onComplete)
+{
+    const auto generation = generation_.load(std::memory_order_acquire);
+    if (arrived_.fetch_add(1,
+                           std::memory_order_acq_rel) + 1 == size_)
+    {
+        onComplete();
+        arrived_.store(0,
+                       std::memory_order_relaxed);
+        generation_.store(generation + 1,
+                          std::memory_order_release);
+    }
+    else
+    {
+        for (int spin = 0;generation_.load(std::memory_order_acquire) == generation;++spin)
+        {
+            if (spin > 1000)
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+}
+
+void ThreadEnsemble::reduce(int rank,
+                            const Matrix<double>& send,
+                            Matrix<double>* receive)
+{
+    const auto size = send.rows() * send.cols();
+    // No member can complete a barrier of this reduction before all have arrived, so all see the same parity.
+    auto& result = results_[(generation_.load(std::memory_order_acquire) / 2) & 1];
+    sends_[rank] = send.data();
+    sizes_[rank] = (receive != nullptr && receive->rows() * receive->cols() == size) ? size : ~std::size_t(0);
+    barrier([this, &result]() {
+        mismatch_ = std::any_of(sizes_.begin(),
+                                sizes_.end(),
+                                [this](std::size_t size) { return size != sizes_[0]; })
+                    || sizes_[0] == ~std::size_t(0);
+        if (!mismatch_)
+        {
+            result.resize(sizes_[0]);
+        }
+    });
+    const bool mismatch = mismatch_;
+
+    if (!mismatch)
+    {
+        const auto begin = size * rank / size_;
+        const auto end = size * (rank + 1) / size_;
+        for (std::size_t i = begin;i < end;++i)
+        {
+            double sum{0};
+            for (int member = 0;member < size_;++member)
+            {
+                sum += sends_[member][i];
+            }
+            result[i] = sum;
+        }
+    }
+    // Other members read our send buffer until they pass this barrier.
+    barrier([]() {});
+
+    if (mismatch)
+    {
+        throw gmxapi::ProtocolError("Ensemble members reduced matrices of different sizes.");
+    }
+    std::copy(result.begin(),
+              result.end(),
+              receive->data());
+}
+
+int ThreadEnsemble::size() const
+{
+    return size_;
+}
+
+} // end namespace plugin
@@ -0,0 +1,88 @@
+#ifndef RESTRAINT_THREADENSEMBLE_H
+#define RESTRAINT_THREADENSEMBLE_H
+
+/*! \file
+ * \brief Ensemble reduction for ensemble members running as threads of one process.
+ *
+ * Serves multi-simulations in one process, such as with thread-MPI, and tests and benchmarks that
+ * need a working ensemble without MPI or Python.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "sessionresources.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief Sum matrices over ensemble members that run as threads of one process.
+ *
+ * Each member uses the reduce function returned by member() as the reduce function of its
+ * Resources. In a reduction, every member publishes its send buffer and waits at a barrier. Then each
+ * member sums a stripe of the elements over all members directly into a shared result buffer, and,
+ * after a second barrier, copies the result. The barrier is lock-free, and waiting members spin and
+ * then yield. Sums are formed in rank order, so they do not depend on timing.
+ *
+ * Create with std::make_shared: reduce functions share ownership of the ensemble.
+ */
+class ThreadEnsemble : public std::enable_shared_from_this<ThreadEnsemble>
+{
+    public:
+        using reduce_type = std::function<void(const Matrix<double>&,
+                                               Matrix<double>*)>;
+
+        /*!
+         * \brief Create an ensemble of a fixed number of members.
+         *
+         * \throws gmxapi::UsageError if size is less than 1.
+         */
+        explicit ThreadEnsemble(int size);
+
+        /*!
+         * \brief Get the reduce function of a member.
+         *
+         * \param rank member rank in [0, size()). Each member must reduce on one thread at a time.
+         */
+        reduce_type member(int rank);
+
+        /*!
+         * \brief Sum send over all members into receive.
+         *
+         * Blocks until every member has called reduce() with a matrix of the same size.
+         *
+         * \throws gmxapi::ProtocolError on every member if the sizes differ.
+         */
+        void reduce(int rank,
+                    const Matrix<double>& send,
+                    Matrix<double>* receive);
+
+        /// Number of members.
+        int size() const;
+
+    private:
+        /// Wait for all members. The last to arrive calls onComplete before releasing the others.
+        template<typename F>
+        void barrier(F onComplete);
+
+        int size_;
+
+        /// Send buffers and sizes published by the members for the current reduction.
+        std::vector<const double*> sends_;
+        std::vector<std::size_t> sizes_;
+        /// Results of alternating reductions, so that members can start the next one while others still copy.
+        std::vector<double> results_[2];
+        bool mismatch_{false};
+
+        std::atomic<int> arrived_{0};
+        /// Barriers completed. Each reduction takes two.
+        std::atomic<unsigned int> generation_{0};
+};
+
+} // end namespace plugin
+
+#endif //RESTRAINT_THREADENSEMBLE_H
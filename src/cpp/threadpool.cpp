@@ -0,0 +1,142 @@
+/*! \file
+ * \brief Code to implement the thread pool declared in threadpool.h
+ */
+
+#include "threadpool.h"
+
+#include <cassert>
+
+#include <utility>
+
+namespace plugin
+{
+
+ThreadPool::ThreadPool(std::size_t numThreads) :
+    // One queue per worker, or one for the waiting thread when there are no workers.
+    queues_(numThreads > 0 ? numThreads : 1)
+{
+    for (std::size_t i = 0;i < numThreads;++i)
+    {
+        threads_.emplace_back(&ThreadPool::workerLoop,
+                              this,
+                              i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(stateMutex_);
+        stop_ = true;
+    }
+    workAvailable_.notify_all();
+    for (auto& thread : threads_)
+    {
+        thread.join();
+    }
+    // Tasks left without workers are run here rather than dropped.
+    while (runTask(0))
+    {}
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    auto& queue = queues_[nextQueue_];
+    nextQueue_ = (nextQueue_ + 1) % queues_.size();
+    ++unfinished_;
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.emplace_back(std::move(task));
+    }
+    {
+        // Update the count under the state lock so a worker about to sleep cannot miss it.
+        std::lock_guard<std::mutex> lock(stateMutex_);
+        ++queued_;
+    }
+    workAvailable_.notify_one();
+}
+
+bool ThreadPool::runTask(std::size_t index)
+{
+    std::function<void()> task;
+    for (std::size_t offset = 0;offset < queues_.size() && !task;++offset)
+    {
+        auto& queue = queues_[(index + offset) % queues_.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty())
+        {
+            // Take from the front of our own queue, but steal from the back of others.
+            if (offset == 0)
+            {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            else
+            {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+        }
+    }
+    if (!task)
+    {
+        return false;
+    }
+    --queued_;
+
+    try
+    {
+        task();
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(stateMutex_);
+        if (!error_)
+        {
+            error_ = std::current_exception();
+        }
+    }
+
+    if (--unfinished_ == 0)
+    {
+        std::lock_guard<std::mutex> lock(stateMutex_);
+        allDone_.notify_all();
+    }
+    return true;
+}
+
+void ThreadPool::workerLoop(std::size_t index)
+{
+    while (true)
+    {
+        if (runTask(index))
+        {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(stateMutex_);
+        workAvailable_.wait(lock,
+                            [this]() { return stop_ || queued_ > 0; });
+        if (stop_ && queued_ == 0)
+        {
+            return;
+        }
+    }
+}
+
+void ThreadPool::wait()
+{
+    // Help with queued tasks, then block until tasks running on workers are done.
+    while (runTask(0))
+    {}
+    std::unique_lock<std::mutex> lock(stateMutex_);
+    allDone_.wait(lock,
+                  [this]() { return unfinished_ == 0; });
+    if (error_)
+    {
+        auto error = error_;
+        error_ = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+} // end namespace plugin
@@ -0,0 +1,105 @@
+#ifndef RESTRAINT_THREADPOOL_H
+#define RESTRAINT_THREADPOOL_H
+
+/*! \file
+ * \brief Work-stealing thread pool for restraint updates.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "alignedallocator.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief Fixed set of worker threads with one task queue each.
+ *
+ * Tasks are distributed round-robin over the queues. A worker takes tasks from the front of its own
+ * queue and, when that is empty, steals from the back of the other queues, so uneven tasks are
+ * balanced without a shared queue becoming a point of contention.
+ *
+ * The thread calling wait() also executes tasks until all have completed, so a pool with zero
+ * worker threads runs every task on that thread.
+ *
+ * submit() and wait() are meant to be called from a single (master) thread.
+ */
+class ThreadPool
+{
+    public:
+        /*!
+         * \brief Start the worker threads.
+         *
+         * \param numThreads number of worker threads in addition to the thread calling wait().
+         */
+        explicit ThreadPool(std::size_t numThreads);
+
+        /*!
+         * \brief Finish queued tasks and join the worker threads.
+         */
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        /*!
+         * \brief Queue a task. It may start immediately on a worker thread.
+         */
+        void submit(std::function<void()> task);
+
+        /*!
+         * \brief Execute queued tasks until all submitted tasks have completed.
+         *
+         * \throws the first exception thrown by a task since the last call to wait(), after all
+         *         tasks have completed.
+         */
+        void wait();
+
+        /*!
+         * \brief Number of worker threads.
+         */
+        std::size_t size() const
+        { return threads_.size(); }
+
+    private:
+        /// Task queue of one worker, on its own cache line.
+        struct alignas(kernelAlignment) Queue
+        {
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+
+        /// Run one task from queue index, or stolen from another queue. Return false if there were none.
+        bool runTask(std::size_t index);
+
+        void workerLoop(std::size_t index);
+
+        /// Over-aligned, so allocated with AlignedAllocator rather than operator new.
+        std::vector<Queue, AlignedAllocator<Queue>> queues_;
+        std::vector<std::thread> threads_;
+        std::size_t nextQueue_{0};
+
+        /// Tasks submitted and not yet completed.
+        std::atomic<std::size_t> unfinished_{0};
+        /// Tasks in queues and not yet started.
+        std::atomic<std::size_t> queued_{0};
+
+        std::mutex stateMutex_;
+        std::condition_variable workAvailable_;
+        std::condition_variable allDone_;
+        bool stop_{false};
+        std::exception_ptr error_{nullptr};
+};
+
+} // end namespace plugin
+
+#endif //RESTRAINT_THREADPOOL_H
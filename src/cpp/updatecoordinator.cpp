@@ -0,0 +1,134 @@
+/*! \file
+ * \brief Code to implement the update coordinator declared in updatecoordinator.h
+ */
+
+#include "updatecoordinator.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "sessionresources.h"
+
+namespace plugin
+{
+
+UpdateCoordinator::UpdateCoordinator(std::size_t numThreads) :
+    pool_{numThreads}
+{
+}
+
+UpdateCoordinator::~UpdateCoordinator()
+{
+    try
+    {
+        pool_.wait();
+    }
+    catch (...)
+    {
+        // Nothing useful can be done with a failed blur of an abandoned update.
+    }
+}
+
+void UpdateCoordinator::beginUpdate(double t)
+{
+    bool stale{false};
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stale = !queue_.empty() && t > queueTime_;
+    }
+    if (stale)
+    {
+        flush();
+    }
+}
+
+void UpdateCoordinator::enqueue(Participant* participant,
+                                const Resources* resources,
+                                double t)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back({participant, resources});
+        queueTime_ = t;
+    }
+    pool_.submit([participant]() { participant->blurWindow(); });
+}
+
+void UpdateCoordinator::flush()
+{
+    std::vector<Update> updates;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        updates.swap(queue_);
+    }
+    if (updates.empty())
+    {
+        return;
+    }
+
+    try
+    {
+        pool_.wait();
+        // Ensemble reductions are collective, so issue them in the same order on every member.
+        for (const auto& update : updates)
+        {
+            update.participant->reduceWindow(*update.resources);
+        }
+        // Participants may only have queued their reductions to be combined.
+        for (const auto& update : updates)
+        {
+            if (update.resources->reduceCoordinator())
+            {
+                update.resources->reduceCoordinator()->flush();
+            }
+        }
+        for (const auto& update : updates)
+        {
+            auto participant = update.participant;
+            pool_.submit([participant]() { participant->rebuildHistogram(); });
+        }
+        pool_.wait();
+    }
+    catch (...)
+    {
+        // Let the tasks of the failed flush finish before the participants drop their updates.
+        try
+        {
+            pool_.wait();
+        }
+        catch (...)
+        {
+        }
+        for (const auto& update : updates)
+        {
+            update.participant->abandonUpdate();
+        }
+        throw;
+    }
+}
+
+void UpdateCoordinator::withdraw(Participant* participant) noexcept
+{
+    // The participant may have a blur in flight. Withdrawal happens during teardown, so errors from
+    // the blur of an abandoned update are not reported.
+    try
+    {
+        pool_.wait();
+    }
+    catch (...)
+    {
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.erase(std::remove_if(queue_.begin(),
+                                queue_.end(),
+                                [participant](const Update& update) { return update.participant == participant; }),
+                 queue_.end());
+}
+
+std::size_t UpdateCoordinator::pending() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+}
+
+} // end namespace plugin
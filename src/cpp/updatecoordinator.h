@@ -0,0 +1,132 @@
+#ifndef RESTRAINT_UPDATECOORDINATOR_H
+#define RESTRAINT_UPDATECOORDINATOR_H
+
+/*! \file
+ * \brief Batch the window updates of all restraints in a simulation onto a thread pool.
+ *
+ * GROMACS calls the update() of each restraint in turn on the master rank, followed by its
+ * evaluate(). Without coordination, a restraint that reaches a window boundary blurs its samples,
+ * takes part in the ensemble reduction, and rebuilds its bias before the next restraint is
+ * updated, so the window updates of many restraints serialize on the master thread.
+ *
+ * With an UpdateCoordinator, a restraint at a window boundary only queues its update. The blur
+ * starts on the thread pool right away, while the master thread carries on with the step. The first
+ * update() call of a later step flushes the queue: it joins the blurs, performs the ensemble
+ * reductions on the master thread in the order the updates were queued (which is the same on every
+ * ensemble member), rebuilds the biases in parallel, and joins again before any restraint is
+ * evaluated for that step. New biases therefore take effect one MD step after the window boundary.
+ */
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+#include "threadpool.h"
+
+namespace plugin
+{
+
+class Resources;
+
+/*!
+ * \brief Plugin-wide scheduler for restraint window updates.
+ *
+ * Share one instance between all restraints of a simulation (see Resources::setUpdateCoordinator()).
+ */
+class UpdateCoordinator
+{
+    public:
+        /*!
+         * \brief Interface of a restraint whose window updates can be coordinated.
+         *
+         * The three phases are called in order for each queued update. blurWindow() and
+         * rebuildHistogram() may run on any thread, concurrently with the phases of other
+         * participants. reduceWindow() runs on the thread that calls UpdateCoordinator::flush().
+         */
+        class Participant
+        {
+            public:
+                virtual ~Participant() = default;
+
+                /// Smooth the samples of the closed window.
+                virtual void blurWindow() = 0;
+
+                /// Combine the closed window across the ensemble.
+                virtual void reduceWindow(const Resources& resources) = 0;
+
+                /// Rebuild the bias from the window history.
+                virtual void rebuildHistogram() = 0;
+
+                /// Drop the update after a phase of it, or of another update flushed with it, failed.
+                virtual void abandonUpdate() noexcept = 0;
+        };
+
+        /*!
+         * \brief Create a coordinator.
+         *
+         * \param numThreads number of worker threads. With zero, queued updates run on the thread
+         *        that flushes them.
+         */
+        explicit UpdateCoordinator(std::size_t numThreads);
+
+        /*!
+         * \brief Wait for queued work, but do not complete the updates.
+         *
+         * Participants should have withdrawn before destruction.
+         */
+        ~UpdateCoordinator();
+
+        /*!
+         * \brief Notify the coordinator that a restraint is being updated at time t.
+         *
+         * Flushes updates queued at an earlier time.
+         */
+        void beginUpdate(double t);
+
+        /*!
+         * \brief Queue the window update of a participant at time t and start its blur.
+         *
+         * \param participant restraint with a closed window. Must stay alive until flushed or withdrawn.
+         * \param resources resources to use for the ensemble reduction.
+         * \param t simulation time.
+         */
+        void enqueue(Participant* participant,
+                     const Resources* resources,
+                     double t);
+
+        /*!
+         * \brief Complete all queued updates.
+         *
+         * If a phase throws, every update of the flush is abandoned before the exception is rethrown.
+         */
+        void flush();
+
+        /*!
+         * \brief Drop queued updates of a participant that is about to be destroyed.
+         */
+        void withdraw(Participant* participant) noexcept;
+
+        /*!
+         * \brief Number of queued updates.
+         */
+        std::size_t pending() const;
+
+    private:
+        struct Update
+        {
+            Participant* participant;
+            const Resources* resources;
+        };
+
+        ThreadPool pool_;
+
+        mutable std::mutex mutex_;
+        /// Updates queued since the last flush, in queue order.
+        std::vector<Update> queue_;
+        /// Time at which the queued updates were issued.
+        double queueTime_{0};
+};
+
+} // end namespace plugin
+
+#endif //RESTRAINT_UPDATECOORDINATOR_H
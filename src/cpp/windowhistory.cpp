@@ -0,0 +1,147 @@
+/*! \file
+ * \brief Code to implement the window history declared in windowhistory.h
+ */
+
+#include "windowhistory.h"
+
+#include <cassert>
+#include <cstdint>
+
+#include <algorithm>
+
+#include "gmxapi/exceptions.h"
+
+namespace plugin
+{
+
+template<typename T>
+WindowHistory<T>::WindowHistory(std::size_t nBins,
+                                std::size_t capacity,
+                                std::size_t recomputePeriod,
+                                const ArenaAllocator<T>& allocator) :
+    nBins_{nBins},
+    capacity_{std::max<std::size_t>(capacity, 1)},
+    recomputePeriod_{recomputePeriod > 0 ? recomputePeriod : capacity_},
+    windows_(capacity_ * nBins,
+             T(0),
+             allocator),
+    sum_(nBins,
+         T(0),
+         allocator)
+{
+}
+
+template<typename T>
+void WindowHistory<T>::push(const T* window)
+{
+    assert(window != nullptr);
+    std::size_t slot{0};
+    if (size_ == capacity_)
+    {
+        // Replace the oldest window.
+        slot = oldest_;
+        oldest_ = (oldest_ + 1) % capacity_;
+        T* evicted = windows_.data() + slot * nBins_;
+        for (std::size_t i = 0;i < nBins_;++i)
+        {
+            sum_[i] += window[i] - evicted[i];
+        }
+    }
+    else
+    {
+        slot = (oldest_ + size_) % capacity_;
+        ++size_;
+        for (std::size_t i = 0;i < nBins_;++i)
+        {
+            sum_[i] += window[i];
+        }
+    }
+    std::copy_n(window,
+                nBins_,
+                windows_.data() + slot * nBins_);
+
+    if (++pushesSinceRecompute_ >= recomputePeriod_)
+    {
+        recompute();
+    }
+}
+
+template<typename T>
+void WindowHistory<T>::recompute()
+{
+    std::fill(sum_.begin(),
+              sum_.end(),
+              T(0));
+    for (std::size_t w = 0;w < size_;++w)
+    {
+        const T* values = window(w);
+        for (std::size_t i = 0;i < nBins_;++i)
+        {
+            sum_[i] += values[i];
+        }
+    }
+    pushesSinceRecompute_ = 0;
+}
+
+template<typename T>
+void WindowHistory<T>::clear()
+{
+    oldest_ = 0;
+    size_ = 0;
+    recompute();
+}
+
+template<typename T>
+void WindowHistory<T>::save(CheckpointWriter* checkpoint) const
+{
+    checkpoint->write(std::uint64_t(nBins_));
+    checkpoint->write(std::uint64_t(capacity_));
+    checkpoint->write(std::uint64_t(oldest_));
+    checkpoint->write(std::uint64_t(size_));
+    checkpoint->write(std::uint64_t(pushesSinceRecompute_));
+    // The running sum is saved rather than recomputed, so that a restart continues bit for bit.
+    checkpoint->write(windows_.data(),
+                      windows_.size());
+    checkpoint->write(sum_.data(),
+                      sum_.size());
+}
+
+template<typename T>
+void WindowHistory<T>::restore(CheckpointReader* checkpoint)
+{
+    const auto nBins = checkpoint->read<std::uint64_t>();
+    const auto capacity = checkpoint->read<std::uint64_t>();
+    if (nBins != nBins_ || capacity != capacity_)
+    {
+        throw gmxapi::UsageError("Window history in " + checkpoint->filename()
+                                 + " has a different number of bins or windows.");
+    }
+    const auto oldest = checkpoint->read<std::uint64_t>();
+    const auto size = checkpoint->read<std::uint64_t>();
+    if (oldest >= capacity_ || size > capacity_)
+    {
+        throw gmxapi::ProtocolError("Window history in " + checkpoint->filename() + " is corrupt.");
+    }
+    oldest_ = oldest;
+    size_ = size;
+    pushesSinceRecompute_ = checkpoint->read<std::uint64_t>();
+    checkpoint->read(windows_.data(),
+                     windows_.size());
+    checkpoint->read(sum_.data(),
+                     sum_.size());
+}
+
+template<typename T>
+const T* WindowHistory<T>::window(std::size_t i) const
+{
+    assert(i < size_);
+    return windows_.data() + ((oldest_ + i) % capacity_) * nBins_;
+}
+
+template
+class WindowHistory<float>;
+
+template
+class WindowHistory<double>;
+
+} // end namespace plugin
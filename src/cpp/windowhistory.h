@@ -0,0 +1,134 @@
+#ifndef RESTRAINT_WINDOWHISTORY_H
+#define RESTRAINT_WINDOWHISTORY_H
+
+/*! \file
+ * \brief Fixed-capacity history of smoothed window histograms with a running sum.
+ */
+
+#include <cstddef>
+
+#include <vector>
+
+#include "arena.h"
+#include "checkpoint.h"
+
+namespace plugin
+{
+
+/*!
+ * \brief Ring buffer of the most recent window histograms and their bin-wise sum.
+ *
+ * All windows live in one contiguous capacity x nBins block, allocated on construction, so adding a
+ * window neither allocates nor moves other windows. The sum is updated by adding the new window and
+ * subtracting the one it replaces, which costs O(nBins) rather than O(capacity * nBins).
+ *
+ * Rounding errors of the running updates accumulate, so the sum is recomputed exactly from the
+ * stored windows every recomputePeriod additions. The default period of one capacity keeps the
+ * amortized cost O(nBins) and bounds the drift to that of capacity additions and subtractions.
+ *
+ * \tparam T element type of the windows and the sum.
+ */
+template<typename T>
+class WindowHistory
+{
+    public:
+        /*!
+         * \brief Allocate storage for the history.
+         *
+         * \param nBins number of bins per window.
+         * \param capacity number of windows kept. At least one window is kept.
+         * \param recomputePeriod number of additions between exact recomputations of the sum, or
+         *        zero to use capacity.
+         * \param allocator source of the storage.
+         */
+        WindowHistory(std::size_t nBins,
+                      std::size_t capacity,
+                      std::size_t recomputePeriod = 0,
+                      const ArenaAllocator<T>& allocator = {});
+
+        /*!
+         * \brief Add a window, replacing the oldest one if the history is full.
+         *
+         * \param window nBins values.
+         */
+        void push(const T* window);
+
+        /*!
+         * \brief Recompute the sum from the stored windows.
+         */
+        void recompute();
+
+        /*!
+         * \brief Discard all windows.
+         */
+        void clear();
+
+        /*!
+         * \brief Append the windows, the running sum, and the ring position to a checkpoint.
+         */
+        void save(CheckpointWriter* checkpoint) const;
+
+        /*!
+         * \brief Restore the state saved by save().
+         *
+         * \throws gmxapi::UsageError if the checkpoint was saved with a different number of bins or capacity.
+         */
+        void restore(CheckpointReader* checkpoint);
+
+        /*!
+         * \brief Bin-wise sum of the stored windows (nBins values).
+         */
+        const T* sum() const
+        { return sum_.data(); }
+
+        /*!
+         * \brief Stored window i, counting from the oldest.
+         */
+        const T* window(std::size_t i) const;
+
+        /// Storage of all capacity() windows, in slot order.
+        const T* data() const
+        { return windows_.data(); }
+
+        /// Slot of the oldest window in data().
+        std::size_t oldest() const
+        { return oldest_; }
+
+        /// Number of stored windows.
+        std::size_t size() const
+        { return size_; }
+
+        /// Maximum number of stored windows.
+        std::size_t capacity() const
+        { return capacity_; }
+
+        /// Number of bins per window.
+        std::size_t nBins() const
+        { return nBins_; }
+
+    private:
+        std::size_t nBins_;
+        std::size_t capacity_;
+        std::size_t recomputePeriod_;
+
+        /// capacity_ windows of nBins_ values each.
+        ArenaVector<T> windows_;
+        ArenaVector<T> sum_;
+
+        /// Slot of the oldest window.
+        std::size_t oldest_{0};
+        std::size_t size_{0};
+        /// Additions since the sum was last computed exactly.
+        std::size_t pushesSinceRecompute_{0};
+};
+
+// Explicitly instantiated in windowhistory.cpp
+extern template
+class WindowHistory<float>;
+
+extern template
+class WindowHistory<double>;
+
+} // end namespace plugin
+
+#endif //RESTRAINT_WINDOWHISTORY_H
@@ -12,14 +12,28 @@
 
 #include <cassert>
 
+#include <chrono>
+#include <functional>
 #include <memory>
+#include <string>
 
 #include "gmxapi/exceptions.h"
 #include "gmxapi/md.h"
 #include "gmxapi/md/mdmodule.h"
 #include "gmxapi/gmxapi.h"
 
+#include "pybind11/numpy.h"
+
+#include "arena.h"
+#include "ensemblebank.h"
 #include "ensemblepotential.h"
+#include "histogramlog.h"
+#if GMXAPI_EXTENSION_HAVE_MPI
+#include "mpireduce.h"
+#endif
+#include "stateview.h"
+#include "stepscheduler.h"
+#include "updatecoordinator.h"
 
 // Make a convenient alias to save some typing...
 namespace py = pybind11;
@@ -137,6 +151,12 @@ std::shared_ptr<gmxapi::MDModule> PyRestraint<plugin::RestraintModule<plugin::En
 {
     return shared_from_this();
 }
+
+template<>
+std::shared_ptr<gmxapi::MDModule> PyRestraint<plugin::RestraintModule<plugin::EnsembleBankPair>>::getModule()
+{
+    return shared_from_this();
+}
 //////////////////////////////////////////////////////////////////////////////////////////
 // New restraints mimicking EnsembleRestraint should specialize getModule() here as above.
 //////////////////////////////////////////////////////////////////////////////////////////
@@ -176,7 +196,79 @@ const char* MyRestraint::docstring =
 class EnsembleRestraintBuilder
 {
     public:
-        explicit EnsembleRestraintBuilder(py::object element)
+        explicit EnsembleRestraintBuilder(py::object element) :
+            EnsembleRestraintBuilder(element,
+                                     py::cast<std::vector<double>>(py::dict(element.attr("params"))["experimental"]))
+        {
+            py::dict parameter_dict = element.attr("params");
+
+            // Get positional parameters.
+            py::list sites = parameter_dict["sites"];
+            for (auto&& site : sites)
+            {
+                siteIndices_.emplace_back(py::cast<int>(site));
+            }
+        }
+
+        virtual ~EnsembleRestraintBuilder() = default;
+
+        /*!
+         * \brief Add node(s) to graph for the work element.
+         *
+         * \param graph networkx.DiGraph object still evolving in gmx.context.
+         *
+         * \todo This may not follow the latest graph building protocol as described.
+         */
+        virtual void build(py::object graph)
+        {
+            if (!subscriber_)
+            {
+                return;
+            }
+            else
+            {
+                if (!py::hasattr(subscriber_, "potential")) throw gmxapi::ProtocolError("Invalid subscriber");
+            }
+
+            // Restraints do not currently add any new nodes to the graph, so we
+            // mark this standard 'graph' argument unused.
+            (void) graph;
+
+            auto potential = PyRestraint<plugin::RestraintModule<plugin::EnsembleRestraint>>::create(name_,
+                                                                                                     siteIndices_,
+                                                                                                     params_,
+                                                                                                     makeResources());
+
+            auto subscriber = subscriber_;
+            py::list potentialList = subscriber.attr("potential");
+            potentialList.append(potential);
+
+        };
+
+        /*!
+         * \brief Accept subscription of an MD task.
+         *
+         * \param subscriber Python object with a 'potential' attribute that is a Python list.
+         *
+         * During build, an object is added to the subscriber's self.potential, which is then bound with
+         * system.add_potential(potential) during the subscriber's launch()
+         */
+        void addSubscriber(py::object subscriber)
+        {
+            assert(py::hasattr(subscriber,
+                               "potential"));
+            subscriber_ = subscriber;
+        };
+
+    protected:
+        /*!
+         * \brief Read the parameters other than the sites.
+         *
+         * \param element WorkElement provided through Context
+         * \param experimental experimental distribution of the pair, or empty for a bank.
+         */
+        EnsembleRestraintBuilder(py::object element,
+                                 const std::vector<double>& experimental)
         {
             name_ = py::cast<std::string>(element.attr("name"));
             assert(!name_.empty());
@@ -190,18 +282,10 @@ class EnsembleRestraintBuilder
             py::dict parameter_dict = element.attr("params");
             // \todo Check for the presence of these dictionary keys to avoid hard-to-diagnose error.
 
-            // Get positional parameters.
-            py::list sites = parameter_dict["sites"];
-            for (auto&& site : sites)
-            {
-                siteIndices_.emplace_back(py::cast<int>(site));
-            }
-
             auto nbins = py::cast<size_t>(parameter_dict["nbins"]);
             auto binWidth = py::cast<double>(parameter_dict["binWidth"]);
             auto minDist = py::cast<double>(parameter_dict["min_dist"]);
             auto maxDist = pybind11::cast<double>(parameter_dict["max_dist"]);
-            auto experimental = pybind11::cast<std::vector<double>>(parameter_dict["experimental"]);
             auto nSamples = pybind11::cast<unsigned int>(parameter_dict["nsamples"]);
             auto samplePeriod = pybind11::cast<double>(parameter_dict["sample_period"]);
             auto nWindows = pybind11::cast<unsigned int>(parameter_dict["nwindows"]);
@@ -218,6 +302,92 @@ class EnsembleRestraintBuilder
                                                      nWindows,
                                                      k,
                                                      sigma);
+            params->name = name_;
+
+            // Optional parameters.
+            if (parameter_dict.contains("table_resolution"))
+            {
+                params->tableResolution = py::cast<unsigned int>(parameter_dict["table_resolution"]);
+            }
+            if (parameter_dict.contains("cutoff_sigmas"))
+            {
+                params->cutoffSigmas = py::cast<double>(parameter_dict["cutoff_sigmas"]);
+            }
+            if (parameter_dict.contains("blur_cutoff_sigmas"))
+            {
+                params->blurCutoffSigmas = py::cast<double>(parameter_dict["blur_cutoff_sigmas"]);
+            }
+            if (parameter_dict.contains("blur_mode"))
+            {
+                params->blurMode = plugin::blurModeFromString(py::cast<std::string>(parameter_dict["blur_mode"]));
+            }
+            if (parameter_dict.contains("precision"))
+            {
+                params->precision = plugin::precisionModeFromString(py::cast<std::string>(parameter_dict["precision"]));
+            }
+            if (parameter_dict.contains("async_reduce_steps"))
+            {
+                params->asyncReduceSteps = py::cast<unsigned int>(parameter_dict["async_reduce_steps"]);
+            }
+            if (parameter_dict.contains("reduce_encoding"))
+            {
+                params->reduceEncoding = plugin::reduceEncodingFromString(py::cast<std::string>(parameter_dict["reduce_encoding"]));
+            }
+            if (parameter_dict.contains("fixed_point_scale"))
+            {
+                params->fixedPointScale = py::cast<double>(parameter_dict["fixed_point_scale"]);
+            }
+            if (parameter_dict.contains("callback_period"))
+            {
+                params->callbackPeriod = py::cast<unsigned int>(parameter_dict["callback_period"]);
+            }
+            if (parameter_dict.contains("checkpoint_file"))
+            {
+                params->checkpointFile = py::cast<std::string>(parameter_dict["checkpoint_file"]);
+            }
+            if (parameter_dict.contains("checkpoint_interval"))
+            {
+                params->checkpointInterval = py::cast<double>(parameter_dict["checkpoint_interval"]);
+            }
+            if (parameter_dict.contains("time_step"))
+            {
+                timeStep_ = py::cast<double>(parameter_dict["time_step"]);
+            }
+            if (parameter_dict.contains("histogram_log"))
+            {
+                histogramLog_ = py::cast<std::string>(parameter_dict["histogram_log"]);
+            }
+            if (parameter_dict.contains("histogram_log_sync"))
+            {
+                histogramLogSync_ = py::cast<double>(parameter_dict["histogram_log_sync"]);
+            }
+            if (parameter_dict.contains("update_threads"))
+            {
+                updateThreads_ = py::cast<size_t>(parameter_dict["update_threads"]);
+            }
+            if (parameter_dict.contains("reduce_backend"))
+            {
+                reduceBackend_ = py::cast<std::string>(parameter_dict["reduce_backend"]);
+                if (reduceBackend_ != "auto" && reduceBackend_ != "mpi" && reduceBackend_ != "hierarchical"
+                    && reduceBackend_ != "python")
+                {
+                    throw gmxapi::UsageError("Unknown reduce_backend '" + reduceBackend_
+                                             + "'. Expected 'auto', 'mpi', 'hierarchical', or 'python'.");
+                }
+            }
+            if (parameter_dict.contains("coalesce_reduce"))
+            {
+                coalesceReduce_ = py::cast<bool>(parameter_dict["coalesce_reduce"]);
+            }
+            if (parameter_dict.contains("memory_arena"))
+            {
+                useArena_ = py::cast<bool>(parameter_dict["memory_arena"]);
+            }
+            if (parameter_dict.contains("huge_pages"))
+            {
+                hugePages_ = py::cast<bool>(parameter_dict["huge_pages"]);
+            }
+
             params_ = std::move(*params);
 
             // Note that if we want to grab a reference to the Context or its communicator, we can get it
@@ -232,86 +402,394 @@ class EnsembleRestraintBuilder
         }
 
         /*!
-         * \brief Add node(s) to graph for the work element.
-         *
-         * \param graph networkx.DiGraph object still evolving in gmx.context.
-         *
-         * \todo This may not follow the latest graph building protocol as described.
+         * \brief Create the ensemble resources of the restraint(s) built by this builder.
          */
-        void build(py::object graph)
+        std::shared_ptr<plugin::Resources> makeResources()
         {
-            if (!subscriber_)
-            {
-                return;
-            }
-            else
-            {
-                if (!py::hasattr(subscriber_, "potential")) throw gmxapi::ProtocolError("Invalid subscriber");
-            }
-
-            // Restraints do not currently add any new nodes to the graph, so we
-            // mark this standard 'graph' argument unused.
-            (void) graph;
-
             // Temporarily subvert things to get quick-and-dirty solution for testing.
             // Need to capture Python communicator and pybind syntax in closure so EnsembleResources
             // can just call with matrix arguments.
 
-            // This can be replaced with a subscription and delayed until launch, if necessary.
-            if (!py::hasattr(context_, "ensemble_update"))
+            // Prefer to reduce directly over the ensemble communicator, without a round trip through Python.
+            auto functor = getNativeReduce();
+            if (!functor)
             {
-                throw gmxapi::ProtocolError("context does not have 'ensemble_update'.");
+                // This can be replaced with a subscription and delayed until launch, if necessary.
+                if (!py::hasattr(context_, "ensemble_update"))
+                {
+                    throw gmxapi::ProtocolError("context does not have 'ensemble_update'.");
+                }
+                // make a local copy of the Python object so we can capture it in the lambda
+                auto update = context_.attr("ensemble_update");
+                // Make a callable with standardizeable signature.
+                const std::string name{name_};
+                functor = [update, name](const plugin::Matrix<double>& send,
+                                         plugin::Matrix<double>* receive) {
+                    update(send,
+                           receive,
+                           py::str(name));
+                };
             }
-            // make a local copy of the Python object so we can capture it in the lambda
-            auto update = context_.attr("ensemble_update");
-            // Make a callable with standardizeable signature.
-            const std::string name{name_};
-            auto functor = [update, name](const plugin::Matrix<double>& send,
-                                          plugin::Matrix<double>* receive) {
-                update(send,
-                       receive,
-                       py::str(name));
-            };
 
             // To use a reduce function on the Python side, we need to provide it with a Python buffer-like object,
             // so we will create one here. Note: it looks like the SharedData element will be useful after all.
+            std::shared_ptr<plugin::ReduceCoordinator> reduceCoordinator;
+            if (coalesceReduce_)
+            {
+                reduceCoordinator = getReduceCoordinator(functor);
+            }
+#if GMXAPI_EXTENSION_HAVE_MPI
+            // Only the native backend can reduce without blocking or exchange encoded windows in their
+            // wire type. Through the Python Context, reductions started by "async_reduce_steps"
+            // restraints complete immediately, and encoded windows are exchanged as doubles.
+            plugin::Resources::async_reduce_type startReduce;
+            plugin::Resources::wire_reduce_type wireReduce;
+            size_t ensembleSize{0};
+            if (const auto mpiReduce = functor.target<plugin::MpiReduce>())
+            {
+                ensembleSize = static_cast<size_t>(mpiReduce->size());
+                startReduce = [reduce = *mpiReduce](const plugin::Matrix<double>& send,
+                                                    plugin::Matrix<double>* receive) {
+                    return reduce.start(send,
+                                        receive);
+                };
+                wireReduce = [reduce = *mpiReduce](plugin::WireType type,
+                                                   const void* send,
+                                                   void* receive,
+                                                   size_t count) {
+                    return reduce.start(type,
+                                        send,
+                                        receive,
+                                        count);
+                };
+            }
+#endif
             auto resources = std::make_shared<plugin::Resources>(std::move(functor));
+#if GMXAPI_EXTENSION_HAVE_MPI
+            resources->setAsyncReduce(std::move(startReduce));
+            resources->setWireReduce(std::move(wireReduce));
+            resources->setEnsembleSize(ensembleSize);
+#endif
+            resources->setReduceCoordinator(std::move(reduceCoordinator));
+            if (updateThreads_ > 0)
+            {
+                resources->setUpdateCoordinator(getUpdateCoordinator());
+            }
+            if (useArena_ || hugePages_)
+            {
+                resources->setArena(getArena());
+            }
+            if (timeStep_ > 0)
+            {
+                resources->setStepScheduler(getStepScheduler());
+            }
+            if (!histogramLog_.empty())
+            {
+                resources->setHistogramLog(getHistogramLog());
+            }
+            return resources;
+        }
 
-            auto potential = PyRestraint<plugin::RestraintModule<plugin::EnsembleRestraint>>::create(name_,
-                                                                                                     siteIndices_,
-                                                                                                     params_,
-                                                                                                     resources);
+        /*!
+         * \brief Get the update coordinator shared by the restraints in the Context, creating it if necessary.
+         *
+         * The first restraint built with "update_threads" determines the number of threads.
+         */
+        std::shared_ptr<plugin::UpdateCoordinator> getUpdateCoordinator()
+        {
+            const char* attribute{"_restraint_update_coordinator"};
+            if (!py::hasattr(context_, attribute))
+            {
+                context_.attr(attribute) = std::make_shared<plugin::UpdateCoordinator>(updateThreads_);
+            }
+            return py::cast<std::shared_ptr<plugin::UpdateCoordinator>>(context_.attr(attribute));
+        }
 
-            auto subscriber = subscriber_;
-            py::list potentialList = subscriber.attr("potential");
-            potentialList.append(potential);
+        /*!
+         * \brief Get a reduce function that bypasses the Python Context, if configured and available.
+         *
+         * The native backend needs the extension to be built with MPI and the Context to provide an
+         * mpi4py communicator for the ensemble. Both native backends duplicate the communicator, and the
+         * hierarchical one also maps a shared memory segment, so the first restraint built with a native
+         * backend creates it for the Context and the other restraints share it.
+         *
+         * \return reduce function, or an empty function to use Context.ensemble_update().
+         * \throws gmxapi::UsageError if the "mpi" or "hierarchical" backend was requested but cannot be used.
+         */
+        std::function<void(const plugin::Matrix<double>&,
+                           plugin::Matrix<double>*)> getNativeReduce()
+        {
+            if (reduceBackend_ == "python")
+            {
+                return {};
+            }
+#if GMXAPI_EXTENSION_HAVE_MPI
+            const char* reduceAttribute{"_restraint_native_reduce"};
+            if (py::hasattr(context_, reduceAttribute))
+            {
+                return sharedNativeReduce(context_.attr(reduceAttribute));
+            }
+            for (const char* attribute : {"ensemble_communicator", "_communicator"})
+            {
+                if (!py::hasattr(context_, attribute))
+                {
+                    continue;
+                }
+                py::object communicator = context_.attr(attribute);
+                if (communicator.is_none() || !py::hasattr(communicator, "py2f"))
+                {
+                    continue;
+                }
+                try
+                {
+                    const auto fortranComm = py::cast<MPI_Fint>(communicator.attr("py2f")());
+                    py::object reduce;
+#if GMXAPI_EXTENSION_HAVE_SHM
+                    if (reduceBackend_ == "hierarchical")
+                    {
+                        reduce = py::cast(std::make_shared<plugin::SharedMemoryReduce>(plugin::hierarchicalReduceFromFortran(fortranComm)));
+                    }
+#endif
+                    if (reduceBackend_ != "hierarchical")
+                    {
+                        reduce = py::cast(std::make_shared<plugin::MpiReduce>(plugin::mpiReduceFromFortran(fortranComm)));
+                    }
+                    if (reduce)
+                    {
+                        context_.attr(reduceAttribute) = reduce;
+                        return sharedNativeReduce(reduce);
+                    }
+                }
+                catch (const gmxapi::UsageError&)
+                {
+                    // mpi4py may use a different MPI library than this extension.
+                    if (reduceBackend_ != "auto")
+                    {
+                        throw;
+                    }
+                    return {};
+                }
+            }
+#endif
+            if (reduceBackend_ == "mpi" || reduceBackend_ == "hierarchical")
+            {
+                throw gmxapi::UsageError("reduce_backend '" + reduceBackend_ + "' requires a plugin built with "
+                                         "MPI (and POSIX shared memory for 'hierarchical') and a Context with an "
+                                         "mpi4py ensemble communicator.");
+            }
+            return {};
+        }
 
-        };
+#if GMXAPI_EXTENSION_HAVE_MPI
+        /*!
+         * \brief Copy the native reduce shared by the restraints in the Context.
+         *
+         * \param reduce MpiReduce or SharedMemoryReduce stored in the Context.
+         * \throws gmxapi::UsageError if it is not the backend requested for this restraint.
+         */
+        std::function<void(const plugin::Matrix<double>&,
+                           plugin::Matrix<double>*)> sharedNativeReduce(const py::object& reduce) const
+        {
+#if GMXAPI_EXTENSION_HAVE_SHM
+            if (py::isinstance<plugin::SharedMemoryReduce>(reduce))
+            {
+                if (reduceBackend_ == "mpi")
+                {
+                    throw gmxapi::UsageError("reduce_backend 'mpi' cannot be used in a Context whose restraints "
+                                             "reduce with 'hierarchical'.");
+                }
+                return py::cast<plugin::SharedMemoryReduce>(reduce);
+            }
+#endif
+            if (reduceBackend_ == "hierarchical")
+            {
+                throw gmxapi::UsageError("reduce_backend 'hierarchical' cannot be used in a Context whose restraints "
+                                         "reduce with 'mpi'.");
+            }
+            return py::cast<plugin::MpiReduce>(reduce);
+        }
+#endif
 
         /*!
-         * \brief Accept subscription of an MD task.
+         * \brief Get the reduce coordinator shared by the restraints in the Context, creating it if necessary.
          *
-         * \param subscriber Python object with a 'potential' attribute that is a Python list.
+         * The combined reduction uses the reduce function of the first restraint built with "coalesce_reduce".
+         */
+        std::shared_ptr<plugin::ReduceCoordinator> getReduceCoordinator(const plugin::ReduceCoordinator::reduce_type& reduce)
+        {
+            const char* attribute{"_restraint_reduce_coordinator"};
+            if (!py::hasattr(context_, attribute))
+            {
+                context_.attr(attribute) = std::make_shared<plugin::ReduceCoordinator>(reduce);
+            }
+            return py::cast<std::shared_ptr<plugin::ReduceCoordinator>>(context_.attr(attribute));
+        }
+
+        /*!
+         * \brief Get the arena shared by the restraints in the Context, creating it if necessary.
          *
-         * During build, an object is added to the subscriber's self.potential, which is then bound with
-         * system.add_potential(potential) during the subscriber's launch()
+         * The first restraint built with "memory_arena" or "huge_pages" determines the options.
          */
-        void addSubscriber(py::object subscriber)
+        std::shared_ptr<plugin::Arena> getArena()
         {
-            assert(py::hasattr(subscriber,
-                               "potential"));
-            subscriber_ = subscriber;
-        };
+            const char* attribute{"_restraint_arena"};
+            if (!py::hasattr(context_, attribute))
+            {
+                plugin::Arena::Options options;
+                options.hugePages = hugePages_;
+                context_.attr(attribute) = std::make_shared<plugin::Arena>(options);
+            }
+            return py::cast<std::shared_ptr<plugin::Arena>>(context_.attr(attribute));
+        }
+
+        /*!
+         * \brief Get the step scheduler shared by the restraints in the Context, creating it if necessary.
+         *
+         * The first restraint built with "time_step" determines the time step.
+         */
+        std::shared_ptr<plugin::StepScheduler> getStepScheduler()
+        {
+            const char* attribute{"_restraint_step_scheduler"};
+            if (!py::hasattr(context_, attribute))
+            {
+                context_.attr(attribute) = std::make_shared<plugin::StepScheduler>(timeStep_);
+            }
+            return py::cast<std::shared_ptr<plugin::StepScheduler>>(context_.attr(attribute));
+        }
+
+        /*!
+         * \brief Get the histogram log shared by the restraints in the Context, creating it if necessary.
+         *
+         * The first restraint built with "histogram_log" determines the file and the sync interval.
+         */
+        std::shared_ptr<plugin::HistogramLog> getHistogramLog()
+        {
+            const char* attribute{"_restraint_histogram_log"};
+            if (!py::hasattr(context_, attribute))
+            {
+                plugin::HistogramLog::Options options;
+                if (histogramLogSync_ >= 0)
+                {
+                    options.syncInterval = std::chrono::milliseconds(static_cast<long long>(histogramLogSync_ * 1000));
+                }
+                context_.attr(attribute) = std::make_shared<plugin::HistogramLog>(histogramLog_,
+                                                                                  options);
+            }
+            return py::cast<std::shared_ptr<plugin::HistogramLog>>(context_.attr(attribute));
+        }
 
         py::object subscriber_;
         py::object context_;
         std::vector<int> siteIndices_;
 
         plugin::ensemble_input_param_type params_;
+        /// Worker threads for window updates shared by the restraints in the Context. Zero updates each restraint in turn.
+        size_t updateThreads_{0};
+        /// One of "auto" (MPI if available), "mpi", "hierarchical" (shared memory within nodes, then MPI), or
+        /// "python" (Context.ensemble_update()).
+        std::string reduceBackend_{"auto"};
+        /// Combine the ensemble reductions of the restraints in the Context into one collective per step.
+        bool coalesceReduce_{false};
+        /// Pack the state of the restraints in the Context into a shared arena, optionally on huge pages.
+        bool useArena_{false};
+        bool hugePages_{false};
+        /// MD time step (ps) of the simulation. If set, events of the restraints in the Context are scheduled on MD steps.
+        double timeStep_{0};
+        /// Append-only log of the windows and histograms of the restraints in the Context, if not empty.
+        std::string histogramLog_;
+        /// Seconds between syncs of the log to disk, or negative for the default.
+        double histogramLogSync_{-1};
 
         std::string name_;
 };
 
+/*!
+ * \brief Build one restraint for each pair of an EnsembleBank.
+ *
+ * Takes the parameters of ensemble_restraint, except that "sites" is an nPairs x nSites array of the
+ * sites of the pairs and "experimental" is an nPairs x nbins array of their experimental
+ * distributions. NumPy arrays are read through the buffer protocol in one copy each; nested lists
+ * are converted by NumPy. The restraint of pair i is named "<name>_<i>".
+ *
+ * Options of ensemble_restraint that EnsembleBank does not implement are refused, rather than
+ * silently ignored.
+ */
+class EnsembleRestraintBankBuilder : public EnsembleRestraintBuilder
+{
+    public:
+        explicit EnsembleRestraintBankBuilder(py::object element) :
+            EnsembleRestraintBuilder(element,
+                                     {})
+        {
+            py::dict parameter_dict = element.attr("params");
+            for (const char* key : {"table_resolution", "precision", "async_reduce_steps", "callback_period",
+                                    "checkpoint_file", "checkpoint_interval", "histogram_log", "histogram_log_sync",
+                                    "update_threads", "coalesce_reduce"})
+            {
+                if (parameter_dict.contains(key))
+                {
+                    throw gmxapi::UsageError(std::string("ensemble_restraint_bank does not support the '") + key
+                                             + "' parameter of ensemble_restraint.");
+                }
+            }
+            using int_array = py::array_t<int, py::array::c_style | py::array::forcecast>;
+            using double_array = py::array_t<double, py::array::c_style | py::array::forcecast>;
+            const auto sites = int_array::ensure(parameter_dict["sites"]);
+            const auto experimental = double_array::ensure(parameter_dict["experimental"]);
+            if (!sites || !experimental || sites.ndim() != 2 || experimental.ndim() != 2
+                || sites.shape(0) != experimental.shape(0)
+                || static_cast<size_t>(experimental.shape(1)) != params_.nBins)
+            {
+                throw gmxapi::UsageError("ensemble_restraint_bank requires a 2-D array of the sites of each pair and "
+                                         "a 2-D array of nbins experimental values per pair, with one row per pair.");
+            }
+
+            const auto nPairs = static_cast<size_t>(sites.shape(0));
+            const auto nSites = static_cast<size_t>(sites.shape(1));
+            pairSites_.reserve(nPairs);
+            for (size_t pair = 0;pair < nPairs;++pair)
+            {
+                const int* row = sites.data() + pair * nSites;
+                pairSites_.emplace_back(row,
+                                        row + nSites);
+            }
+            bankParams_.shared = params_;
+            bankParams_.experimental.assign(experimental.data(),
+                                            experimental.data() + experimental.size());
+        }
+
+        void build(py::object graph) override
+        {
+            if (!subscriber_)
+            {
+                return;
+            }
+            else
+            {
+                if (!py::hasattr(subscriber_, "potential")) throw gmxapi::ProtocolError("Invalid subscriber");
+            }
+
+            // Restraints do not currently add any new nodes to the graph.
+            (void) graph;
+
+            auto bank = std::make_shared<plugin::EnsembleBank>(bankParams_,
+                                                               makeResources());
+            py::list potentialList = subscriber_.attr("potential");
+            for (size_t pair = 0;pair < pairSites_.size();++pair)
+            {
+                auto potential = PyRestraint<plugin::RestraintModule<plugin::EnsembleBankPair>>::create(name_ + "_" + std::to_string(pair),
+                                                                                                        pairSites_[pair],
+                                                                                                        plugin::ensemble_bank_pair_param_type{bank, pair},
+                                                                                                        bank->resources());
+                potentialList.append(potential);
+            }
+        }
+
+    private:
+        std::vector<std::vector<int>> pairSites_;
+        plugin::ensemble_bank_param_type bankParams_;
+};
+
 namespace {
 
 /*!
@@ -327,6 +805,56 @@ std::unique_ptr<EnsembleRestraintBuilder> createEnsembleBuilder(const py::object
     return builder;
 }
 
+/*!
+ * \brief Factory function to create a new restraint bank builder for use during Session launch.
+ *
+ * \param element WorkElement provided through Context
+ * \return ownership of new builder object
+ */
+std::unique_ptr<EnsembleRestraintBankBuilder> createEnsembleBankBuilder(const py::object& element)
+{
+    using std::make_unique;
+    auto builder = make_unique<EnsembleRestraintBankBuilder>(element);
+    return builder;
+}
+
+/*!
+ * \brief Get the live state of a launched ensemble restraint.
+ *
+ * \throws gmxapi::UsageError before the simulation is launched.
+ */
+plugin::EnsembleStateView ensembleState(PyRestraint<plugin::RestraintModule<plugin::EnsembleRestraint>>& restraint)
+{
+    const auto instance = restraint.instance();
+    if (!instance)
+    {
+        throw gmxapi::UsageError("The state of a restraint is available once the simulation is launched.");
+    }
+    return instance->stateView();
+}
+
+/*!
+ * \brief Wrap a buffer of live state in a read-only NumPy array, without copying.
+ *
+ * \param view buffer to wrap.
+ * \param owner Python object that keeps the buffer alive as long as the array.
+ */
+py::array stateArray(const plugin::StateView& view,
+                     py::handle owner)
+{
+    const auto dtype = view.itemSize == sizeof(double) ? py::dtype::of<double>() : py::dtype::of<float>();
+    std::vector<py::ssize_t> shape(view.shape.begin(),
+                                   view.shape.end());
+    py::array array(dtype,
+                    shape,
+                    {},
+                    view.data,
+                    owner);
+    // The restraint writes the buffer while the simulation runs. Readers must not.
+    array.attr("setflags")(py::arg("write") = false);
+    return array;
+}
+
 }
 
 
@@ -371,6 +899,73 @@ PYBIND11_MODULE(myplugin, m) {
             );
         });
 
+    // Opaque handle so restraints built in the same Context can share their window update threads.
+    py::class_<plugin::UpdateCoordinator, std::shared_ptr<plugin::UpdateCoordinator>>(m,
+                                                                                  "UpdateCoordinator");
+
+    // Schedules the events of the restraints in a Context on MD steps.
+    py::class_<plugin::StepScheduler, std::shared_ptr<plugin::StepScheduler>>(m,
+                                                                              "StepScheduler")
+        .def_property_readonly("pending",
+                               &plugin::StepScheduler::pending,
+                               "Number of scheduled restraint events.");
+
+    // Log of the windows and histograms of the restraints in a Context, written in the background.
+    py::class_<plugin::HistogramLog, std::shared_ptr<plugin::HistogramLog>>(m,
+                                                                            "HistogramLog")
+        .def_property_readonly("written",
+                               &plugin::HistogramLog::written,
+                               "Number of records written to the file.")
+        .def_property_readonly("dropped",
+                               &plugin::HistogramLog::dropped,
+                               "Number of records dropped because the writer fell behind.")
+        .def_property_readonly("good",
+                               &plugin::HistogramLog::good,
+                               "Whether every write to the file has succeeded.");
+
+#if GMXAPI_EXTENSION_HAVE_MPI
+    // Opaque handle so restraints built in the same Context can share one duplicate of the ensemble communicator.
+    py::class_<plugin::MpiReduce, std::shared_ptr<plugin::MpiReduce>>(m,
+                                                                      "MpiReduce")
+        .def_property_readonly("size",
+                               &plugin::MpiReduce::size,
+                               "Number of ensemble members.");
+#if GMXAPI_EXTENSION_HAVE_SHM
+    // Opaque handle so restraints built in the same Context can share one shared memory segment per node.
+    py::class_<plugin::SharedMemoryReduce, std::shared_ptr<plugin::SharedMemoryReduce>>(m,
+                                                                                        "SharedMemoryReduce")
+        .def_property_readonly("local_size",
+                               &plugin::SharedMemoryReduce::localSize,
+                               "Number of ensemble members on this node.");
+#endif
+#endif
+
+    // Combines the ensemble reductions of the restraints in a Context.
+    py::class_<plugin::ReduceCoordinator, std::shared_ptr<plugin::ReduceCoordinator>>(m,
+                                                                                  "ReduceCoordinator")
+        .def_property_readonly("collectives",
+                               &plugin::ReduceCoordinator::collectives,
+                               "Number of combined reductions performed.");
+
+    // Arena holding the state of the restraints in a Context. Report its footprint to size jobs.
+    py::class_<plugin::Arena, std::shared_ptr<plugin::Arena>>(m,
+                                                              "Arena")
+        .def("report",
+             &plugin::Arena::report,
+             "Summarize the memory use of restraint state.")
+        .def("footprint",
+             [](const plugin::Arena& arena) {
+                 const auto footprint = arena.footprint();
+                 py::dict result;
+                 result["blocks"] = footprint.blocks;
+                 result["reserved_bytes"] = footprint.reservedBytes;
+                 result["used_bytes"] = footprint.usedBytes;
+                 result["released_bytes"] = footprint.releasedBytes;
+                 result["allocations"] = footprint.allocations;
+                 return result;
+             },
+             "Memory use of restraint state in bytes.");
+
     //////////////////////////////////////////////////////////////////////////
     // Begin EnsembleRestraint
     //
@@ -396,6 +991,43 @@ PYBIND11_MODULE(myplugin, m) {
     ensemble.def("bind",
                  &PyEnsemble::bind,
                  "Implement binding protocol");
+
+    // Read-only views of the live state of a launched restraint, for monitoring. The arrays share
+    // memory with the restraint. To take a consistent copy, read the version, copy the arrays, and
+    // read the version again: retry if it was odd or has changed.
+    ensemble.def_property_readonly("histogram",
+                                   [](py::object self) {
+                                       return stateArray(ensembleState(self.cast<PyEnsemble&>()).histogram,
+                                                         self);
+                                   },
+                                   "Smoothed histogram minus the experimental distribution (nbins).");
+    ensemble.def_property_readonly("windows",
+                                   [](py::object self) {
+                                       return stateArray(ensembleState(self.cast<PyEnsemble&>()).windows,
+                                                         self);
+                                   },
+                                   "Window history (nwindows x nbins) in storage order. See oldest_window.");
+    ensemble.def_property_readonly("samples",
+                                   [](py::object self) {
+                                       return stateArray(ensembleState(self.cast<PyEnsemble&>()).samples,
+                                                         self);
+                                   },
+                                   "Distance samples of the open window (nsamples). See current_sample.");
+    ensemble.def_property_readonly("oldest_window",
+                                   [](PyEnsemble& self) { return ensembleState(self).oldestWindow; },
+                                   "Row of windows holding the oldest window.");
+    ensemble.def_property_readonly("window_count",
+                                   [](PyEnsemble& self) { return ensembleState(self).windowCount; },
+                                   "Number of stored windows.");
+    ensemble.def_property_readonly("current_sample",
+                                   [](PyEnsemble& self) { return ensembleState(self).currentSample; },
+                                   "Number of samples of the open window.");
+    ensemble.def_property_readonly("history_version",
+                                   [](PyEnsemble& self) { return ensembleState(self).historyVersion->load(); },
+                                   "Version of histogram, windows, oldest_window and window_count. Odd during an update.");
+    ensemble.def_property_readonly("samples_version",
+                                   [](PyEnsemble& self) { return ensembleState(self).samplesVersion->load(); },
+                                   "Version of samples and current_sample. Odd during an update.");
     /*
      * To implement gmxapi_workspec_1_0, the module needs a function that a Context can import that
      * produces a builder that translates workspec elements for session launching. The object returned
@@ -412,6 +1044,29 @@ PYBIND11_MODULE(myplugin, m) {
     // End EnsembleRestraint
     ///////////////////////////////////////////////////////////////////////////
 
+    ///////////////////////////////////////////////////////////////////////////
+    // Begin EnsembleBank
+    //
+    // One bank holds the state of many pairs, presented to GROMACS as one restraint per pair.
+    pybind11::class_<EnsembleRestraintBankBuilder> ensembleBankBuilder(m,
+                                                                       "EnsembleBankBuilder");
+    ensembleBankBuilder.def("add_subscriber",
+                            &EnsembleRestraintBankBuilder::addSubscriber);
+    ensembleBankBuilder.def("build",
+                            &EnsembleRestraintBankBuilder::build);
+
+    using PyEnsembleBankPair = PyRestraint<plugin::RestraintModule<plugin::EnsembleBankPair>>;
+    py::class_<PyEnsembleBankPair, std::shared_ptr<PyEnsembleBankPair>> ensembleBankPair(m, "EnsembleBankRestraint");
+    ensembleBankPair.def("bind",
+                         &PyEnsembleBankPair::bind,
+                         "Implement binding protocol");
+
+    m.def("ensemble_restraint_bank",
+          [](const py::object element) { return createEnsembleBankBuilder(element); });
+    //
+    // End EnsembleBank
+    ///////////////////////////////////////////////////////////////////////////
+
 
 
 
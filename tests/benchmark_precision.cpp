@@ -0,0 +1,139 @@
+/*! \file
+ * \brief Compare the ensemble restraint kernels in single and double precision.
+ *
+ * Not run as part of the test suite. Build the gmxapi_extension_precision-benchmark target and run
+ * it on an otherwise idle machine, e.g.
+ *
+ *     ./gmxapi_extension_precision-benchmark
+ *
+ * Times are reported per force evaluation.
+ */
+
+#include <cmath>
+#include <cstdio>
+
+#include <chrono>
+#include <vector>
+
+#include "alignedallocator.h"
+#include "biaskernel.h"
+#include "ensemblepotential.h"
+#include "pairbatch.h"
+
+namespace {
+
+constexpr std::size_t nbins{128};
+constexpr double binWidth{0.05};
+constexpr double sigma{0.1};
+constexpr double k{100.};
+
+/*!
+ * \brief Time repeated evaluation of a callable over a range of distances.
+ *
+ * \return best time per evaluation over several trials, in nanoseconds.
+ */
+template<class Function>
+double timePerCall(Function&& function,
+                   std::size_t numCalls)
+{
+    double best{0};
+    double sink{0};
+    for (int trial = 0;trial < 5;++trial)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0;i < numCalls;++i)
+        {
+            sink += function(0.5 + 5.4 * i / numCalls);
+        }
+        const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        const double perCall = elapsed.count() / numCalls;
+        if (trial == 0 || perCall < best)
+        {
+            best = perCall;
+        }
+    }
+    // Keep the result live so the loop is not optimized away.
+    if (sink == 42.)
+    {
+        fprintf(stderr, "%f\n", sink);
+    }
+    return best;
+}
+
+/// Bias histogram in the padded, aligned storage read by the kernel.
+template<typename T>
+plugin::AlignedVector<T> makeHistogram()
+{
+    plugin::AlignedVector<T> histogram(plugin::paddedSize<T>(nbins), 0);
+    for (std::size_t i = 0;i < nbins;++i)
+    {
+        const double x{i * binWidth};
+        histogram[i] = static_cast<T>(exp(-(x - 3.) * (x - 3.)) - 0.8 * exp(-2. * (x - 4.5) * (x - 4.5)));
+    }
+    return histogram;
+}
+
+void benchmarkKernel(const char* label,
+                     double cutoffSigmas)
+{
+    const auto doubleHistogram = makeHistogram<double>();
+    const auto floatHistogram = makeHistogram<float>();
+    const plugin::BiasKernel<double> doubleKernel{binWidth, sigma, k, cutoffSigmas};
+    const plugin::BiasKernel<float> floatKernel{binWidth, sigma, k, cutoffSigmas};
+
+    const std::size_t numCalls{200000};
+    const double doubleTime = timePerCall([&](double R){ return doubleKernel(R, doubleHistogram.data(), nbins).force; },
+                                          numCalls);
+    const double floatTime = timePerCall([&](double R){ return floatKernel(R, floatHistogram.data(), nbins).force; },
+                                         numCalls);
+    printf("%-32s %10.2f %10.2f %8.2fx\n", label, doubleTime, floatTime, doubleTime / floatTime);
+}
+
+/// Time per pair of BasicEnsemblePotential<Precision>::calculate() on a batch of pairs.
+template<class Precision>
+double timePotential()
+{
+    auto params = plugin::makeEnsembleParams(nbins, binWidth, 0.5, 5.9, std::vector<double>(nbins, 0.),
+                                             1, 0.001, 1, k, sigma);
+    const plugin::BasicEnsemblePotential<Precision> potential{*params};
+
+    const std::size_t numPairs{4096};
+    std::vector<real> x(numPairs), zero(numPairs, 0.), fx(numPairs), fy(numPairs), fz(numPairs);
+    for (std::size_t i = 0;i < numPairs;++i)
+    {
+        x[i] = static_cast<real>(0.5 + 5.4 * i / numPairs);
+    }
+    plugin::PairBatch pairs;
+    pairs.size = numPairs;
+    pairs.x = x.data();
+    pairs.y = pairs.z = pairs.x0 = pairs.y0 = pairs.z0 = zero.data();
+    plugin::PairBatchForces forces;
+    forces.x = fx.data();
+    forces.y = fy.data();
+    forces.z = fz.data();
+
+    const std::size_t numBatches{50};
+    return timePerCall([&](double){ potential.calculate(pairs, 0., forces); return fx[1]; },
+                       numBatches) / numPairs;
+}
+
+template<class Precision>
+void benchmarkPotential(const char* label)
+{
+    const double doubleTime = timePotential<plugin::DoublePrecision>();
+    const double floatTime = timePotential<Precision>();
+    printf("%-32s %10.2f %10.2f %8.2fx\n", label, doubleTime, floatTime, doubleTime / floatTime);
+}
+
+} // end anonymous namespace
+
+int main()
+{
+    printf("%zu bins, ns per evaluation\n", nbins);
+    printf("%-32s %10s %10s %9s\n", "", "double", "float", "speedup");
+    benchmarkKernel("kernel, full sum", 0.);
+    benchmarkKernel("kernel, 6 sigma cutoff", 6.);
+    benchmarkPotential<plugin::SinglePrecision>("batch potential, single");
+    benchmarkPotential<plugin::MixedPrecision>("batch potential, mixed");
+    return 0;
+}
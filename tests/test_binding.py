@@ -8,7 +8,9 @@
 
 import logging
 import os
+import types
 
+import numpy
 import pytest
 
 try:
@@ -37,6 +39,7 @@ try:
         not MPI.Is_initialized() or MPI.COMM_WORLD.Get_size() < 2,
         reason="Test requires at least 2 MPI ranks, but MPI is not initialized or too small.")
 except (ImportError, ModuleNotFoundError):
+    MPI = None
     withmpi_only = pytest.mark.skip(
         reason="Test requires at least 2 MPI ranks, but mpi4py is not available.")
     rank = ''
@@ -134,3 +137,168 @@ def test_ensemble_potential_withmpi(spc_water_box):
     context = _context(md)
     with context as session:
         session.run()
+
+
+def ensemble_params(nbins=10, nwindows=4):
+    return {'sites': [1, 4],
+            'nbins': nbins,
+            'binWidth': 0.1,
+            'min_dist': 0.,
+            'max_dist': 10.,
+            'experimental': [1.] * nbins,
+            'nsamples': 1,
+            'sample_period': 0.001,
+            'nwindows': nwindows,
+            'k': 10000.,
+            'sigma': 1.}
+
+
+class FakeContext(object):
+    """Context of an ensemble with one member."""
+    def ensemble_update(self, send, receive, tag):
+        numpy.asarray(receive)[...] = numpy.asarray(send)
+
+
+def build_restraints(operation, params, name='restraint', context=None):
+    """Build restraints from a work element as a Context does, without launching a simulation."""
+    import myplugin
+    if context is None:
+        context = FakeContext()
+    element = types.SimpleNamespace(name=name,
+                                    params=params,
+                                    workspec=types.SimpleNamespace(_context=context))
+    subscriber = types.SimpleNamespace(potential=[])
+    builder = getattr(myplugin, operation)(element)
+    builder.add_subscriber(subscriber)
+    builder.build(None)
+    return subscriber.potential
+
+
+def test_ensemble_state_before_launch():
+    restraint, = build_restraints('ensemble_restraint', ensemble_params())
+    for attribute in ('histogram', 'windows', 'samples', 'oldest_window', 'window_count',
+                      'current_sample', 'history_version', 'samples_version'):
+        with pytest.raises(RuntimeError):
+            getattr(restraint, attribute)
+
+
+@nompi
+@pytest.mark.usefixtures("cleandir")
+def test_ensemble_state_views(spc_water_box, monkeypatch):
+    """Read the live state of a restraint after a simulation."""
+    import myplugin
+    restraints = []
+    make_builder = myplugin.ensemble_restraint
+
+    class RecordingBuilder(object):
+        """Keep the restraint built for the simulation, to inspect it afterwards."""
+        def __init__(self, element):
+            self.builder = make_builder(element)
+            self.subscriber = None
+
+        def add_subscriber(self, subscriber):
+            self.subscriber = subscriber
+            self.builder.add_subscriber(subscriber)
+
+        def build(self, graph):
+            self.builder.build(graph)
+            restraints.append(self.subscriber.potential[-1])
+
+    monkeypatch.setattr(myplugin, 'ensemble_restraint', RecordingBuilder)
+
+    md = from_tpr([spc_water_box], append_output=False)
+    potential = WorkElement(namespace="myplugin",
+                            operation="ensemble_restraint",
+                            params=ensemble_params(nbins=10, nwindows=4))
+    potential.name = "ensemble_restraint"
+    md.add_dependency(potential)
+    with _context(md) as session:
+        session.run()
+
+    restraint, = restraints
+    histogram = restraint.histogram
+    assert histogram.shape == (10,)
+    assert restraint.windows.shape == (4, 10)
+    assert restraint.samples.shape == (1,)
+
+    # The arrays share memory with the restraint, which readers must not write.
+    assert numpy.shares_memory(histogram, restraint.histogram)
+    assert not histogram.flags.writeable
+    with pytest.raises(ValueError):
+        histogram[0] = 0.
+
+    # Each window update advances the version by two, and it is even between updates.
+    version = restraint.history_version
+    assert version % 2 == 0
+    assert restraint.window_count == min(4, version // 2)
+    assert 0 <= restraint.oldest_window < 4
+    assert restraint.samples_version % 2 == 0
+    assert restraint.current_sample <= 1
+
+
+def test_ensemble_restraint_bank():
+    params = ensemble_params(nbins=10)
+    params['sites'] = numpy.array([[1, 4], [2, 5], [3, 6]])
+    params['experimental'] = numpy.linspace(0., 1., 30).reshape(3, 10)
+    restraints = build_restraints('ensemble_restraint_bank', params, name='bank')
+    assert len(restraints) == 3
+
+    # Nested lists are converted by NumPy.
+    params['sites'] = [[1, 4], [2, 5]]
+    params['experimental'] = [[1.] * 10] * 2
+    assert len(build_restraints('ensemble_restraint_bank', params, name='bank')) == 2
+
+
+@pytest.mark.parametrize('sites, experimental',
+                         [([1, 4], [[1.] * 10]),                # sites not 2-D
+                          ([[1, 4]], [1.] * 10),                # experimental not 2-D
+                          ([[1, 4], [2, 5]], [[1.] * 10]),      # different numbers of pairs
+                          ([[1, 4]], [[1.] * 9])])              # rows of other than nbins values
+def test_ensemble_restraint_bank_shapes(sites, experimental):
+    params = ensemble_params(nbins=10)
+    params['sites'] = sites
+    params['experimental'] = experimental
+    with pytest.raises(RuntimeError):
+        build_restraints('ensemble_restraint_bank', params, name='bank')
+
+
+@pytest.mark.parametrize('key, value', [('table_resolution', 8),
+                                        ('precision', 'mixed'),
+                                        ('async_reduce_steps', 2),
+                                        ('callback_period', 2),
+                                        ('checkpoint_file', 'bank.cpt'),
+                                        ('checkpoint_interval', 1.),
+                                        ('histogram_log', 'bank.log'),
+                                        ('histogram_log_sync', 1.),
+                                        ('update_threads', 2),
+                                        ('coalesce_reduce', True)])
+def test_ensemble_restraint_bank_unsupported(key, value):
+    """Options of ensemble_restraint that the bank does not implement are refused."""
+    params = ensemble_params(nbins=10)
+    params['sites'] = [[1, 4]]
+    params['experimental'] = [[1.] * 10]
+    params[key] = value
+    with pytest.raises(RuntimeError):
+        build_restraints('ensemble_restraint_bank', params, name='bank')
+
+
+@pytest.mark.parametrize('backend, reduce_type', [('mpi', 'MpiReduce'),
+                                                  ('hierarchical', 'SharedMemoryReduce')])
+def test_native_reduce_shared(backend, reduce_type):
+    """Restraints in a Context share one native reduce, so they set up the communicators once."""
+    import myplugin
+    if MPI is None or not hasattr(myplugin, reduce_type):
+        pytest.skip('Test requires mpi4py and a plugin built with MPI (and shared memory).')
+    context = FakeContext()
+    context.ensemble_communicator = MPI.COMM_WORLD
+    params = dict(ensemble_params(), reduce_backend=backend)
+    build_restraints('ensemble_restraint', params, name='first', context=context)
+    reduce = context._restraint_native_reduce
+    assert isinstance(reduce, getattr(myplugin, reduce_type))
+    build_restraints('ensemble_restraint', params, name='second', context=context)
+    assert context._restraint_native_reduce is reduce
+
+    # Restraints in the Context cannot ask for the other native backend.
+    params['reduce_backend'] = 'hierarchical' if backend == 'mpi' else 'mpi'
+    with pytest.raises(RuntimeError):
+        build_restraints('ensemble_restraint', params, name='third', context=context)
@@ -4,6 +4,8 @@
 
 #include "testingconfiguration.h"
 
+#include <cmath>
+
 #include <iostream>
 #include <vector>
 
@@ -76,4 +78,63 @@ TEST(EnsembleBoundingPotentialPlugin, ForceCalc)
     ASSERT_GT(force[0], 0.) << " where force is (" << force[0] << ", " << force[1] << ", " << force[2] << ")\n";
 }
 
+TEST(EnsembleBoundingPotentialPlugin, BatchForceCalc)
+{
+    const std::vector<double>
+        experimental{{0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1}};
+
+    plugin::EnsemblePotential restraint{10, // nbins
+                                       1.0, // binWidth
+                                       5.0, // minDist
+                                       5.0, // maxDist
+                                       experimental, // experimental reference histogram
+                                       1, // nSamples
+                                       0.001, // samplePeriod
+                                       1, // nWindows
+                                       100., // k
+                                       1.0 // sigma
+    };
+
+    // Enough pairs to take the threaded path. Distances span both sides of the flat bottom, and
+    // the first pair is degenerate.
+    const size_t numPairs{2 * plugin::minThreadedBatchSize + 3};
+    std::vector<real> x(numPairs), y(numPairs), z(numPairs);
+    std::vector<real> x0(numPairs, 1.), y0(numPairs, -1.), z0(numPairs, 0.5);
+    for (size_t i = 0;i < numPairs;++i)
+    {
+        x[i] = x0[i] + static_cast<real>(0.02 * i);
+        y[i] = y0[i] + static_cast<real>(0.01 * (i % 7));
+        z[i] = z0[i] - static_cast<real>(0.005 * (i % 11));
+    }
+    plugin::PairBatch pairs;
+    pairs.size = numPairs;
+    pairs.x = x.data();
+    pairs.y = y.data();
+    pairs.z = z.data();
+    pairs.x0 = x0.data();
+    pairs.y0 = y0.data();
+    pairs.z0 = z0.data();
+
+    std::vector<real> fx(numPairs), fy(numPairs), fz(numPairs), energy(numPairs);
+    plugin::PairBatchForces forces;
+    forces.x = fx.data();
+    forces.y = fy.data();
+    forces.z = fz.data();
+    forces.energy = energy.data();
+
+    restraint.calculate(pairs, 0.001, forces);
+
+    for (size_t i = 0;i < numPairs;++i)
+    {
+        const auto expected = restraint.calculate(Vector{x[i], y[i], z[i]},
+                                                  Vector{x0[i], y0[i], z0[i]},
+                                                  0.001);
+        EXPECT_NEAR(expected.force[0], fx[i], 1e-4 * (1 + std::abs(expected.force[0]))) << " for pair " << i;
+        EXPECT_NEAR(expected.force[1], fy[i], 1e-4 * (1 + std::abs(expected.force[1]))) << " for pair " << i;
+        EXPECT_NEAR(expected.force[2], fz[i], 1e-4 * (1 + std::abs(expected.force[2]))) << " for pair " << i;
+        EXPECT_NEAR(expected.energy, energy[i], 1e-4 * (1 + std::abs(expected.energy))) << " for pair " << i;
+    }
+    ASSERT_EQ(static_cast<real>(0.0), fx[0]);
+}
+
 } // end anonymous namespace
@@ -0,0 +1,170 @@
+/*! \file
+ * \brief Test the restraint bank against independent restraints for each pair.
+ */
+
+#include <cmath>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "ensemblebank.h"
+#include "ensemblepotential.h"
+#include "sessionresources.h"
+#include "stepscheduler.h"
+#include "threadensemble.h"
+
+#include "gmxapi/exceptions.h"
+
+#include <gtest/gtest.h>
+
+using ::gmx::Vector;
+
+namespace {
+
+constexpr size_t nbins{40};
+constexpr size_t npairs{3};
+
+/// Resources of a single-member ensemble, counting reductions.
+std::shared_ptr<plugin::Resources> makeResources(int* reductions)
+{
+    auto reduce = std::make_shared<plugin::ThreadEnsemble>(1)->member(0);
+    return std::make_shared<plugin::Resources>([reduce, reductions](const plugin::Matrix<double>& send,
+                                                                    plugin::Matrix<double>* receive) {
+        ++*reductions;
+        reduce(send,
+               receive);
+    });
+}
+
+/// Distinct experimental distributions, row-major.
+std::vector<double> experimentalDistributions()
+{
+    std::vector<double> experimental(npairs * nbins, 0.);
+    for (size_t pair = 0;pair < npairs;++pair)
+    {
+        experimental[pair * nbins + 10 + 5 * pair] = 1.;
+    }
+    return experimental;
+}
+
+/// Position of the first site of a pair at a step.
+Vector position(size_t pair,
+                int step)
+{
+    return {real(1.2 + 0.4 * pair + 0.05 * (step % 7)), 0, 0};
+}
+
+TEST(EnsembleRestraintBank, MatchesIndependentRestraints)
+{
+    plugin::ensemble_bank_param_type params;
+    params.shared = *plugin::makeEnsembleParams(nbins, 0.1, 0.5, 3.5, {}, 3, 0.002, 2, 10., 0.2);
+    params.experimental = experimentalDistributions();
+
+    int bankReductions{0};
+    auto bank = std::make_shared<plugin::EnsembleBank>(params,
+                                                       makeResources(&bankReductions));
+    ASSERT_EQ(bank->size(), npairs);
+    int batchReductions{0};
+    plugin::EnsembleBank batchBank{params, makeResources(&batchReductions)};
+
+    int pairReductions{0};
+    auto pairResources = makeResources(&pairReductions);
+    std::vector<std::shared_ptr<plugin::EnsemblePotential>> single;
+    std::vector<plugin::EnsembleBankPair> views;
+    for (size_t pair = 0;pair < npairs;++pair)
+    {
+        auto pairParams = params.shared;
+        pairParams.experimental.assign(params.experimental.begin() + pair * nbins,
+                                       params.experimental.begin() + (pair + 1) * nbins);
+        single.push_back(std::allocate_shared<plugin::EnsemblePotential>(plugin::AlignedAllocator<plugin::EnsemblePotential>(),
+                                                                         pairParams));
+        views.emplace_back(std::vector<int>{0, 1},
+                           plugin::ensemble_bank_pair_param_type{bank, pair},
+                           nullptr);
+    }
+
+    const Vector v0{0, 0, 0};
+    std::vector<real> x(npairs), zeros(npairs, 0);
+    for (int step = 0;step <= 30;++step)
+    {
+        const double t = step * 0.001;
+        for (size_t pair = 0;pair < npairs;++pair)
+        {
+            views[pair].update(position(pair, step), v0, t);
+            single[pair]->callback(position(pair, step), v0, t, *pairResources);
+            x[pair] = position(pair, step)[0];
+        }
+        batchBank.callback(plugin::PairBatch{npairs, x.data(), zeros.data(), zeros.data(),
+                                             zeros.data(), zeros.data(), zeros.data()},
+                           t);
+    }
+    // Windows of 3 samples every 2 steps close at steps 6, 12, ..., 30: one reduction for the whole bank.
+    EXPECT_EQ(bankReductions, 5);
+    EXPECT_EQ(batchReductions, 5);
+    EXPECT_EQ(pairReductions, 5 * static_cast<int>(npairs));
+
+    std::vector<real> fx(npairs), fy(npairs), fz(npairs), energy(npairs);
+    for (double r = 0.3;r < 4.;r += 0.05)
+    {
+        std::fill(x.begin(), x.end(), real(r));
+        batchBank.calculate(plugin::PairBatch{npairs, x.data(), zeros.data(), zeros.data(),
+                                              zeros.data(), zeros.data(), zeros.data()},
+                            0.03,
+                            plugin::PairBatchForces{fx.data(), fy.data(), fz.data(), energy.data()});
+        for (size_t pair = 0;pair < npairs;++pair)
+        {
+            const Vector v{real(r), 0, 0};
+            const auto expected = single[pair]->calculate(v, v0, 0.03);
+            const auto viewResult = views[pair].evaluate(v, v0, 0.03);
+            // The bank computes distances in double precision, and the potential in real.
+            const double tolerance = 1e-5 * (1 + std::abs(expected.force[0]));
+            EXPECT_NEAR(viewResult.force[0], expected.force[0], tolerance);
+            EXPECT_NEAR(viewResult.energy, expected.energy, tolerance);
+            EXPECT_NEAR(fx[pair], expected.force[0], tolerance);
+            EXPECT_NEAR(energy[pair], expected.energy, tolerance);
+        }
+    }
+}
+
+TEST(EnsembleRestraintBank, StepSchedule)
+{
+    // Samples every 3 steps with a time step that is not representable in binary.
+    plugin::ensemble_bank_param_type params;
+    params.shared = *plugin::makeEnsembleParams(nbins, 0.1, 0.5, 3.5, {}, 2, 0.006, 2, 10., 0.2);
+    params.experimental = experimentalDistributions();
+    int reductions{0};
+    auto resources = makeResources(&reductions);
+    resources->setStepScheduler(std::make_shared<plugin::StepScheduler>(0.002));
+    plugin::EnsembleBank bank{params, resources};
+
+    const Vector v0{0, 0, 0};
+    for (int step = 0;step <= 3000;++step)
+    {
+        for (size_t pair = 0;pair < npairs;++pair)
+        {
+            bank.callback(pair, position(pair, step), v0, step * 0.002);
+        }
+        EXPECT_EQ(reductions, step / 6);
+    }
+}
+
+TEST(EnsembleRestraintBank, Arguments)
+{
+    plugin::ensemble_bank_param_type params;
+    params.shared = *plugin::makeEnsembleParams(nbins, 0.1, 0.5, 3.5, {}, 2, 0.002, 2, 10., 0.2);
+    int reductions{0};
+    EXPECT_THROW(plugin::EnsembleBank(params, makeResources(&reductions)), gmxapi::UsageError);
+    params.experimental = experimentalDistributions();
+    params.experimental.pop_back();
+    EXPECT_THROW(plugin::EnsembleBank(params, makeResources(&reductions)), gmxapi::UsageError);
+    params.experimental = experimentalDistributions();
+    EXPECT_THROW(plugin::EnsembleBank(params, nullptr), gmxapi::UsageError);
+
+    auto bank = std::make_shared<plugin::EnsembleBank>(params,
+                                                       makeResources(&reductions));
+    EXPECT_THROW(plugin::EnsembleBankPair({0, 1}, plugin::ensemble_bank_pair_param_type{bank, npairs}, nullptr),
+                 gmxapi::UsageError);
+}
+
+} // end anonymous namespace
@@ -0,0 +1,293 @@
+/*! \file
+ * \brief Test the operations and wire encodings of ensemble reductions, and the threaded ensemble.
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "sessionresources.h"
+#include "threadensemble.h"
+
+#include "gmxapi/exceptions.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+/// Number of identical members in the simulated ensemble.
+constexpr int ensembleSize{3};
+
+/*!
+ * \brief Provide a handle to an ensemble of identical members, without a Session.
+ */
+class FakeEnsemble
+{
+    public:
+        FakeEnsemble() :
+            reduce_{[this](const plugin::Matrix<double>& send,
+                           plugin::Matrix<double>* receive) {
+                ++doubleReductions;
+                for (size_t i = 0;i < send.cols();++i)
+                {
+                    receive->data()[i] = ensembleSize * send.data()[i];
+                }
+            }},
+            startReduce_{},
+            wireReduce_{[this](plugin::WireType type,
+                               const void* send,
+                               void* receive,
+                               size_t count) {
+                if (fail)
+                {
+                    throw gmxapi::ProtocolError("Simulated reduction failure.");
+                }
+                wireTypes.push_back(type);
+                switch (type)
+                {
+                    case plugin::WireType::Float32:
+                        scale<float>(send, receive, count);
+                        break;
+                    case plugin::WireType::Int32:
+                        scale<std::int32_t>(send, receive, count);
+                        break;
+                    default:
+                        scale<double>(send, receive, count);
+                }
+                return plugin::ReduceRequest{};
+            }}
+        {}
+
+        /// Handle exchanging encoded data as doubles, or in its wire type.
+        plugin::ResourcesHandle handle(bool wire)
+        {
+            plugin::ResourcesHandle handle{};
+            handle.reduce_ = &reduce_;
+            handle.startReduce_ = &startReduce_;
+            handle.wireReduce_ = wire ? &wireReduce_ : nullptr;
+            handle.session_ = nullptr;
+            return handle;
+        }
+
+        int doubleReductions{0};
+        std::vector<plugin::WireType> wireTypes;
+        /// Whether exchanges in the wire type fail, as if an ensemble member had failed.
+        bool fail{false};
+
+    private:
+        template<typename T>
+        static void scale(const void* send,
+                          void* receive,
+                          size_t count)
+        {
+            for (size_t i = 0;i < count;++i)
+            {
+                static_cast<T*>(receive)[i] = ensembleSize * static_cast<const T*>(send)[i];
+            }
+        }
+
+        std::function<void(const plugin::Matrix<double>&,
+                           plugin::Matrix<double>*)> reduce_;
+        plugin::Resources::async_reduce_type startReduce_;
+        plugin::Resources::wire_reduce_type wireReduce_;
+};
+
+TEST(EnsembleReduce, SumAndMean)
+{
+    FakeEnsemble ensemble;
+    const auto handle = ensemble.handle(false);
+    plugin::Matrix<double> send{std::vector<double>{0.1, -2., 3e10}};
+    plugin::Matrix<double> receive{1, 3};
+
+    plugin::ReduceOptions options;
+    handle.reduce(send, &receive, options);
+    EXPECT_EQ(*receive.vector(), (std::vector<double>{0.1 * 3, -6., 9e10}));
+
+    options.operation = plugin::ReduceOperation::Mean;
+    handle.reduce(send, &receive, options);
+    for (size_t i = 0;i < 3;++i)
+    {
+        EXPECT_DOUBLE_EQ(receive.data()[i], send.data()[i]);
+    }
+
+    plugin::Matrix<double> mismatched{1, 2};
+    EXPECT_THROW(handle.reduce(send, &mismatched, options), gmxapi::ProtocolError);
+}
+
+TEST(EnsembleReduce, Encodings)
+{
+    const std::vector<double> values{0.1, -2.5, 1.0 / 3, 1e-7};
+    plugin::Matrix<double> send{std::vector<double>(values)};
+    for (bool wire : {false, true})
+    {
+        FakeEnsemble ensemble;
+        const auto handle = ensemble.handle(wire);
+        plugin::ReduceOptions options;
+        options.operation = plugin::ReduceOperation::Mean;
+        plugin::Matrix<double> receive{1, values.size()};
+
+        options.encoding = plugin::ReduceEncoding::Float32;
+        handle.reduce(send, &receive, options);
+        for (size_t i = 0;i < values.size();++i)
+        {
+            EXPECT_NEAR(receive.data()[i], values[i], 1e-7 * std::abs(values[i]));
+        }
+
+        options.encoding = plugin::ReduceEncoding::Fixed32;
+        options.fixedPointScale = 1024;
+        handle.reduce(send, &receive, options);
+        for (size_t i = 0;i < values.size();++i)
+        {
+            EXPECT_EQ(receive.data()[i], std::round(values[i] * 1024) / 1024);
+        }
+
+        plugin::Matrix<double> large{std::vector<double>{3e6}};
+        plugin::Matrix<double> largeReceive{1, 1};
+        EXPECT_THROW(handle.reduce(large, &largeReceive, options), gmxapi::ProtocolError);
+
+        // Within range for one member, but not once summed over the ensemble, if its size is known.
+        plugin::Matrix<double> summedLarge{std::vector<double>{1e6}};
+        options.ensembleSize = ensembleSize;
+        EXPECT_THROW(handle.reduce(summedLarge, &largeReceive, options), gmxapi::ProtocolError);
+        options.ensembleSize = 0;
+        auto sizedHandle = handle;
+        sizedHandle.ensembleSize_ = ensembleSize;
+        EXPECT_THROW(sizedHandle.reduce(summedLarge, &largeReceive, options), gmxapi::ProtocolError);
+
+        if (wire)
+        {
+            EXPECT_EQ(ensemble.wireTypes, (std::vector<plugin::WireType>{plugin::WireType::Float32,
+                                                                         plugin::WireType::Int32}));
+            EXPECT_EQ(ensemble.doubleReductions, 0);
+        }
+        else
+        {
+            EXPECT_EQ(ensemble.doubleReductions, 2);
+        }
+    }
+}
+
+TEST(EnsembleReduce, DeltaEncoding)
+{
+    FakeEnsemble ensemble;
+    const auto handle = ensemble.handle(true);
+    plugin::ReduceOptions options;
+    options.operation = plugin::ReduceOperation::Mean;
+    options.encoding = plugin::ReduceEncoding::Delta;
+
+    plugin::Matrix<double> send{1, 2};
+    plugin::Matrix<double> receive{1, 2};
+    EXPECT_THROW(handle.reduce(send, &receive, options), gmxapi::UsageError);
+
+    // Slowly varying data around an offset too large for the fixed32 encoding at this resolution.
+    options.fixedPointScale = 1 << 28;
+    plugin::ReduceHistory history;
+    options.history = &history;
+    for (int window = 0;window < 1000;++window)
+    {
+        send.data()[0] = 1000. + std::sin(0.01 * window);
+        send.data()[1] = 0.5 + 1e-3 * window;
+        auto request = handle.startReduce(send, &receive, options);
+        request.wait();
+        // Errors are bounded by the resolution and do not accumulate.
+        EXPECT_NEAR(receive.data()[0], send.data()[0], 0.5 / options.fixedPointScale);
+        EXPECT_NEAR(receive.data()[1], send.data()[1], 0.5 / options.fixedPointScale);
+    }
+    ASSERT_EQ(ensemble.wireTypes.size(), 1000u);
+    EXPECT_EQ(ensemble.wireTypes.front(), plugin::WireType::Float64);
+    EXPECT_EQ(ensemble.wireTypes.back(), plugin::WireType::Int32);
+
+    // Changes must still fit.
+    send.data()[0] = 2000.;
+    EXPECT_THROW(handle.reduce(send, &receive, options), gmxapi::ProtocolError);
+
+    // Failed reductions leave the history as it was, so later results are not offset by their changes.
+    send.data()[0] = 1001.;
+    ensemble.fail = true;
+    EXPECT_THROW(handle.reduce(send, &receive, options), gmxapi::ProtocolError);
+    ensemble.fail = false;
+    send.data()[0] = 1000.5;
+    handle.reduce(send, &receive, options);
+    EXPECT_NEAR(receive.data()[0], send.data()[0], 0.5 / options.fixedPointScale);
+    EXPECT_NEAR(receive.data()[1], send.data()[1], 0.5 / options.fixedPointScale);
+}
+
+TEST(EnsembleReduce, CombinedMean)
+{
+    plugin::ReduceCoordinator coordinator{[](const plugin::Matrix<double>& send,
+                                             plugin::Matrix<double>* receive) {
+        for (size_t i = 0;i < send.cols();++i)
+        {
+            receive->data()[i] = ensembleSize * send.data()[i];
+        }
+    }};
+    plugin::Matrix<double> send{std::vector<double>{1., 2.}};
+    plugin::Matrix<double> sum{1, 2};
+    plugin::Matrix<double> mean{1, 2};
+    coordinator.enqueue(&sum, &send, &sum, 0.);
+    coordinator.enqueue(&mean, &send, &mean, 0., {}, plugin::ReduceOperation::Mean);
+    coordinator.flush();
+    EXPECT_EQ(*sum.vector(), (std::vector<double>{3., 6.}));
+    EXPECT_EQ(*mean.vector(), (std::vector<double>{1., 2.}));
+}
+
+TEST(EnsembleReduce, ThreadEnsemble)
+{
+    EXPECT_THROW(plugin::ThreadEnsemble(0), gmxapi::UsageError);
+    const int members{4};
+    auto ensemble = std::make_shared<plugin::ThreadEnsemble>(members);
+    EXPECT_EQ(ensemble->size(), members);
+    EXPECT_THROW(ensemble->member(members), gmxapi::UsageError);
+
+    std::vector<int> errors(members, 0);
+    std::vector<int> mismatches(members, 0);
+    std::vector<std::thread> threads;
+    for (int rank = 0;rank < members;++rank)
+    {
+        threads.emplace_back([&, rank]() {
+            auto reduce = ensemble->member(rank);
+            for (int reduction = 0;reduction < 200;++reduction)
+            {
+                // Sizes vary between reductions, including sizes smaller than the ensemble.
+                const size_t size = 1 + reduction % 7;
+                plugin::Matrix<double> send{1, size};
+                plugin::Matrix<double> receive{1, size};
+                for (size_t i = 0;i < size;++i)
+                {
+                    send.data()[i] = rank * 1000. + reduction + i;
+                }
+                reduce(send, &receive);
+                for (size_t i = 0;i < size;++i)
+                {
+                    const double expected = 1000. * members * (members - 1) / 2 + members * (reduction + i);
+                    errors[rank] += receive.data()[i] != expected;
+                }
+            }
+            // Members disagreeing about the size all fail, and can continue.
+            plugin::Matrix<double> send{1, rank == 0 ? 2u : 3u};
+            plugin::Matrix<double> receive{1, rank == 0 ? 2u : 3u};
+            try
+            {
+                reduce(send, &receive);
+            }
+            catch (const gmxapi::ProtocolError&)
+            {
+                ++mismatches[rank];
+            }
+            plugin::Matrix<double> again{1, 3};
+            plugin::Matrix<double> result{1, 3};
+            reduce(again, &result);
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    EXPECT_EQ(errors, std::vector<int>(members, 0));
+    EXPECT_EQ(mismatches, std::vector<int>(members, 1));
+}
+
+} // end anonymous namespace
@@ -0,0 +1,134 @@
+/*! \file
+ * \brief Test the harmonic restraint bank against the harmonic potential of each pair.
+ */
+
+#include <cfenv>
+#include <cmath>
+
+#include <memory>
+#include <vector>
+
+#include "harmonicbank.h"
+#include "sessionresources.h"
+
+#include "gmxapi/exceptions.h"
+
+#include <gtest/gtest.h>
+
+using ::gmx::Vector;
+
+namespace {
+
+/// More pairs than a SIMD block, and not a multiple of its width.
+constexpr size_t npairs{37};
+
+plugin::harmonic_bank_param_type bankParams()
+{
+    plugin::harmonic_bank_param_type params;
+    for (size_t pair = 0;pair < npairs;++pair)
+    {
+        params.R0.push_back(real(0.5 + 0.1 * pair));
+        params.k.push_back(real(100. + 10. * pair));
+    }
+    return params;
+}
+
+TEST(HarmonicRestraintBank, BatchMatchesPairs)
+{
+    const auto params = bankParams();
+    plugin::HarmonicBank bank{params};
+    ASSERT_EQ(bank.size(), npairs);
+
+    std::vector<real> x(npairs), y(npairs), z(npairs), x0(npairs), y0(npairs), z0(npairs);
+    for (size_t pair = 0;pair < npairs;++pair)
+    {
+        x[pair] = real(0.3 * pair);
+        y[pair] = real(1. - 0.05 * pair);
+        z[pair] = real(0.2);
+        x0[pair] = real(0.1);
+        y0[pair] = 0;
+        z0[pair] = real(0.2 * (pair % 3));
+    }
+    // Coincident sites have no force.
+    x[5] = x0[5];
+    y[5] = y0[5];
+    z[5] = z0[5];
+
+    std::vector<real> fx(npairs), fy(npairs), fz(npairs), energy(npairs);
+    // Nor do they raise floating-point exceptions, which trap in builds that enable them.
+    std::feclearexcept(FE_ALL_EXCEPT);
+    bank.calculate(plugin::PairBatch{npairs, x.data(), y.data(), z.data(), x0.data(), y0.data(), z0.data()},
+                   0,
+                   plugin::PairBatchForces{fx.data(), fy.data(), fz.data(), energy.data()});
+    EXPECT_FALSE(std::fetestexcept(FE_DIVBYZERO | FE_INVALID));
+
+    for (size_t pair = 0;pair < npairs;++pair)
+    {
+        const Vector v{x[pair], y[pair], z[pair]};
+        const Vector v0{x0[pair], y0[pair], z0[pair]};
+        const auto point = bank.calculate(pair, v, v0, 0);
+
+        const double dx = x[pair] - x0[pair];
+        const double dy = y[pair] - y0[pair];
+        const double dz = z[pair] - z0[pair];
+        const double R = std::sqrt(dx * dx + dy * dy + dz * dz);
+        const double k = params.k[pair];
+        const double stretch = R - params.R0[pair];
+        const double expectedEnergy = 0.5 * k * stretch * stretch;
+        const double expectedForce = R > 0 ? -k * stretch * dx / R : 0.;
+
+        const double tolerance = 1e-5 * (1 + std::abs(expectedEnergy));
+        EXPECT_NEAR(point.energy, expectedEnergy, tolerance);
+        EXPECT_NEAR(energy[pair], expectedEnergy, tolerance);
+        EXPECT_NEAR(point.force[0], expectedForce, 1e-5 * (1 + std::abs(expectedForce)));
+        EXPECT_NEAR(fx[pair], point.force[0], 1e-5 * (1 + std::abs(expectedForce)));
+        EXPECT_NEAR(fy[pair], point.force[1], 1e-5 * (1 + std::abs(point.force[1])));
+        EXPECT_NEAR(fz[pair], point.force[2], 1e-5 * (1 + std::abs(point.force[2])));
+    }
+    EXPECT_EQ(fx[5], 0);
+    EXPECT_EQ(fy[5], 0);
+    EXPECT_EQ(fz[5], 0);
+}
+
+TEST(HarmonicRestraintBank, ModulesReturnSameRestraint)
+{
+    auto bank = std::make_shared<plugin::HarmonicBank>(bankParams());
+    std::vector<std::shared_ptr<plugin::RestraintModule<plugin::HarmonicBankPair>>> modules;
+    for (size_t pair = 0;pair < npairs;++pair)
+    {
+        modules.push_back(std::make_shared<plugin::RestraintModule<plugin::HarmonicBankPair>>("harmonic_" + std::to_string(pair),
+                                                                                              std::vector<int>{int(pair), int(npairs + pair)},
+                                                                                              plugin::harmonic_bank_pair_param_type{bank, pair},
+                                                                                              nullptr));
+    }
+    auto restraint = modules[3]->getRestraint();
+    EXPECT_EQ(restraint, modules[3]->getRestraint());
+    EXPECT_EQ(restraint->sites(), (std::vector<int>{3, int(npairs) + 3}));
+
+    const Vector v{1, 1, 0};
+    const Vector v0{0, 0, 0};
+    const auto expected = bank->calculate(3, v, v0, 0);
+    const auto point = restraint->evaluate(v, v0, 0);
+    EXPECT_EQ(point.force[0], expected.force[0]);
+    EXPECT_EQ(point.energy, expected.energy);
+}
+
+TEST(HarmonicRestraintBank, Arguments)
+{
+    EXPECT_THROW(plugin::HarmonicBank(plugin::harmonic_bank_param_type{}), gmxapi::UsageError);
+    auto params = bankParams();
+    params.k.pop_back();
+    EXPECT_THROW(plugin::HarmonicBank{params}, gmxapi::UsageError);
+
+    auto bank = std::make_shared<plugin::HarmonicBank>(bankParams());
+    EXPECT_THROW(plugin::HarmonicBankPair({0, 1}, plugin::harmonic_bank_pair_param_type{bank, npairs}, nullptr),
+                 gmxapi::UsageError);
+    std::vector<real> coordinates(npairs - 1), forces(npairs - 1);
+    EXPECT_THROW(bank->calculate(plugin::PairBatch{npairs - 1, coordinates.data(), coordinates.data(), coordinates.data(),
+                                                   coordinates.data(), coordinates.data(), coordinates.data()},
+                                 0,
+                                 plugin::PairBatchForces{forces.data(), forces.data(), forces.data(), nullptr}),
+                 gmxapi::UsageError);
+}
+
+} // end anonymous namespace
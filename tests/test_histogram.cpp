@@ -4,11 +4,32 @@
 
 #include "testingconfiguration.h"
 
+#include <cmath>
+#include <cstdio>
+
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include "alignedallocator.h"
+#include "arena.h"
+#include "biaskernel.h"
+#include "blur.h"
 #include "ensemblepotential.h"
+#include "forcetable.h"
+#include "pairbatch.h"
+#include "precision.h"
 #include "sessionresources.h"
+#include "stepscheduler.h"
+#include "threadensemble.h"
+#include "windowhistory.h"
+
+#include "gmxapi/exceptions.h"
 
 #include <gtest/gtest.h>
 
@@ -36,12 +57,9 @@ TEST(EnsembleHistogramPotentialPlugin, ForceCalc)
     // store temporary values long enough for inspection
     Vector force{};
 
-    /*! We need to be able to mock up a Session or otherwise get a dummy SessionResources.
-    // Get a dummy EnsembleResources. We aren't testing that here.
-    auto dummyFunc = [](const plugin::Matrix<double>&, plugin::Matrix<double>*){
-        return;};
-    auto resource = std::make_shared<plugin::EnsembleResources>(dummyFunc);
-    */
+    // A single-member ensemble provides the reduction without a Session.
+    auto ensemble = std::make_shared<plugin::ThreadEnsemble>(1);
+    auto resource = std::make_shared<plugin::Resources>(ensemble->member(0));
 
     // Define a reference distribution with a triangular peak at the 1.0 bin.
     const std::vector<double>
@@ -71,13 +89,6 @@ TEST(EnsembleHistogramPotentialPlugin, ForceCalc)
     ASSERT_EQ(static_cast<real>(0.0), norm(calculateForce(e1, e2, 0.)));
     ASSERT_EQ(static_cast<real>(0.0), norm(calculateForce(e1, static_cast<real>(-1)*e1, 0.)));
 
-    /* In 0.0.7, we cannot have a SessionResource without a Session. We can't
-     * really do this mock-up test in the 0.0.7 infrastructure without some
-     * colossal kludges, so we'll remove this until the new SessionResources
-     * protocol is further along.
-     * See https://github.com/kassonlab/gmxapi/issues/77
-     * See https://github.com/kassonlab/gmxapi/issues/186
-
     // Establish a history of the atoms being 2.0 apart.
     restraint.callback(e1, static_cast<real>(3)*e1, 0.001, *resource);
 
@@ -89,7 +100,826 @@ TEST(EnsembleHistogramPotentialPlugin, ForceCalc)
 
     // When input vectors are equal, output vector is meaningless and magnitude is set to zero.
     ASSERT_EQ(static_cast<real>(0.0), norm(calculateForce(e1, e1, 0.001)));
-    */
+}
+
+TEST(EnsembleHistogramPotentialPlugin, EnsembleCallback)
+{
+    // Members sample different distances, but share the histogram averaged over the ensemble.
+    const size_t nbins{40};
+    const int members{3};
+    auto params = plugin::makeEnsembleParams(nbins, 0.1, 0.5, 3.5, std::vector<double>(nbins, 0.), 4, 0.001, 2, 10., 0.2);
+    auto ensemble = std::make_shared<plugin::ThreadEnsemble>(members);
+    std::vector<std::shared_ptr<plugin::EnsemblePotential>> restraints;
+    std::vector<std::unique_ptr<plugin::Resources>> resources;
+    for (int rank = 0;rank < members;++rank)
+    {
+        // Potentials are over-aligned.
+        restraints.push_back(std::allocate_shared<plugin::EnsemblePotential>(plugin::AlignedAllocator<plugin::EnsemblePotential>(),
+                                                                             *params));
+        resources.emplace_back(new plugin::Resources(ensemble->member(rank)));
+    }
+    plugin::EnsemblePotential alone{*params};
+    plugin::Resources aloneResources{std::make_shared<plugin::ThreadEnsemble>(1)->member(0)};
+
+    const Vector v0{0, 0, 0};
+    std::vector<std::thread> threads;
+    for (int rank = 0;rank < members;++rank)
+    {
+        threads.emplace_back([&, rank]() {
+            const Vector v{real(1.5 + 0.3 * rank), 0, 0};
+            for (int step = 0;step <= 12;++step)
+            {
+                restraints[rank]->callback(v, v0, step * 0.001, *resources[rank]);
+            }
+        });
+    }
+    const Vector v{real(1.5), 0, 0};
+    for (int step = 0;step <= 12;++step)
+    {
+        alone.callback(v, v0, step * 0.001, aloneResources);
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    bool differs{false};
+    for (double x = 1.;x < 3.;x += 0.05)
+    {
+        const Vector position{real(x), 0, 0};
+        const auto force = restraints[0]->calculate(position, v0, 0.012).force[0];
+        for (int rank = 1;rank < members;++rank)
+        {
+            EXPECT_EQ(force, restraints[rank]->calculate(position, v0, 0.012).force[0]);
+        }
+        differs = differs || force != alone.calculate(position, v0, 0.012).force[0];
+    }
+    EXPECT_TRUE(differs);
+}
+
+/*!
+ * \brief Ensemble of one member whose reductions complete on the given test() call, or when waited for.
+ */
+class DeferredReduction : public plugin::ReduceRequest::Operation
+{
+    public:
+        DeferredReduction(const plugin::Matrix<double>& send,
+                          plugin::Matrix<double>* receive,
+                          int testsToComplete,
+                          int* waits) :
+            send_{&send},
+            receive_{receive},
+            testsToComplete_{testsToComplete},
+            waits_{waits}
+        {}
+
+        ~DeferredReduction() override
+        {
+            if (receive_)
+            {
+                wait();
+            }
+        }
+
+        bool test() override
+        {
+            if (--testsToComplete_ > 0)
+            {
+                return false;
+            }
+            complete();
+            return true;
+        }
+
+        void wait() override
+        {
+            ++*waits_;
+            complete();
+        }
+
+    private:
+        void complete()
+        {
+            std::copy_n(send_->data(),
+                        send_->rows() * send_->cols(),
+                        receive_->data());
+            receive_ = nullptr;
+        }
+
+        const plugin::Matrix<double>* send_;
+        plugin::Matrix<double>* receive_;
+        int testsToComplete_;
+        int* waits_;
+};
+
+TEST(EnsembleHistogramPotentialPlugin, AsyncReduce)
+{
+    // Windows of 4 samples close at steps 4 and 8. The first reduction completes on the given test()
+    // call, and the restraint waits for it async_reduce_steps after step 4, or at the next window.
+    struct Case
+    {
+        unsigned int asyncReduceSteps;
+        int testsToComplete;
+        int appliedStep;
+        int waits;
+    };
+    const std::vector<Case> cases{{3, 2, 6, 0},
+                                  {3, 100, 7, 1},
+                                  {10, 100, 8, 1}};
+    const size_t nbins{40};
+    const double dt{0.001};
+    for (const bool scheduled : {false, true})
+    {
+        for (const auto& expected : cases)
+        {
+            auto params = plugin::makeEnsembleParams(nbins, 0.1, 0.5, 3.5, std::vector<double>(nbins, 0.), 4, dt, 2, 10., 0.2);
+            params->asyncReduceSteps = expected.asyncReduceSteps;
+            int waits{0};
+            int reductions{0};
+            plugin::Resources resources{[](const plugin::Matrix<double>&, plugin::Matrix<double>*) {
+                FAIL() << "Asynchronous reductions should not block.";
+            }};
+            resources.setAsyncReduce([&](const plugin::Matrix<double>& send,
+                                         plugin::Matrix<double>* receive) {
+                // Later reductions complete on the first test().
+                const int tests = reductions++ == 0 ? expected.testsToComplete : 1;
+                return plugin::ReduceRequest(std::make_unique<DeferredReduction>(send,
+                                                                                 receive,
+                                                                                 tests,
+                                                                                 &waits));
+            });
+            if (scheduled)
+            {
+                resources.setStepScheduler(std::make_shared<plugin::StepScheduler>(dt));
+            }
+            plugin::EnsemblePotential restraint{*params};
+
+            const Vector v0{0, 0, 0};
+            const Vector v{real(2.), 0, 0};
+            const auto initialForce = restraint.calculate(v, v0, 0.).force[0];
+            for (int step = 0;step <= 8;++step)
+            {
+                restraint.callback(v, v0, step * dt, resources);
+                const auto force = restraint.calculate(v, v0, step * dt).force[0];
+                // The previous histogram applies while the reduction is pending.
+                if (step < expected.appliedStep)
+                {
+                    EXPECT_EQ(force, initialForce) << "step " << step << ", scheduled " << scheduled;
+                }
+                else
+                {
+                    EXPECT_NE(force, initialForce) << "step " << step << ", scheduled " << scheduled;
+                }
+            }
+            EXPECT_EQ(waits, expected.waits) << "scheduled " << scheduled;
+            EXPECT_EQ(reductions, 2);
+        }
+    }
+}
+
+TEST(EnsembleHistogramPotentialPlugin, CallbackPeriod)
+{
+    // Samples are due every 4 steps, so calling back every 2 steps gives the same histograms.
+    const size_t nbins{40};
+    const double dt{0.001};
+    auto params = plugin::makeEnsembleParams(nbins, 0.1, 0.5, 3.5, std::vector<double>(nbins, 0.), 3, 4 * dt, 2, 10., 0.2);
+    auto makeRestraint = [&params, dt]() {
+        auto resources = std::make_shared<plugin::Resources>(std::make_shared<plugin::ThreadEnsemble>(1)->member(0));
+        resources->setStepScheduler(std::make_shared<plugin::StepScheduler>(dt));
+        return plugin::RestraintFactory<plugin::EnsembleRestraint>::create({0, 1},
+                                                                         *params,
+                                                                         resources);
+    };
+    auto everyStep = makeRestraint();
+    params->callbackPeriod = 2;
+    auto everyOtherStep = makeRestraint();
+
+    const Vector v0{0, 0, 0};
+    for (int step = 0;step <= 40;++step)
+    {
+        const Vector v{real(1.5 + 0.05 * (step % 5)), 0, 0};
+        everyStep->update(v, v0, step * dt);
+        everyOtherStep->update(v, v0, step * dt);
+    }
+
+    bool biased{false};
+    for (double x = 1.;x < 3.;x += 0.05)
+    {
+        const Vector position{real(x), 0, 0};
+        const auto force = everyStep->evaluate(position, v0, 40 * dt).force[0];
+        EXPECT_EQ(force, everyOtherStep->evaluate(position, v0, 40 * dt).force[0]);
+        biased = biased || force != 0;
+    }
+    EXPECT_TRUE(biased);
+
+    // Without MD steps, or with a period that does not divide the sample period, samples could be missed.
+    EXPECT_THROW(plugin::RestraintFactory<plugin::EnsembleRestraint>::create({0, 1},
+                                                                           *params,
+                                                                           std::make_shared<plugin::Resources>(std::make_shared<plugin::ThreadEnsemble>(1)->member(0))),
+                 gmxapi::UsageError);
+    params->callbackPeriod = 5;
+    EXPECT_THROW(makeRestraint(), gmxapi::UsageError);
+}
+
+TEST(EnsembleHistogramPotentialPlugin, CallbackPeriodNotDividing)
+{
+    // Samples are due every 4 steps. Calling back every 3 steps would take samples late and close
+    // windows every 18 steps instead of 16, so the period is rejected.
+    const size_t nbins{40};
+    const double dt{0.001};
+    auto params = plugin::makeEnsembleParams(nbins, 0.1, 0.5, 3.5, std::vector<double>(nbins, 0.), 4, 4 * dt, 2, 10., 0.2);
+    auto resources = std::make_shared<plugin::Resources>(std::make_shared<plugin::ThreadEnsemble>(1)->member(0));
+    resources->setStepScheduler(std::make_shared<plugin::StepScheduler>(dt));
+    params->callbackPeriod = 3;
+    EXPECT_THROW(plugin::RestraintFactory<plugin::EnsembleRestraint>::create({0, 1},
+                                                                           *params,
+                                                                           resources),
+                 gmxapi::UsageError);
+    params->callbackPeriod = 4;
+    EXPECT_NO_THROW(plugin::RestraintFactory<plugin::EnsembleRestraint>::create({0, 1},
+                                                                              *params,
+                                                                              resources));
+}
+
+TEST(EnsembleHistogramPotentialPlugin, StateView)
+{
+    // Windows of 3 samples, one every 4 steps.
+    const size_t nbins{40};
+    const double dt{0.001};
+    auto params = plugin::makeEnsembleParams(nbins, 0.1, 0.5, 3.5, std::vector<double>(nbins, 0.), 3, 4 * dt, 2, 10., 0.2);
+    auto restraint = plugin::RestraintFactory<plugin::EnsembleRestraint>::create({0, 1},
+                                                                               *params,
+                                                                               std::make_shared<plugin::Resources>(std::make_shared<plugin::ThreadEnsemble>(1)->member(0)));
+    const auto initial = restraint->stateView();
+    ASSERT_EQ(initial.histogram.shape, std::vector<size_t>{nbins});
+    ASSERT_EQ(initial.windows.shape, (std::vector<size_t>{2, nbins}));
+    ASSERT_EQ(initial.samples.shape, std::vector<size_t>{3});
+    ASSERT_EQ(initial.histogram.itemSize, sizeof(double));
+    EXPECT_EQ(initial.windowCount, 0u);
+    EXPECT_EQ(initial.historyVersion->load(), 0u);
+
+    const Vector v0{0, 0, 0};
+    for (int step = 0;step <= 42;++step)
+    {
+        const Vector v{real(1.5 + 0.05 * (step % 5)), 0, 0};
+        restraint->update(v, v0, step * dt);
+    }
+    // The views read the live buffers, and each window update advanced the version by two.
+    const auto state = restraint->stateView();
+    EXPECT_EQ(state.histogram.data, initial.histogram.data);
+    EXPECT_EQ(state.windowCount, 2u);
+    EXPECT_EQ(state.oldestWindow, 1u);
+    EXPECT_EQ(state.historyVersion->load(), 6u);
+    EXPECT_EQ(state.samplesVersion->load() % 2, 0u);
+    EXPECT_EQ(state.currentSample, 1u);
+    const auto sample = static_cast<const double*>(state.samples.data)[0];
+    EXPECT_GE(sample, 1.49);
+    EXPECT_LE(sample, 1.61);
+
+    const auto histogram = static_cast<const double*>(state.histogram.data);
+    EXPECT_NE(*std::max_element(histogram, histogram + nbins), 0.);
+}
+
+TEST(EnsembleHistogramPotentialPlugin, Checkpoint)
+{
+    // Windows of 3 samples, one every 4 steps, and checkpoints at the events of steps 12 and 24.
+    const size_t nbins{40};
+    const double dt{0.001};
+    auto params = plugin::makeEnsembleParams(nbins, 0.1, 0.5, 3.5, std::vector<double>(nbins, 0.), 3, 4 * dt, 3, 10., 0.2);
+    auto makeRestraint = [&params, dt]() {
+        auto resources = std::make_shared<plugin::Resources>(std::make_shared<plugin::ThreadEnsemble>(1)->member(0));
+        resources->setStepScheduler(std::make_shared<plugin::StepScheduler>(dt));
+        return plugin::RestraintFactory<plugin::EnsembleRestraint>::create({0, 1},
+                                                                         *params,
+                                                                         resources);
+    };
+    auto reference = makeRestraint();
+
+    const std::string filename{::testing::TempDir() + "ensemble_restraint_checkpoint.bin"};
+    std::remove(filename.c_str());
+    params->checkpointFile = filename;
+    params->checkpointInterval = 10 * dt;
+    auto interrupted = makeRestraint();
+
+    const Vector v0{0, 0, 0};
+    auto position = [](int step) { return Vector{real(1.5 + 0.05 * (step % 5)), 0, 0}; };
+    for (int step = 0;step <= 60;++step)
+    {
+        reference->update(position(step), v0, step * dt);
+        if (step <= 26)
+        {
+            interrupted->update(position(step), v0, step * dt);
+        }
+    }
+    interrupted.reset();
+
+    // The restart continues from step 24, where the last checkpoint was written.
+    auto restarted = makeRestraint();
+    EXPECT_EQ(restarted->stateView().windowCount, 2u);
+    for (int step = 24;step <= 60;++step)
+    {
+        restarted->update(position(step), v0, step * dt);
+    }
+    EXPECT_EQ(restarted->stateView().windowCount, 3u);
+    EXPECT_EQ(restarted->stateView().currentSample, reference->stateView().currentSample);
+    for (double x = 1.;x < 3.;x += 0.05)
+    {
+        const Vector v{real(x), 0, 0};
+        EXPECT_EQ(restarted->evaluate(v, v0, 60 * dt).force[0], reference->evaluate(v, v0, 60 * dt).force[0]);
+    }
+
+    // The file is replaced by rename, and a checkpoint of different parameters is refused.
+    EXPECT_EQ(std::fopen((filename + ".tmp").c_str(), "rb"), nullptr);
+    EXPECT_FALSE(reference->restoreCheckpoint(filename + ".missing"));
+    params->nWindows = 4;
+    EXPECT_THROW(makeRestraint(), gmxapi::UsageError);
+    std::remove(filename.c_str());
+}
+
+TEST(EnsembleHistogramPotentialPlugin, CheckpointRestartTime)
+{
+    // Windows of 3 samples, one every 4 steps, close at steps 12, 24, 36, 48 and 60. The checkpoint
+    // is written at the event of step 16, with the sample of step 16 in the open window.
+    const size_t nbins{40};
+    const double dt{0.001};
+    auto params = plugin::makeEnsembleParams(nbins, 0.1, 0.5, 3.5, std::vector<double>(nbins, 0.), 3, 4 * dt, 3, 10., 0.2);
+    auto makeRestraint = [&params, dt]() {
+        auto resources = std::make_shared<plugin::Resources>(std::make_shared<plugin::ThreadEnsemble>(1)->member(0));
+        resources->setStepScheduler(std::make_shared<plugin::StepScheduler>(dt));
+        return plugin::RestraintFactory<plugin::EnsembleRestraint>::create({0, 1},
+                                                                         *params,
+                                                                         resources);
+    };
+    const Vector v0{0, 0, 0};
+    auto position = [](int step) { return Vector{real(1.5 + 0.05 * (step % 5)), 0, 0}; };
+    // Steps at which the restraint updated its windows.
+    auto run = [&position, &v0, dt](plugin::EnsembleRestraint* restraint,
+                                    int first) {
+        std::vector<int> updates;
+        auto version = restraint->stateView().historyVersion->load();
+        for (int step = first;step <= 60;++step)
+        {
+            restraint->update(position(step), v0, step * dt);
+            if (restraint->stateView().historyVersion->load() != version)
+            {
+                version = restraint->stateView().historyVersion->load();
+                updates.push_back(step);
+            }
+        }
+        return updates;
+    };
+    auto reference = makeRestraint();
+    EXPECT_EQ(run(reference.get(), 0), (std::vector<int>{12, 24, 36, 48, 60}));
+
+    const std::string filename{::testing::TempDir() + "ensemble_restraint_restart.bin"};
+    std::remove(filename.c_str());
+    params->checkpointFile = filename;
+    params->checkpointInterval = 13 * dt;
+    auto interrupted = makeRestraint();
+    for (int step = 0;step <= 18;++step)
+    {
+        interrupted->update(position(step), v0, step * dt);
+    }
+    interrupted.reset();
+    // The restarted restraints checkpoint to the same file, so each restarts from a copy.
+    std::ifstream saved{filename,
+                        std::ios::binary};
+    const std::string checkpoint{std::istreambuf_iterator<char>(saved),
+                                 std::istreambuf_iterator<char>()};
+    auto restart = [&]() {
+        std::ofstream{filename,
+                      std::ios::binary} << checkpoint;
+        return makeRestraint();
+    };
+
+    auto sameBias = [&reference, &v0, dt](plugin::EnsembleRestraint* restraint) {
+        for (double x = 1.;x < 3.;x += 0.05)
+        {
+            const Vector v{real(x), 0, 0};
+            if (restraint->evaluate(v, v0, 60 * dt).force[0] != reference->evaluate(v, v0, 60 * dt).force[0])
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+    // A restart from before the checkpoint drops the sample of step 16 and takes it again, and one
+    // from after it misses nothing, so both match the uninterrupted run.
+    for (int step : {14, 18})
+    {
+        auto restarted = restart();
+        EXPECT_EQ(run(restarted.get(), step), (std::vector<int>{24, 36, 48, 60}));
+        EXPECT_TRUE(sameBias(restarted.get()));
+    }
+
+    // The sample of step 20 is missed and repeats that of step 22, but windows close on the same
+    // steps, so the bias matches once the window of step 24 has left the history.
+    auto late = restart();
+    EXPECT_EQ(run(late.get(), 22), (std::vector<int>{24, 36, 48, 60}));
+    EXPECT_TRUE(sameBias(late.get()));
+
+    // The window of step 12 is after a restart at step 10, and the window of step 24 is missing at step 26.
+    for (int step : {10, 26})
+    {
+        auto refused = restart();
+        EXPECT_THROW(refused->update(position(step), v0, step * dt), gmxapi::UsageError);
+    }
+    std::remove(filename.c_str());
+}
+
+TEST(EnsembleHistogramPotentialPlugin, TabulatedForce)
+{
+    // Use the bin layout of the restrained-ensemble example with a bias histogram that changes sign.
+    const size_t nbins{70};
+    const double binWidth{0.1};
+    const double sigma{0.2};
+    const double k{100.};
+    const double minDist{1.9};
+    const double maxDist{6.0};
+
+    std::vector<double> histogram(nbins);
+    for (size_t i = 0;i < nbins;++i)
+    {
+        const double x{i * binWidth};
+        histogram[i] = exp(-(x - 3.) * (x - 3.)) - 0.8 * exp(-2. * (x - 4.5) * (x - 4.5));
+    }
+
+    plugin::ForceTable<double> table;
+    ASSERT_TRUE(table.empty());
+    table.build(histogram.data(), nbins, binWidth, sigma, k, minDist, maxDist, 8);
+    ASSERT_FALSE(table.empty());
+
+    double maxForce{0};
+    double maxEnergy{0};
+    double forceError{0};
+    double energyError{0};
+    for (double R = minDist;R <= maxDist;R += 0.0007)
+    {
+        const auto direct = plugin::evaluateBias(R, histogram.data(), nbins, binWidth, sigma, k);
+        const auto tabulated = table.evaluate(R);
+        maxForce = std::max(maxForce, std::abs(direct.force));
+        maxEnergy = std::max(maxEnergy, std::abs(direct.energy));
+        forceError = std::max(forceError, std::abs(tabulated.force - direct.force));
+        energyError = std::max(energyError, std::abs(tabulated.energy - direct.energy));
+    }
+    ASSERT_GT(maxForce, 0.);
+    // Cubic Hermite interpolation with 8 intervals per bin (h = sigma / 16) is accurate to about 1e-8 relative.
+    EXPECT_LT(forceError, 1e-6 * maxForce);
+    EXPECT_LT(energyError, 1e-6 * maxEnergy);
+
+    // Force is the negative derivative of energy.
+    const double h{1e-5};
+    const double R{3.3};
+    const auto point = plugin::evaluateBias(R, histogram.data(), nbins, binWidth, sigma, k);
+    const double dUdR = (plugin::evaluateBias(R + h, histogram.data(), nbins, binWidth, sigma, k).energy
+                         - plugin::evaluateBias(R - h, histogram.data(), nbins, binWidth, sigma, k).energy) / (2 * h);
+    EXPECT_NEAR(-dUdR, point.force, 1e-6 * maxForce);
+
+    // Without a histogram, the tabulated potential is zero everywhere between the bounds.
+    auto params = plugin::makeEnsembleParams(nbins, binWidth, minDist, maxDist, histogram, 1, 0.001, 1, k, sigma);
+    params->tableResolution = 8;
+    plugin::EnsemblePotential tabulated{*params};
+    const gmx::Vector e1{real(1), real(0), real(0)};
+    ASSERT_EQ(static_cast<real>(0.0), norm(tabulated.calculate(e1, static_cast<real>(4)*e1, 0.).force));
+}
+
+TEST(EnsembleHistogramPotentialPlugin, TruncatedKernel)
+{
+    const size_t nbins{70};
+    const double binWidth{0.1};
+    const double sigma{0.2};
+    const double k{100.};
+
+    // The kernel requires zero-padded, aligned storage.
+    plugin::AlignedVector<double> histogram(plugin::paddedSize<double>(nbins), 0.);
+    for (size_t i = 0;i < nbins;++i)
+    {
+        const double x{i * binWidth};
+        histogram[i] = exp(-(x - 3.) * (x - 3.)) - 0.8 * exp(-2. * (x - 4.5) * (x - 4.5));
+    }
+
+    const plugin::BiasKernel<double> truncated{binWidth, sigma, k, 6.};
+    const plugin::BiasKernel<double> untruncated{binWidth, sigma, k, 0.};
+
+    double maxForce{0};
+    double maxEnergy{0};
+    double truncatedError{0};
+    double untruncatedError{0};
+    double energyError{0};
+    // Include distances beyond both ends of the histogram.
+    for (double R = -1.;R <= 8.;R += 0.0013)
+    {
+        const auto direct = plugin::evaluateBias(R, histogram.data(), nbins, binWidth, sigma, k);
+        const auto fast = truncated(R, histogram.data(), nbins);
+        const auto full = untruncated(R, histogram.data(), nbins);
+        maxForce = std::max(maxForce, std::abs(direct.force));
+        maxEnergy = std::max(maxEnergy, std::abs(direct.energy));
+        truncatedError = std::max(truncatedError, std::abs(fast.force - direct.force));
+        energyError = std::max(energyError, std::abs(fast.energy - direct.energy));
+        untruncatedError = std::max(untruncatedError, std::abs(full.force - direct.force));
+    }
+    ASSERT_GT(maxForce, 0.);
+    // Documented tolerances in biaskernel.h
+    EXPECT_LT(truncatedError, 1e-7 * maxForce);
+    EXPECT_LT(energyError, 1e-7 * maxEnergy);
+    EXPECT_LT(untruncatedError, 1e-12 * maxForce);
+}
+
+TEST(EnsembleHistogramPotentialPlugin, KernelTails)
+{
+    // A single bin at the origin, far beyond the reach of the Gaussian at the distances below.
+    const size_t nbins{70};
+    const double binWidth{0.1};
+    const double sigma{0.2};
+    const double k{100.};
+    plugin::AlignedVector<float> singleHistogram(plugin::paddedSize<float>(nbins), 0.f);
+    plugin::AlignedVector<double> doubleHistogram(plugin::paddedSize<double>(nbins), 0.);
+    singleHistogram[0] = 1.f;
+    doubleHistogram[0] = 1.;
+
+    // Without a cutoff, the kernel visits every bin, and tails below the range of exp() must vanish
+    // rather than contribute the exponential of the lowest argument. A narrower Gaussian reaches
+    // that range in double precision.
+    const plugin::BiasKernel<float> singleKernel{binWidth, sigma, k, 0.};
+    const plugin::BiasKernel<double> doubleKernel{binWidth, sigma / 2, k, 0.};
+    for (const double R : {3., 5., 6.8})
+    {
+        const auto point = singleKernel(R, singleHistogram.data(), nbins);
+        EXPECT_EQ(point.force, 0.) << "R = " << R;
+        EXPECT_EQ(point.energy, 0.) << "R = " << R;
+    }
+    const auto point = doubleKernel(6.8, doubleHistogram.data(), nbins);
+    EXPECT_EQ(point.force, 0.);
+    EXPECT_EQ(point.energy, 0.);
+
+    // Within range, the tail is small but not zero.
+    EXPECT_GT(singleKernel(2., singleHistogram.data(), nbins).energy, 0.);
+    EXPECT_GT(doubleKernel(3., doubleHistogram.data(), nbins).energy, 0.);
+}
+
+TEST(EnsembleHistogramPotentialPlugin, TruncatedBlur)
+{
+    const size_t nbins{70};
+    const double binWidth{0.1};
+    const double sigma{0.2};
+
+    // Include samples beyond both ends of the grid.
+    std::vector<double> samples;
+    for (size_t i = 0;i < 200;++i)
+    {
+        samples.push_back(-0.5 + 8. * ((i * 37) % 200) / 200.);
+    }
+
+    // Untruncated reference, as in the original BlurToGrid.
+    std::vector<double> reference(nbins, 0.);
+    const double normalization = 1. / (samples.size() * sqrt(2. * M_PI * sigma * sigma));
+    for (size_t i = 0;i < nbins;++i)
+    {
+        for (const auto sample : samples)
+        {
+            const double x{i * binWidth - sample};
+            reference[i] += normalization * exp(-x * x / (2 * sigma * sigma));
+        }
+    }
+    const double maxValue = *std::max_element(reference.begin(), reference.end());
+
+    std::vector<double> truncated(nbins), untruncated(nbins);
+    plugin::BlurToGrid<double>(0., binWidth, sigma, 6.)(samples, &truncated);
+    plugin::BlurToGrid<double>(0., binWidth, sigma, 0.)(samples, &untruncated);
+
+    std::vector<float> singleSamples(samples.begin(), samples.end());
+    std::vector<double> single(nbins);
+    plugin::BlurToGrid<float>(0., binWidth, sigma, 6.)(singleSamples, &single);
+
+    for (size_t i = 0;i < nbins;++i)
+    {
+        // Documented tolerance in blur.h
+        EXPECT_NEAR(reference[i], truncated[i], 1e-7 * maxValue);
+        EXPECT_NEAR(reference[i], untruncated[i], 1e-12 * maxValue);
+        EXPECT_NEAR(reference[i], single[i], 1e-5 * maxValue);
+    }
+
+    // Kernel storage is fully overwritten, and padding is left at zero.
+    plugin::AlignedVector<double> grid(plugin::paddedSize<double>(nbins), 1.);
+    plugin::BlurToGrid<double>(0., binWidth, sigma, 6.)(samples, nbins, grid.data());
+    for (size_t i = nbins;i < grid.size();++i)
+    {
+        EXPECT_EQ(0., grid[i]);
+    }
+}
+
+TEST(EnsembleHistogramPotentialPlugin, BinnedBlur)
+{
+    const size_t nbins{70};
+    const double binWidth{0.1};
+
+    std::vector<double> samples;
+    for (size_t i = 0;i < 5000;++i)
+    {
+        samples.push_back(-0.5 + 8. * ((i * 37) % 5000) / 5000.);
+    }
+
+    // Narrow and wide Gaussians exercise the direct and FFT convolutions.
+    for (const double sigma : {0.2, 1.5})
+    {
+        std::vector<double> reference(nbins);
+        plugin::BlurToGrid<double>(0., binWidth, sigma, 6.)(samples, &reference);
+        const double maxValue = *std::max_element(reference.begin(), reference.end());
+
+        using Convolution = plugin::BinnedBlur<double>::Convolution;
+        for (const auto convolution : {Convolution::Automatic, Convolution::Direct, Convolution::Fft})
+        {
+            std::vector<double> binned(nbins);
+            plugin::BinnedBlur<double> blur{0., binWidth, sigma, 6., convolution};
+            blur(samples, &binned);
+            // Repeated use reuses the prepared stencil.
+            blur(samples, &binned);
+            for (size_t i = 0;i < nbins;++i)
+            {
+                // Documented tolerance in blur.h
+                EXPECT_NEAR(reference[i], binned[i], 5e-4 * maxValue) << "sigma " << sigma << " bin " << i;
+            }
+        }
+
+        std::vector<float> singleSamples(samples.begin(), samples.end());
+        std::vector<double> single(nbins);
+        plugin::BinnedBlur<float>(0., binWidth, sigma, 6.)(singleSamples, &single);
+        for (size_t i = 0;i < nbins;++i)
+        {
+            EXPECT_NEAR(reference[i], single[i], 5e-4 * maxValue);
+        }
+    }
+
+    EXPECT_EQ(plugin::BlurMode::Binned, plugin::blurModeFromString("binned"));
+    EXPECT_THROW(plugin::blurModeFromString("fast"), gmxapi::UsageError);
+}
+
+TEST(EnsembleHistogramPotentialPlugin, SinglePrecision)
+{
+    const size_t nbins{70};
+    const double binWidth{0.1};
+    const double sigma{0.2};
+    const double k{100.};
+    const double minDist{1.9};
+    const double maxDist{6.0};
+
+    std::vector<double> reference(nbins);
+    plugin::AlignedVector<float> histogram(plugin::paddedSize<float>(nbins), 0.f);
+    for (size_t i = 0;i < nbins;++i)
+    {
+        const double x{i * binWidth};
+        reference[i] = exp(-(x - 3.) * (x - 3.)) - 0.8 * exp(-2. * (x - 4.5) * (x - 4.5));
+        histogram[i] = static_cast<float>(reference[i]);
+    }
+
+    const plugin::BiasKernel<float> kernel{binWidth, sigma, k, 6.};
+    plugin::ForceTable<float> table;
+    table.build(histogram.data(), nbins, binWidth, sigma, k, minDist, maxDist, 8);
+
+    double maxForce{0};
+    double kernelError{0};
+    double tableError{0};
+    for (double R = minDist;R <= maxDist;R += 0.0013)
+    {
+        const auto direct = plugin::evaluateBias(R, reference.data(), nbins, binWidth, sigma, k);
+        maxForce = std::max(maxForce, std::abs(direct.force));
+        kernelError = std::max(kernelError, std::abs(kernel(R, histogram.data(), nbins).force - direct.force));
+        tableError = std::max(tableError, std::abs(table.evaluate(R).force - direct.force));
+    }
+    ASSERT_GT(maxForce, 0.);
+    // Documented tolerance in biaskernel.h
+    EXPECT_LT(kernelError, 1e-5 * maxForce);
+    EXPECT_LT(tableError, 1e-5 * maxForce);
+
+    // Every precision policy produces the same forces, to within single precision.
+    auto params = plugin::makeEnsembleParams(nbins, binWidth, minDist, maxDist, reference, 1, 0.001, 1, k, sigma);
+    const plugin::EnsemblePotential doublePotential{*params};
+    const plugin::BasicEnsemblePotential<plugin::SinglePrecision> singlePotential{*params};
+    const plugin::BasicEnsemblePotential<plugin::MixedPrecision> mixedPotential{*params};
+
+    const std::vector<real> x{1., 2., 5., 7.5};
+    const std::vector<real> zero(x.size(), 0.);
+    std::vector<real> fx(x.size()), fy(x.size()), fz(x.size());
+    plugin::PairBatch pairs;
+    pairs.size = x.size();
+    pairs.x = x.data();
+    pairs.y = pairs.z = pairs.x0 = pairs.y0 = pairs.z0 = zero.data();
+    plugin::PairBatchForces forces;
+    forces.x = fx.data();
+    forces.y = fy.data();
+    forces.z = fz.data();
+
+    doublePotential.calculate(pairs, 0., forces);
+    const auto expected = fx;
+    singlePotential.calculate(pairs, 0., forces);
+    for (size_t i = 0;i < x.size();++i)
+    {
+        EXPECT_NEAR(expected[i], fx[i], 1e-5 * std::max(maxForce, double(std::abs(expected[i]))));
+    }
+    mixedPotential.calculate(pairs, 0., forces);
+    for (size_t i = 0;i < x.size();++i)
+    {
+        EXPECT_NEAR(expected[i], fx[i], 1e-5 * std::max(maxForce, double(std::abs(expected[i]))));
+    }
+
+    EXPECT_EQ(plugin::PrecisionMode::Mixed, plugin::precisionModeFromString("mixed"));
+    EXPECT_THROW(plugin::precisionModeFromString("quad"), gmxapi::UsageError);
+}
+
+TEST(EnsembleHistogramPotentialPlugin, WindowHistory)
+{
+    const size_t nBins{5};
+    const size_t capacity{4};
+    plugin::WindowHistory<double> history{nBins,
+                                          capacity};
+    EXPECT_EQ(history.size(), 0u);
+
+    // Window w holds w + 0.1 * i in bin i, so the expected sums are easy to write down.
+    std::vector<double> window(nBins);
+    for (size_t w = 0;w < 11;++w)
+    {
+        for (size_t i = 0;i < nBins;++i)
+        {
+            window[i] = w + 0.1 * i;
+        }
+        history.push(window.data());
+
+        const size_t stored = std::min(w + 1, capacity);
+        ASSERT_EQ(history.size(), stored);
+        const size_t oldest = w + 1 - stored;
+        for (size_t i = 0;i < nBins;++i)
+        {
+            double expected{0};
+            for (size_t k = oldest;k <= w;++k)
+            {
+                expected += k + 0.1 * i;
+            }
+            EXPECT_NEAR(history.sum()[i], expected, 1e-12);
+        }
+        EXPECT_DOUBLE_EQ(history.window(0)[0], oldest);
+        EXPECT_DOUBLE_EQ(history.window(stored - 1)[nBins - 1], w + 0.1 * (nBins - 1));
+    }
+
+    history.clear();
+    EXPECT_EQ(history.size(), 0u);
+    EXPECT_EQ(history.sum()[0], 0.);
+
+    // A running sum in single precision drifts, but recomputation brings it back to the exact sum.
+    plugin::WindowHistory<float> drifting{1,
+                                          3,
+                                          1000000};
+    for (int w = 0;w < 100000;++w)
+    {
+        const float value = w % 2 ? 1e4f : 1.1f;
+        drifting.push(&value);
+    }
+    drifting.recompute();
+    EXPECT_FLOAT_EQ(drifting.sum()[0], 1e4f + 1.1f + 1e4f);
+}
+
+TEST(EnsembleHistogramPotentialPlugin, Arena)
+{
+    plugin::Arena::Options options;
+    options.blockSize = 4096;
+    auto arena = std::make_shared<plugin::Arena>(options);
+
+    // Allocations are cache-line aligned and padded, and large requests get their own block.
+    plugin::ArenaVector<float> small(3, 1.f, plugin::ArenaAllocator<float>(arena));
+    plugin::ArenaVector<double> large(1000, 0., plugin::ArenaAllocator<double>(arena));
+    EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(small.data()) % plugin::kernelAlignment);
+    EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(large.data()) % plugin::kernelAlignment);
+    auto footprint = arena->footprint();
+    EXPECT_EQ(footprint.allocations, 2u);
+    EXPECT_EQ(footprint.usedBytes, plugin::kernelAlignment + 8000u);
+    EXPECT_EQ(footprint.blocks, 2u);
+    EXPECT_FALSE(arena->report().empty());
+
+    // Restraints created with an arena in their resources take their state from it, and compute the same forces.
+    const size_t nbins{50};
+    std::vector<double> experimental(nbins);
+    for (size_t i = 0;i < nbins;++i)
+    {
+        experimental[i] = exp(-0.1 * (i - 20.) * (i - 20.));
+    }
+    auto params = plugin::makeEnsembleParams(nbins, 0.1, 1.0, 4.5, experimental, 1, 0.001, 4, 10., 0.2);
+    auto resources = std::make_shared<plugin::Resources>([](const plugin::Matrix<double>&, plugin::Matrix<double>*){});
+    auto heapRestraint = plugin::RestraintFactory<plugin::EnsembleRestraint>::create({0, 1}, *params, resources);
+    resources->setArena(arena);
+    const auto before = arena->footprint();
+    auto arenaRestraint = plugin::RestraintFactory<plugin::EnsembleRestraint>::create({0, 1}, *params, resources);
+    EXPECT_GT(arena->footprint().allocations, before.allocations);
+    EXPECT_GT(arena->footprint().usedBytes, before.usedBytes);
+
+    for (double x = 0.5;x < 5.;x += 0.37)
+    {
+        const ::gmx::Vector v{real(x), 0, 0};
+        const ::gmx::Vector v0{0, 0, 0};
+        EXPECT_EQ(heapRestraint->evaluate(v, v0, 0.).force[0], arenaRestraint->evaluate(v, v0, 0.).force[0]);
+    }
+
+    // The arena outlives the restraint's use of it.
+    arenaRestraint.reset();
+    EXPECT_EQ(arena->footprint().allocations, 2u);
 }
 
 } // end anonymous namespace
@@ -0,0 +1,183 @@
+/*! \file
+ * \brief Test the background log of restraint windows and histograms.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ensemblepotential.h"
+#include "histogramlog.h"
+#include "sessionresources.h"
+#include "stepscheduler.h"
+#include "threadensemble.h"
+
+#include <gtest/gtest.h>
+
+using ::gmx::Vector;
+
+namespace {
+
+/// A record read back from a log file.
+struct Record
+{
+    plugin::LogRecordKind kind;
+    std::string name;
+    std::int64_t step;
+    double time;
+    std::uint32_t itemSize;
+    std::vector<double> values;
+};
+
+/// Read the bytes of a value from data at offset, and advance the offset.
+template<typename T>
+T take(const std::vector<char>& data,
+       size_t* offset)
+{
+    T value;
+    std::memcpy(&value, data.data() + *offset, sizeof(T));
+    *offset += sizeof(T);
+    return value;
+}
+
+/// Read a log file, checking its header.
+std::vector<Record> readLog(const std::string& filename)
+{
+    std::vector<char> data;
+    plugin::RAIIFile file{filename.c_str(), "rb"};
+    EXPECT_NE(file.fh(), nullptr);
+    char block[256];
+    size_t count{0};
+    while ((count = std::fread(block, 1, sizeof(block), file.fh())) > 0)
+    {
+        data.insert(data.end(), block, block + count);
+    }
+
+    size_t offset{0};
+    EXPECT_EQ(take<std::uint32_t>(data, &offset), 0x474c4845u);
+    EXPECT_EQ(take<std::uint32_t>(data, &offset), 1u);
+    std::vector<Record> records;
+    while (offset < data.size())
+    {
+        Record record;
+        record.kind = static_cast<plugin::LogRecordKind>(take<std::uint32_t>(data, &offset));
+        const auto nameLength = take<std::uint32_t>(data, &offset);
+        record.step = take<std::int64_t>(data, &offset);
+        record.time = take<double>(data, &offset);
+        record.itemSize = take<std::uint32_t>(data, &offset);
+        const auto count = take<std::uint32_t>(data, &offset);
+        record.name.assign(data.data() + offset, nameLength);
+        offset += nameLength;
+        for (size_t i = 0;i < count;++i)
+        {
+            record.values.push_back(record.itemSize == sizeof(float) ? take<float>(data, &offset)
+                                                                      : take<double>(data, &offset));
+        }
+        records.push_back(record);
+    }
+    EXPECT_EQ(offset, data.size());
+    return records;
+}
+
+/// Options for a log that writes and syncs promptly.
+plugin::HistogramLog::Options promptOptions()
+{
+    plugin::HistogramLog::Options options;
+    options.flushInterval = std::chrono::milliseconds(1);
+    options.syncInterval = std::chrono::milliseconds(0);
+    return options;
+}
+
+TEST(HistogramLog, RecordsRoundTrip)
+{
+    const std::string filename{::testing::TempDir() + "histogram_log_roundtrip.bin"};
+    std::remove(filename.c_str());
+    {
+        plugin::HistogramLog log{filename, promptOptions()};
+        auto channel = log.channel("pair_a", 4);
+        const std::vector<double> window{0.1, 0.2, 0.3, 0.4};
+        const std::vector<float> histogram{-1.f, 0.f, 1.f};
+        EXPECT_TRUE(channel->push(plugin::LogRecordKind::Window, 12, 0.024, window.data(), window.size()));
+        EXPECT_TRUE(channel->push(plugin::LogRecordKind::Histogram, -1, 0.024, histogram.data(), histogram.size()));
+    }
+    // A later run appends to the log without another file header.
+    {
+        plugin::HistogramLog log{filename, promptOptions()};
+        const std::vector<double> window{1., 2.};
+        log.channel("pair_b", 2)->push(plugin::LogRecordKind::Window, 24, 0.048, window.data(), window.size());
+    }
+
+    const auto records = readLog(filename);
+    ASSERT_EQ(records.size(), 3u);
+    EXPECT_EQ(records[0].kind, plugin::LogRecordKind::Window);
+    EXPECT_EQ(records[0].name, "pair_a");
+    EXPECT_EQ(records[0].step, 12);
+    EXPECT_EQ(records[0].time, 0.024);
+    EXPECT_EQ(records[0].values, (std::vector<double>{0.1, 0.2, 0.3, 0.4}));
+    EXPECT_EQ(records[1].kind, plugin::LogRecordKind::Histogram);
+    EXPECT_EQ(records[1].itemSize, sizeof(float));
+    EXPECT_EQ(records[1].step, -1);
+    EXPECT_EQ(records[1].values, (std::vector<double>{-1., 0., 1.}));
+    EXPECT_EQ(records[2].name, "pair_b");
+    EXPECT_EQ(records[2].values, (std::vector<double>{1., 2.}));
+    std::remove(filename.c_str());
+}
+
+TEST(HistogramLog, FullChannelDrops)
+{
+    plugin::LogChannel channel{"pair", 2, 2};
+    const double values[2]{1., 2.};
+    EXPECT_TRUE(channel.push(plugin::LogRecordKind::Window, 0, 0., values, 2));
+    EXPECT_TRUE(channel.push(plugin::LogRecordKind::Window, 1, 0., values, 2));
+    EXPECT_FALSE(channel.push(plugin::LogRecordKind::Window, 2, 0., values, 2));
+    EXPECT_EQ(channel.dropped(), 1u);
+
+    std::vector<char> buffer;
+    EXPECT_EQ(channel.drain(&buffer), 2u);
+    EXPECT_FALSE(buffer.empty());
+    EXPECT_TRUE(channel.push(plugin::LogRecordKind::Window, 3, 0., values, 2));
+    EXPECT_EQ(channel.drain(&buffer), 1u);
+}
+
+TEST(HistogramLog, RestraintWindows)
+{
+    const std::string filename{::testing::TempDir() + "histogram_log_restraint.bin"};
+    std::remove(filename.c_str());
+    const size_t nbins{40};
+    const double dt{0.001};
+    auto log = std::make_shared<plugin::HistogramLog>(filename, promptOptions());
+    {
+        // Windows of 3 samples, one every 4 steps, close at steps 12, 24, and 36.
+        auto params = plugin::makeEnsembleParams(nbins, 0.1, 0.5, 3.5, std::vector<double>(nbins, 0.), 3, 4 * dt, 2, 10., 0.2);
+        params->name = "restraint_0";
+        auto resources = std::make_shared<plugin::Resources>(std::make_shared<plugin::ThreadEnsemble>(1)->member(0));
+        resources->setStepScheduler(std::make_shared<plugin::StepScheduler>(dt));
+        resources->setHistogramLog(log);
+        auto restraint = plugin::RestraintFactory<plugin::EnsembleRestraint>::create({0, 1}, *params, resources);
+
+        const Vector v0{0, 0, 0};
+        for (int step = 0;step <= 40;++step)
+        {
+            const Vector v{real(1.5 + 0.05 * (step % 5)), 0, 0};
+            restraint->update(v, v0, step * dt);
+        }
+    }
+    log.reset();
+
+    const auto records = readLog(filename);
+    ASSERT_EQ(records.size(), 6u);
+    for (size_t i = 0;i < records.size();++i)
+    {
+        EXPECT_EQ(records[i].name, "restraint_0");
+        EXPECT_EQ(records[i].kind, i % 2 == 0 ? plugin::LogRecordKind::Window : plugin::LogRecordKind::Histogram);
+        EXPECT_EQ(records[i].step, static_cast<std::int64_t>(12 * (i / 2 + 1)));
+        EXPECT_EQ(records[i].values.size(), nbins);
+    }
+    std::remove(filename.c_str());
+}
+
+} // end anonymous namespace
@@ -0,0 +1,110 @@
+/*! \file
+ * \brief Test the native MPI ensemble reduction.
+ *
+ * Runs on a single rank under CTest. To test an actual ensemble, run with mpiexec.
+ */
+
+#include <mpi.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "mpireduce.h"
+#include "sessionresources.h"
+
+#include "gmxapi/exceptions.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+/// Initialize MPI for the tests, as mpi4py does for the Python module.
+class MpiEnvironment : public ::testing::Environment
+{
+    public:
+        void SetUp() override
+        {
+            int initialized{0};
+            MPI_Initialized(&initialized);
+            if (!initialized)
+            {
+                MPI_Init(nullptr,
+                         nullptr);
+            }
+        }
+
+        void TearDown() override
+        {
+            MPI_Finalize();
+        }
+};
+
+::testing::Environment* const mpiEnvironment = ::testing::AddGlobalTestEnvironment(new MpiEnvironment);
+
+TEST(MpiEnsembleReduce, SumsOverRanks)
+{
+    int rank{0};
+    int size{0};
+    MPI_Comm_rank(MPI_COMM_WORLD,
+                  &rank);
+    MPI_Comm_size(MPI_COMM_WORLD,
+                  &size);
+
+    // Obtain the communicator the way the Python module does from mpi4py.
+    const plugin::MpiReduce reduce = plugin::mpiReduceFromFortran(MPI_Comm_c2f(MPI_COMM_WORLD));
+    EXPECT_EQ(reduce.size(), size);
+
+    plugin::Matrix<double> send{std::vector<double>{1., 2., double(rank)}};
+    plugin::Matrix<double> receive{1, 3};
+    reduce(send,
+           &receive);
+    EXPECT_EQ(receive.data()[0], size);
+    EXPECT_EQ(receive.data()[1], 2. * size);
+    EXPECT_EQ(receive.data()[2], size * (size - 1) / 2.);
+
+    // Used as the reduce function of Resources.
+    plugin::Resources resources{plugin::MpiReduce(MPI_COMM_WORLD)};
+    plugin::Matrix<double> mismatched{1, 2};
+    EXPECT_THROW(reduce(send, &mismatched), gmxapi::ProtocolError);
+}
+
+TEST(MpiEnsembleReduce, NonBlocking)
+{
+    int size{0};
+    MPI_Comm_size(MPI_COMM_WORLD,
+                  &size);
+
+    const plugin::MpiReduce reduce{MPI_COMM_WORLD};
+    plugin::Matrix<double> send{std::vector<double>{1., 2.}};
+    plugin::Matrix<double> receive{1, 2};
+    auto request = reduce.start(send,
+                                &receive);
+    while (!request.test())
+    {
+        // Other work would go here.
+    }
+    EXPECT_TRUE(request.done());
+    EXPECT_EQ(receive.data()[0], size);
+    EXPECT_EQ(receive.data()[1], 2. * size);
+
+    plugin::Matrix<double> again{1, 2};
+    request = reduce.start(send,
+                           &again);
+    request.wait();
+    EXPECT_EQ(again.data()[1], 2. * size);
+
+    plugin::Matrix<double> mismatched{1, 3};
+    EXPECT_THROW(reduce.start(send, &mismatched), gmxapi::ProtocolError);
+
+    // Encoded data is reduced in its wire type.
+    const std::vector<float> floats{0.5f, 1.5f};
+    std::vector<float> floatSums(2);
+    reduce.start(plugin::WireType::Float32, floats.data(), floatSums.data(), 2).wait();
+    EXPECT_EQ(floatSums[1], 1.5f * size);
+    const std::vector<std::int32_t> ints{-3, 7};
+    std::vector<std::int32_t> intSums(2);
+    reduce.start(plugin::WireType::Int32, ints.data(), intSums.data(), 2).wait();
+    EXPECT_EQ(intSums[0], -3 * size);
+}
+
+} // end anonymous namespace
@@ -0,0 +1,172 @@
+/*! \file
+ * \brief Test the shared memory reduction with ensemble members in separate processes.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "shmreduce.h"
+
+#include "gmxapi/exceptions.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+/// Number of elements, more than the capacity of the segment.
+constexpr std::size_t size{1000};
+constexpr std::size_t capacity{96};
+
+/// Data of an ensemble member for a reduction.
+std::vector<double> memberData(int rank,
+                               int reduction)
+{
+    std::vector<double> data(size);
+    for (std::size_t i = 0;i < size;++i)
+    {
+        data[i] = (rank + 1) * 0.25 + i * reduction;
+    }
+    return data;
+}
+
+/// Pieces of a reduction of size elements.
+constexpr std::size_t pieces{(size + capacity - 1) / capacity};
+
+/*!
+ * \brief Reduce a few times as one member of a node, and check the results.
+ *
+ * \param nodes number of identical nodes simulated by the reduction between node leaders.
+ * \param failing reduction in which the reduction between nodes throws, or -1.
+ * \return number of wrong results.
+ */
+int runMember(const std::string& name,
+              int rank,
+              int members,
+              int nodes,
+              int failing = -1)
+{
+    plugin::SharedMemoryReduce::reduce_type interNodeReduce;
+    if (nodes > 1 && rank == 0)
+    {
+        std::size_t calls{0};
+        interNodeReduce = [nodes, failing, calls](const plugin::Matrix<double>& send,
+                                                  plugin::Matrix<double>* receive) mutable {
+            if (failing >= 0 && calls++ == failing * pieces)
+            {
+                throw std::runtime_error("link down");
+            }
+            for (std::size_t i = 0;i < send.cols();++i)
+            {
+                receive->data()[i] = nodes * send.data()[i];
+            }
+        };
+    }
+    plugin::SharedMemoryReduce reduce{name, rank, members, capacity, interNodeReduce};
+    int errors{0};
+    for (int reduction = 0;reduction < 20;++reduction)
+    {
+        plugin::Matrix<double> send{memberData(rank, reduction)};
+        plugin::Matrix<double> receive{1, size};
+        if (reduction == failing)
+        {
+            // The leader sees the error of the reduction between nodes, the other members a ProtocolError.
+            try
+            {
+                reduce(send,
+                       &receive);
+                ++errors;
+            }
+            catch (const gmxapi::ProtocolError&)
+            {
+                errors += rank == 0;
+            }
+            catch (const std::runtime_error& error)
+            {
+                errors += rank != 0 || std::string(error.what()) != "link down";
+            }
+            continue;
+        }
+        reduce(send,
+               &receive);
+        for (std::size_t i = 0;i < size;++i)
+        {
+            double expected{0};
+            for (int member = 0;member < members;++member)
+            {
+                expected += memberData(member, reduction)[i];
+            }
+            errors += receive.data()[i] != nodes * expected;
+        }
+    }
+    return errors;
+}
+
+/// Run members in child processes and in this process, and count wrong results.
+int runNode(const std::string& name,
+            int members,
+            int nodes,
+            int failing = -1)
+{
+    std::vector<pid_t> children;
+    for (int rank = 1;rank < members;++rank)
+    {
+        const pid_t pid = fork();
+        if (pid == 0)
+        {
+            int errors{1};
+            try
+            {
+                errors = runMember(name, rank, members, nodes, failing);
+            }
+            catch (...)
+            {
+            }
+            _exit(errors == 0 ? 0 : 1);
+        }
+        children.push_back(pid);
+    }
+    int errors = runMember(name, 0, members, nodes, failing);
+    for (const auto pid : children)
+    {
+        int status{0};
+        waitpid(pid, &status, 0);
+        errors += !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    return errors;
+}
+
+TEST(SharedMemoryReduce, SumsOverProcesses)
+{
+    const std::string name = "/gmxapi_reduce_test_" + std::to_string(getpid());
+    EXPECT_EQ(runNode(name, 4, 1), 0);
+    // The name can be reused once all members have attached.
+    EXPECT_EQ(runNode(name, 3, 2), 0);
+    EXPECT_EQ(runNode(name, 1, 1), 0);
+}
+
+TEST(SharedMemoryReduce, InterNodeFailure)
+{
+    // After the failed reduction, the following ones succeed on every member.
+    const std::string name = "/gmxapi_reduce_test_" + std::to_string(getpid());
+    EXPECT_EQ(runNode(name, 3, 2, 5), 0);
+}
+
+TEST(SharedMemoryReduce, Arguments)
+{
+    const std::string name = "/gmxapi_reduce_test_" + std::to_string(getpid());
+    EXPECT_THROW(plugin::SharedMemoryReduce(name, 2, 2), gmxapi::UsageError);
+    EXPECT_THROW(plugin::SharedMemoryReduce(name, 0, 1, 0), gmxapi::UsageError);
+
+    plugin::SharedMemoryReduce reduce{name, 0, 1};
+    EXPECT_EQ(reduce.localRank(), 0);
+    EXPECT_EQ(reduce.localSize(), 1);
+    plugin::Matrix<double> send{1, 3};
+    plugin::Matrix<double> mismatched{1, 2};
+    EXPECT_THROW(reduce(send, &mismatched), gmxapi::ProtocolError);
+}
+
+} // end anonymous namespace
@@ -0,0 +1,500 @@
+/*! \file
+ * \brief Test the thread pool and the scheduling of restraint events and window updates.
+ */
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "ensemblepotential.h"
+#include "sessionresources.h"
+#include "stepscheduler.h"
+#include "threadpool.h"
+#include "updatecoordinator.h"
+
+#include "gmxapi/exceptions.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+/*!
+ * \brief Record the phases of coordinated updates in the order they complete.
+ */
+class PhaseLog
+{
+    public:
+        void record(int id,
+                    char phase)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            entries_.emplace_back(id,
+                                  phase);
+        }
+
+        std::vector<std::pair<int, char>> entries() const
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return entries_;
+        }
+
+    private:
+        mutable std::mutex mutex_;
+        std::vector<std::pair<int, char>> entries_;
+};
+
+class FakeParticipant : public plugin::UpdateCoordinator::Participant
+{
+    public:
+        FakeParticipant(int id,
+                        PhaseLog* log) :
+            id_{id},
+            log_{log}
+        {}
+
+        void blurWindow() override
+        {
+            log_->record(id_,
+                         'b');
+        }
+
+        void reduceWindow(const plugin::Resources&) override
+        {
+            reduceThread = std::this_thread::get_id();
+            if (failReduce)
+            {
+                throw gmxapi::ProtocolError("reduction failed");
+            }
+            log_->record(id_,
+                         'r');
+        }
+
+        void rebuildHistogram() override
+        {
+            log_->record(id_,
+                         'h');
+        }
+
+        void abandonUpdate() noexcept override
+        {
+            log_->record(id_,
+                         'a');
+        }
+
+        std::thread::id reduceThread;
+        bool failReduce{false};
+
+    private:
+        int id_;
+        PhaseLog* log_;
+};
+
+TEST(RestraintUpdateCoordination, ThreadPoolRunsAllTasks)
+{
+    for (std::size_t numThreads : {0, 1, 4})
+    {
+        plugin::ThreadPool pool{numThreads};
+        EXPECT_EQ(pool.size(), numThreads);
+        std::atomic<int> count{0};
+        for (int i = 0;i < 1000;++i)
+        {
+            pool.submit([&count]() { ++count; });
+        }
+        pool.wait();
+        EXPECT_EQ(count.load(), 1000);
+
+        // The pool can be reused after waiting.
+        pool.submit([&count]() { ++count; });
+        pool.wait();
+        EXPECT_EQ(count.load(), 1001);
+    }
+}
+
+TEST(RestraintUpdateCoordination, ThreadPoolPropagatesErrors)
+{
+    plugin::ThreadPool pool{2};
+    std::atomic<int> count{0};
+    pool.submit([]() { throw std::runtime_error("task failed"); });
+    for (int i = 0;i < 10;++i)
+    {
+        pool.submit([&count]() { ++count; });
+    }
+    EXPECT_THROW(pool.wait(),
+                 std::runtime_error);
+    // Other tasks still ran, and the error is reported only once.
+    EXPECT_EQ(count.load(), 10);
+    EXPECT_NO_THROW(pool.wait());
+}
+
+TEST(RestraintUpdateCoordination, FlushOrder)
+{
+    plugin::Resources resources{[](const plugin::Matrix<double>&, plugin::Matrix<double>*) {}};
+    PhaseLog log;
+    std::vector<FakeParticipant> participants{{0, &log}, {1, &log}, {2, &log}};
+
+    plugin::UpdateCoordinator coordinator{3};
+    coordinator.beginUpdate(1.0);
+    for (auto& participant : participants)
+    {
+        coordinator.enqueue(&participant,
+                            &resources,
+                            1.0);
+    }
+    EXPECT_EQ(coordinator.pending(), 3u);
+
+    // Other restraints being updated in the same step do not complete the updates.
+    coordinator.beginUpdate(1.0);
+    EXPECT_EQ(coordinator.pending(), 3u);
+
+    // The next step does.
+    coordinator.beginUpdate(1.1);
+    EXPECT_EQ(coordinator.pending(), 0u);
+
+    const auto entries = log.entries();
+    ASSERT_EQ(entries.size(), 9u);
+    // All blurs are joined before reductions, which are issued in queue order on the flushing thread.
+    for (std::size_t i = 0;i < 3;++i)
+    {
+        EXPECT_EQ(entries[i].second, 'b');
+        EXPECT_EQ(entries[3 + i].first, static_cast<int>(i));
+        EXPECT_EQ(entries[3 + i].second, 'r');
+        EXPECT_EQ(entries[6 + i].second, 'h');
+    }
+    for (const auto& participant : participants)
+    {
+        EXPECT_EQ(participant.reduceThread, std::this_thread::get_id());
+    }
+}
+
+TEST(RestraintUpdateCoordination, Withdraw)
+{
+    plugin::Resources resources{[](const plugin::Matrix<double>&, plugin::Matrix<double>*) {}};
+    PhaseLog log;
+    FakeParticipant kept{0, &log};
+    FakeParticipant withdrawn{1, &log};
+
+    // Without worker threads, blurs run when the coordinator waits.
+    plugin::UpdateCoordinator coordinator{0};
+    coordinator.enqueue(&kept,
+                        &resources,
+                        1.0);
+    coordinator.enqueue(&withdrawn,
+                        &resources,
+                        1.0);
+    coordinator.withdraw(&withdrawn);
+    EXPECT_EQ(coordinator.pending(), 1u);
+    coordinator.flush();
+
+    const std::vector<std::pair<int, char>> expected{{0, 'b'}, {1, 'b'}, {0, 'r'}, {0, 'h'}};
+    EXPECT_EQ(log.entries(), expected);
+}
+
+TEST(RestraintUpdateCoordination, FailedFlush)
+{
+    plugin::Resources resources{[](const plugin::Matrix<double>&, plugin::Matrix<double>*) {}};
+    PhaseLog log;
+    FakeParticipant first{0, &log};
+    FakeParticipant failing{1, &log};
+    failing.failReduce = true;
+
+    plugin::UpdateCoordinator coordinator{2};
+    coordinator.enqueue(&first,
+                        &resources,
+                        1.0);
+    coordinator.enqueue(&failing,
+                        &resources,
+                        1.0);
+    EXPECT_THROW(coordinator.flush(),
+                 gmxapi::ProtocolError);
+    EXPECT_EQ(coordinator.pending(), 0u);
+
+    // Every update of the flush is abandoned, including those whose reductions succeeded.
+    const auto entries = log.entries();
+    ASSERT_EQ(entries.size(), 5u);
+    const std::vector<std::pair<int, char>> expected{{0, 'r'}, {0, 'a'}, {1, 'a'}};
+    EXPECT_EQ((std::vector<std::pair<int, char>>(entries.begin() + 2, entries.end())), expected);
+}
+
+TEST(RestraintUpdateCoordination, FailedFlushOfRestraints)
+{
+    const size_t nbins{10};
+    // The first reduction fails, as it would if an ensemble member had failed.
+    int reductions{0};
+    auto reduce = [&reductions](const plugin::Matrix<double>& send,
+                                plugin::Matrix<double>* receive) {
+        if (reductions++ == 0)
+        {
+            throw gmxapi::ProtocolError("reduction failed");
+        }
+        *receive->vector() = std::vector<double>(send.data(), send.data() + send.cols());
+    };
+    for (const bool combined : {false, true})
+    {
+        reductions = 0;
+        plugin::Resources resources{reduce};
+        resources.setUpdateCoordinator(std::make_shared<plugin::UpdateCoordinator>(2));
+        if (combined)
+        {
+            resources.setReduceCoordinator(std::make_shared<plugin::ReduceCoordinator>(reduce));
+        }
+
+        auto params = plugin::makeEnsembleParams(nbins, 0.5, 0.5, 4.5, std::vector<double>(nbins, 0.), 2, 0.001, 2, 10., 0.4);
+        plugin::EnsemblePotential first{*params};
+        plugin::EnsemblePotential second{*params};
+        const ::gmx::Vector v0{0, 0, 0};
+        const ::gmx::Vector v{real(2.), 0, 0};
+        const double dt{0.001};
+        const auto initialForce = first.calculate(v, v0, 0.).force[0];
+        for (int step = 0;step <= 7;++step)
+        {
+            if (step == 3)
+            {
+                // The windows closed at step 2 are combined here, and the failure is reported.
+                EXPECT_THROW(first.callback(v, v0, step * dt, resources),
+                             gmxapi::ProtocolError);
+                EXPECT_EQ(resources.updateCoordinator()->pending(), 0u);
+                EXPECT_EQ(first.calculate(v, v0, step * dt).force[0], initialForce);
+                EXPECT_EQ(second.calculate(v, v0, step * dt).force[0], initialForce);
+            }
+            // The failure was reported before the sample of this step, so the caller retries it.
+            first.callback(v, v0, step * dt, resources);
+            second.callback(v, v0, step * dt, resources);
+        }
+        // Both restraints dropped the failed update and took part in the later ones.
+        EXPECT_NE(first.calculate(v, v0, 0.).force[0], initialForce);
+        EXPECT_EQ(first.calculate(v, v0, 0.).force[0], second.calculate(v, v0, 0.).force[0]);
+        EXPECT_EQ(reductions, combined ? 3 : 5);
+    }
+}
+
+/*!
+ * \brief Reduction completing on the given test() call, or when waited for.
+ */
+class FakeOperation : public plugin::ReduceRequest::Operation
+{
+    public:
+        FakeOperation(int testsToComplete,
+                      bool fail,
+                      int* waits) :
+            testsToComplete_{testsToComplete},
+            fail_{fail},
+            waits_{waits}
+        {}
+
+        ~FakeOperation() override
+        {
+            if (testsToComplete_ > 0)
+            {
+                wait();
+            }
+        }
+
+        bool test() override
+        {
+            if (fail_)
+            {
+                throw gmxapi::ProtocolError("reduction failed");
+            }
+            return --testsToComplete_ <= 0;
+        }
+
+        void wait() override
+        {
+            ++*waits_;
+            testsToComplete_ = 0;
+        }
+
+    private:
+        int testsToComplete_;
+        bool fail_;
+        int* waits_;
+};
+
+TEST(RestraintUpdateCoordination, ReduceRequest)
+{
+    int waits{0};
+    plugin::ReduceRequest complete;
+    EXPECT_TRUE(complete.done());
+    EXPECT_TRUE(complete.test());
+    complete.wait();
+
+    plugin::ReduceRequest request{std::make_unique<FakeOperation>(3, false, &waits)};
+    EXPECT_FALSE(request.test());
+    EXPECT_FALSE(request.test());
+    EXPECT_FALSE(request.done());
+    EXPECT_TRUE(request.test());
+    EXPECT_TRUE(request.done());
+    EXPECT_EQ(waits, 0);
+
+    request = plugin::ReduceRequest{std::make_unique<FakeOperation>(3, false, &waits)};
+    request.wait();
+    EXPECT_TRUE(request.done());
+    EXPECT_EQ(waits, 1);
+
+    // Abandoned requests still complete.
+    {
+        plugin::ReduceRequest abandoned{std::make_unique<FakeOperation>(3, false, &waits)};
+    }
+    EXPECT_EQ(waits, 2);
+
+    plugin::ReduceRequest failed{std::make_unique<FakeOperation>(3, true, &waits)};
+    EXPECT_THROW(failed.test(), gmxapi::ProtocolError);
+    EXPECT_TRUE(failed.done());
+}
+
+TEST(RestraintUpdateCoordination, CombinedReduce)
+{
+    // Stand-in for an ensemble of two identical members.
+    std::vector<size_t> reduceSizes;
+    plugin::ReduceCoordinator coordinator{[&reduceSizes](const plugin::Matrix<double>& send,
+                                                         plugin::Matrix<double>* receive) {
+        reduceSizes.push_back(send.cols());
+        for (size_t i = 0;i < send.cols();++i)
+        {
+            receive->data()[i] = 2 * send.data()[i];
+        }
+    }};
+
+    plugin::Matrix<double> send1{std::vector<double>{1., 2.}};
+    plugin::Matrix<double> send2{std::vector<double>{3., 4., 5.}};
+    plugin::Matrix<double> send3{std::vector<double>{6.}};
+    plugin::Matrix<double> receive1{1, 2};
+    plugin::Matrix<double> receive2{1, 3};
+    plugin::Matrix<double> receive3{1, 1};
+    std::vector<int> completed;
+    coordinator.enqueue(&send1, &send1, &receive1, 1.0, [&completed]() { completed.push_back(1); });
+    coordinator.enqueue(&send2, &send2, &receive2, 1.0, [&completed]() { completed.push_back(2); });
+    coordinator.enqueue(&send3, &send3, &receive3, 1.0);
+    coordinator.withdraw(&send3);
+    coordinator.enqueue(&send3, &send3, &receive3, 1.0);
+    EXPECT_THROW(coordinator.enqueue(&send1, &send1, &receive3, 1.0), gmxapi::ProtocolError);
+
+    coordinator.beginUpdate(1.0);
+    EXPECT_EQ(coordinator.pending(), 3u);
+    coordinator.beginUpdate(1.1);
+    EXPECT_EQ(coordinator.pending(), 0u);
+
+    // One collective over the packed buffers, scattered back in order.
+    EXPECT_EQ(reduceSizes, std::vector<size_t>{6});
+    EXPECT_EQ(coordinator.collectives(), 1u);
+    EXPECT_EQ(*receive1.vector(), (std::vector<double>{2., 4.}));
+    EXPECT_EQ(*receive2.vector(), (std::vector<double>{6., 8., 10.}));
+    EXPECT_EQ(*receive3.vector(), std::vector<double>{12.});
+    EXPECT_EQ(completed, (std::vector<int>{1, 2}));
+}
+
+TEST(RestraintUpdateCoordination, CombinedReduceOfRestraints)
+{
+    const size_t nbins{10};
+    std::vector<size_t> reduceSizes;
+    auto reduce = [&reduceSizes](const plugin::Matrix<double>& send,
+                                 plugin::Matrix<double>* receive) {
+        reduceSizes.push_back(send.cols());
+        *receive->vector() = std::vector<double>(send.data(), send.data() + send.cols());
+    };
+    plugin::Resources resources{reduce};
+    resources.setReduceCoordinator(std::make_shared<plugin::ReduceCoordinator>(reduce));
+
+    auto params = plugin::makeEnsembleParams(nbins, 0.5, 0.5, 4.5, std::vector<double>(nbins, 0.), 2, 0.001, 2, 10., 0.4);
+    plugin::EnsemblePotential first{*params};
+    plugin::EnsemblePotential second{*params};
+    const ::gmx::Vector v0{0, 0, 0};
+    const ::gmx::Vector v{real(2.), 0, 0};
+    const double dt{0.001};
+    const auto initialForce = first.calculate(v, v0, 0.).force[0];
+    for (int step = 0;step <= 7;++step)
+    {
+        first.callback(v, v0, step * dt, resources);
+        second.callback(v, v0, step * dt, resources);
+        if (step == 2)
+        {
+            // The windows closed at this step, but are combined at the next one.
+            EXPECT_EQ(first.calculate(v, v0, step * dt).force[0], initialForce);
+        }
+        if (step == 3)
+        {
+            EXPECT_NE(first.calculate(v, v0, step * dt).force[0], initialForce);
+        }
+    }
+    // Windows closed at steps 2, 4, and 6: one collective each for both restraints, and the member count.
+    EXPECT_EQ(reduceSizes, (std::vector<size_t>{2 * nbins + 1, 2 * nbins + 1, 2 * nbins + 1}));
+}
+
+TEST(RestraintUpdateCoordination, StepScheduler)
+{
+    EXPECT_THROW(plugin::StepScheduler(0.), gmxapi::UsageError);
+    plugin::StepScheduler scheduler{0.002};
+    EXPECT_EQ(scheduler.step(1000.002), 500001);
+    EXPECT_EQ(scheduler.steps(0.006), 3);
+    EXPECT_EQ(scheduler.steps(0.), 1);
+
+    plugin::StepScheduler::Client first;
+    plugin::StepScheduler::Client second;
+    // Clients are due until scheduled.
+    EXPECT_TRUE(scheduler.due(&first, 0.));
+    scheduler.schedule(&first, 3);
+    EXPECT_TRUE(scheduler.due(&second, 0.));
+    scheduler.schedule(&second, 2);
+    EXPECT_EQ(scheduler.pending(), 2u);
+    std::vector<int> firstDue;
+    std::vector<int> secondDue;
+    for (int step = 1;step <= 6;++step)
+    {
+        if (scheduler.due(&first, step * 0.002))
+        {
+            firstDue.push_back(step);
+            scheduler.schedule(&first, step + 3);
+        }
+        if (scheduler.due(&second, step * 0.002))
+        {
+            secondDue.push_back(step);
+        }
+    }
+    EXPECT_EQ(firstDue, (std::vector<int>{3, 6}));
+    // Without a new event, a client is due at every step.
+    EXPECT_EQ(secondDue, (std::vector<int>{2, 3, 4, 5, 6}));
+    scheduler.withdraw(&first);
+    EXPECT_EQ(scheduler.pending(), 0u);
+}
+
+TEST(RestraintUpdateCoordination, StepScheduledRestraints)
+{
+    // Sample every 3 steps, with a time step that is not representable in binary.
+    const double dt{0.002};
+    auto params = plugin::makeEnsembleParams(10, 0.5, 0.5, 4.5, std::vector<double>(10, 0.), 2, 3 * dt, 2, 10., 0.4);
+    int step{0};
+    std::vector<int> reduceSteps;
+    plugin::Resources resources{[&step, &reduceSteps](const plugin::Matrix<double>& send,
+                                                      plugin::Matrix<double>* receive) {
+        reduceSteps.push_back(step);
+        *receive->vector() = std::vector<double>(send.data(), send.data() + send.cols());
+    }};
+    auto scheduler = std::make_shared<plugin::StepScheduler>(dt);
+    resources.setStepScheduler(scheduler);
+
+    {
+        plugin::EnsemblePotential first{*params};
+        plugin::EnsemblePotential second{*params};
+        const ::gmx::Vector v0{0, 0, 0};
+        const ::gmx::Vector v{real(2.), 0, 0};
+        for (step = 0;step <= 3000;++step)
+        {
+            first.callback(v, v0, step * dt, resources);
+            second.callback(v, v0, step * dt, resources);
+        }
+        EXPECT_EQ(scheduler->pending(), 2u);
+    }
+    EXPECT_EQ(scheduler->pending(), 0u);
+
+    // Windows close every 6 steps exactly, for both restraints.
+    ASSERT_EQ(reduceSteps.size(), 2u * 500);
+    for (size_t i = 0;i < reduceSteps.size();++i)
+    {
+        EXPECT_EQ(reduceSteps[i], 6 * (1 + static_cast<int>(i / 2)));
+    }
+}
+
+} // end anonymous namespace